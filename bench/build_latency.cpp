@@ -0,0 +1,161 @@
+// End-to-end build latency: runs the `cato` binary on each program in a
+// corpus, from reading the .cato file to the executable on disk, once with
+// the built-in assembler and linker and once with --system-ld (nasm and
+// ld). Reports the median and p95 of the timed builds for each. The
+// --system-ld column reads "n/a" where nasm or ld is not installed.
+//
+//   cato_build_bench [--cato PATH] [--warmup N] [--reps N] [--corpus DIR]...
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef CATO_KERNEL_DIR
+#define CATO_KERNEL_DIR "bench/kernels"
+#endif
+#ifndef CATO_BINARY
+#define CATO_BINARY "./cato"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Latency {
+    double median = 0;
+    double p95 = 0;
+};
+
+// Seconds for one `cato` run with `args`, or nothing if it failed.
+static std::optional<double> build_once(const std::string& cato, const std::vector<std::string>& args)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(cato.c_str()));
+    for (const std::string& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const auto start = Clock::now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(cato.c_str(), argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return {};
+    }
+    return seconds;
+}
+
+static std::optional<Latency> measure(const std::string& cato, const std::vector<std::string>& args, int warmup, int reps)
+{
+    for (int i = 0; i < warmup; i++) {
+        if (!build_once(cato, args).has_value()) {
+            return {};
+        }
+    }
+    std::vector<double> samples;
+    for (int i = 0; i < reps; i++) {
+        std::optional<double> seconds = build_once(cato, args);
+        if (!seconds.has_value()) {
+            return {};
+        }
+        samples.push_back(seconds.value());
+    }
+    std::sort(samples.begin(), samples.end());
+    return Latency { samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 95 / 100)] };
+}
+
+static void print(const std::optional<Latency>& latency)
+{
+    if (!latency.has_value()) {
+        std::cout << std::setw(10) << "n/a" << std::setw(10) << "n/a";
+        return;
+    }
+    std::cout << std::setw(10) << latency->median * 1e3 << std::setw(10) << latency->p95 * 1e3;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string cato = CATO_BINARY;
+    int warmup = 2;
+    int reps = 20;
+    std::vector<std::string> corpus_dirs;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--cato") {
+            cato = value;
+        } else if (arg == "--warmup") {
+            warmup = std::max(0, std::atoi(value));
+        } else if (arg == "--reps") {
+            reps = std::max(1, std::atoi(value));
+        } else if (arg == "--corpus") {
+            corpus_dirs.push_back(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (corpus_dirs.empty()) {
+        corpus_dirs.push_back(CATO_KERNEL_DIR);
+    }
+
+    std::vector<std::filesystem::path> programs;
+    for (const std::string& dir : corpus_dirs) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".cato") {
+                programs.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(programs.begin(), programs.end());
+    if (programs.empty()) {
+        std::cerr << "No programs in the corpus" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::filesystem::path output_dir = std::filesystem::temp_directory_path() / ("cato_build_bench_" + std::to_string(getpid()));
+    std::cout << std::left << std::setw(20) << "program" << std::right << std::setw(20) << "in-process (ms)"
+              << std::setw(20) << "--system-ld (ms)" << "\n";
+    std::cout << std::setw(20) << "" << std::setw(10) << "median" << std::setw(10) << "p95" << std::setw(10) << "median"
+              << std::setw(10) << "p95" << "\n";
+    size_t failed = 0;
+    for (const std::filesystem::path& path : programs) {
+        const std::vector<std::string> args { "-o", output_dir.string(), path.string() };
+        std::vector<std::string> system_args { "--system-ld" };
+        system_args.insert(system_args.end(), args.begin(), args.end());
+
+        const std::optional<Latency> in_process = measure(cato, args, warmup, reps);
+        const std::optional<Latency> system_tools = measure(cato, system_args, warmup, reps);
+        failed += !in_process.has_value();
+        std::cout << std::left << std::setw(20) << path.stem().string() << std::right << std::fixed << std::setprecision(2);
+        print(in_process);
+        print(system_tools);
+        std::cout << "\n";
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(output_dir, ec);
+    if (failed > 0) {
+        std::cout << failed << " of " << programs.size() << " programs failed to build\n";
+    }
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,292 @@
+// Compiler throughput on large synthetic programs: bytes/s through the
+// Tokenizer, nodes/s through the Parser, instructions/s out of the
+// Generator and source bytes/s through the Assembler. Each phase runs a few
+// untimed warmup rounds, then reports the median and p95 of the timed ones.
+//
+//   cato_bench [--seed N] [--functions N] [--depth N] [--elifs N] [--loops N]
+//              [--warmup N] [--reps N] [--json FILE]
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/tokenization.hpp"
+#include "../src/parser.hpp"
+#include "../src/generation.hpp"
+#include "../src/assembler.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct ProgramShape {
+    uint32_t seed = 42;
+    size_t functions = 500;
+    int depth = 10; // expression nesting
+    int elifs = 8;  // arms in each elif chain
+    int loops = 3;  // nested for loops per function
+};
+
+// Emits functions that call earlier ones, so the program stays valid for
+// any shape.
+class ProgramGenerator {
+public:
+    explicit ProgramGenerator(const ProgramShape& shape)
+        : m_shape(shape)
+        , m_rng(shape.seed)
+    {
+    }
+
+    std::string generate()
+    {
+        for (size_t i = 0; i < m_shape.functions; i++) {
+            function(i);
+        }
+        m_out << "exit(f" << m_shape.functions - 1 << "(1, 2));\n";
+        return m_out.str();
+    }
+
+private:
+    int pick(int bound)
+    {
+        return static_cast<int>(m_rng() % static_cast<uint32_t>(bound));
+    }
+
+    void expr(int depth, const std::vector<std::string>& vars, size_t callee_limit)
+    {
+        if (depth == 0 || pick(4) == 0) {
+            if (pick(3) == 0) {
+                m_out << pick(1000);
+            } else {
+                m_out << vars[static_cast<size_t>(pick(static_cast<int>(vars.size())))];
+            }
+            return;
+        }
+        static constexpr const char* ops[] = { " + ", " - ", " * ", " / " };
+        if (callee_limit > 0 && pick(8) == 0) {
+            m_out << "f" << pick(static_cast<int>(callee_limit)) << "(";
+            expr(depth - 1, vars, callee_limit);
+            m_out << ", ";
+            expr(depth - 1, vars, callee_limit);
+            m_out << ")";
+            return;
+        }
+        m_out << "(";
+        expr(depth - 1, vars, callee_limit);
+        const char* op = ops[pick(4)];
+        m_out << op;
+        if (op[1] == '/') {
+            m_out << pick(9) + 1;
+        } else {
+            expr(depth - 1, vars, callee_limit);
+        }
+        m_out << ")";
+    }
+
+    void function(size_t index)
+    {
+        std::vector<std::string> vars = { "a", "b" };
+        m_out << "function f" << index << "(a, b){\n";
+        m_out << "  int x = ";
+        expr(m_shape.depth, vars, index);
+        m_out << ";\n";
+        vars.push_back("x");
+
+        m_out << "  if(x > " << pick(100) << "){ x = x - a; }\n";
+        for (int arm = 0; arm < m_shape.elifs; arm++) {
+            m_out << "  elif(x == " << arm << "){ x = ";
+            expr(m_shape.depth / 2, vars, index);
+            m_out << "; }\n";
+        }
+        m_out << "  else { x = x + b; }\n";
+
+        for (int level = 0; level < m_shape.loops; level++) {
+            m_out << std::string(static_cast<size_t>(level + 1) * 2, ' ') << "for(int i" << level << " = 0; i"
+                  << level << " < " << pick(10) + 1 << "; i" << level << " = i" << level << " + 1){\n";
+            vars.push_back("i");
+            vars.back() += std::to_string(level);
+        }
+        m_out << std::string(static_cast<size_t>(m_shape.loops + 1) * 2, ' ') << "x = ";
+        expr(m_shape.depth / 2, vars, index);
+        m_out << ";\n";
+        for (int level = m_shape.loops; level > 0; level--) {
+            m_out << std::string(static_cast<size_t>(level) * 2, ' ') << "}\n";
+        }
+        m_out << "  return(x);\n}\n";
+    }
+
+    ProgramShape m_shape;
+    std::mt19937 m_rng;
+    std::stringstream m_out;
+};
+
+struct PhaseResult {
+    std::string name;
+    std::string unit;
+    double work = 0; // units processed per run
+    std::vector<double> seconds;
+
+    double percentile(double p) const
+    {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())));
+        return sorted[index];
+    }
+};
+
+// Runs `body` warmup + reps times and keeps the timings of the last reps.
+template <typename Body>
+static std::vector<double> time_phase(int warmup, int reps, Body body)
+{
+    std::vector<double> seconds;
+    for (int i = 0; i < warmup + reps; i++) {
+        const auto start = Clock::now();
+        body();
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (i >= warmup) {
+            seconds.push_back(elapsed);
+        }
+    }
+    return seconds;
+}
+
+// Lines of generated assembly that are instructions rather than labels,
+// directives or comments.
+static size_t count_instructions(const std::string& assembly)
+{
+    size_t count = 0;
+    std::istringstream lines(assembly);
+    for (std::string line; std::getline(lines, line);) {
+        const size_t first = line.find_first_not_of(" \t");
+        if (first == 0 || first == std::string::npos || line[first] == ';') {
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    ProgramShape shape;
+    int warmup = 2;
+    int reps = 10;
+    std::string json_path;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--seed") {
+            shape.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        } else if (arg == "--functions") {
+            shape.functions = std::max<size_t>(1, std::strtoul(value, nullptr, 10));
+        } else if (arg == "--depth") {
+            shape.depth = std::max(1, std::atoi(value));
+        } else if (arg == "--elifs") {
+            shape.elifs = std::max(0, std::atoi(value));
+        } else if (arg == "--loops") {
+            shape.loops = std::max(0, std::atoi(value));
+        } else if (arg == "--warmup") {
+            warmup = std::max(0, std::atoi(value));
+        } else if (arg == "--reps") {
+            reps = std::max(1, std::atoi(value));
+        } else if (arg == "--json") {
+            json_path = value;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::string source = ProgramGenerator(shape).generate();
+    const std::vector<Token> tokens = Tokenizer(std::string(source)).tokenize();
+    size_t nodes = 0;
+    std::string assembly;
+    {
+        Parser parser(tokens);
+        std::optional<NodeProg> prog = parser.parse_prog();
+        if (!prog.has_value()) {
+            std::cerr << "Invalid Program" << std::endl;
+            return EXIT_FAILURE;
+        }
+        nodes = parser.m_allocator.allocations();
+        assembly = Generator(prog.value()).generate_program();
+    }
+    const size_t instructions = count_instructions(assembly);
+
+    std::vector<PhaseResult> phases;
+    phases.push_back({ "tokenize", "bytes/s", static_cast<double>(source.size()), time_phase(warmup, reps, [&] {
+        Tokenizer tokenizer { std::string(source) };
+        if (tokenizer.tokenize().size() != tokens.size()) {
+            std::abort();
+        }
+    }) });
+    phases.push_back({ "parse", "nodes/s", static_cast<double>(nodes), {} });
+    phases.push_back({ "generate", "instructions/s", static_cast<double>(instructions), {} });
+    // Parsing and generation need fresh inputs each round; only the phase
+    // itself is inside the timed region.
+    for (int i = 0; i < warmup + reps; i++) {
+        Parser parser(tokens);
+        auto start = Clock::now();
+        std::optional<NodeProg> prog = parser.parse_prog();
+        const double parse_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        Generator generator(prog.value());
+        start = Clock::now();
+        const std::string output = generator.generate_program();
+        const double generate_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (output != assembly) {
+            std::cerr << "Generator output changed between runs" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (i >= warmup) {
+            phases[1].seconds.push_back(parse_seconds);
+            phases[2].seconds.push_back(generate_seconds);
+        }
+    }
+    phases.push_back({ "assemble", "bytes/s", static_cast<double>(assembly.size()), time_phase(warmup, reps, [&] {
+        if (!Assembler(assembly).assemble().has_value()) {
+            std::abort();
+        }
+    }) });
+
+    std::cout << shape.functions << " functions, " << source.size() << " bytes, " << tokens.size() << " tokens, "
+              << nodes << " nodes, " << instructions << " instructions (seed " << shape.seed << ")\n";
+    std::cout << std::left << std::setw(10) << "phase" << std::right << std::setw(14) << "median (ms)" << std::setw(12)
+              << "p95 (ms)" << std::setw(18) << "throughput" << "  unit\n";
+    for (const PhaseResult& phase : phases) {
+        const double median = phase.percentile(0.5);
+        std::cout << std::left << std::setw(10) << phase.name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(14) << median * 1e3 << std::setw(12) << phase.percentile(0.95) * 1e3
+                  << std::setprecision(0) << std::setw(18) << phase.work / median << "  " << phase.unit << "\n";
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream json(json_path);
+        json << std::setprecision(9);
+        json << "{\n  \"seed\": " << shape.seed << ",\n  \"functions\": " << shape.functions << ",\n  \"depth\": "
+             << shape.depth << ",\n  \"elifs\": " << shape.elifs << ",\n  \"loops\": " << shape.loops
+             << ",\n  \"warmup\": " << warmup << ",\n  \"reps\": " << reps << ",\n  \"source_bytes\": "
+             << source.size() << ",\n  \"tokens\": " << tokens.size() << ",\n  \"nodes\": " << nodes
+             << ",\n  \"instructions\": " << instructions << ",\n  \"phases\": {\n";
+        for (size_t i = 0; i < phases.size(); i++) {
+            const PhaseResult& phase = phases[i];
+            const double median = phase.percentile(0.5);
+            json << "    \"" << phase.name << "\": { \"median_s\": " << median << ", \"p95_s\": "
+                 << phase.percentile(0.95) << ", \"throughput\": " << phase.work / median << ", \"unit\": \""
+                 << phase.unit << "\" }" << (i + 1 < phases.size() ? "," : "") << "\n";
+        }
+        json << "  }\n}\n";
+        if (!json) {
+            std::cerr << "Cannot write " << json_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+// Times Generator::generate_program() on a synthetic many-function program
+// with 1..N threads and checks every run against the serial output.
+//
+//   cato_codegen_bench [functions] [max threads] [repetitions]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../src/tokenization.hpp"
+#include "../src/parser.hpp"
+#include "../src/generation.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static std::string make_program(size_t functions, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::stringstream out;
+    for (size_t i = 0; i < functions; i++) {
+        const unsigned k = rng() % 100;
+        out << "function f" << i << "(a, b){\n"
+            << "  if(a > b){ return(a * " << k << " + b); }\n"
+            << "  elif(a == b){ return(a - " << k << "); }\n"
+            << "  else { return((a + b) / " << (k % 7 + 1) << "); }\n"
+            << "}\n";
+    }
+    out << "exit(f0(1, 2));\n";
+    return out.str();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t functions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    const size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    const size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : hardware;
+    const int reps = argc > 3 ? std::max(1, std::atoi(argv[3])) : 5;
+
+    Tokenizer tokenizer(make_program(functions, 42));
+    Parser parser(tokenizer.tokenize());
+    std::optional<NodeProg> prog = parser.parse_prog();
+    if (!prog.has_value()) {
+        std::cerr << "Invalid Program" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string serial;
+    double serial_ms = 0;
+    std::cout << functions << " functions, " << hardware << " hardware threads\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "median (ms)" << std::setw(10) << "speedup"
+              << std::setw(12) << "identical" << "\n";
+    for (size_t threads = 1; threads <= max_threads; threads++) {
+        std::vector<double> times;
+        std::string output;
+        for (int i = 0; i < reps; i++) {
+            Generator generator(prog.value());
+            generator.set_jobs(threads);
+            const auto start = Clock::now();
+            output = generator.generate_program();
+            times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+        if (threads == 1) {
+            serial = output;
+            serial_ms = median;
+        }
+        std::cout << std::setw(8) << threads << std::setw(14) << std::fixed << std::setprecision(2) << median
+                  << std::setw(9) << serial_ms / median << "x" << std::setw(12) << (output == serial ? "yes" : "NO")
+                  << "\n";
+        if (output != serial) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
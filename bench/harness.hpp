@@ -0,0 +1,284 @@
+#pragma once
+
+// What the benchmarks share: building a program the way `cato` does,
+// running it, running it on the bytecode interpreter, reading a corpus and
+// the `// expect: N` and `// output: TEXT` lines of its programs, and one
+// check that every way of running a program agrees.
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../src/tokenization.hpp"
+#include "../src/parser.hpp"
+#include "../src/generation.hpp"
+#include "../src/assembler.hpp"
+#include "../src/linker.hpp"
+#include "../src/bytecode.hpp"
+#include "../src/interpreter.hpp"
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// -O0, -O1 and -O2.
+inline constexpr int levels = 3;
+
+struct Run {
+    int status = -1; // exit code, or -1 if there was none
+    std::string output;
+    double seconds = 0;
+    std::string error; // why there is no exit code, when it is known
+};
+
+inline std::string read_file(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// The .cato files in `dirs`, sorted. Directories that do not exist add
+// nothing.
+inline std::vector<std::filesystem::path> list_programs(const std::vector<std::string>& dirs)
+{
+    std::vector<std::filesystem::path> programs;
+    for (const std::string& dir : dirs) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            if (entry.path().extension() == ".cato") {
+                programs.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(programs.begin(), programs.end());
+    return programs;
+}
+
+// What a program's comments say it does: `// expect: N` is its exit code
+// and `// output: TEXT` everything it prints, with `\n` for a newline and
+// `\\` for a backslash.
+struct Expectation {
+    std::optional<int> status;
+    std::optional<std::string> output;
+};
+
+inline Expectation expectation(const std::string& source)
+{
+    Expectation expected;
+    const std::string status_marker = "// expect:";
+    if (const size_t at = source.find(status_marker); at != std::string::npos) {
+        expected.status = std::atoi(source.c_str() + at + status_marker.size());
+    }
+    const std::string output_marker = "// output: ";
+    if (const size_t at = source.find(output_marker); at != std::string::npos) {
+        std::string& output = expected.output.emplace();
+        for (size_t i = at + output_marker.size(); i < source.size() && source[i] != '\n'; i++) {
+            if (source[i] == '\\' && i + 1 < source.size() && source[i + 1] != '\n') {
+                output += source[++i] == 'n' ? '\n' : source[i];
+            } else {
+                output += source[i];
+            }
+        }
+    }
+    return expected;
+}
+
+// The assembly `cato -O<level>` generates for `prog`, evaluator included.
+inline std::string lower(const NodeProg& prog, int level = 2)
+{
+    const Passes passes = Passes::level(level);
+    std::optional<Evaluator> evaluator;
+    Generator generator(prog);
+    generator.set_passes(passes);
+    if (passes.fold) {
+        evaluator.emplace(prog, Evaluator::default_fuel);
+        generator.use_evaluator(&evaluator.value());
+    }
+    return generator.generate_program();
+}
+
+// Assembles and links `assembly` into the executable `exe`; returns why it
+// could not, if it could not.
+inline std::optional<std::string> link(const std::string& assembly, const std::string& exe)
+{
+    std::optional<ObjectFile> obj = Assembler(assembly).assemble();
+    if (!obj.has_value()) {
+        return "the built-in assembler rejected the generated code";
+    }
+    Linker linker;
+    linker.add_object(std::move(obj.value()));
+    std::optional<LinkedImage> image = linker.link();
+    if (!image.has_value() || !Linker::write_executable(image.value(), exe)) {
+        return "linking failed";
+    }
+    return {};
+}
+
+// Builds `source` into `exe` as `cato -O<level>` does; returns why it could
+// not, if it could not.
+inline std::optional<std::string> build(const std::string& source, const std::string& exe, int level = 2)
+{
+    try {
+        Tokenizer tokenizer { std::string(source) };
+        // The parser owns the nodes, so it lives until they are lowered.
+        Parser parser(tokenizer.tokenize());
+        std::optional<NodeProg> prog = parser.parse_prog();
+        if (!prog.has_value()) {
+            return "Invalid Program";
+        }
+        return link(lower(prog.value(), level), exe);
+    } catch (const CompileError& err) {
+        return err.what();
+    }
+}
+
+// Runs `exe` with its output going to `output_path`, or nowhere if that is
+// empty, and kills it after `timeout` seconds.
+inline Run run_once(const std::string& exe, const std::string& output_path, unsigned timeout)
+{
+    Run run;
+    const auto start = Clock::now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        const int out = open(output_path.empty() ? "/dev/null" : output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            _exit(127);
+        }
+        dup2(out, STDOUT_FILENO);
+        alarm(timeout);
+        execl(exe.c_str(), exe.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (WIFEXITED(status)) {
+        run.status = WEXITSTATUS(status);
+    } else {
+        run.error = "killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    if (!output_path.empty()) {
+        run.output = read_file(output_path);
+    }
+    return run;
+}
+
+// Runs `source` on the bytecode interpreter, printing to `output`; without
+// one a print is an error. The output is not kept in the Run.
+inline Run interpret(const std::string& source, std::FILE* output = nullptr)
+{
+    Run run;
+    const auto start = Clock::now();
+    try {
+        Tokenizer tokenizer { std::string(source) };
+        Parser parser(tokenizer.tokenize());
+        std::optional<NodeProg> prog = parser.parse_prog();
+        if (!prog.has_value()) {
+            run.error = "Invalid Program";
+            return run;
+        }
+        BytecodeCompiler compiler(prog.value());
+        std::optional<BytecodeProgram> program = compiler.compile();
+        if (!program.has_value()) {
+            run.error = compiler.error();
+            return run;
+        }
+        Interpreter interpreter(program.value());
+        interpreter.set_output(output);
+        const InterpreterResult result = interpreter.run();
+        if (result.status == InterpreterResult::Status::error) {
+            run.error = result.error;
+        } else {
+            run.status = static_cast<int>(result.value & 0xff);
+        }
+    } catch (const CompileError& err) {
+        run.error = err.what();
+    }
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return run;
+}
+
+// As interpret(), keeping what the program prints.
+inline Run interpret_captured(const std::string& source)
+{
+    std::FILE* output = std::tmpfile();
+    if (output == nullptr) {
+        return { .error = "no temporary file for the output" };
+    }
+    Run run = interpret(source, output);
+    std::rewind(output);
+    char buffer[4096];
+    for (size_t got; (got = std::fread(buffer, 1, sizeof(buffer), output)) > 0;) {
+        run.output.append(buffer, got);
+    }
+    std::fclose(output);
+    return run;
+}
+
+// Builds `source` into `exe` at every level and runs each build `runs`
+// times, keeping the fastest run of each in `results`. Every run must exit,
+// and agree with the other runs, the other levels, the interpreter when
+// `interpreted`, and the program's `// expect:` and `// output:` lines.
+// Returns the first disagreement, if there is one.
+inline std::optional<std::string> check(const std::string& source, const std::string& exe, unsigned timeout, int runs,
+    bool interpreted, std::array<Run, levels>& results)
+{
+    const Expectation expected = expectation(source);
+    const std::string output_path = exe + ".out";
+    std::optional<Run> reference;
+    std::string reference_name;
+    if (interpreted) {
+        reference = interpret_captured(source);
+        reference_name = "the interpreter";
+        if (reference->status < 0) {
+            return "the interpreter failed: " + reference->error;
+        }
+    }
+    for (int level = 0; level < levels; level++) {
+        const std::string name = "-O" + std::to_string(level);
+        if (std::optional<std::string> error = build(source, exe, level)) {
+            return name + " build failed: " + error.value();
+        }
+        Run best = run_once(exe, output_path, timeout);
+        for (int i = 1; i < runs; i++) {
+            Run again = run_once(exe, output_path, timeout);
+            if (again.status != best.status || again.output != best.output) {
+                return name + " is not deterministic";
+            }
+            best.seconds = std::min(best.seconds, again.seconds);
+        }
+        if (best.status < 0) {
+            return name + " did not exit: " + best.error;
+        }
+        if (expected.status.has_value() && best.status != expected.status.value()) {
+            return name + " exited " + std::to_string(best.status) + ", expected " + std::to_string(expected.status.value());
+        }
+        if (expected.output.has_value() && best.output != expected.output.value()) {
+            return name + " printed \"" + best.output + "\", expected \"" + expected.output.value() + "\"";
+        }
+        if (!reference.has_value()) {
+            reference = best;
+            reference_name = name;
+        } else if (best.status != reference->status) {
+            return name + " exited " + std::to_string(best.status) + ", " + reference_name + " "
+                + std::to_string(reference->status);
+        } else if (best.output != reference->output) {
+            return name + " printed \"" + best.output + "\", " + reference_name + " \"" + reference->output + "\"";
+        }
+        results[level] = std::move(best);
+    }
+    return {};
+}
+
+} // namespace bench
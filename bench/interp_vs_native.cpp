@@ -0,0 +1,92 @@
+// Compares time-to-first-result of the bytecode interpreter with the native
+// pipeline (generate, assemble, link, write, exec) on short programs.
+//
+//   cato_interp_bench [repetitions]
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "./harness.hpp"
+
+struct Sample {
+    const char* name;
+    const char* source;
+};
+
+static const Sample samples[] = {
+    { "arith", "exit(1 + 2 * 3 - 8 / 4);" },
+    { "call", "function test(d, e){\n return(d + e + e + d);\n}\nexit(test(6, 3));" },
+    { "branch", "function f(a){ if(a > 3){ return(a * 2); } elif(a == 1){ return(100); } else { return(7); } }\n"
+                "exit(f(5));" },
+    { "fib", "function fib(n){ if(n < 2){ return(n); } return(fib(n - 1) + fib(n - 2)); }\nexit(fib(15));" },
+};
+
+using bench::Clock;
+
+static double micros_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static int run_interpreter(const std::string& source)
+{
+    const bench::Run run = bench::interpret(source);
+    if (run.status < 0) {
+        std::cerr << run.error << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return run.status;
+}
+
+// Builds the way `cato` does, evaluator included, then runs the result;
+// native miscompiles that never terminate are killed.
+static int run_native(const std::string& source, const std::string& exe)
+{
+    if (std::optional<std::string> error = bench::build(source, exe)) {
+        std::cerr << error.value() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return bench::run_once(exe, "", 5).status;
+}
+
+static double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+    const int reps = argc > 1 ? std::max(1, std::atoi(argv[1])) : 50;
+    const std::string exe = "/tmp/cato_interp_bench_" + std::to_string(getpid());
+
+    std::cerr << std::left << std::setw(10) << "program" << std::right << std::setw(16) << "interp (us)"
+              << std::setw(16) << "native (us)" << std::setw(10) << "speedup" << std::setw(10) << "agree" << "\n";
+    for (const Sample& sample : samples) {
+        std::vector<double> interp_times;
+        std::vector<double> native_times;
+        int interp_result = 0;
+        int native_result = 0;
+        for (int i = 0; i < reps; i++) {
+            auto start = Clock::now();
+            interp_result = run_interpreter(sample.source);
+            interp_times.push_back(micros_since(start));
+
+            start = Clock::now();
+            native_result = run_native(sample.source, exe);
+            native_times.push_back(micros_since(start));
+        }
+        const double interp = median(interp_times);
+        const double native = median(native_times);
+        std::cerr << std::left << std::setw(10) << sample.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(16) << interp << std::setw(16) << native << std::setw(9) << native / interp << "x"
+                  << std::setw(10) << (interp_result == native_result ? "yes" : "no") << "\n";
+    }
+    std::remove(exe.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+// Compiles machine-generated programs whose expressions nest `depth` levels
+// deep and runs them: parentheses, `+` chains leaning either way, indexing
+// and calls. Parsing, lowering and the generated code must all cope with
+// any depth memory allows, so a crash or a wrong exit code fails the run.
+//
+//   cato_nesting_bench [depth]
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "./harness.hpp"
+
+using bench::Clock;
+
+struct Case {
+    const char* name;
+    std::string source;
+    int expect;
+};
+
+static std::string repeat(const std::string& text, size_t count)
+{
+    std::string out;
+    out.reserve(text.size() * count);
+    for (size_t i = 0; i < count; i++) {
+        out += text;
+    }
+    return out;
+}
+
+static std::vector<Case> make_cases(size_t depth)
+{
+    const int sum = static_cast<int>((depth + 3) & 0xff);
+    return {
+        { "parens", "int x = 7;\nexit(" + repeat("(", depth) + "x" + repeat(")", depth) + ");\n", 7 },
+        { "left +", "int x = 3;\nexit(x" + repeat(" + 1", depth) + ");\n", sum },
+        { "right +", "int x = 3;\nexit(" + repeat("1 + (", depth) + "x" + repeat(")", depth) + ");\n", sum },
+        // a[0] is 1 and a[1] is 0, so each level flips the index.
+        { "index", "int a[2];\na[0] = 1;\nexit(" + repeat("a[", depth) + "0" + repeat("]", depth) + ");\n",
+            static_cast<int>(depth & 1) },
+        { "calls", "function up(v) {\n    return v + 1;\n}\nint x = 3;\nexit(" + repeat("up(", depth) + "x"
+                + repeat(")", depth) + ");\n",
+            sum },
+    };
+}
+
+static double ms_since(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t depth = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    const std::string exe = "/tmp/cato_nesting_bench_" + std::to_string(getpid());
+
+    std::cout << "depth " << depth << "\n";
+    std::cout << std::left << std::setw(10) << "case" << std::right << std::setw(12) << "parse (ms)" << std::setw(15)
+              << "generate (ms)" << std::setw(15) << "assemble (ms)" << std::setw(8) << "exit" << std::setw(8)
+              << "expect" << "\n";
+    bool ok = true;
+    for (const Case& c : make_cases(depth)) {
+        auto start = Clock::now();
+        Tokenizer tokenizer { std::string(c.source) };
+        Parser parser(tokenizer.tokenize());
+        std::optional<NodeProg> prog = parser.parse_prog();
+        const double parse_ms = ms_since(start);
+        if (!prog.has_value()) {
+            std::cerr << c.name << ": invalid program" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // As cato does; the evaluator gives up on expressions this deep.
+        start = Clock::now();
+        const std::string assembly = bench::lower(prog.value());
+        const double generate_ms = ms_since(start);
+
+        start = Clock::now();
+        if (std::optional<std::string> error = bench::link(assembly, exe)) {
+            std::cerr << c.name << ": " << error.value() << std::endl;
+            return EXIT_FAILURE;
+        }
+        const double assemble_ms = ms_since(start);
+
+        const int status = bench::run_once(exe, "", 60).status;
+        ok = ok && status == c.expect;
+        std::cout << std::left << std::setw(10) << c.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << parse_ms << std::setw(15) << generate_ms << std::setw(15) << assemble_ms
+                  << std::setw(8) << status << std::setw(8) << c.expect << (status == c.expect ? "" : "  WRONG")
+                  << "\n";
+    }
+    std::remove(exe.c_str());
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
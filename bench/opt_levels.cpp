@@ -0,0 +1,333 @@
+// Compiles every program in a corpus at -O0, -O1 and -O2, runs each
+// binary and checks that the levels exit with the same code and print the
+// same output, and that all of them match a program's `// expect: N` and
+// `// output: TEXT` lines where it has them. Then reports how much faster
+// each level ran than -O0. Programs under --check (bench/differential by
+// default) are not timed, and the bytecode interpreter must agree on them
+// as well.
+//
+// --fuzz N also generates N random programs from --seed S on: functions
+// that print, exit or run off their end, called from inside operands, and
+// no `exit`, so each exits with whatever its last statement left. They are
+// checked like the --check programs; one that fails is printed with its
+// seed. Any difference fails the run.
+//
+//   cato_opt_bench [--runs N] [--timeout SECONDS] [--corpus DIR]... [--check DIR]...
+//                  [--fuzz N] [--seed S]
+
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./harness.hpp"
+
+#ifndef CATO_KERNEL_DIR
+#define CATO_KERNEL_DIR "bench/kernels"
+#endif
+#ifndef CATO_DIFFERENTIAL_DIR
+#define CATO_DIFFERENTIAL_DIR "bench/differential"
+#endif
+
+using bench::levels;
+
+// Random programs for --fuzz. Functions only call the ones before them and
+// index arrays only through p(), which prints its argument and returns it,
+// so every program ends and stays in bounds; division is only by nonzero
+// constants.
+class FuzzProgram {
+public:
+    inline explicit FuzzProgram(uint64_t seed)
+        : m_rng(seed)
+    {
+    }
+
+    inline std::string generate()
+    {
+        m_out << "function p(a){ print(a); return a; }\n";
+        const int functions = 1 + pick(4);
+        for (int f = 0; f < functions; f++) {
+            function(f);
+        }
+        m_function = functions;
+        m_ints.clear();
+        const int statements = 2 + pick(6);
+        for (int i = 0; i < statements; i++) {
+            statement("", false);
+        }
+        statement("", true);
+        return m_out.str();
+    }
+
+private:
+    inline int pick(int n)
+    {
+        return static_cast<int>(m_rng() % static_cast<uint64_t>(n));
+    }
+
+    inline void function(int f)
+    {
+        m_function = f;
+        const int params = 1 + pick(2);
+        m_ints.clear();
+        m_out << "function f" << f << "(";
+        for (int i = 0; i < params; i++) {
+            m_ints.push_back("a" + std::to_string(i));
+            m_out << (i > 0 ? ", " : "") << m_ints.back();
+        }
+        m_out << "){\n";
+        const int statements = 1 + pick(4);
+        for (int i = 0; i < statements; i++) {
+            statement("    ", false);
+        }
+        // Some run off their end.
+        if (pick(3) > 0) {
+            m_out << "    return " << expr(2) << ";\n";
+        }
+        m_out << "}\n";
+        m_arity.push_back(params);
+    }
+
+    inline std::string expr(int depth)
+    {
+        const int choice = pick(depth > 0 ? 10 : 4);
+        if (choice == 0 || (choice == 1 && m_ints.empty())) {
+            return std::to_string(pick(10));
+        }
+        if (choice == 1) {
+            return m_ints[pick(static_cast<int>(m_ints.size()))];
+        }
+        if (choice == 2 && !m_allocs.empty() && pick(2) == 0) {
+            return "len(" + m_allocs[pick(static_cast<int>(m_allocs.size()))] + ")";
+        }
+        if (choice == 2 && !m_arrays.empty()) {
+            const auto& [name, size] = m_arrays[pick(static_cast<int>(m_arrays.size()))];
+            return name + "[" + index(size) + "]";
+        }
+        if (choice <= 3) {
+            return "p(" + std::to_string(pick(10)) + ")";
+        }
+        if (choice <= 5 && m_function > 0) {
+            const int f = pick(m_function);
+            std::string call = "f" + std::to_string(f) + "(";
+            for (int i = 0; i < m_arity[f]; i++) {
+                call += (i > 0 ? ", " : "") + expr(depth - 1);
+            }
+            return call + ")";
+        }
+        if (choice == 6) {
+            return "(" + expr(depth - 1) + " / " + std::to_string(1 + pick(9)) + ")";
+        }
+        static const char* const ops[] = { "+", "-", "*", "<", ">", "==", "!=", "&&", "||" };
+        return "(" + expr(depth - 1) + " " + ops[pick(9)] + " " + expr(depth - 1) + ")";
+    }
+
+    inline std::string index(int size)
+    {
+        return pick(2) == 0 ? std::to_string(pick(size)) : "p(" + std::to_string(pick(size)) + ")";
+    }
+
+    // Arrays only at the top level, so they stay in scope.
+    inline void statement(const std::string& indent, bool last)
+    {
+        const bool top = indent.empty();
+        switch (pick(top ? 9 : 6)) {
+        case 0:
+        case 1: {
+            const std::string name = "v" + std::to_string(m_names++);
+            m_out << indent << "int " << name << " = " << expr(3) << ";\n";
+            m_ints.push_back(name);
+            return;
+        }
+        case 2:
+            if (m_ints.empty()) {
+                break;
+            }
+            m_out << indent << m_ints[pick(static_cast<int>(m_ints.size()))] << " = " << expr(3) << ";\n";
+            return;
+        case 3:
+            m_out << indent << "print(" << expr(3) << ");\n";
+            return;
+        case 4:
+            m_out << indent << "if (" << expr(2) << ") {\n";
+            m_out << indent << "    print(" << expr(2) << ");\n";
+            if (!top && pick(2) == 0) {
+                m_out << indent << "    return " << expr(2) << ";\n";
+            } else if (pick(4) == 0) {
+                m_out << indent << "    exit(" << expr(2) << ");\n";
+            }
+            m_out << indent << "}" << (pick(2) == 0 ? " else { println(); }\n" : "\n");
+            return;
+        case 5:
+            if (top || pick(3) > 0) {
+                break;
+            }
+            m_out << indent << "exit(" << expr(2) << ");\n";
+            return;
+        case 6: {
+            const std::string name = "b" + std::to_string(m_names++);
+            const int size = 1 + pick(6);
+            m_out << "int " << name << "[" << size << "];\n";
+            m_arrays.push_back({ name, size });
+            return;
+        }
+        case 7:
+            // Allocated arrays are only measured, as their contents start
+            // out unspecified.
+            m_allocs.push_back("h" + std::to_string(m_names++));
+            m_out << "int " << m_allocs.back() << "[] = alloc(" << 1 + pick(6) << ");\n";
+            return;
+        case 8: {
+            if (m_arrays.empty()) {
+                break;
+            }
+            const auto& [name, size] = m_arrays[pick(static_cast<int>(m_arrays.size()))];
+            m_out << name << "[" << index(size) << "] = " << expr(3) << ";\n";
+            return;
+        }
+        }
+        m_out << indent << "print(" << expr(last ? 3 : 1) << ");\n";
+    }
+
+    std::mt19937_64 m_rng;
+    std::stringstream m_out;
+    std::vector<int> m_arity;
+    int m_function = 0; // f0 .. f(m_function - 1) may be called
+    int m_names = 0;
+    std::vector<std::string> m_ints;
+    std::vector<std::pair<std::string, int>> m_arrays;
+    std::vector<std::string> m_allocs;
+};
+
+int main(int argc, char* argv[])
+{
+    int runs = 3;
+    unsigned timeout = 60;
+    int fuzz = 0;
+    uint64_t seed = 1;
+    std::vector<std::string> corpus_dirs;
+    std::vector<std::string> check_dirs;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--runs") {
+            runs = std::max(1, std::atoi(value));
+        } else if (arg == "--timeout") {
+            timeout = static_cast<unsigned>(std::max(1, std::atoi(value)));
+        } else if (arg == "--corpus") {
+            corpus_dirs.push_back(value);
+        } else if (arg == "--check") {
+            check_dirs.push_back(value);
+        } else if (arg == "--fuzz") {
+            fuzz = std::max(0, std::atoi(value));
+        } else if (arg == "--seed") {
+            seed = std::strtoull(value, nullptr, 10);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (corpus_dirs.empty()) {
+        corpus_dirs.push_back(CATO_KERNEL_DIR);
+    }
+    if (check_dirs.empty()) {
+        check_dirs.push_back(CATO_DIFFERENTIAL_DIR);
+    }
+
+    // Timed programs first, then the ones that are only checked.
+    std::vector<std::filesystem::path> programs = bench::list_programs(corpus_dirs);
+    const size_t timed = programs.size();
+    for (std::filesystem::path& path : bench::list_programs(check_dirs)) {
+        programs.push_back(std::move(path));
+    }
+    if (programs.empty() && fuzz == 0) {
+        std::cerr << "No programs in the corpus" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::string exe = "/tmp/cato_opt_bench_" + std::to_string(getpid());
+    std::array<double, levels> log_speedup {};
+    size_t measured = 0;
+    size_t wrong = 0;
+
+    if (!programs.empty()) {
+        std::cout << std::left << std::setw(20) << "program" << std::right << std::setw(8) << "exit";
+        for (int level = 0; level < levels; level++) {
+            std::cout << std::setw(10) << ("-O" + std::to_string(level) + " (ms)");
+            if (level > 0) {
+                std::cout << std::setw(8) << "speedup";
+            }
+        }
+        std::cout << "\n";
+    }
+
+    for (size_t program = 0; program < programs.size(); program++) {
+        const std::filesystem::path& path = programs[program];
+        const std::string source = bench::read_file(path.string());
+        std::cout << std::left << std::setw(20) << path.stem().string() << std::right << std::flush;
+
+        std::array<bench::Run, levels> results;
+        const std::optional<std::string> problem = bench::check(source, exe, timeout, program < timed ? runs : 1,
+            program >= timed, results);
+        if (problem.has_value()) {
+            wrong++;
+            std::cout << "  WRONG: " << problem.value() << "\n";
+            continue;
+        }
+
+        std::cout << std::setw(8) << results[0].status << std::fixed << std::setprecision(2);
+        if (program >= timed) {
+            std::cout << std::setw(10) << "checked" << "\n";
+            continue;
+        }
+        for (int level = 0; level < levels; level++) {
+            std::cout << std::setw(10) << results[level].seconds * 1e3;
+            if (level > 0) {
+                const double speedup = results[0].seconds / results[level].seconds;
+                log_speedup[level] += std::log(speedup);
+                std::cout << std::setw(7) << speedup << "x";
+            }
+        }
+        measured++;
+        std::cout << "\n";
+    }
+    size_t fuzz_wrong = 0;
+    for (int i = 0; i < fuzz; i++) {
+        const uint64_t program_seed = seed + static_cast<uint64_t>(i);
+        const std::string source = FuzzProgram(program_seed).generate();
+        std::array<bench::Run, levels> results;
+        if (std::optional<std::string> problem = bench::check(source, exe, timeout, 1, true, results)) {
+            fuzz_wrong++;
+            std::cout << "fuzz --seed " << program_seed << "  WRONG: " << problem.value() << "\n" << source;
+        }
+    }
+    if (fuzz > 0) {
+        std::cout << fuzz - fuzz_wrong << " of " << fuzz << " fuzzed programs agree from --seed " << seed << "\n";
+    }
+    std::error_code ec;
+    std::filesystem::remove(exe, ec);
+    std::filesystem::remove(exe + ".out", ec);
+
+    if (measured > 0) {
+        std::cout << std::left << std::setw(20) << "geomean" << std::right << std::setw(18) << "";
+        for (int level = 1; level < levels; level++) {
+            std::cout << std::setw(10) << "" << std::setw(7) << std::exp(log_speedup[level] / measured) << "x";
+        }
+        std::cout << "\n";
+    }
+    if (wrong > 0) {
+        std::cout << wrong << " of " << programs.size() << " programs disagree\n";
+    }
+    return wrong == 0 && fuzz_wrong == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
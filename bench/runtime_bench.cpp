@@ -0,0 +1,331 @@
+// Runs the kernels in bench/kernels as native executables and records how
+// fast the generated code is: wall time and, where perf_event_open is
+// allowed, cycles, instructions, branch misses and L1 data-cache misses.
+// Each kernel names its exit code in a `// expect: N` line, so a
+// miscompile fails the run as well as a slowdown.
+//
+//   cato_runtime_bench [--runs N] [--kernels DIR] [--timeout SECONDS]
+//                      [--save-baseline FILE] [--baseline FILE]
+//                      [--tolerance PERCENT] [--wall-tolerance PERCENT]
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./harness.hpp"
+
+#ifndef CATO_KERNEL_DIR
+#define CATO_KERNEL_DIR "bench/kernels"
+#endif
+
+using bench::Clock;
+
+struct Counter {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const std::array<Counter, 4> counters = { {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "l1d-misses", PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+} };
+
+// One run of a kernel; a counter perf could not open is left empty.
+struct Sample {
+    int status = -1; // exit code, or -1 if the process did not exit
+    double seconds = 0;
+    std::array<std::optional<uint64_t>, counters.size()> counts;
+};
+
+// Measured medians, one row per kernel in the baseline file.
+struct Result {
+    double seconds = 0;
+    std::array<std::optional<uint64_t>, counters.size()> counts;
+};
+
+static int open_counter(const Counter& counter, pid_t pid)
+{
+    perf_event_attr attr {};
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+// The child waits on a pipe until the counters are attached, and they start
+// counting at its exec, so neither fork nor the harness is measured.
+static Sample run_once(const std::string& exe, unsigned timeout)
+{
+    int gate[2];
+    if (pipe(gate) != 0) {
+        return {};
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(gate[1]);
+        char go;
+        if (read(gate[0], &go, 1) != 1) {
+            _exit(127);
+        }
+        // What a kernel prints is not checked, only its exit code.
+        const int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+        }
+        alarm(timeout);
+        execl(exe.c_str(), exe.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    close(gate[0]);
+
+    Sample sample;
+    std::array<int, counters.size()> fds;
+    for (size_t i = 0; i < counters.size(); i++) {
+        fds[i] = open_counter(counters[i], pid);
+    }
+    const auto start = Clock::now();
+    const char go = 1;
+    if (write(gate[1], &go, 1) != 1) {
+        kill(pid, SIGKILL);
+    }
+    close(gate[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    sample.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    sample.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    for (size_t i = 0; i < counters.size(); i++) {
+        uint64_t value = 0;
+        if (fds[i] >= 0 && read(fds[i], &value, sizeof(value)) == sizeof(value)) {
+            sample.counts[i] = value;
+        }
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    return sample;
+}
+
+template <typename T>
+static T median(std::vector<T> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// One line per kernel: name, seconds, then each counter or `-`.
+static std::map<std::string, Result> read_baseline(const std::string& path)
+{
+    std::map<std::string, Result> baseline;
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line);) {
+        std::istringstream fields(line);
+        std::string name;
+        Result result;
+        if (!(fields >> name >> result.seconds)) {
+            continue;
+        }
+        for (std::optional<uint64_t>& count : result.counts) {
+            std::string value;
+            fields >> value;
+            if (!value.empty() && value != "-") {
+                count = std::stoull(value);
+            }
+        }
+        baseline[name] = result;
+    }
+    return baseline;
+}
+
+static void write_baseline(const std::string& path, const std::map<std::string, Result>& results)
+{
+    std::ofstream file(path);
+    file << std::setprecision(9);
+    for (const auto& [name, result] : results) {
+        file << name << " " << result.seconds;
+        for (const std::optional<uint64_t>& count : result.counts) {
+            file << " ";
+            if (count.has_value()) {
+                file << count.value();
+            } else {
+                file << "-";
+            }
+        }
+        file << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = 5;
+    unsigned timeout = 20;
+    double tolerance = 2;       // instructions
+    double wall_tolerance = 10; // wall time is much noisier
+    std::string kernel_dir = CATO_KERNEL_DIR;
+    std::string baseline_path;
+    std::string save_path;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--runs") {
+            runs = std::max(1, std::atoi(value));
+        } else if (arg == "--kernels") {
+            kernel_dir = value;
+        } else if (arg == "--timeout") {
+            timeout = static_cast<unsigned>(std::max(1, std::atoi(value)));
+        } else if (arg == "--baseline") {
+            baseline_path = value;
+        } else if (arg == "--save-baseline") {
+            save_path = value;
+        } else if (arg == "--tolerance") {
+            tolerance = std::atof(value);
+        } else if (arg == "--wall-tolerance") {
+            wall_tolerance = std::atof(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::vector<std::filesystem::path> kernels = bench::list_programs({ kernel_dir });
+    if (kernels.empty()) {
+        std::cerr << "No kernels in " << kernel_dir << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::map<std::string, Result> baseline = baseline_path.empty() ? std::map<std::string, Result> {} : read_baseline(baseline_path);
+    std::map<std::string, Result> results;
+    const std::string exe = "/tmp/cato_runtime_bench_" + std::to_string(getpid());
+    bool perf_available = false;
+    size_t wrong = 0;
+    size_t regressed = 0;
+
+    std::cout << std::left << std::setw(10) << "kernel" << std::right << std::setw(8) << "exit" << std::setw(12)
+              << "wall (ms)";
+    for (const Counter& counter : counters) {
+        std::cout << std::setw(16) << counter.name;
+    }
+    std::cout << "\n";
+
+    for (const std::filesystem::path& path : kernels) {
+        const std::string name = path.stem().string();
+        const std::string source = bench::read_file(path.string());
+        const std::optional<int> expected = bench::expectation(source).status;
+
+        std::cout << std::left << std::setw(10) << name << std::right;
+        if (std::optional<std::string> error = bench::build(source, exe)) {
+            std::cout << "  build failed: " << error.value() << "\n";
+            wrong++;
+            continue;
+        }
+
+        std::vector<Sample> samples;
+        // A wrong answer (or a hang) is not worth repeating.
+        for (int i = 0; i < runs; i++) {
+            samples.push_back(run_once(exe, timeout));
+            if (samples.back().status != expected) {
+                break;
+            }
+        }
+        Result result;
+        std::vector<double> seconds;
+        for (const Sample& sample : samples) {
+            seconds.push_back(sample.seconds);
+        }
+        result.seconds = median(seconds);
+        for (size_t c = 0; c < counters.size(); c++) {
+            std::vector<uint64_t> counts;
+            for (const Sample& sample : samples) {
+                if (sample.counts[c].has_value()) {
+                    counts.push_back(sample.counts[c].value());
+                }
+            }
+            if (counts.size() == samples.size()) {
+                result.counts[c] = median(counts);
+                perf_available = true;
+            }
+        }
+        results[name] = result;
+
+        // Every run has to agree with the expected exit code.
+        const int status = samples.front().status;
+        bool correct = expected.has_value();
+        for (const Sample& sample : samples) {
+            correct = correct && sample.status == expected.value();
+        }
+        std::cout << std::setw(8) << (status < 0 ? std::string("signal") : std::to_string(status)) << std::fixed
+                  << std::setprecision(2) << std::setw(12) << result.seconds * 1e3;
+        for (const std::optional<uint64_t>& count : result.counts) {
+            std::cout << std::setw(16) << (count.has_value() ? std::to_string(count.value()) : std::string("-"));
+        }
+        if (!correct) {
+            wrong++;
+            std::cout << "  WRONG, expected " << (expected.has_value() ? std::to_string(expected.value()) : "a `// expect:` line");
+        }
+
+        // Instruction counts are stable run to run, so they are compared
+        // when both sides have them; wall time otherwise.
+        if (auto it = baseline.find(name); it != baseline.end()) {
+            const Result& base = it->second;
+            const size_t instructions = 1;
+            double before = base.seconds;
+            double after = result.seconds;
+            const char* measure = "wall";
+            double limit = wall_tolerance;
+            if (base.counts[instructions].has_value() && result.counts[instructions].has_value()) {
+                before = static_cast<double>(base.counts[instructions].value());
+                after = static_cast<double>(result.counts[instructions].value());
+                measure = "instructions";
+                limit = tolerance;
+            }
+            const double change = before > 0 ? (after - before) / before * 100 : 0;
+            std::cout << "  " << measure << " " << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos;
+            if (change > limit) {
+                regressed++;
+                std::cout << " REGRESSED";
+            }
+        }
+        std::cout << "\n";
+    }
+    std::error_code ec;
+    std::filesystem::remove(exe, ec);
+
+    if (!perf_available) {
+        std::cout << "Hardware counters unavailable (perf_event_open denied or unsupported); wall time only\n";
+    }
+    if (!save_path.empty()) {
+        write_baseline(save_path, results);
+    }
+    if (wrong > 0) {
+        std::cout << wrong << " of " << kernels.size() << " kernels miscompiled\n";
+    }
+    if (regressed > 0) {
+        std::cout << regressed << " kernels regressed\n";
+    }
+    return wrong == 0 && regressed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
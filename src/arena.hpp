@@ -1,64 +1,265 @@
-#pragma once
-
-#include <cstddef>
-#include <cstdlib>
-#include <memory>
-#include <utility>
-
-class ArenaAllocator final {
-public:
-    explicit ArenaAllocator(const std::size_t max_num_bytes)
-        : m_size { max_num_bytes }
-        , m_buffer { new std::byte[max_num_bytes] }
-        , m_offset { m_buffer }
-    {
-    }
-
-    ArenaAllocator(const ArenaAllocator&) = delete;
-    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
-
-    ArenaAllocator(ArenaAllocator&& other) noexcept
-        : m_size { std::exchange(other.m_size, 0) }
-        , m_buffer { std::exchange(other.m_buffer, nullptr) }
-        , m_offset { std::exchange(other.m_offset, nullptr) }
-    {
-    }
-
-    ArenaAllocator& operator=(ArenaAllocator&& other) noexcept
-    {
-        std::swap(m_size, other.m_size);
-        std::swap(m_buffer, other.m_buffer);
-        std::swap(m_offset, other.m_offset);
-        return *this;
-    }
-
-    template <typename T>
-    [[nodiscard]] T* alloc()
-    {
-        std::size_t remaining_num_bytes = m_size - static_cast<std::size_t>(m_offset - m_buffer);
-        auto pointer = static_cast<void*>(m_offset);
-        const auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
-        if (aligned_address == nullptr) {
-            throw std::bad_alloc {};
-        }
-        m_offset = static_cast<std::byte*>(aligned_address) + sizeof(T);
-        return static_cast<T*>(aligned_address);
-    }
-
-    template <typename T, typename... Args>
-    [[nodiscard]] T* emplace(Args&&... args)
-    {
-        const auto allocated_memory = alloc<T>();
-        return new (allocated_memory) T { std::forward<Args>(args)... };
-    }
-
-    ~ArenaAllocator()
-    {
-        delete[] m_buffer;
-    }
-
-private:
-    std::size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
-};
\ No newline at end of file
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class ArenaAllocator final {
+public:
+    explicit ArenaAllocator(const std::size_t max_num_bytes)
+        : m_size { max_num_bytes }
+        , m_buffer { new std::byte[max_num_bytes] }
+        , m_offset { m_buffer }
+    {
+    }
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    ArenaAllocator(ArenaAllocator&& other) noexcept
+        : m_size { std::exchange(other.m_size, 0) }
+        , m_buffer { std::exchange(other.m_buffer, nullptr) }
+        , m_offset { std::exchange(other.m_offset, nullptr) }
+        , m_full_blocks { std::move(other.m_full_blocks) }
+        , m_allocations { std::exchange(other.m_allocations, 0) }
+        , m_peak_bytes { std::exchange(other.m_peak_bytes, 0) }
+    {
+    }
+
+    ArenaAllocator& operator=(ArenaAllocator&& other) noexcept
+    {
+        std::swap(m_size, other.m_size);
+        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_offset, other.m_offset);
+        std::swap(m_full_blocks, other.m_full_blocks);
+        std::swap(m_allocations, other.m_allocations);
+        std::swap(m_peak_bytes, other.m_peak_bytes);
+        return *this;
+    }
+
+    template <typename T>
+    [[nodiscard]] T* alloc()
+    {
+        std::size_t remaining_num_bytes = m_size - static_cast<std::size_t>(m_offset - m_buffer);
+        auto pointer = static_cast<void*>(m_offset);
+        auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
+        if (aligned_address == nullptr) {
+            // Start a new block of the same size; earlier allocations stay put.
+            if (sizeof(T) + alignof(T) > m_size) {
+                throw std::bad_alloc {};
+            }
+            m_full_blocks.push_back(std::exchange(m_buffer, new std::byte[m_size]));
+            m_offset = m_buffer;
+            pointer = static_cast<void*>(m_offset);
+            remaining_num_bytes = m_size;
+            aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
+        }
+        m_offset = static_cast<std::byte*>(aligned_address) + sizeof(T);
+        m_allocations++;
+        return static_cast<T*>(aligned_address);
+    }
+
+    template <typename T, typename... Args>
+    [[nodiscard]] T* emplace(Args&&... args)
+    {
+        const auto allocated_memory = alloc<T>();
+        return new (allocated_memory) T { std::forward<Args>(args)... };
+    }
+
+    // Forgets every allocation (without running destructors) and keeps only
+    // the current block for reuse.
+    void reset()
+    {
+        m_peak_bytes = peak_bytes();
+        for (std::byte* block : m_full_blocks) {
+            delete[] block;
+        }
+        m_full_blocks.clear();
+        m_offset = m_buffer;
+        m_allocations = 0;
+    }
+
+    // Number of objects allocated since construction or the last reset().
+    [[nodiscard]] std::size_t allocations() const
+    {
+        return m_allocations;
+    }
+
+    [[nodiscard]] std::size_t bytes_used() const
+    {
+        return m_full_blocks.size() * m_size + static_cast<std::size_t>(m_offset - m_buffer);
+    }
+
+    // High-water mark of bytes_used() over the arena's whole life.
+    [[nodiscard]] std::size_t peak_bytes() const
+    {
+        return std::max(m_peak_bytes, bytes_used());
+    }
+
+    ~ArenaAllocator()
+    {
+        delete[] m_buffer;
+        for (std::byte* block : m_full_blocks) {
+            delete[] block;
+        }
+    }
+
+private:
+    std::size_t m_size;
+    std::byte* m_buffer;
+    std::byte* m_offset;
+    std::vector<std::byte*> m_full_blocks;
+    std::size_t m_allocations = 0;
+    std::size_t m_peak_bytes = 0;
+};
+
+// A stack for walking trees that may be nested deeper than the call stack
+// allows. Items live in fixed-size chunks from its own arena; popping keeps
+// the chunks for the next push, so a walk allocates only as much as its
+// deepest point needs.
+template <typename T>
+class ArenaStack final {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+
+public:
+    ArenaStack()
+        : m_arena { block_chunks * sizeof(Chunk) }
+    {
+    }
+
+    void push(const T& value)
+    {
+        if (m_chunk == nullptr) {
+            m_chunk = m_arena.emplace<Chunk>();
+        } else if (m_used == chunk_items) {
+            if (m_chunk->next == nullptr) {
+                m_chunk->next = m_arena.emplace<Chunk>();
+                m_chunk->next->prev = m_chunk;
+            }
+            m_chunk = m_chunk->next;
+            m_used = 0;
+        }
+        std::memcpy(m_chunk->items + m_used * sizeof(T), &value, sizeof(T));
+        m_used++;
+        m_size++;
+    }
+
+    T pop()
+    {
+        T value = top();
+        m_used--;
+        m_size--;
+        if (m_used == 0 && m_chunk->prev != nullptr) {
+            m_chunk = m_chunk->prev;
+            m_used = chunk_items;
+        }
+        return value;
+    }
+
+    [[nodiscard]] T top() const
+    {
+        T value;
+        std::memcpy(&value, m_chunk->items + (m_used - 1) * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return m_size;
+    }
+
+    void clear()
+    {
+        while (m_chunk != nullptr && m_chunk->prev != nullptr) {
+            m_chunk = m_chunk->prev;
+        }
+        m_used = 0;
+        m_size = 0;
+    }
+
+private:
+    static constexpr std::size_t chunk_items = std::max<std::size_t>(1, 4096 / sizeof(T));
+    static constexpr std::size_t block_chunks = 16;
+
+    struct Chunk {
+        alignas(T) std::byte items[chunk_items * sizeof(T)];
+        Chunk* prev;
+        Chunk* next;
+    };
+
+    ArenaAllocator m_arena;
+    Chunk* m_chunk = nullptr; // holding the top item
+    std::size_t m_used = 0;   // items in m_chunk
+    std::size_t m_size = 0;
+};
+
+// Keeps arenas alive between compilations so a long-running process does
+// not pay for fresh allocations and page faults on every file. Arenas are
+// made on first use, so the pool holds as many as ever ran at once.
+class ArenaPool final {
+public:
+    // Gives `owner`'s arena (anything with release_arena()) back to the
+    // pool when it goes out of scope, however the compilation ends.
+    template <typename Owner>
+    class Lease final {
+    public:
+        Lease(ArenaPool* pool, Owner& owner)
+            : m_pool { pool }
+            , m_owner { owner }
+        {
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease()
+        {
+            if (m_pool != nullptr) {
+                m_pool->release(m_owner.release_arena());
+            }
+        }
+
+    private:
+        ArenaPool* m_pool;
+        Owner& m_owner;
+    };
+
+    explicit ArenaPool(const std::size_t arena_size)
+        : m_arena_size { arena_size }
+    {
+    }
+
+    ArenaAllocator acquire()
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_free.empty()) {
+            return ArenaAllocator(m_arena_size);
+        }
+        ArenaAllocator arena = std::move(m_free.back());
+        m_free.pop_back();
+        return arena;
+    }
+
+    void release(ArenaAllocator arena)
+    {
+        arena.reset();
+        std::lock_guard lock(m_mutex);
+        m_free.push_back(std::move(arena));
+    }
+
+private:
+    std::size_t m_arena_size;
+    std::mutex m_mutex;
+    std::vector<ArenaAllocator> m_free;
+};
@@ -0,0 +1,1346 @@
+#pragma once
+
+#include <elf.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./object.hpp"
+
+// Built-in x86-64 assembler for the NASM subset the Generator emits. It
+// turns the generated text straight into an ObjectFile, so neither the AOT
+// build nor the JIT has to spawn `nasm`. Anything it does not understand is
+// reported and the caller falls back to the external assembler.
+
+class Assembler {
+public:
+    // With `implicit_externs`, undefined symbols become external references
+    // instead of errors, so one function can be assembled on its own.
+    inline explicit Assembler(std::string src, bool implicit_externs = false)
+        : m_src(std::move(src))
+        , m_implicit_externs(implicit_externs)
+    {
+    }
+
+    inline std::optional<ObjectFile> assemble()
+    {
+        try {
+            switch_section(".text");
+            std::istringstream lines(m_src);
+            std::string line;
+            while (std::getline(lines, line)) {
+                m_line++;
+                assemble_line(line);
+            }
+            return finish();
+        } catch (const Error& err) {
+            std::cerr << "assembler: ";
+            if (m_line > 0) {
+                std::cerr << "line " << m_line << ": ";
+            }
+            std::cerr << err.message << std::endl;
+            return {};
+        }
+    }
+
+    // Recommended multi-byte NOP encodings, indexed by length - 1.
+    static inline const std::vector<std::vector<uint8_t>>& nops()
+    {
+        static const std::vector<std::vector<uint8_t>> table = {
+            { 0x90 },
+            { 0x66, 0x90 },
+            { 0x0F, 0x1F, 0x00 },
+            { 0x0F, 0x1F, 0x40, 0x00 },
+            { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+            { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+            { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+            { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+            { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        };
+        return table;
+    }
+
+private:
+    struct Error {
+        std::string message;
+    };
+
+    enum class OperandKind { reg, imm, mem };
+
+    struct Operand {
+        OperandKind kind;
+        int reg = -1;
+        int size = 0; // in bits, 0 when the operand does not say
+        int64_t imm = 0;
+        std::string symbol {};
+        int base = -1;
+        int index = -1;
+        int scale = 1;
+        bool rip = false;
+    };
+
+    struct Fixup {
+        size_t section;
+        size_t field;
+        size_t insn_end;
+        std::string symbol;
+        int64_t addend;
+        uint32_t type;
+    };
+
+    struct Label {
+        size_t section;
+        uint64_t offset;
+    };
+
+    [[noreturn]] static inline void fail(const std::string& message)
+    {
+        throw Error { message };
+    }
+
+    static inline std::string lower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+        return s;
+    }
+
+    static inline std::string trim(const std::string& s)
+    {
+        const size_t begin = s.find_first_not_of(" \t\r");
+        if (begin == std::string::npos) {
+            return {};
+        }
+        const size_t end = s.find_last_not_of(" \t\r");
+        return s.substr(begin, end - begin + 1);
+    }
+
+    static inline bool is_ident(const std::string& s)
+    {
+        if (s.empty() || !(std::isalpha(static_cast<unsigned char>(s[0])) || s[0] == '_' || s[0] == '.')) {
+            return false;
+        }
+        return std::all_of(s.begin(), s.end(), [](unsigned char c) {
+            return std::isalnum(c) || c == '_' || c == '.' || c == '$' || c == '@';
+        });
+    }
+
+    // Splits on top-level commas, leaving quoted strings and brackets intact.
+    static inline std::vector<std::string> split_operands(const std::string& s)
+    {
+        std::vector<std::string> parts;
+        std::string current;
+        char quote = 0;
+        int depth = 0;
+        for (char c : s) {
+            if (quote) {
+                current.push_back(c);
+                if (c == quote) {
+                    quote = 0;
+                }
+            } else if (c == '\'' || c == '"' || c == '`') {
+                quote = c;
+                current.push_back(c);
+            } else if (c == '[') {
+                depth++;
+                current.push_back(c);
+            } else if (c == ']') {
+                depth--;
+                current.push_back(c);
+            } else if (c == ',' && depth == 0) {
+                parts.push_back(trim(current));
+                current.clear();
+            } else {
+                current.push_back(c);
+            }
+        }
+        if (!trim(current).empty() || !parts.empty()) {
+            parts.push_back(trim(current));
+        }
+        return parts;
+    }
+
+    static inline std::optional<std::pair<int, int>> parse_reg(const std::string& name)
+    {
+        static const std::map<std::string, std::pair<int, int>> regs = [] {
+            std::map<std::string, std::pair<int, int>> table;
+            const char* r64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi" };
+            const char* r32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+            const char* r16[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+            const char* r8[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" };
+            for (int i = 0; i < 8; i++) {
+                table[r64[i]] = { i, 64 };
+                table[r32[i]] = { i, 32 };
+                table[r16[i]] = { i, 16 };
+                table[r8[i]] = { i, 8 };
+            }
+            for (int i = 0; i < 16; i++) {
+                // Appended rather than `"xmm" + ...`, which GCC 12 flags
+                // with a -Wrestrict false positive.
+                std::string xmm = "xmm";
+                xmm += std::to_string(i);
+                table[xmm] = { i, 128 };
+            }
+            for (int i = 8; i < 16; i++) {
+                std::string base = "r";
+                base += std::to_string(i);
+                table[base] = { i, 64 };
+                table[base + "d"] = { i, 32 };
+                table[base + "w"] = { i, 16 };
+                table[base + "b"] = { i, 8 };
+            }
+            return table;
+        }();
+        auto it = regs.find(lower(name));
+        if (it == regs.end()) {
+            return {};
+        }
+        return it->second;
+    }
+
+    static inline std::optional<int64_t> parse_number(const std::string& text)
+    {
+        std::string s = lower(trim(text));
+        bool negative = false;
+        if (!s.empty() && (s[0] == '-' || s[0] == '+')) {
+            negative = s[0] == '-';
+            s = trim(s.substr(1));
+        }
+        if (s.empty()) {
+            return {};
+        }
+        int base = 10;
+        if (s.size() > 2 && s[0] == '0' && s[1] == 'x') {
+            base = 16;
+            s = s.substr(2);
+        } else if (s.size() > 1 && s.back() == 'h' && std::isdigit(static_cast<unsigned char>(s[0]))) {
+            base = 16;
+            s.pop_back();
+        }
+        uint64_t value = 0;
+        for (char c : s) {
+            if (c == '_') {
+                continue;
+            }
+            int digit;
+            if (std::isdigit(static_cast<unsigned char>(c))) {
+                digit = c - '0';
+            } else if (base == 16 && c >= 'a' && c <= 'f') {
+                digit = c - 'a' + 10;
+            } else {
+                return {};
+            }
+            if (digit >= base) {
+                return {};
+            }
+            value = value * base + digit;
+        }
+        return negative ? -static_cast<int64_t>(value) : static_cast<int64_t>(value);
+    }
+
+    // Parses `sym`, `sym + n`, `sym - n`, `n`; returns symbol and offset.
+    inline std::pair<std::string, int64_t> parse_value(const std::string& text) const
+    {
+        std::string symbol;
+        int64_t value = 0;
+        for (const auto& [sign, term] : split_terms(text)) {
+            if (auto number = parse_number(term)) {
+                value += sign * number.value();
+            } else if (is_ident(term) && symbol.empty() && sign > 0) {
+                symbol = qualify(term);
+            } else {
+                fail("unsupported expression `" + text + "`");
+            }
+        }
+        return { symbol, value };
+    }
+
+    static inline std::vector<std::pair<int, std::string>> split_terms(const std::string& text)
+    {
+        std::vector<std::pair<int, std::string>> terms;
+        std::string current;
+        int sign = 1;
+        for (size_t i = 0; i < text.size(); i++) {
+            const char c = text[i];
+            if ((c == '+' || c == '-') && !trim(current).empty()) {
+                terms.push_back({ sign, trim(current) });
+                current.clear();
+                sign = c == '-' ? -1 : 1;
+            } else if ((c == '+' || c == '-') && trim(current).empty()) {
+                sign *= c == '-' ? -1 : 1;
+            } else {
+                current.push_back(c);
+            }
+        }
+        if (!trim(current).empty()) {
+            terms.push_back({ sign, trim(current) });
+        }
+        return terms;
+    }
+
+    inline std::string qualify(const std::string& name) const
+    {
+        if (!name.empty() && name[0] == '.' && !name.starts_with("..")) {
+            return m_last_global + name;
+        }
+        return name;
+    }
+
+    inline Operand parse_operand(const std::string& text) const
+    {
+        std::string s = trim(text);
+        int size = 0;
+        static const std::map<std::string, int> sizes = { { "byte", 8 }, { "word", 16 }, { "dword", 32 }, { "qword", 64 } };
+        const size_t space = s.find_first_of(" \t[");
+        if (space != std::string::npos) {
+            auto it = sizes.find(lower(trim(s.substr(0, space))));
+            if (it != sizes.end()) {
+                size = it->second;
+                s = trim(s.substr(space));
+            }
+        }
+
+        if (!s.empty() && s.front() == '[') {
+            if (s.back() != ']') {
+                fail("unterminated memory operand `" + text + "`");
+            }
+            Operand op { .kind = OperandKind::mem, .size = size };
+            std::string inner = trim(s.substr(1, s.size() - 2));
+            bool explicit_rel = false;
+            bool explicit_abs = false;
+            if (lower(inner).starts_with("rel ")) {
+                explicit_rel = true;
+                inner = inner.substr(4);
+            } else if (lower(inner).starts_with("abs ")) {
+                explicit_abs = true;
+                inner = inner.substr(4);
+            }
+            for (const auto& [sign, term] : split_terms(inner)) {
+                const size_t star = term.find('*');
+                if (star != std::string::npos) {
+                    auto reg = parse_reg(trim(term.substr(0, star)));
+                    auto scale = parse_number(term.substr(star + 1));
+                    if (!reg || reg->second != 64 || !scale || sign < 0 || op.index >= 0) {
+                        fail("bad index `" + term + "`");
+                    }
+                    op.index = reg->first;
+                    op.scale = static_cast<int>(scale.value());
+                } else if (auto reg = parse_reg(term)) {
+                    if (reg->second != 64 || sign < 0) {
+                        fail("bad address register `" + term + "`");
+                    }
+                    if (op.base < 0) {
+                        op.base = reg->first;
+                    } else if (op.index < 0) {
+                        op.index = reg->first;
+                    } else {
+                        fail("too many registers in `" + text + "`");
+                    }
+                } else if (auto number = parse_number(term)) {
+                    op.imm += sign * number.value();
+                } else if (is_ident(term) && op.symbol.empty() && sign > 0) {
+                    op.symbol = qualify(term);
+                } else {
+                    fail("unsupported address `" + text + "`");
+                }
+            }
+            if (op.scale != 1 && op.scale != 2 && op.scale != 4 && op.scale != 8) {
+                fail("bad scale in `" + text + "`");
+            }
+            if (op.index == 4) {
+                fail("rsp cannot be an index register");
+            }
+            op.rip = op.base < 0 && op.index < 0 && !op.symbol.empty() && (explicit_rel || (m_default_rel && !explicit_abs));
+            if (!op.symbol.empty() && !op.rip && (op.base >= 0 || op.index >= 0)) {
+                fail("symbolic address with registers is not supported");
+            }
+            return op;
+        }
+
+        if (auto reg = parse_reg(s)) {
+            if (size != 0 && size != reg->second) {
+                fail("operand size mismatch in `" + text + "`");
+            }
+            return { .kind = OperandKind::reg, .reg = reg->first, .size = reg->second };
+        }
+
+        Operand op { .kind = OperandKind::imm, .size = size };
+        if (s.size() >= 3 && (s.front() == '\'' || s.front() == '"') && s.back() == s.front()) {
+            int64_t value = 0;
+            const std::string chars = s.substr(1, s.size() - 2);
+            for (size_t i = 0; i < chars.size() && i < 8; i++) {
+                value |= static_cast<int64_t>(static_cast<unsigned char>(chars[i])) << (8 * i);
+            }
+            op.imm = value;
+            return op;
+        }
+        auto [symbol, value] = parse_value(s);
+        op.symbol = symbol;
+        op.imm = value;
+        return op;
+    }
+
+    inline ObjectSection& section()
+    {
+        return m_sections[m_current];
+    }
+
+    inline void emit(uint8_t byte)
+    {
+        if (section().nobits) {
+            fail("code or data in a nobits section");
+        }
+        section().data.push_back(byte);
+    }
+
+    inline void emit(std::initializer_list<uint8_t> bytes)
+    {
+        for (uint8_t byte : bytes) {
+            emit(byte);
+        }
+    }
+
+    inline void emit_le(uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++) {
+            emit(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    inline size_t here()
+    {
+        return section().nobits ? section().size : section().data.size();
+    }
+
+    // Emits a 32- or 64-bit field that refers to `symbol`; the reference is
+    // resolved in finish() once the end of the instruction is known.
+    inline void emit_symbol_field(const std::string& symbol, int64_t addend, uint32_t type, int bytes)
+    {
+        m_pending.push_back({ m_current, here(), 0, symbol, addend, type });
+        emit_le(0, bytes);
+    }
+
+    inline void end_instruction()
+    {
+        for (Fixup& fixup : m_pending) {
+            fixup.insn_end = here();
+            m_fixups.push_back(fixup);
+        }
+        m_pending.clear();
+    }
+
+    static inline bool fits8(int64_t value)
+    {
+        return value >= INT8_MIN && value <= INT8_MAX;
+    }
+
+    static inline bool fits32(int64_t value)
+    {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    // Emits [66] [REX] opcode ModRM [SIB] [disp] for an r/m operand.
+    // `reg` is either a register number or a /digit opcode extension.
+    inline void emit_rm(const std::vector<uint8_t>& opcode, int size, int reg, const Operand& rm, bool byte_reg_operand = false)
+    {
+        if (size == 16) {
+            emit(0x66);
+        }
+        uint8_t rex = 0;
+        if (size == 64) {
+            rex |= 0x08;
+        }
+        if (reg & 8) {
+            rex |= 0x04;
+        }
+        bool force_rex = byte_reg_operand && reg >= 4 && reg < 8;
+        if (rm.kind == OperandKind::reg) {
+            if (rm.reg & 8) {
+                rex |= 0x01;
+            }
+            if (rm.size == 8 && rm.reg >= 4 && rm.reg < 8) {
+                force_rex = true;
+            }
+        } else {
+            if (rm.base >= 0 && (rm.base & 8)) {
+                rex |= 0x01;
+            }
+            if (rm.index >= 0 && (rm.index & 8)) {
+                rex |= 0x02;
+            }
+        }
+        if (rex || force_rex) {
+            emit(0x40 | rex);
+        }
+        for (uint8_t byte : opcode) {
+            emit(byte);
+        }
+
+        const uint8_t reg_bits = static_cast<uint8_t>((reg & 7) << 3);
+        if (rm.kind == OperandKind::reg) {
+            emit(0xC0 | reg_bits | (rm.reg & 7));
+            return;
+        }
+        if (rm.rip) {
+            emit(0x05 | reg_bits);
+            emit_symbol_field(rm.symbol, rm.imm, R_X86_64_PC32, 4);
+            return;
+        }
+        if (rm.base < 0) {
+            // [disp32] or [index*scale + disp32]: SIB with no base.
+            emit(0x04 | reg_bits);
+            const uint8_t index = rm.index >= 0 ? (rm.index & 7) : 4;
+            emit(static_cast<uint8_t>(scale_bits(rm.scale) << 6 | index << 3 | 5));
+            if (!rm.symbol.empty()) {
+                emit_symbol_field(rm.symbol, rm.imm, R_X86_64_32S, 4);
+            } else {
+                if (!fits32(rm.imm)) {
+                    fail("displacement out of range");
+                }
+                emit_le(static_cast<uint64_t>(rm.imm), 4);
+            }
+            return;
+        }
+        if (!fits32(rm.imm)) {
+            fail("displacement out of range");
+        }
+        uint8_t mod;
+        if (rm.imm == 0 && (rm.base & 7) != 5) {
+            mod = 0x00;
+        } else if (fits8(rm.imm)) {
+            mod = 0x40;
+        } else {
+            mod = 0x80;
+        }
+        if (rm.index < 0 && (rm.base & 7) != 4) {
+            emit(mod | reg_bits | (rm.base & 7));
+        } else {
+            emit(mod | reg_bits | 4);
+            const uint8_t index = rm.index >= 0 ? (rm.index & 7) : 4;
+            emit(static_cast<uint8_t>(scale_bits(rm.scale) << 6 | index << 3 | (rm.base & 7)));
+        }
+        if (mod == 0x40) {
+            emit(static_cast<uint8_t>(rm.imm));
+        } else if (mod == 0x80) {
+            emit_le(static_cast<uint64_t>(rm.imm), 4);
+        }
+    }
+
+    static inline int scale_bits(int scale)
+    {
+        switch (scale) {
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        case 8:
+            return 3;
+        default:
+            return 0;
+        }
+    }
+
+    // `op_size` 64 marks a 32-bit immediate the CPU sign-extends.
+    inline void emit_imm(const Operand& imm, int bytes, int op_size = 0)
+    {
+        if (!imm.symbol.empty()) {
+            emit_symbol_field(imm.symbol, imm.imm, bytes == 8 ? R_X86_64_64 : R_X86_64_32S, bytes);
+            return;
+        }
+        if (bytes == 1 && !(fits8(imm.imm) || (imm.imm >= 0 && imm.imm <= 0xFF))) {
+            fail("immediate does not fit in a byte");
+        }
+        if (bytes == 4 && op_size == 64 && !fits32(imm.imm)) {
+            fail("immediate does not fit in a sign-extended 32 bits");
+        }
+        if (bytes == 4 && !(fits32(imm.imm) || (imm.imm >= 0 && imm.imm <= 0xFFFFFFFF))) {
+            fail("immediate does not fit in 32 bits");
+        }
+        emit_le(static_cast<uint64_t>(imm.imm), bytes);
+    }
+
+    static inline int operand_size(const std::vector<Operand>& ops, int fallback = 0)
+    {
+        int size = 0;
+        for (const Operand& op : ops) {
+            if (op.kind == OperandKind::imm || op.size == 0) {
+                continue;
+            }
+            if (size != 0 && size != op.size) {
+                fail("operand size mismatch");
+            }
+            size = op.size;
+        }
+        if (size == 0) {
+            if (fallback == 0) {
+                fail("operation size not specified");
+            }
+            size = fallback;
+        }
+        return size;
+    }
+
+    static inline std::optional<int> condition_code(const std::string& cc)
+    {
+        static const std::map<std::string, int> codes = {
+            { "o", 0 }, { "no", 1 }, { "b", 2 }, { "c", 2 }, { "nae", 2 }, { "ae", 3 }, { "nb", 3 }, { "nc", 3 },
+            { "e", 4 }, { "z", 4 }, { "ne", 5 }, { "nz", 5 }, { "be", 6 }, { "na", 6 }, { "a", 7 }, { "nbe", 7 },
+            { "s", 8 }, { "ns", 9 }, { "p", 10 }, { "pe", 10 }, { "np", 11 }, { "po", 11 }, { "l", 12 }, { "nge", 12 },
+            { "ge", 13 }, { "nl", 13 }, { "le", 14 }, { "ng", 14 }, { "g", 15 }, { "nle", 15 },
+        };
+        auto it = codes.find(cc);
+        if (it == codes.end()) {
+            return {};
+        }
+        return it->second;
+    }
+
+    inline void expect(const std::vector<Operand>& ops, size_t count, const std::string& mnemonic)
+    {
+        if (ops.size() != count) {
+            fail("`" + mnemonic + "` expects " + std::to_string(count) + " operand(s)");
+        }
+    }
+
+    static inline bool is_xmm(const Operand& op)
+    {
+        return op.kind == OperandKind::reg && op.size == 128;
+    }
+
+    // The SSE2 integer instructions the vectorizer uses. False if
+    // `mnemonic` is not one of them.
+    inline bool assemble_sse(const std::string& mnemonic, const std::vector<Operand>& ops)
+    {
+        struct Form {
+            uint8_t prefix;
+            uint8_t opcode;
+        };
+        // xmm, xmm/m128
+        static const std::map<std::string, Form> packed = {
+            { "paddq", { 0x66, 0xD4 } }, { "psubq", { 0x66, 0xFB } }, { "pand", { 0x66, 0xDB } },
+            { "por", { 0x66, 0xEB } }, { "pxor", { 0x66, 0xEF } }, { "pcmpeqd", { 0x66, 0x76 } },
+            { "punpcklqdq", { 0x66, 0x6C } }, { "movdqa", { 0x66, 0x6F } }, { "movdqu", { 0xF3, 0x6F } },
+        };
+        auto plain_sse = [&](uint8_t prefix, uint8_t opcode, int reg, const Operand& rm, int size = 32) {
+            emit(prefix);
+            emit_rm({ 0x0F, opcode }, size, reg, rm);
+        };
+
+        if (auto it = packed.find(mnemonic); it != packed.end()) {
+            expect(ops, 2, mnemonic);
+            const Form form = it->second;
+            if (is_xmm(ops[0]) && (is_xmm(ops[1]) || ops[1].kind == OperandKind::mem)) {
+                plain_sse(form.prefix, form.opcode, ops[0].reg, ops[1]);
+            } else if ((mnemonic == "movdqa" || mnemonic == "movdqu") && ops[0].kind == OperandKind::mem && is_xmm(ops[1])) {
+                plain_sse(form.prefix, 0x7F, ops[1].reg, ops[0]);
+            } else {
+                fail("bad operands for `" + mnemonic + "`");
+            }
+            return true;
+        }
+        if (mnemonic == "pshufd") {
+            expect(ops, 3, mnemonic);
+            if (!is_xmm(ops[0]) || !(is_xmm(ops[1]) || ops[1].kind == OperandKind::mem) || ops[2].kind != OperandKind::imm) {
+                fail("bad operands for `pshufd`");
+            }
+            plain_sse(0x66, 0x70, ops[0].reg, ops[1]);
+            emit_imm(ops[2], 1);
+            return true;
+        }
+        if (mnemonic == "psrlq" || mnemonic == "psllq") {
+            expect(ops, 2, mnemonic);
+            if (!is_xmm(ops[0]) || ops[1].kind != OperandKind::imm) {
+                fail("bad operands for `" + mnemonic + "`");
+            }
+            plain_sse(0x66, 0x73, mnemonic == "psrlq" ? 2 : 6, ops[0]);
+            emit_imm(ops[1], 1);
+            return true;
+        }
+        if (mnemonic == "movq" && ops.size() == 2 && (is_xmm(ops[0]) || is_xmm(ops[1]))) {
+            if (is_xmm(ops[0]) && !is_xmm(ops[1]) && (ops[1].kind == OperandKind::mem || ops[1].size == 64)) {
+                plain_sse(0x66, 0x6E, ops[0].reg, ops[1], 64);
+            } else if (is_xmm(ops[1]) && !is_xmm(ops[0]) && (ops[0].kind == OperandKind::mem || ops[0].size == 64)) {
+                plain_sse(0x66, 0x7E, ops[1].reg, ops[0], 64);
+            } else {
+                fail("bad operands for `movq`");
+            }
+            return true;
+        }
+        for (const Operand& op : ops) {
+            if (is_xmm(op)) {
+                fail("`" + mnemonic + "` does not take xmm registers");
+            }
+        }
+        return false;
+    }
+
+    inline void assemble_instruction(const std::string& mnemonic, const std::vector<Operand>& ops)
+    {
+        static const std::map<std::string, int> alu = {
+            { "add", 0 }, { "or", 1 }, { "adc", 2 }, { "sbb", 3 }, { "and", 4 }, { "sub", 5 }, { "xor", 6 }, { "cmp", 7 },
+        };
+        static const std::map<std::string, int> unary = {
+            { "not", 2 }, { "neg", 3 }, { "mul", 4 }, { "div", 6 }, { "idiv", 7 },
+        };
+        static const std::map<std::string, int> shifts = {
+            { "rol", 0 }, { "ror", 1 }, { "shl", 4 }, { "sal", 4 }, { "shr", 5 }, { "sar", 7 },
+        };
+        static const std::map<std::string, std::vector<uint8_t>> plain = {
+            { "ret", { 0xC3 } }, { "syscall", { 0x0F, 0x05 } }, { "cqo", { 0x48, 0x99 } }, { "cdq", { 0x99 } },
+            { "nop", { 0x90 } }, { "leave", { 0xC9 } }, { "ud2", { 0x0F, 0x0B } }, { "int3", { 0xCC } },
+            { "pause", { 0xF3, 0x90 } }, { "hlt", { 0xF4 } }, { "stosq", { 0x48, 0xAB } },
+        };
+
+        if (auto it = plain.find(mnemonic); it != plain.end()) {
+            expect(ops, 0, mnemonic);
+            for (uint8_t byte : it->second) {
+                emit(byte);
+            }
+            return;
+        }
+
+        if (assemble_sse(mnemonic, ops)) {
+            return;
+        }
+
+        if (auto it = alu.find(mnemonic); it != alu.end()) {
+            expect(ops, 2, mnemonic);
+            const int n = it->second;
+            const Operand& dst = ops[0];
+            const Operand& src = ops[1];
+            const int size = operand_size(ops);
+            const uint8_t byte_op = size == 8 ? 0 : 1;
+            if (src.kind == OperandKind::imm) {
+                if (dst.kind == OperandKind::imm) {
+                    fail("bad destination");
+                }
+                if (size == 8) {
+                    emit_rm({ 0x80 }, size, n, dst);
+                    emit_imm(src, 1);
+                } else if (src.symbol.empty() && fits8(src.imm)) {
+                    emit_rm({ 0x83 }, size, n, dst);
+                    emit_imm(src, 1);
+                } else {
+                    emit_rm({ 0x81 }, size, n, dst);
+                    emit_imm(src, size == 16 ? 2 : 4, size);
+                }
+            } else if (src.kind == OperandKind::reg) {
+                emit_rm({ static_cast<uint8_t>(n * 8 + byte_op) }, size, src.reg, dst, size == 8);
+            } else if (dst.kind == OperandKind::reg) {
+                emit_rm({ static_cast<uint8_t>(n * 8 + 2 + byte_op) }, size, dst.reg, src, size == 8);
+            } else {
+                fail("`" + mnemonic + "` cannot take two memory operands");
+            }
+            return;
+        }
+
+        if (auto it = unary.find(mnemonic); it != unary.end()) {
+            expect(ops, 1, mnemonic);
+            const int size = operand_size(ops);
+            emit_rm({ static_cast<uint8_t>(size == 8 ? 0xF6 : 0xF7) }, size, it->second, ops[0]);
+            return;
+        }
+
+        if (auto it = shifts.find(mnemonic); it != shifts.end()) {
+            expect(ops, 2, mnemonic);
+            const int size = operand_size({ ops[0] });
+            const bool byte = size == 8;
+            if (ops[1].kind == OperandKind::reg && ops[1].reg == 1 && ops[1].size == 8) {
+                emit_rm({ static_cast<uint8_t>(byte ? 0xD2 : 0xD3) }, size, it->second, ops[0]);
+            } else if (ops[1].kind == OperandKind::imm && ops[1].imm == 1) {
+                emit_rm({ static_cast<uint8_t>(byte ? 0xD0 : 0xD1) }, size, it->second, ops[0]);
+            } else if (ops[1].kind == OperandKind::imm) {
+                emit_rm({ static_cast<uint8_t>(byte ? 0xC0 : 0xC1) }, size, it->second, ops[0]);
+                emit_imm(ops[1], 1);
+            } else {
+                fail("bad shift count");
+            }
+            return;
+        }
+
+        if (mnemonic == "mov") {
+            expect(ops, 2, mnemonic);
+            const Operand& dst = ops[0];
+            const Operand& src = ops[1];
+            const int size = operand_size(ops);
+            if (src.kind == OperandKind::imm) {
+                if (dst.kind == OperandKind::reg && size == 64) {
+                    if (src.symbol.empty() && src.imm >= 0 && src.imm <= 0xFFFFFFFF) {
+                        // Zero-extending 32-bit move, as nasm picks it.
+                        if (dst.reg & 8) {
+                            emit(0x41);
+                        }
+                        emit(static_cast<uint8_t>(0xB8 + (dst.reg & 7)));
+                        emit_imm(src, 4);
+                    } else if (src.symbol.empty() && fits32(src.imm)) {
+                        emit_rm({ 0xC7 }, 64, 0, dst);
+                        emit_imm(src, 4, 64);
+                    } else {
+                        emit(static_cast<uint8_t>(0x48 | ((dst.reg & 8) ? 1 : 0)));
+                        emit(static_cast<uint8_t>(0xB8 + (dst.reg & 7)));
+                        emit_imm(src, 8);
+                    }
+                    return;
+                }
+                if (dst.kind == OperandKind::reg && size != 8) {
+                    if (size == 16) {
+                        emit(0x66);
+                    }
+                    if (dst.reg & 8) {
+                        emit(0x41);
+                    }
+                    emit(static_cast<uint8_t>(0xB8 + (dst.reg & 7)));
+                    emit_imm(src, size / 8);
+                    return;
+                }
+                if (dst.kind == OperandKind::imm) {
+                    fail("bad destination");
+                }
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0xC6 : 0xC7) }, size, 0, dst);
+                emit_imm(src, size == 8 ? 1 : size == 16 ? 2 : 4, size);
+                return;
+            }
+            if (src.kind == OperandKind::reg) {
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0x88 : 0x89) }, size, src.reg, dst, size == 8);
+                return;
+            }
+            if (dst.kind == OperandKind::reg) {
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0x8A : 0x8B) }, size, dst.reg, src, size == 8);
+                return;
+            }
+            fail("`mov` cannot take two memory operands");
+        }
+
+        if (mnemonic == "movzx" || mnemonic == "movsx") {
+            expect(ops, 2, mnemonic);
+            if (ops[0].kind != OperandKind::reg || ops[1].kind == OperandKind::imm) {
+                fail("bad operands for `" + mnemonic + "`");
+            }
+            const int src_size = ops[1].size == 0 ? 8 : ops[1].size;
+            uint8_t op = mnemonic == "movzx" ? 0xB6 : 0xBE;
+            if (src_size == 16) {
+                op++;
+            } else if (src_size != 8) {
+                fail("bad source size for `" + mnemonic + "`");
+            }
+            emit_rm({ 0x0F, op }, ops[0].size, ops[0].reg, ops[1]);
+            return;
+        }
+
+        if (mnemonic == "movsxd") {
+            expect(ops, 2, mnemonic);
+            if (ops[0].kind != OperandKind::reg || ops[0].size != 64) {
+                fail("bad operands for `movsxd`");
+            }
+            emit_rm({ 0x63 }, 64, ops[0].reg, ops[1]);
+            return;
+        }
+
+        if (mnemonic == "lea") {
+            expect(ops, 2, mnemonic);
+            if (ops[0].kind != OperandKind::reg || ops[1].kind != OperandKind::mem) {
+                fail("bad operands for `lea`");
+            }
+            emit_rm({ 0x8D }, ops[0].size, ops[0].reg, ops[1]);
+            return;
+        }
+
+        if (mnemonic == "test") {
+            expect(ops, 2, mnemonic);
+            const int size = operand_size(ops);
+            if (ops[1].kind == OperandKind::imm) {
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0xF6 : 0xF7) }, size, 0, ops[0]);
+                emit_imm(ops[1], size == 8 ? 1 : size == 16 ? 2 : 4, size);
+            } else if (ops[1].kind == OperandKind::reg) {
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0x84 : 0x85) }, size, ops[1].reg, ops[0], size == 8);
+            } else {
+                fail("bad operands for `test`");
+            }
+            return;
+        }
+
+        if (mnemonic == "imul") {
+            if (ops.size() == 1) {
+                const int size = operand_size(ops);
+                emit_rm({ static_cast<uint8_t>(size == 8 ? 0xF6 : 0xF7) }, size, 5, ops[0]);
+                return;
+            }
+            if (ops.empty() || ops.size() > 3 || ops[0].kind != OperandKind::reg) {
+                fail("bad operands for `imul`");
+            }
+            const int size = ops[0].size;
+            if (ops.size() == 2 && ops[1].kind != OperandKind::imm) {
+                emit_rm({ 0x0F, 0xAF }, size, ops[0].reg, ops[1]);
+                return;
+            }
+            const Operand& src = ops.size() == 3 ? ops[1] : ops[0];
+            const Operand& imm = ops.back();
+            if (imm.kind != OperandKind::imm) {
+                fail("bad operands for `imul`");
+            }
+            if (imm.symbol.empty() && fits8(imm.imm)) {
+                emit_rm({ 0x6B }, size, ops[0].reg, src);
+                emit_imm(imm, 1);
+            } else {
+                emit_rm({ 0x69 }, size, ops[0].reg, src);
+                emit_imm(imm, 4, size);
+            }
+            return;
+        }
+
+        if (mnemonic == "xadd") {
+            expect(ops, 2, mnemonic);
+            if (ops[1].kind != OperandKind::reg || ops[0].kind == OperandKind::imm) {
+                fail("bad operands for `xadd`");
+            }
+            const int size = operand_size(ops);
+            emit_rm({ 0x0F, static_cast<uint8_t>(size == 8 ? 0xC0 : 0xC1) }, size, ops[1].reg, ops[0], size == 8);
+            return;
+        }
+
+        if (mnemonic == "inc" || mnemonic == "dec") {
+            expect(ops, 1, mnemonic);
+            const int size = operand_size(ops);
+            emit_rm({ static_cast<uint8_t>(size == 8 ? 0xFE : 0xFF) }, size, mnemonic == "inc" ? 0 : 1, ops[0]);
+            return;
+        }
+
+        if (mnemonic == "push" || mnemonic == "pop") {
+            expect(ops, 1, mnemonic);
+            const bool push = mnemonic == "push";
+            const Operand& op = ops[0];
+            if (op.kind == OperandKind::reg) {
+                if (op.size != 64) {
+                    fail("`" + mnemonic + "` needs a 64-bit register");
+                }
+                if (op.reg & 8) {
+                    emit(0x41);
+                }
+                emit(static_cast<uint8_t>((push ? 0x50 : 0x58) + (op.reg & 7)));
+            } else if (op.kind == OperandKind::mem) {
+                emit_rm({ static_cast<uint8_t>(push ? 0xFF : 0x8F) }, 32, push ? 6 : 0, op);
+            } else if (push) {
+                if (op.symbol.empty() && fits8(op.imm)) {
+                    emit(0x6A);
+                    emit_imm(op, 1);
+                } else {
+                    emit(0x68);
+                    emit_imm(op, 4, 64);
+                }
+            } else {
+                fail("cannot pop into an immediate");
+            }
+            return;
+        }
+
+        if (mnemonic == "jmp" || mnemonic == "call") {
+            expect(ops, 1, mnemonic);
+            const bool call = mnemonic == "call";
+            const Operand& op = ops[0];
+            if (op.kind == OperandKind::imm) {
+                if (op.symbol.empty()) {
+                    fail("`" + mnemonic + "` to an absolute address");
+                }
+                emit(static_cast<uint8_t>(call ? 0xE8 : 0xE9));
+                emit_symbol_field(op.symbol, op.imm, R_X86_64_PC32, 4);
+            } else {
+                if (op.kind == OperandKind::reg && op.size != 64) {
+                    fail("`" + mnemonic + "` needs a 64-bit register");
+                }
+                emit_rm({ 0xFF }, 32, call ? 2 : 4, op);
+            }
+            return;
+        }
+
+        if (mnemonic.size() > 1 && mnemonic[0] == 'j') {
+            if (auto cc = condition_code(mnemonic.substr(1))) {
+                expect(ops, 1, mnemonic);
+                if (ops[0].kind != OperandKind::imm || ops[0].symbol.empty()) {
+                    fail("`" + mnemonic + "` needs a label");
+                }
+                emit({ 0x0F, static_cast<uint8_t>(0x80 + cc.value()) });
+                emit_symbol_field(ops[0].symbol, ops[0].imm, R_X86_64_PC32, 4);
+                return;
+            }
+        }
+
+        if (mnemonic.starts_with("set")) {
+            if (auto cc = condition_code(mnemonic.substr(3))) {
+                expect(ops, 1, mnemonic);
+                if (ops[0].kind == OperandKind::imm || operand_size(ops, 8) != 8) {
+                    fail("`" + mnemonic + "` needs a byte operand");
+                }
+                emit_rm({ 0x0F, static_cast<uint8_t>(0x90 + cc.value()) }, 8, 0, ops[0]);
+                return;
+            }
+        }
+
+        if (mnemonic.starts_with("cmov")) {
+            if (auto cc = condition_code(mnemonic.substr(4))) {
+                expect(ops, 2, mnemonic);
+                if (ops[0].kind != OperandKind::reg || ops[1].kind == OperandKind::imm) {
+                    fail("bad operands for `" + mnemonic + "`");
+                }
+                emit_rm({ 0x0F, static_cast<uint8_t>(0x40 + cc.value()) }, operand_size(ops), ops[0].reg, ops[1]);
+                return;
+            }
+        }
+
+        fail("unsupported instruction `" + mnemonic + "`");
+    }
+
+    inline void switch_section(const std::string& name)
+    {
+        for (size_t i = 0; i < m_sections.size(); i++) {
+            if (m_sections[i].name == name) {
+                m_current = i;
+                return;
+            }
+        }
+        ObjectSection section;
+        section.name = name;
+        if (name == ".text" || name.starts_with(".text.")) {
+            section.flags = SHF_ALLOC | SHF_EXECINSTR;
+            section.align = 16;
+        } else if (name == ".rodata" || name.starts_with(".rodata.")) {
+            section.flags = SHF_ALLOC;
+            section.align = 8;
+        } else if (name == ".data" || name.starts_with(".data.")) {
+            section.flags = SHF_ALLOC | SHF_WRITE;
+            section.align = 8;
+        } else if (name == ".bss" || name.starts_with(".bss.")) {
+            section.flags = SHF_ALLOC | SHF_WRITE;
+            section.align = 8;
+            section.nobits = true;
+        } else {
+            fail("unknown section `" + name + "`");
+        }
+        m_current = m_sections.size();
+        m_sections.push_back(std::move(section));
+    }
+
+    inline void define_label(const std::string& raw)
+    {
+        if (raw[0] != '.') {
+            m_last_global = raw;
+        }
+        const std::string name = qualify(raw);
+        if (parse_reg(name)) {
+            fail("`" + name + "` is a register name");
+        }
+        if (!m_labels.emplace(name, Label { m_current, here() }).second) {
+            fail("label `" + name + "` redefined");
+        }
+        m_label_order.push_back(name);
+    }
+
+    static inline std::string unescape(const std::string& body, char quote)
+    {
+        if (quote != '`') {
+            return body;
+        }
+        std::string out;
+        for (size_t i = 0; i < body.size(); i++) {
+            if (body[i] != '\\' || i + 1 == body.size()) {
+                out.push_back(body[i]);
+                continue;
+            }
+            switch (body[++i]) {
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case '0':
+                out.push_back('\0');
+                break;
+            default:
+                out.push_back(body[i]);
+            }
+        }
+        return out;
+    }
+
+    inline void assemble_data(int width, const std::vector<std::string>& items)
+    {
+        for (const std::string& item : items) {
+            if (item.size() >= 2 && (item.front() == '\'' || item.front() == '"' || item.front() == '`') && item.back() == item.front()) {
+                const std::string bytes = unescape(item.substr(1, item.size() - 2), item.front());
+                for (char c : bytes) {
+                    emit_le(static_cast<unsigned char>(c), width);
+                }
+                // Strings in dw/dd/dq are padded to a whole element.
+                continue;
+            }
+            auto [symbol, value] = parse_value(item);
+            if (!symbol.empty()) {
+                if (width != 4 && width != 8) {
+                    fail("symbol in a data directive narrower than 32 bits");
+                }
+                emit_symbol_field(symbol, value, width == 8 ? R_X86_64_64 : R_X86_64_32, width);
+            } else {
+                emit_le(static_cast<uint64_t>(value), width);
+            }
+        }
+        end_instruction();
+    }
+
+    inline void align_to(uint64_t alignment)
+    {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+            fail("alignment must be a power of two");
+        }
+        section().align = std::max(section().align, alignment);
+        if (section().nobits) {
+            section().size = (section().size + alignment - 1) / alignment * alignment;
+            return;
+        }
+        size_t padding = (alignment - here() % alignment) % alignment;
+        const bool code = section().flags & SHF_EXECINSTR;
+        while (padding > 0) {
+            if (!code) {
+                emit(0);
+                padding--;
+                continue;
+            }
+            const size_t chunk = std::min<size_t>(padding, nops().size());
+            for (uint8_t byte : nops()[chunk - 1]) {
+                emit(byte);
+            }
+            padding -= chunk;
+        }
+    }
+
+    // `%line N+M file`: the code that follows came from line N of `file`.
+    inline void source_line(const std::string& rest)
+    {
+        const size_t space = rest.find_first_of(" \t");
+        const std::string number = rest.substr(0, std::min(rest.find('+'), space));
+        auto line = parse_number(number);
+        if (!line || line.value() < 0 || line.value() > UINT32_MAX) {
+            fail("bad line number `" + number + "`");
+        }
+        if (space != std::string::npos) {
+            m_source_file = trim(rest.substr(space));
+        }
+        if (!(section().flags & SHF_EXECINSTR)) {
+            return;
+        }
+        if (!m_source_lines.empty() && m_source_lines.back().section == m_current && m_source_lines.back().offset == here()) {
+            m_source_lines.pop_back();
+        }
+        m_source_lines.push_back({ m_current, here(), static_cast<uint32_t>(line.value()) });
+    }
+
+    inline void assemble_line(const std::string& raw)
+    {
+        if (trim(raw).starts_with("%line ")) {
+            source_line(trim(trim(raw).substr(6)));
+            return;
+        }
+        // Strip the comment, respecting quotes.
+        std::string line;
+        char quote = 0;
+        for (char c : raw) {
+            if (quote) {
+                if (c == quote) {
+                    quote = 0;
+                }
+            } else if (c == '\'' || c == '"' || c == '`') {
+                quote = c;
+            } else if (c == ';') {
+                break;
+            }
+            line.push_back(c);
+        }
+        line = trim(line);
+        if (line.empty()) {
+            return;
+        }
+
+        // Optional leading `label:`.
+        const size_t colon = line.find(':');
+        if (colon != std::string::npos && is_ident(trim(line.substr(0, colon)))) {
+            define_label(trim(line.substr(0, colon)));
+            line = trim(line.substr(colon + 1));
+            if (line.empty()) {
+                return;
+            }
+        }
+
+        const size_t space = line.find_first_of(" \t");
+        const std::string word = lower(line.substr(0, space));
+        const std::string rest = space == std::string::npos ? std::string {} : trim(line.substr(space));
+
+        if (word == "section" || word == "segment") {
+            switch_section(trim(rest.substr(0, rest.find_first_of(" \t"))));
+        } else if (word == "global") {
+            for (const std::string& name : split_operands(rest)) {
+                m_globals.insert(trim(name.substr(0, name.find(':'))));
+            }
+        } else if (word == "extern") {
+            for (const std::string& name : split_operands(rest)) {
+                m_externs.insert(name);
+            }
+        } else if (word == "default") {
+            if (lower(rest) == "rel") {
+                m_default_rel = true;
+            } else if (lower(rest) == "abs") {
+                m_default_rel = false;
+            } else {
+                fail("unknown default `" + rest + "`");
+            }
+        } else if (word == "align") {
+            auto items = split_operands(rest);
+            auto alignment = items.empty() ? std::nullopt : parse_number(items[0]);
+            if (!alignment) {
+                fail("bad alignment `" + rest + "`");
+            }
+            align_to(static_cast<uint64_t>(alignment.value()));
+        } else if (word == "db" || word == "dw" || word == "dd" || word == "dq") {
+            const int width = word == "db" ? 1 : word == "dw" ? 2 : word == "dd" ? 4 : 8;
+            assemble_data(width, split_operands(rest));
+        } else if (word == "resb" || word == "resw" || word == "resd" || word == "resq") {
+            const int width = word == "resb" ? 1 : word == "resw" ? 2 : word == "resd" ? 4 : 8;
+            auto count = parse_number(rest);
+            if (!count || count.value() < 0) {
+                fail("bad reservation `" + rest + "`");
+            }
+            if (section().nobits) {
+                section().size += static_cast<uint64_t>(count.value()) * width;
+            } else {
+                for (int64_t i = 0; i < count.value() * width; i++) {
+                    emit(0);
+                }
+            }
+        } else if (word == "rep" || word == "lock") {
+            // A prefix, then the instruction it applies to.
+            const size_t split = rest.find_first_of(" \t");
+            const std::string mnemonic = lower(rest.substr(0, split));
+            const bool fits = word == "rep" ? mnemonic == "stosq"
+                                            : mnemonic == "add" || mnemonic == "sub" || mnemonic == "inc" || mnemonic == "dec" || mnemonic == "xadd";
+            if (!fits) {
+                fail("bad instruction after `" + word + "`");
+            }
+            std::vector<Operand> ops;
+            for (const std::string& text : split_operands(split == std::string::npos ? std::string {} : trim(rest.substr(split)))) {
+                ops.push_back(parse_operand(text));
+            }
+            if (word == "lock" && (ops.empty() || ops[0].kind != OperandKind::mem)) {
+                fail("`lock` needs a memory destination");
+            }
+            emit(word == "rep" ? 0xF3 : 0xF0);
+            assemble_instruction(mnemonic, ops);
+            end_instruction();
+        } else {
+            std::vector<Operand> ops;
+            for (const std::string& text : split_operands(rest)) {
+                ops.push_back(parse_operand(text));
+            }
+            assemble_instruction(word, ops);
+            end_instruction();
+        }
+    }
+
+    inline ObjectFile finish()
+    {
+        ObjectFile obj;
+        obj.sections = m_sections;
+        for (ObjectSection& section : obj.sections) {
+            if (!section.nobits) {
+                section.size = section.data.size();
+            }
+        }
+
+        std::map<std::string, size_t> symbol_index;
+        obj.symbols.push_back({}); // index 0 is the null symbol, as in ELF
+        for (const std::string& name : m_label_order) {
+            const Label& label = m_labels.at(name);
+            symbol_index[name] = obj.symbols.size();
+            obj.symbols.push_back({
+                .name = name,
+                .section = static_cast<int>(label.section),
+                .value = label.offset,
+                .global = m_globals.count(name) > 0,
+            });
+        }
+        for (const std::string& name : m_globals) {
+            if (!m_labels.count(name)) {
+                m_line = 0;
+                fail("global `" + name + "` is never defined");
+            }
+        }
+
+        // Function symbols get a size reaching to the next global, so the
+        // linked image can map addresses back to functions.
+        for (size_t i = 1; i < obj.symbols.size(); i++) {
+            ObjectSymbol& sym = obj.symbols[i];
+            if (!sym.global || !(obj.sections[sym.section].flags & SHF_EXECINSTR)) {
+                continue;
+            }
+            uint64_t end = obj.sections[sym.section].size;
+            for (const ObjectSymbol& other : obj.symbols) {
+                if (other.global && other.section == sym.section && other.value > sym.value) {
+                    end = std::min(end, other.value);
+                }
+            }
+            sym.size = end - sym.value;
+        }
+
+        for (const Fixup& fixup : m_fixups) {
+            auto label = m_labels.find(fixup.symbol);
+            const int64_t pc_adjust = static_cast<int64_t>(fixup.insn_end - fixup.field);
+            if (label != m_labels.end() && label->second.section == fixup.section && fixup.type == R_X86_64_PC32) {
+                const int64_t value = static_cast<int64_t>(label->second.offset) + fixup.addend
+                    - static_cast<int64_t>(fixup.insn_end);
+                std::vector<uint8_t>& data = obj.sections[fixup.section].data;
+                for (int i = 0; i < 4; i++) {
+                    data[fixup.field + i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+                }
+                continue;
+            }
+            size_t index;
+            if (auto it = symbol_index.find(fixup.symbol); it != symbol_index.end()) {
+                index = it->second;
+            } else {
+                if (!m_implicit_externs && !m_externs.count(fixup.symbol)) {
+                    m_line = 0;
+                    fail("symbol `" + fixup.symbol + "` is undefined");
+                }
+                index = obj.symbols.size();
+                symbol_index[fixup.symbol] = index;
+                obj.symbols.push_back({ .name = fixup.symbol, .global = true });
+            }
+            const int64_t addend = fixup.type == R_X86_64_PC32 ? fixup.addend - pc_adjust : fixup.addend;
+            obj.relocs.push_back({ fixup.section, fixup.field, fixup.type, index, addend });
+        }
+        obj.lines = m_source_lines;
+        obj.line_file = m_source_file;
+        return obj;
+    }
+
+    const std::string m_src;
+    const bool m_implicit_externs;
+    size_t m_line = 0;
+    std::vector<ObjectSection> m_sections;
+    size_t m_current = 0;
+    std::map<std::string, Label> m_labels;
+    std::vector<std::string> m_label_order;
+    std::set<std::string> m_globals;
+    std::set<std::string> m_externs;
+    std::string m_last_global;
+    bool m_default_rel = false;
+    std::vector<Fixup> m_pending;
+    std::vector<Fixup> m_fixups;
+    std::vector<ObjectLine> m_source_lines;
+    std::string m_source_file;
+};
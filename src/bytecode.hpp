@@ -0,0 +1,847 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+#include "./frame.hpp"
+#include "./parallel.hpp"
+#include "./parser.hpp"
+
+// Compact register-based bytecode for NodeProg. Every function gets a fixed
+// window of 64-bit registers: parameters first, then locals, then
+// expression temporaries. Calls place arguments at the top of the caller's
+// window and the callee's window starts there, so arguments are never
+// copied. An array of N elements takes N + 1 registers: its length, then
+// the elements. An array from `alloc` lives on the interpreter's heap
+// instead, and its register holds a handle to it.
+
+enum class Op : uint8_t {
+    loadi, // a = sext(bc)
+    loadk, // a = constants[bc]
+    mov,   // a = b
+    add,   // a = b op c, for add..gt
+    sub,
+    mul,
+    div,
+    eq,
+    ne,
+    lt,
+    gt,
+    addi, // a = b op sext(c), for addi..gti
+    subi,
+    muli,
+    divi,
+    eqi,
+    nei,
+    lti,
+    gti,
+    jmp,  // pc = bc
+    jz,   // if a == 0: pc = bc
+    call, // a = functions[b](a, a + 1, ...); the callee window starts at a
+    ret,  // return a
+    exit, // exit(a)
+    print, // print a, then a newline if b
+    prints, // print strings[bc]
+    array,  // a = bc, a + 1 .. a + bc = 0
+    loadx,  // a = (b + 1)[c], c checked against b
+    storex, // (a + 1)[b] = c, b checked against a
+    alloc,  // a = a new heap array of b elements
+    loadh,  // a = b[c] for the heap array b, c checked
+    storeh, // a[b] = c for the heap array a, b checked
+    lenh,   // a = length of the heap array b
+    mark,   // a = the heap top
+    release, // free heap arrays allocated since the mark a
+    count,
+};
+
+inline const char* op_name(Op op)
+{
+    static const char* const names[] = {
+        "loadi", "loadk", "mov", "add", "sub", "mul", "div", "eq", "ne", "lt", "gt",
+        "addi", "subi", "muli", "divi", "eqi", "nei", "lti", "gti",
+        "jmp", "jz", "call", "ret", "exit", "print", "prints",
+        "array", "loadx", "storex", "alloc", "loadh", "storeh", "lenh", "mark", "release",
+    };
+    return names[static_cast<size_t>(op)];
+}
+
+struct Instr {
+    Op op;
+    uint8_t unused = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    inline uint32_t bc() const
+    {
+        return static_cast<uint32_t>(b) | static_cast<uint32_t>(c) << 16;
+    }
+};
+static_assert(sizeof(Instr) == 8);
+
+struct BytecodeFunction {
+    std::string name;
+    uint16_t params = 0;
+    uint32_t frame_size = 0;
+    std::vector<Instr> code {};
+    std::vector<int64_t> constants {};
+};
+
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> functions; // functions[0] is the top-level code
+    std::vector<std::string> strings;
+};
+
+class BytecodeCompiler {
+public:
+    inline explicit BytecodeCompiler(const NodeProg& prog)
+        : m_prog(prog)
+    {
+    }
+
+    // Returns nothing, with error() set, for programs the bytecode cannot
+    // express (string literals, unknown names, wrong argument counts).
+    inline std::optional<BytecodeProgram> compile()
+    {
+        BytecodeProgram program;
+        program.functions.push_back({ .name = "_start" });
+        std::vector<const NodeFunctionDecl*> decls;
+        for (const NodeStatement* stmt : m_prog.statements) {
+            if (auto decl = std::get_if<NodeFunctionDecl*>(&stmt->var)) {
+                const std::string& name = (*decl)->ident.value.value();
+                if (!m_function_index.emplace(name, program.functions.size()).second) {
+                    return fail("Function redefined: " + name);
+                }
+                program.functions.push_back({ .name = name, .params = static_cast<uint16_t>((*decl)->params.size()) });
+                decls.push_back(*decl);
+            }
+        }
+        m_program = &program;
+
+        begin_function(program.functions[0], true);
+        m_next_reg = 1; // r0 tracks the last value, the implicit exit code
+        m_locals_top = 1;
+        for (const NodeStatement* stmt : m_prog.statements) {
+            if (!compile_statement(stmt)) {
+                return {};
+            }
+        }
+        emit({ .op = Op::exit, .a = 0 });
+        if (!end_function()) {
+            return {};
+        }
+
+        for (size_t i = 0; i < decls.size(); i++) {
+            BytecodeFunction& fn = program.functions[i + 1];
+            begin_function(fn, false);
+            for (const Token& param : decls[i]->params) {
+                if (!declare(param.value.value())) {
+                    return {};
+                }
+            }
+            if (!compile_scope(decls[i]->body)) {
+                return {};
+            }
+            const uint16_t zero = alloc_temp();
+            emit({ .op = Op::loadi, .a = zero });
+            emit({ .op = Op::ret, .a = zero });
+            if (!end_function()) {
+                return {};
+            }
+        }
+        return program;
+    }
+
+    inline const std::string& error() const
+    {
+        return m_error;
+    }
+
+private:
+    struct Var {
+        std::string name;
+        uint16_t reg;
+        uint32_t length = 0; // elements, for an array
+        bool heap = false;
+
+        inline bool is_array() const
+        {
+            return length > 0 || heap;
+        }
+    };
+
+    static constexpr uint32_t max_registers = std::numeric_limits<uint16_t>::max();
+    static constexpr uint32_t max_depth = 2000;
+
+    inline std::nullopt_t fail(const std::string& message)
+    {
+        if (m_error.empty()) {
+            m_error = message;
+        }
+        return std::nullopt;
+    }
+
+    inline void begin_function(BytecodeFunction& fn, bool top_level)
+    {
+        m_fn = &fn;
+        m_top_level = top_level;
+        m_vars.clear();
+        m_scopes.clear();
+        m_next_reg = 0;
+        m_locals_top = 0;
+        m_max_reg = 0;
+    }
+
+    inline bool end_function()
+    {
+        if (m_max_reg > max_registers) {
+            fail("Function needs too many registers: " + m_fn->name);
+            return false;
+        }
+        m_fn->frame_size = std::max<uint32_t>(m_max_reg, 1);
+        return true;
+    }
+
+    inline void emit(Instr instr)
+    {
+        m_fn->code.push_back(instr);
+    }
+
+    inline size_t here() const
+    {
+        return m_fn->code.size();
+    }
+
+    inline void patch_target(size_t at, size_t target)
+    {
+        m_fn->code[at].b = static_cast<uint16_t>(target);
+        m_fn->code[at].c = static_cast<uint16_t>(target >> 16);
+    }
+
+    inline uint16_t alloc_temp()
+    {
+        const uint32_t reg = m_next_reg++;
+        m_max_reg = std::max(m_max_reg, m_next_reg);
+        return static_cast<uint16_t>(std::min(reg, max_registers));
+    }
+
+    inline bool declare(const std::string& name)
+    {
+        if (find_var(name) != nullptr) {
+            fail("Identifier already used: " + name);
+            return false;
+        }
+        m_next_reg = m_locals_top;
+        m_vars.push_back({ name, alloc_temp() });
+        m_locals_top = m_next_reg;
+        return true;
+    }
+
+    // The register of a hidden variable; identifiers are never empty.
+    inline uint16_t declare_hidden()
+    {
+        m_next_reg = m_locals_top;
+        m_vars.push_back({ {}, alloc_temp() });
+        m_locals_top = m_next_reg;
+        return m_vars.back().reg;
+    }
+
+    // Takes the next length + 1 registers for an array.
+    inline bool declare_array(const std::string& name, uint64_t length)
+    {
+        if (find_var(name) != nullptr) {
+            fail("Identifier already used: " + name);
+            return false;
+        }
+        if (m_locals_top + length + 1 > max_registers) {
+            fail("Array too large for the bytecode: " + name);
+            return false;
+        }
+        m_vars.push_back({ name, static_cast<uint16_t>(m_locals_top), static_cast<uint32_t>(length) });
+        m_locals_top += static_cast<uint32_t>(length) + 1;
+        m_next_reg = m_locals_top;
+        m_max_reg = std::max(m_max_reg, m_next_reg);
+        return true;
+    }
+
+    inline const Var* find_var(const std::string& name) const
+    {
+        for (auto it = m_vars.rbegin(); it != m_vars.rend(); ++it) {
+            if (it->name == name) {
+                return &*it;
+            }
+        }
+        return nullptr;
+    }
+
+    // A scalar variable's register.
+    inline std::optional<uint16_t> find(const std::string& name) const
+    {
+        const Var* var = find_var(name);
+        if (var == nullptr || var->is_array()) {
+            return {};
+        }
+        return var->reg;
+    }
+
+    inline const Var* find_array(const std::string& name)
+    {
+        const Var* var = find_var(name);
+        if (var == nullptr || !var->is_array()) {
+            fail("Not an array: " + name);
+            return nullptr;
+        }
+        return var;
+    }
+
+    inline void begin_scope()
+    {
+        m_scopes.push_back(m_vars.size());
+    }
+
+    inline void end_scope()
+    {
+        m_vars.resize(m_scopes.back());
+        m_scopes.pop_back();
+        m_locals_top = m_vars.empty() ? (m_top_level ? 1 : 0) : m_vars.back().reg + 1u + m_vars.back().length;
+        m_next_reg = m_locals_top;
+    }
+
+    inline void track_last(uint16_t reg)
+    {
+        if (m_top_level && reg != 0) {
+            emit({ .op = Op::mov, .a = 0, .b = reg });
+        }
+    }
+
+    // After a statement with no value of its own, a print or an array
+    // declaration, the native code leaves 0 as well.
+    inline void track_none()
+    {
+        if (m_top_level) {
+            emit({ .op = Op::loadi, .a = 0 });
+        }
+    }
+
+    static inline std::optional<int64_t> literal(const NodeExpr* expr)
+    {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto lit = std::get_if<NodeTermIntLit*>(&(*term)->var)) {
+                return (*lit)->value;
+            }
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                return literal((*paren)->expr);
+            }
+        }
+        return {};
+    }
+
+    // Compiles `expr` and returns the register holding its value. That is
+    // the variable's own register for identifiers, a fresh temporary
+    // otherwise.
+    inline std::optional<uint16_t> compile_expr(const NodeExpr* expr)
+    {
+        while (auto paren = paren_inside(expr)) {
+            expr = paren;
+        }
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                const std::string& name = (*ident)->ident.value.value();
+                auto reg = find(name);
+                if (!reg.has_value()) {
+                    return fail("Undeclared identifier: " + name);
+                }
+                return reg;
+            }
+        }
+        const uint32_t mark = m_next_reg;
+        const uint16_t dst = alloc_temp();
+        if (!compile_expr_into(expr, dst)) {
+            return {};
+        }
+        m_next_reg = mark + 1;
+        return dst;
+    }
+
+    static inline const NodeExpr* paren_inside(const NodeExpr* expr)
+    {
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        auto paren = term ? std::get_if<NodeTermParen*>(&(*term)->var) : nullptr;
+        return paren ? (*paren)->expr : nullptr;
+    }
+
+    // The walk recurses, so expressions nested deeper than max_depth are
+    // left to native code.
+    inline bool compile_expr_into(const NodeExpr* expr, uint16_t dst)
+    {
+        if (m_depth == max_depth) {
+            fail("Expression nested too deeply for the bytecode");
+            return false;
+        }
+        m_depth++;
+        const bool compiled = emit_expr_into(expr, dst);
+        m_depth--;
+        return compiled;
+    }
+
+    inline bool emit_expr_into(const NodeExpr* expr, uint16_t dst)
+    {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            return compile_term_into(*term, dst);
+        }
+        const NodeBinExpression* bin = std::get<NodeBinExpression*>(expr->var);
+        if (auto and_ = std::get_if<NodeBinExpressionAnd*>(&bin->var)) {
+            return compile_logical((*and_)->lhs, (*and_)->rhs, true, dst);
+        }
+        if (auto or_ = std::get_if<NodeBinExpressionOr*>(&bin->var)) {
+            return compile_logical((*or_)->lhs, (*or_)->rhs, false, dst);
+        }
+        const auto [op, lhs, rhs] = std::visit([](auto* node) {
+            using T = std::decay_t<decltype(*node)>;
+            Op op = Op::add;
+            if constexpr (std::is_same_v<T, NodeBinExpressionSub>) {
+                op = Op::sub;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionMulti>) {
+                op = Op::mul;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionDiv>) {
+                op = Op::div;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionEquals>) {
+                op = Op::eq;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionNotEquals>) {
+                op = Op::ne;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionLess>) {
+                op = Op::lt;
+            } else if constexpr (std::is_same_v<T, NodeBinExpressionGreater>) {
+                op = Op::gt;
+            }
+            return std::tuple<Op, const NodeExpr*, const NodeExpr*> { op, node->lhs, node->rhs };
+        }, bin->var);
+
+        const uint32_t mark = m_next_reg;
+        auto imm = literal(rhs);
+        if (imm.has_value() && imm.value() >= INT16_MIN && imm.value() <= INT16_MAX) {
+            auto left = compile_expr(lhs);
+            if (!left.has_value()) {
+                return false;
+            }
+            const Op op_imm = static_cast<Op>(static_cast<uint8_t>(op) + (static_cast<uint8_t>(Op::addi) - static_cast<uint8_t>(Op::add)));
+            emit({ .op = op_imm, .a = dst, .b = left.value(), .c = static_cast<uint16_t>(static_cast<int16_t>(imm.value())) });
+        } else {
+            // The operands run in the native code's order, which shows when
+            // both call functions that print or exit. A variable is read by
+            // the operation itself, but a call cannot change it.
+            const bool lhs_first = evaluates_lhs_first(bin);
+            auto first = compile_expr(lhs_first ? lhs : rhs);
+            if (!first.has_value()) {
+                return false;
+            }
+            auto second = compile_expr(lhs_first ? rhs : lhs);
+            if (!second.has_value()) {
+                return false;
+            }
+            emit({ .op = op, .a = dst, .b = lhs_first ? first.value() : second.value(), .c = lhs_first ? second.value() : first.value() });
+        }
+        m_next_reg = std::max(mark, static_cast<uint32_t>(dst) + 1);
+        return true;
+    }
+
+    // `lhs && rhs` or `lhs || rhs`, 0 or 1, with rhs skipped when lhs
+    // decides it. The value is built in a temporary: `dst` may be a
+    // variable that rhs reads.
+    inline bool compile_logical(const NodeExpr* lhs, const NodeExpr* rhs, bool is_and, uint16_t dst)
+    {
+        const uint32_t mark = m_next_reg;
+        const uint16_t value = alloc_temp();
+        if (!compile_expr_into(lhs, value)) {
+            return false;
+        }
+        const size_t skip = here();
+        emit({ .op = Op::jz, .a = value });
+        std::optional<size_t> done;
+        if (!is_and) {
+            emit({ .op = Op::loadi, .a = value, .b = 1 });
+            done = here();
+            emit({ .op = Op::jmp });
+            patch_target(skip, here());
+        }
+        if (!compile_expr_into(rhs, value)) {
+            return false;
+        }
+        emit({ .op = Op::nei, .a = value, .b = value, .c = 0 });
+        patch_target(is_and ? skip : done.value(), here());
+        emit({ .op = Op::mov, .a = dst, .b = value });
+        m_next_reg = std::max(mark, static_cast<uint32_t>(dst) + 1);
+        return true;
+    }
+
+    inline bool compile_term_into(const NodeTerm* term, uint16_t dst)
+    {
+        if (auto lit = std::get_if<NodeTermIntLit*>(&term->var)) {
+            const int64_t value = (*lit)->value;
+            if (value >= INT32_MIN && value <= INT32_MAX) {
+                const uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(value));
+                emit({ .op = Op::loadi, .a = dst, .b = static_cast<uint16_t>(bits), .c = static_cast<uint16_t>(bits >> 16) });
+            } else {
+                const uint32_t index = static_cast<uint32_t>(m_fn->constants.size());
+                m_fn->constants.push_back(value);
+                emit({ .op = Op::loadk, .a = dst, .b = static_cast<uint16_t>(index), .c = static_cast<uint16_t>(index >> 16) });
+            }
+            return true;
+        }
+        if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+            const std::string& name = (*ident)->ident.value.value();
+            auto reg = find(name);
+            if (!reg.has_value()) {
+                fail("Undeclared identifier: " + name);
+                return false;
+            }
+            if (reg.value() != dst) {
+                emit({ .op = Op::mov, .a = dst, .b = reg.value() });
+            }
+            return true;
+        }
+        if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+            return compile_expr_into((*paren)->expr, dst);
+        }
+        if (auto term_not = std::get_if<NodeTermNot*>(&term->var)) {
+            const uint32_t mark = m_next_reg;
+            auto operand = compile_expr((*term_not)->expr);
+            if (!operand.has_value()) {
+                return false;
+            }
+            emit({ .op = Op::eqi, .a = dst, .b = operand.value(), .c = 0 });
+            m_next_reg = std::max(mark, static_cast<uint32_t>(dst) + 1);
+            return true;
+        }
+        if (auto index = std::get_if<NodeTermIndex*>(&term->var)) {
+            const Var* array = find_array((*index)->ident.value.value());
+            if (array == nullptr) {
+                return false;
+            }
+            const uint32_t mark = m_next_reg;
+            auto at = compile_expr((*index)->index);
+            if (!at.has_value()) {
+                return false;
+            }
+            emit({ .op = array->heap ? Op::loadh : Op::loadx, .a = dst, .b = array->reg, .c = at.value() });
+            m_next_reg = std::max(mark, static_cast<uint32_t>(dst) + 1);
+            return true;
+        }
+        if (auto length = std::get_if<NodeTermLength*>(&term->var)) {
+            const Var* array = find_array((*length)->ident.value.value());
+            if (array == nullptr) {
+                return false;
+            }
+            if (array->heap) {
+                emit({ .op = Op::lenh, .a = dst, .b = array->reg });
+                return true;
+            }
+            emit({ .op = Op::loadi, .a = dst, .b = static_cast<uint16_t>(array->length), .c = static_cast<uint16_t>(array->length >> 16) });
+            return true;
+        }
+        if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+            const std::string& name = (*call)->ident.value.value();
+            auto it = m_function_index.find(name);
+            if (it == m_function_index.end()) {
+                fail("Undefined function: " + name);
+                return false;
+            }
+            const BytecodeFunction& callee = m_program->functions[it->second];
+            if (callee.params != (*call)->args.size()) {
+                fail("Wrong number of arguments to " + name);
+                return false;
+            }
+            const uint32_t mark = m_next_reg;
+            // Call straight into `dst` when it is the newest temporary;
+            // otherwise the arguments would clobber live registers.
+            const bool in_place = dst >= m_locals_top && dst + 1u == m_next_reg;
+            const uint16_t base = in_place ? dst : alloc_temp();
+            for (size_t i = 1; i < (*call)->args.size(); i++) {
+                alloc_temp();
+            }
+            for (size_t i = 0; i < (*call)->args.size(); i++) {
+                if (!compile_expr_into((*call)->args[i], static_cast<uint16_t>(base + i))) {
+                    return false;
+                }
+            }
+            emit({ .op = Op::call, .a = base, .b = static_cast<uint16_t>(it->second) });
+            if (base != dst) {
+                emit({ .op = Op::mov, .a = dst, .b = base });
+            }
+            m_next_reg = std::max(mark, static_cast<uint32_t>(dst) + 1);
+            return true;
+        }
+        fail("String literals are not supported by the bytecode backend");
+        return false;
+    }
+
+    // A scope that allocates frees its arrays on the way out; the
+    // interpreter frees what a function allocated when it returns.
+    inline bool compile_scope(const NodeScope* scope)
+    {
+        begin_scope();
+        std::optional<uint16_t> mark;
+        if (allocates(scope)) {
+            mark = declare_hidden();
+            emit({ .op = Op::mark, .a = mark.value() });
+        }
+        for (const NodeStatement* stmt : scope->statements) {
+            if (!compile_statement(stmt)) {
+                return false;
+            }
+        }
+        if (mark.has_value()) {
+            emit({ .op = Op::release, .a = mark.value() });
+        }
+        end_scope();
+        return true;
+    }
+
+    static inline bool allocates(const NodeScope* scope)
+    {
+        return std::any_of(scope->statements.begin(), scope->statements.end(), [](const NodeStatement* stmt) {
+            auto array = std::get_if<NodeStatementArray*>(&stmt->var);
+            return array != nullptr && (*array)->size != nullptr;
+        });
+    }
+
+    inline bool compile_if_predicate(const NodeIfPred* pred, std::vector<size_t>& end_jumps)
+    {
+        if (auto else_ = std::get_if<NodeIfPredicateElse*>(&pred->var)) {
+            return compile_scope((*else_)->scope);
+        }
+        const NodeIfPredicateElif* elif = std::get<NodeIfPredicateElif*>(pred->var);
+        return compile_conditional(elif->expr, elif->scope, elif->pred, end_jumps);
+    }
+
+    inline bool compile_conditional(const NodeExpr* cond_expr, const NodeScope* scope,
+        const std::optional<NodeIfPred*>& pred, std::vector<size_t>& end_jumps)
+    {
+        auto cond = compile_expr(cond_expr);
+        if (!cond.has_value()) {
+            return false;
+        }
+        track_last(cond.value());
+        const size_t skip = here();
+        emit({ .op = Op::jz, .a = cond.value() });
+        m_next_reg = m_locals_top;
+        if (!compile_scope(scope)) {
+            return false;
+        }
+        if (pred.has_value()) {
+            end_jumps.push_back(here());
+            emit({ .op = Op::jmp });
+            patch_target(skip, here());
+            return compile_if_predicate(pred.value(), end_jumps);
+        }
+        patch_target(skip, here());
+        return true;
+    }
+
+    inline bool compile_statement(const NodeStatement* stmt)
+    {
+        const bool ok = std::visit([this](auto* node) { return compile(node); }, stmt->var);
+        m_next_reg = m_locals_top;
+        return ok;
+    }
+
+    inline bool compile(const NodeStatementExit* stmt)
+    {
+        auto value = compile_expr(stmt->expr);
+        if (!value.has_value()) {
+            return false;
+        }
+        emit({ .op = Op::exit, .a = value.value() });
+        return true;
+    }
+
+    inline bool compile(const NodeStatementInt* stmt)
+    {
+        const uint32_t reg = m_locals_top;
+        m_next_reg = reg + 1;
+        m_max_reg = std::max(m_max_reg, m_next_reg);
+        if (!compile_expr_into(stmt->expr, static_cast<uint16_t>(std::min(reg, max_registers)))) {
+            return false;
+        }
+        if (!declare(stmt->ident.value.value())) {
+            return false;
+        }
+        track_last(find(stmt->ident.value.value()).value());
+        return true;
+    }
+
+    inline bool compile(const NodeStatementAssign* stmt)
+    {
+        auto reg = find(stmt->ident.value.value());
+        if (!reg.has_value()) {
+            fail("Undeclared identifier: " + stmt->ident.value.value());
+            return false;
+        }
+        if (!compile_expr_into(stmt->expr, reg.value())) {
+            return false;
+        }
+        track_last(reg.value());
+        return true;
+    }
+
+    inline bool compile(const NodeStatementArray* stmt)
+    {
+        if (stmt->size != nullptr) {
+            auto size = compile_expr(stmt->size);
+            if (!size.has_value() || !declare(stmt->ident.value.value())) {
+                return false;
+            }
+            m_vars.back().heap = true;
+            emit({ .op = Op::alloc, .a = m_vars.back().reg, .b = size.value() });
+            track_none();
+            return true;
+        }
+        if (!declare_array(stmt->ident.value.value(), stmt->length)) {
+            return false;
+        }
+        const Var& array = m_vars.back();
+        emit({ .op = Op::array, .a = array.reg, .b = static_cast<uint16_t>(array.length), .c = static_cast<uint16_t>(array.length >> 16) });
+        track_none();
+        return true;
+    }
+
+    inline bool compile(const NodeStatementStore* stmt)
+    {
+        const Var* array = find_array(stmt->ident.value.value());
+        if (array == nullptr) {
+            return false;
+        }
+        const uint16_t base = array->reg;
+        auto at = compile_expr(stmt->index);
+        if (!at.has_value()) {
+            return false;
+        }
+        auto value = compile_expr(stmt->expr);
+        if (!value.has_value()) {
+            return false;
+        }
+        emit({ .op = array->heap ? Op::storeh : Op::storex, .a = base, .b = at.value(), .c = value.value() });
+        track_last(value.value());
+        return true;
+    }
+
+    inline bool compile(const NodeStatementPrint* stmt)
+    {
+        if (stmt->expr) {
+            auto value = compile_expr(stmt->expr);
+            if (!value.has_value()) {
+                return false;
+            }
+            emit({ .op = Op::print, .a = value.value(), .b = stmt->newline });
+            track_none();
+            return true;
+        }
+        const uint32_t index = static_cast<uint32_t>(m_program->strings.size());
+        m_program->strings.push_back((stmt->string ? stmt->string->value : std::string {}) + (stmt->newline ? "\n" : ""));
+        emit({ .op = Op::prints, .b = static_cast<uint16_t>(index), .c = static_cast<uint16_t>(index >> 16) });
+        track_none();
+        return true;
+    }
+
+    inline bool compile(const NodeScope* scope)
+    {
+        return compile_scope(scope);
+    }
+
+    inline bool compile(const NodeStatementIf* stmt)
+    {
+        std::vector<size_t> end_jumps;
+        if (!compile_conditional(stmt->expr, stmt->scope, stmt->pred, end_jumps)) {
+            return false;
+        }
+        for (size_t jump : end_jumps) {
+            patch_target(jump, here());
+        }
+        return true;
+    }
+
+    // A parallel loop runs its iterations in order here, which is one of
+    // the orders the native code may run them in.
+    inline bool compile(const NodeStatementFor* stmt)
+    {
+        if (stmt->parallel) {
+            ParallelChecker(m_prog).check(stmt);
+        }
+        // As in the generator, the counter belongs to the enclosing scope,
+        // so a later loop cannot declare it again.
+        if (stmt->init && !compile_statement(stmt->init)) {
+            return false;
+        }
+        const size_t top = here();
+        std::optional<size_t> exit_jump;
+        if (stmt->condition) {
+            auto cond = compile_expr(stmt->condition);
+            if (!cond.has_value()) {
+                return false;
+            }
+            track_last(cond.value());
+            exit_jump = here();
+            emit({ .op = Op::jz, .a = cond.value() });
+            m_next_reg = m_locals_top;
+        }
+        if (stmt->scope && !compile_scope(stmt->scope)) {
+            return false;
+        }
+        if (stmt->iteration && !compile_statement(stmt->iteration)) {
+            return false;
+        }
+        const size_t back = here();
+        emit({ .op = Op::jmp });
+        patch_target(back, top);
+        if (exit_jump.has_value()) {
+            patch_target(exit_jump.value(), here());
+        }
+        return true;
+    }
+
+    inline bool compile(const NodeFunctionDecl*)
+    {
+        // Top-level declarations are compiled separately; nested ones are
+        // not generated by the native backend either.
+        return true;
+    }
+
+    inline bool compile(const NodeStatementReturn* stmt)
+    {
+        if (m_top_level) {
+            fail("return outside of a function");
+            return false;
+        }
+        uint16_t reg;
+        if (stmt->expr) {
+            auto value = compile_expr(stmt->expr);
+            if (!value.has_value()) {
+                return false;
+            }
+            reg = value.value();
+        } else {
+            reg = alloc_temp();
+            emit({ .op = Op::loadi, .a = reg });
+        }
+        emit({ .op = Op::ret, .a = reg });
+        return true;
+    }
+
+    const NodeProg& m_prog;
+    BytecodeProgram* m_program = nullptr;
+    BytecodeFunction* m_fn = nullptr;
+    bool m_top_level = false;
+    std::map<std::string, size_t> m_function_index;
+    std::vector<Var> m_vars;
+    std::vector<size_t> m_scopes;
+    uint32_t m_next_reg = 0;
+    uint32_t m_locals_top = 0;
+    uint32_t m_max_reg = 0;
+    uint32_t m_depth = 0; // of compile_expr_into calls
+    std::string m_error;
+};
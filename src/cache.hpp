@@ -0,0 +1,378 @@
+#pragma once
+
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "./hash.hpp"
+#include "./object.hpp"
+
+// On-disk, content-addressed store of generated and assembled functions. Entries
+// are keyed by the function's token hash, the compiler build and the code
+// generation flags, so an edit to one function only misses for that
+// function. Least recently used entries are evicted past a size limit.
+
+// Any rebuild of the compiler may change the code it emits.
+inline constexpr const char* compiler_version = "cato " __DATE__ " " __TIME__;
+
+struct CachedFunction {
+    std::string code;
+    std::vector<std::string> strings; // literals the code refers to
+    ObjectFile object;                // `code` assembled on its own
+};
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t evicted = 0;
+    uint64_t size = 0; // approximate bytes on disk
+};
+
+class FunctionCache {
+public:
+    static constexpr uint64_t default_max_bytes = 64 * 1024 * 1024;
+
+    inline explicit FunctionCache(std::filesystem::path dir, uint64_t max_bytes = default_max_bytes)
+        : m_dir(std::move(dir))
+        , m_max_bytes(max_bytes)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+    }
+
+    inline uint64_t key(uint64_t content_hash, const std::string& flags) const
+    {
+        uint64_t hash = fnv1a(compiler_version);
+        hash = fnv1a(flags, hash);
+        return fnv1a(content_hash, hash);
+    }
+
+    inline std::optional<CachedFunction> load(uint64_t key)
+    {
+        const std::filesystem::path path = entry_path(key);
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            std::lock_guard lock(m_stats_mutex);
+            m_stats.misses++;
+            return {};
+        }
+        std::string contents(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+        std::optional<CachedFunction> entry;
+        if (file) {
+            entry = decode(contents);
+        }
+        std::error_code ec;
+        if (!entry.has_value()) {
+            std::filesystem::remove(path, ec);
+            std::lock_guard lock(m_stats_mutex);
+            m_stats.misses++;
+            return {};
+        }
+        // The modification time doubles as the last-use time for eviction.
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        std::lock_guard lock(m_stats_mutex);
+        m_stats.hits++;
+        m_stats.bytes_read += contents.size();
+        return entry;
+    }
+
+    inline void store(uint64_t key, const CachedFunction& entry)
+    {
+        const std::string data = encode(entry);
+        // Write then rename, so concurrent compilers never see half an entry.
+        const std::filesystem::path path = entry_path(key);
+        std::filesystem::path temp = path;
+        temp += ".tmp" + std::to_string(getpid()) + "." + std::to_string(m_temp_counter++);
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+                return;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp, path, ec);
+        if (ec) {
+            std::filesystem::remove(temp, ec);
+            return;
+        }
+        std::lock_guard lock(m_stats_mutex);
+        m_stats.bytes_written += data.size();
+        m_unflushed += data.size();
+    }
+
+    // Updates the running size total at the end of a build and trims the
+    // cache only once that total passes the limit, so a build does not have
+    // to stat every entry. A long-lived compiler may flush many times.
+    inline void flush()
+    {
+        std::lock_guard lock(m_stats_mutex);
+        const std::filesystem::path size_path = m_dir / "size";
+        uint64_t total = 0;
+        if (std::ifstream file(size_path); file) {
+            file >> total;
+        }
+        total += std::exchange(m_unflushed, 0);
+        if (total > m_max_bytes) {
+            total = trim();
+        } else if (total == m_stats.size) {
+            return;
+        }
+        m_stats.size = total;
+        std::filesystem::path temp = size_path;
+        temp += ".tmp" + std::to_string(getpid());
+        std::ofstream(temp) << total << "\n";
+        std::error_code ec;
+        std::filesystem::rename(temp, size_path, ec);
+    }
+
+    inline CacheStats stats()
+    {
+        std::lock_guard lock(m_stats_mutex);
+        return m_stats;
+    }
+
+private:
+    // Drops least recently used entries until the cache fits its limit and
+    // returns the exact size that is left.
+    inline uint64_t trim()
+    {
+        struct Entry {
+            std::filesystem::file_time_type used;
+            uint64_t size;
+            std::filesystem::path path;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const auto& item : std::filesystem::directory_iterator(m_dir, ec)) {
+            if (item.path().extension() != ".fn") {
+                continue;
+            }
+            std::error_code item_ec;
+            const uint64_t size = item.file_size(item_ec);
+            const auto used = item.last_write_time(item_ec);
+            if (item_ec) {
+                continue;
+            }
+            entries.push_back({ used, size, item.path() });
+            total += size;
+        }
+        if (total > m_max_bytes) {
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+                return a.used < b.used;
+            });
+            for (const Entry& entry : entries) {
+                if (total <= m_max_bytes) {
+                    break;
+                }
+                if (std::filesystem::remove(entry.path, ec)) {
+                    total -= entry.size;
+                    m_stats.evicted++;
+                }
+            }
+        }
+        return total;
+    }
+
+    static constexpr std::string_view magic = "cato-fn 3\n";
+
+    inline std::filesystem::path entry_path(uint64_t key) const
+    {
+        std::stringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << key << ".fn";
+        return m_dir / name.str();
+    }
+
+    // Little-endian u64 fields; strings and byte arrays are length-prefixed.
+    struct Writer {
+        std::string out;
+
+        void u64(uint64_t value)
+        {
+            for (int i = 0; i < 8; i++) {
+                out.push_back(static_cast<char>(value >> (i * 8)));
+            }
+        }
+        void bytes(const void* data, size_t size)
+        {
+            u64(size);
+            out.append(static_cast<const char*>(data), size);
+        }
+        void str(const std::string& value)
+        {
+            bytes(value.data(), value.size());
+        }
+    };
+
+    struct Reader {
+        const std::string& in;
+        size_t pos = 0;
+        bool ok = true;
+
+        uint64_t u64()
+        {
+            if (in.size() - pos < 8) {
+                ok = false;
+                return 0;
+            }
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) {
+                value |= static_cast<uint64_t>(static_cast<uint8_t>(in[pos + i])) << (i * 8);
+            }
+            pos += 8;
+            return value;
+        }
+        std::string str()
+        {
+            const uint64_t size = u64();
+            if (!ok || size > in.size() - pos) {
+                ok = false;
+                return {};
+            }
+            std::string value = in.substr(pos, size);
+            pos += size;
+            return value;
+        }
+        // Guards counts read from a damaged file against huge reservations.
+        uint64_t count()
+        {
+            const uint64_t value = u64();
+            if (value > in.size()) {
+                ok = false;
+                return 0;
+            }
+            return value;
+        }
+    };
+
+    static inline std::string encode(const CachedFunction& entry)
+    {
+        Writer w { std::string(magic) };
+        w.u64(entry.strings.size());
+        for (const std::string& str : entry.strings) {
+            w.str(str);
+        }
+        w.str(entry.code);
+        const ObjectFile& obj = entry.object;
+        w.u64(obj.sections.size());
+        for (const ObjectSection& section : obj.sections) {
+            w.str(section.name);
+            w.bytes(section.data.data(), section.data.size());
+            w.u64(section.size);
+            w.u64(section.align);
+            w.u64(section.flags);
+            w.u64(section.nobits);
+        }
+        w.u64(obj.symbols.size());
+        for (const ObjectSymbol& sym : obj.symbols) {
+            w.str(sym.name);
+            w.u64(static_cast<uint64_t>(static_cast<int64_t>(sym.section)));
+            w.u64(sym.value);
+            w.u64(sym.size);
+            w.u64(sym.global);
+            w.u64(sym.absolute);
+        }
+        w.u64(obj.relocs.size());
+        for (const ObjectReloc& reloc : obj.relocs) {
+            w.u64(reloc.section);
+            w.u64(reloc.offset);
+            w.u64(reloc.type);
+            w.u64(reloc.symbol);
+            w.u64(static_cast<uint64_t>(reloc.addend));
+        }
+        w.str(obj.line_file);
+        w.u64(obj.lines.size());
+        for (const ObjectLine& line : obj.lines) {
+            w.u64(line.section);
+            w.u64(line.offset);
+            w.u64(line.line);
+        }
+        return std::move(w.out);
+    }
+
+    static inline std::optional<CachedFunction> decode(const std::string& data)
+    {
+        if (!data.starts_with(magic)) {
+            return {};
+        }
+        Reader r { data, magic.size() };
+        CachedFunction entry;
+        for (uint64_t i = 0, n = r.count(); r.ok && i < n; i++) {
+            entry.strings.push_back(r.str());
+        }
+        entry.code = r.str();
+        ObjectFile& obj = entry.object;
+        for (uint64_t i = 0, n = r.count(); r.ok && i < n; i++) {
+            ObjectSection section;
+            section.name = r.str();
+            const std::string bytes = r.str();
+            section.data.assign(bytes.begin(), bytes.end());
+            section.size = r.u64();
+            section.align = r.u64();
+            section.flags = r.u64();
+            section.nobits = r.u64() != 0;
+            obj.sections.push_back(std::move(section));
+        }
+        for (uint64_t i = 0, n = r.count(); r.ok && i < n; i++) {
+            ObjectSymbol sym;
+            sym.name = r.str();
+            sym.section = static_cast<int>(static_cast<int64_t>(r.u64()));
+            sym.value = r.u64();
+            sym.size = r.u64();
+            sym.global = r.u64() != 0;
+            sym.absolute = r.u64() != 0;
+            if (sym.section < -1 || sym.section >= static_cast<int>(obj.sections.size())) {
+                r.ok = false;
+            }
+            obj.symbols.push_back(std::move(sym));
+        }
+        for (uint64_t i = 0, n = r.count(); r.ok && i < n; i++) {
+            ObjectReloc reloc;
+            reloc.section = r.u64();
+            reloc.offset = r.u64();
+            reloc.type = static_cast<uint32_t>(r.u64());
+            reloc.symbol = r.u64();
+            reloc.addend = static_cast<int64_t>(r.u64());
+            if (reloc.section >= obj.sections.size() || reloc.symbol >= obj.symbols.size()) {
+                r.ok = false;
+            }
+            obj.relocs.push_back(reloc);
+        }
+        obj.line_file = r.str();
+        for (uint64_t i = 0, n = r.count(); r.ok && i < n; i++) {
+            ObjectLine line;
+            line.section = r.u64();
+            line.offset = r.u64();
+            line.line = static_cast<uint32_t>(r.u64());
+            if (line.section >= obj.sections.size()) {
+                r.ok = false;
+            }
+            obj.lines.push_back(line);
+        }
+        if (!r.ok || r.pos != data.size()) {
+            return {};
+        }
+        return entry;
+    }
+
+    std::filesystem::path m_dir;
+    uint64_t m_max_bytes;
+    CacheStats m_stats;
+    uint64_t m_unflushed = 0; // bytes stored since the last flush()
+    std::atomic<uint64_t> m_temp_counter = 0;
+    std::mutex m_stats_mutex; // load() and store() may run on several threads
+};
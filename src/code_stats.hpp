@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./layout.hpp"
+#include "./object.hpp"
+
+// What --code-stats reports: static measures of the code the generator
+// emits, per function, which can be diffed between two compilers without
+// running anything. They are read off the assembly text, with code bytes
+// from the assembled object.
+
+struct CodeMetrics {
+    std::string name;
+    int64_t instructions = 0;
+    int64_t push_pop = 0;
+    int64_t mov = 0;        // mov, movzx, movq, cmovcc and the like
+    int64_t arithmetic = 0; // integer and SSE ALU ops, lea, compares and setcc
+    int64_t branches = 0;   // jumps, calls and returns
+    int64_t divides = 0;
+    int64_t memory_operands = 0;
+    int64_t max_stack = 0;  // bytes below the stack pointer on entry
+    int64_t frame = 0;      // bytes the prologue allocates
+    int64_t code_bytes = 0; // up to the next function, padding included; 0 if not assembled
+
+    // Counts add up; the stack and frame of a total are the largest.
+    CodeMetrics& operator+=(const CodeMetrics& other)
+    {
+        instructions += other.instructions;
+        push_pop += other.push_pop;
+        mov += other.mov;
+        arithmetic += other.arithmetic;
+        branches += other.branches;
+        divides += other.divides;
+        memory_operands += other.memory_operands;
+        max_stack = std::max(max_stack, other.max_stack);
+        frame = std::max(frame, other.frame);
+        code_bytes += other.code_bytes;
+        return *this;
+    }
+
+    CodeMetrics operator-(const CodeMetrics& other) const
+    {
+        CodeMetrics diff = *this;
+        diff.instructions -= other.instructions;
+        diff.push_pop -= other.push_pop;
+        diff.mov -= other.mov;
+        diff.arithmetic -= other.arithmetic;
+        diff.branches -= other.branches;
+        diff.divides -= other.divides;
+        diff.memory_operands -= other.memory_operands;
+        diff.max_stack -= other.max_stack;
+        diff.frame -= other.frame;
+        diff.code_bytes -= other.code_bytes;
+        return diff;
+    }
+};
+
+namespace code_stats_detail {
+    inline bool is_jump(const std::string& mnemonic)
+    {
+        return mnemonic.size() > 1 && mnemonic[0] == 'j';
+    }
+
+    inline bool is_arithmetic(const std::string& mnemonic)
+    {
+        static const char* const names[] = { "add", "sub", "imul", "mul", "neg", "inc", "dec", "and", "or", "xor",
+            "not", "shl", "shr", "sar", "sal", "lea", "cmp", "test", "cqo" };
+        return std::find(std::begin(names), std::end(names), mnemonic) != std::end(names) || mnemonic.starts_with("set")
+            || (mnemonic[0] == 'p' && mnemonic != "push" && mnemonic != "pop");
+    }
+
+    inline int64_t number(const std::string& text)
+    {
+        try {
+            return std::stoll(text, nullptr, 0);
+        } catch (const std::exception&) {
+            return 0;
+        }
+    }
+
+    // Measures one function's lines. The stack is followed in text order:
+    // a label takes the depth of the first jump seen to it, and one that
+    // only follows a jump or return with no such jump starts a routine of
+    // its own, as an outlined parallel loop body does.
+    inline CodeMetrics measure(std::string name, const std::vector<std::string>& lines)
+    {
+        using namespace layout_detail;
+        CodeMetrics metrics { .name = std::move(name) };
+        std::map<std::string, int64_t> label_depth;
+        int64_t depth = 0;
+        int64_t frame_base = 0; // the depth rbp was set at
+        bool reachable = true;
+        bool frame_next = false;
+        for (const std::string& line : lines) {
+            if (is_label(line)) {
+                const std::string label = line.substr(0, line.size() - 1);
+                if (auto it = label_depth.find(label); it != label_depth.end()) {
+                    depth = it->second;
+                } else if (!reachable) {
+                    depth = 0;
+                }
+                reachable = true;
+                continue;
+            }
+            if (!is_instruction(line)) {
+                continue;
+            }
+            std::istringstream words(trim(line));
+            std::string mnemonic;
+            words >> mnemonic;
+            if (mnemonic == "lock" || mnemonic == "rep") {
+                words >> mnemonic;
+            }
+            std::string operands;
+            std::getline(words, operands);
+            operands = trim(operands);
+            const std::string first = trim(operands.substr(0, operands.find(',')));
+            const std::string second = operands.find(',') == std::string::npos ? std::string() : trim(operands.substr(operands.find(',') + 1));
+
+            metrics.instructions++;
+            if (mnemonic != "lea" && operands.find('[') != std::string::npos) {
+                metrics.memory_operands++;
+            }
+            if (mnemonic == "push" || mnemonic == "pop") {
+                metrics.push_pop++;
+                depth += mnemonic == "push" ? 8 : -8;
+            } else if (mnemonic.starts_with("mov") || mnemonic.starts_with("cmov")) {
+                metrics.mov++;
+                if (first == "rbp" && second == "rsp") {
+                    frame_base = depth;
+                    frame_next = metrics.frame == 0;
+                    continue;
+                }
+                if (first == "rsp" && second == "rbp") {
+                    depth = frame_base;
+                }
+            } else if (mnemonic == "div" || mnemonic == "idiv") {
+                metrics.divides++;
+            } else if (is_jump(mnemonic) || mnemonic == "call" || mnemonic == "ret") {
+                metrics.branches++;
+                if (is_jump(mnemonic)) {
+                    label_depth.emplace(first, depth);
+                }
+                reachable = mnemonic == "call" || (is_jump(mnemonic) && mnemonic != "jmp");
+            } else if (is_arithmetic(mnemonic)) {
+                metrics.arithmetic++;
+                if (first == "rsp" && (mnemonic == "sub" || mnemonic == "add")) {
+                    const int64_t bytes = number(second);
+                    depth += mnemonic == "sub" ? bytes : -bytes;
+                    if (frame_next && mnemonic == "sub") {
+                        metrics.frame = bytes;
+                    }
+                }
+            }
+            frame_next = false;
+            metrics.max_stack = std::max(metrics.max_stack, depth);
+        }
+        return metrics;
+    }
+}
+
+// Splits a whole program as the generator emits it into `_start`, the code
+// up to the functions, and each `;; Function:` section. The runtime after
+// them is not the program's and is left out. Code bytes come from the
+// symbol sizes in `object`, when it could be assembled.
+inline std::vector<CodeMetrics> measure_code(const std::string& program, const std::optional<ObjectFile>& object)
+{
+    std::vector<CodeMetrics> functions;
+    std::istringstream input(program);
+    std::string name;
+    std::vector<std::string> lines;
+    bool in_main = false;
+    for (std::string line; std::getline(input, line);) {
+        if (line == "_start:") {
+            in_main = true;
+            name = "_start";
+        } else if (in_main && line == ";;functions") {
+            in_main = false;
+            functions.push_back(code_stats_detail::measure(name, lines));
+            lines.clear();
+            name.clear();
+        } else if (line.starts_with(";; Function: ")) {
+            name = line.substr(13);
+        } else if (line.starts_with(";; /Function: ")) {
+            functions.push_back(code_stats_detail::measure(name, lines));
+            lines.clear();
+            name.clear();
+        } else if (!name.empty()) {
+            lines.push_back(std::move(line));
+        }
+    }
+    if (object.has_value()) {
+        for (CodeMetrics& function : functions) {
+            for (const ObjectSymbol& sym : object->symbols) {
+                if (sym.global && sym.name == function.name) {
+                    function.code_bytes = static_cast<int64_t>(sym.size);
+                }
+            }
+        }
+    }
+    return functions;
+}
+
+inline CodeMetrics total_metrics(const std::vector<CodeMetrics>& functions)
+{
+    CodeMetrics total { .name = "[total]" };
+    for (const CodeMetrics& function : functions) {
+        total += function;
+    }
+    return total;
+}
+
+// The measures of one file, and for each pass that was on, what the totals
+// gained by it: the totals with it less the totals without it.
+struct CodeReport {
+    std::string file;
+    std::vector<CodeMetrics> functions;
+    std::vector<CodeMetrics> passes;
+};
+
+// Collects the reports of every file in an invocation.
+class CodeStats {
+public:
+    inline void add(CodeReport report)
+    {
+        std::lock_guard lock(m_mutex);
+        m_reports.push_back(std::move(report));
+    }
+
+    inline void print(std::ostream& out, bool json)
+    {
+        std::lock_guard lock(m_mutex);
+        std::stable_sort(m_reports.begin(), m_reports.end(), [](const CodeReport& a, const CodeReport& b) {
+            return a.file < b.file;
+        });
+        if (json) {
+            out << "{\"files\": [";
+            for (size_t i = 0; i < m_reports.size(); i++) {
+                const CodeReport& report = m_reports[i];
+                out << (i == 0 ? "" : ", ") << "{\"file\": \"" << report.file << "\", \"functions\": [";
+                for (size_t f = 0; f < report.functions.size(); f++) {
+                    out << (f == 0 ? "" : ", ");
+                    print_json(out, report.functions[f]);
+                }
+                out << "], \"total\": ";
+                print_json(out, total_metrics(report.functions));
+                out << ", \"passes\": [";
+                for (size_t p = 0; p < report.passes.size(); p++) {
+                    out << (p == 0 ? "" : ", ");
+                    print_json(out, report.passes[p]);
+                }
+                out << "]}";
+            }
+            out << "]}" << std::endl;
+            return;
+        }
+        for (const CodeReport& report : m_reports) {
+            if (m_reports.size() > 1) {
+                out << report.file << "\n";
+            }
+            header(out, "function");
+            for (const CodeMetrics& function : report.functions) {
+                row(out, function, false);
+            }
+            row(out, total_metrics(report.functions), false);
+            if (!report.passes.empty()) {
+                out << "\n";
+                header(out, "pass");
+                for (const CodeMetrics& pass : report.passes) {
+                    row(out, pass, true);
+                }
+            }
+        }
+        out << std::flush;
+    }
+
+private:
+    static inline void header(std::ostream& out, const char* what)
+    {
+        out << std::left << std::setw(20) << what << std::right;
+        for (const char* column : { "insns", "push/pop", "mov", "arith", "branch", "div", "mem", "stack", "frame", "bytes" }) {
+            out << std::setw(column[0] == 'p' ? 10 : 8) << column;
+        }
+        out << "\n";
+    }
+
+    static inline void row(std::ostream& out, const CodeMetrics& m, bool signs)
+    {
+        out << std::left << std::setw(20) << m.name << std::right << (signs ? std::showpos : std::noshowpos);
+        out << std::setw(8) << m.instructions << std::setw(10) << m.push_pop << std::setw(8) << m.mov << std::setw(8)
+            << m.arithmetic << std::setw(8) << m.branches << std::setw(8) << m.divides << std::setw(8)
+            << m.memory_operands << std::setw(8) << m.max_stack << std::setw(8) << m.frame << std::setw(8)
+            << m.code_bytes << std::noshowpos << "\n";
+    }
+
+    static inline void print_json(std::ostream& out, const CodeMetrics& m)
+    {
+        out << "{\"name\": \"" << m.name << "\", \"instructions\": " << m.instructions << ", \"push_pop\": " << m.push_pop
+            << ", \"mov\": " << m.mov << ", \"arithmetic\": " << m.arithmetic << ", \"branches\": " << m.branches
+            << ", \"divides\": " << m.divides << ", \"memory_operands\": " << m.memory_operands
+            << ", \"max_stack\": " << m.max_stack << ", \"frame\": " << m.frame << ", \"code_bytes\": " << m.code_bytes
+            << "}";
+    }
+
+    std::mutex m_mutex;
+    std::vector<CodeReport> m_reports;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// An error in the program being compiled. A single-file build reports it
+// and exits; a batch build reports it against its file and carries on.
+struct CompileError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] inline void compile_error(const std::string& message)
+{
+    throw CompileError(message);
+}
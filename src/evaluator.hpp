@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "./bytecode.hpp"
+#include "./interpreter.hpp"
+
+// Runs code at compile time on the bytecode interpreter. Besides `exit`, a
+// cato function's only effect is printing, and a program reads no input, so
+// a call whose arguments are constants, or the whole program, can be
+// replaced by its result as long as it prints nothing; the interpreter gets
+// no output stream and stops at the first print. Each evaluation may run
+// `fuel` bytecode instructions, and the calls folded into one function
+// eight times that between them; when the fuel runs out, or the
+// interpreter reports an error the native code would trap on, the caller
+// lowers the code as usual. That includes running out of stack: calls may
+// take half the native_stack_bytes a native program gets by default, so
+// recursion that would crash natively is never folded into a clean exit,
+// however its frames compare with the estimate or the environment with the
+// default.
+//
+// Whether a call folds depends only on the function being lowered, not on
+// which calls other threads got to first: every evaluation of the same
+// call costs the fuel it first took, even when its result is remembered.
+class Evaluator {
+public:
+    static constexpr uint64_t default_fuel = 1000000;
+    static constexpr size_t native_stack_bytes = 8 * 1024 * 1024;
+
+    inline Evaluator(const NodeProg& prog, uint64_t fuel)
+        : m_fuel(fuel)
+    {
+        m_program = BytecodeCompiler(prog).compile();
+        if (m_program.has_value()) {
+            for (size_t i = 1; i < m_program->functions.size(); i++) {
+                m_functions.emplace(m_program->functions[i].name, i);
+            }
+        }
+    }
+
+    Evaluator(const Evaluator&) = delete;
+    Evaluator& operator=(const Evaluator&) = delete;
+
+    // What each function being lowered starts with for call().
+    inline uint64_t budget() const
+    {
+        return m_fuel * 8;
+    }
+
+    // The program's exit code.
+    inline std::optional<int64_t> run_program()
+    {
+        return evaluate(InterpreterResult::Status::exited, [](Interpreter& interpreter) { return interpreter.run(); }).value;
+    }
+
+    // What `name(args...)` returns, paid for out of `budget`; once a call
+    // costs more than is left, nothing more is evaluated against it. Safe
+    // to call from several threads.
+    inline std::optional<int64_t> call(const std::string& name, const std::vector<int64_t>& args, uint64_t& budget)
+    {
+        auto function = m_functions.find(name);
+        if (budget == 0 || function == m_functions.end() || m_program->functions[function->second].params != args.size()) {
+            return {};
+        }
+        std::pair<size_t, std::vector<int64_t>> key { function->second, args };
+        std::optional<Outcome> outcome;
+        {
+            std::lock_guard lock(m_mutex);
+            if (auto it = m_results.find(key); it != m_results.end()) {
+                outcome = it->second;
+            }
+        }
+        if (!outcome.has_value()) {
+            outcome = evaluate(InterpreterResult::Status::returned, [&](Interpreter& interpreter) {
+                return interpreter.call(function->second, args);
+            });
+            std::lock_guard lock(m_mutex);
+            m_results.emplace(std::move(key), outcome.value());
+        }
+        if (outcome->used > budget) {
+            budget = 0;
+            return {};
+        }
+        budget -= outcome->used;
+        return outcome->value;
+    }
+
+private:
+    struct Outcome {
+        std::optional<int64_t> value;
+        uint64_t used = 0; // fuel
+    };
+
+    template <typename Run>
+    inline Outcome evaluate(InterpreterResult::Status expected, Run run)
+    {
+        if (!m_program.has_value() || m_fuel == 0) {
+            return {};
+        }
+        Interpreter interpreter(m_program.value());
+        interpreter.set_fuel(m_fuel);
+        interpreter.set_stack_limit(native_stack_bytes / 2);
+        const InterpreterResult result = run(interpreter);
+        const uint64_t used = m_fuel - interpreter.fuel();
+        if (result.status != expected) {
+            return { {}, used };
+        }
+        return { result.value, used };
+    }
+
+    std::optional<BytecodeProgram> m_program;
+    std::unordered_map<std::string, size_t> m_functions;
+    const uint64_t m_fuel;
+    std::mutex m_mutex;
+    std::map<std::pair<size_t, std::vector<int64_t>>, Outcome> m_results;
+};
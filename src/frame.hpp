@@ -0,0 +1,732 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "./parser.hpp"
+
+// Where a function's variables live. Each one gets a fixed 8-byte slot
+// below rbp, and variables that are never live at the same time share a
+// slot. The frame is allocated once in the prologue.
+struct FrameLayout {
+    std::vector<size_t> param_slots; // register parameters, in order
+    std::unordered_map<const NodeStatementInt*, size_t> local_slots;
+    // Common subexpressions: the first evaluation stores its value in a slot
+    // and the later ones load it instead of computing it again.
+    std::unordered_map<const NodeExpr*, size_t> value_slots;
+    std::unordered_map<const NodeExpr*, size_t> reused_values;
+    size_t slot_count = 0;
+    // Arrays lie below the slots, each in its own block; this is the rbp
+    // offset of element 0. Top-level arrays are static and not in here.
+    std::unordered_map<const NodeStatementArray*, int64_t> array_offsets;
+    size_t array_bytes = 0;
+    // Heap arrays keep their address in a slot. A scope that allocates,
+    // and the body of a function that does anywhere, saves the heap top on
+    // entry to put it back on exit.
+    std::unordered_map<const NodeStatementArray*, size_t> heap_slots;
+    std::unordered_map<const NodeScope*, size_t> heap_marks;
+    bool leaf = true; // makes no calls; `exit` does not count, it never returns
+
+    // Keeps rsp 16-byte aligned below the saved rbp.
+    size_t frame_bytes() const
+    {
+        return (slot_count * 8 + array_bytes + 15) / 16 * 16;
+    }
+
+    static int64_t offset(size_t slot)
+    {
+        return -8 * static_cast<int64_t>(slot + 1);
+    }
+};
+
+inline bool logical(const NodeBinExpression* bin)
+{
+    return std::holds_alternative<NodeBinExpressionAnd*>(bin->var) || std::holds_alternative<NodeBinExpressionOr*>(bin->var);
+}
+
+// Whether the generator evaluates `bin`'s left operand before its right
+// one: the right one first for arithmetic and the left one first for
+// comparisons, unless that one is a literal or a variable and the other is
+// not, and always the left one first for `&&` and `||`. Leaving the operand that cannot change for last means a chain like
+// `a + b + c + ...` holds one value on the stack instead of one per operator.
+inline bool evaluates_lhs_first(const NodeBinExpression* bin)
+{
+    auto simple = [](const NodeExpr* expr) {
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        return term != nullptr
+            && (std::holds_alternative<NodeTermIntLit*>((*term)->var) || std::holds_alternative<NodeTermIdent*>((*term)->var));
+    };
+    const auto [lhs, rhs] = std::visit([](const auto* node) {
+        return std::pair<const NodeExpr*, const NodeExpr*> { node->lhs, node->rhs };
+    }, bin->var);
+    if (logical(bin)) {
+        return true;
+    }
+    const bool comparison = bin->var.index() >= 4; // after + - * /, see NodeBinExpression
+    if (comparison) {
+        return !simple(lhs) || simple(rhs);
+    }
+    return simple(rhs) && !simple(lhs);
+}
+
+// Computes a FrameLayout from live ranges. A range runs from where the
+// variable is declared to its last use, with positions numbered in the order
+// the generator lowers the code. A variable that is used inside a loop but
+// declared before it is live across the back-edge, so its range covers the
+// whole loop. Parameters are all live on entry, so register parameter i
+// always gets slot i. Names are resolved with the generator's scoping rules;
+// undeclared names are left for the generator to report.
+//
+// The same walk numbers values. Arithmetic and comparisons with the same
+// operator and operand values get the same number, in either operand order
+// for + * == !=, and a variable's number changes when it is assigned. An
+// expression whose value was already computed on every path to it reuses
+// that result, which then gets a range of its own. Values computed in an if
+// arm or a loop are only reused inside it, and a loop gives the variables it
+// assigns fresh numbers at its header.
+//
+// A parallel loop's body runs in a frame with this same layout, once per
+// thread, and reaches the variables declared outside it in the frame of
+// the code that started the loop.
+class FramePlanner {
+public:
+    // Without `reuse`, values are still numbered but every expression is
+    // computed where it stands.
+    inline explicit FramePlanner(bool reuse = true)
+        : m_reuse(reuse)
+    {
+    }
+
+    inline FrameLayout plan_function(const NodeFunctionDecl* func_decl, size_t register_params)
+    {
+        for (size_t i = 0; i < func_decl->params.size(); i++) {
+            declare(func_decl->params[i].value.value(), i < register_params, nullptr, fresh_value());
+        }
+        m_pos++;
+        walk_scope(func_decl->body, allocates(func_decl->body));
+        return assign_slots();
+    }
+
+    inline FrameLayout plan_program(const NodeProg& prog)
+    {
+        for (const NodeStatement* statement : prog.statements) {
+            if (auto array = std::get_if<NodeStatementArray*>(&statement->var); array && !(*array)->size) {
+                declare((*array)->ident.value.value(), false, nullptr, fresh_value());
+            } else {
+                walk_statement(statement);
+            }
+        }
+        return assign_slots();
+    }
+
+private:
+    static constexpr size_t no_slot = static_cast<size_t>(-1);
+
+    using Value = uint32_t;
+
+    struct Range {
+        size_t start;
+        size_t end;
+        const NodeStatementInt* decl; // a variable; null for a parameter
+        const NodeExpr* expr;         // or a reused value
+        const NodeStatementArray* array = nullptr; // or a heap array's address
+        const NodeScope* scope = nullptr;          // or a heap mark
+    };
+
+    struct Name {
+        std::string name;
+        size_t range;
+        Value value;
+    };
+
+    struct Loop {
+        size_t start;
+        std::vector<size_t> carried; // ranges that must last to the loop's end
+    };
+
+    struct Available {
+        const NodeExpr* expr; // the first evaluation
+        size_t pos;
+        size_t range;         // no_slot until something reuses it
+    };
+
+    // What was known at the start of a conditional region.
+    struct Snapshot {
+        size_t available;
+        std::vector<Value> values;
+    };
+
+    void declare(const std::string& name, bool needs_slot, const NodeStatementInt* decl, Value value)
+    {
+        size_t range = no_slot;
+        if (needs_slot) {
+            range = m_ranges.size();
+            m_ranges.push_back({ m_pos, m_pos, decl, nullptr });
+        }
+        m_names.push_back({ name, range, value });
+    }
+
+    Name* find(const std::string& name)
+    {
+        auto it = std::find_if(m_names.rbegin(), m_names.rend(), [&](const Name& entry) { return entry.name == name; });
+        return it == m_names.rend() ? nullptr : &*it;
+    }
+
+    void use(const std::string& name)
+    {
+        if (const Name* var = find(name); var != nullptr && var->range != no_slot) {
+            touch(var->range);
+        }
+    }
+
+    void touch(size_t index)
+    {
+        Range& range = m_ranges[index];
+        range.end = m_pos++;
+        // The outermost loop entered since the range started ends last.
+        for (Loop& loop : m_loops) {
+            if (loop.start > range.start) {
+                loop.carried.push_back(index);
+                break;
+            }
+        }
+    }
+
+    Value fresh_value(bool constant = false)
+    {
+        m_constant.push_back(constant);
+        return static_cast<Value>(m_constant.size() - 1);
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot snapshot { m_available_log.size(), {} };
+        for (const Name& var : m_names) {
+            snapshot.values.push_back(var.value);
+        }
+        return snapshot;
+    }
+
+    // Forgets what the region computed and puts variables back to their
+    // values at its start, adding the ones the region assigned to
+    // `assigned`.
+    void forget_since(size_t available)
+    {
+        while (m_available_log.size() > available) {
+            m_available.erase(m_available_log.back());
+            m_available_log.pop_back();
+        }
+    }
+
+    void restore(const Snapshot& snapshot, std::vector<size_t>& assigned)
+    {
+        forget_since(snapshot.available);
+        for (size_t i = 0; i < snapshot.values.size() && i < m_names.size(); i++) {
+            if (m_names[i].value != snapshot.values[i]) {
+                m_names[i].value = snapshot.values[i];
+                assigned.push_back(i);
+            }
+        }
+    }
+
+    static void collect_assigned(const NodeStatement* stmt, std::vector<std::string>& names)
+    {
+        if (auto assign = std::get_if<NodeStatementAssign*>(&stmt->var)) {
+            names.push_back((*assign)->ident.value.value());
+        } else if (auto scope = std::get_if<NodeScope*>(&stmt->var)) {
+            collect_assigned(*scope, names);
+        } else if (auto stmt_if = std::get_if<NodeStatementIf*>(&stmt->var)) {
+            collect_assigned((*stmt_if)->scope, names);
+            std::optional<NodeIfPred*> pred = (*stmt_if)->pred;
+            while (pred.has_value()) {
+                if (auto elif = std::get_if<NodeIfPredicateElif*>(&pred.value()->var)) {
+                    collect_assigned((*elif)->scope, names);
+                    pred = (*elif)->pred;
+                } else {
+                    collect_assigned(std::get<NodeIfPredicateElse*>(pred.value()->var)->scope, names);
+                    pred.reset();
+                }
+            }
+        } else if (auto stmt_for = std::get_if<NodeStatementFor*>(&stmt->var)) {
+            for (const NodeStatement* part : { (*stmt_for)->init, (*stmt_for)->iteration }) {
+                if (part != nullptr) {
+                    collect_assigned(part, names);
+                }
+            }
+            if ((*stmt_for)->scope != nullptr) {
+                collect_assigned((*stmt_for)->scope, names);
+            }
+        }
+    }
+
+    static void collect_assigned(const NodeScope* scope, std::vector<std::string>& names)
+    {
+        for (const NodeStatement* statement : scope->statements) {
+            collect_assigned(statement, names);
+        }
+    }
+
+    void walk_scope(const NodeScope* scope, bool mark = false)
+    {
+        for (const NodeStatement* statement : scope->statements) {
+            if (auto array = std::get_if<NodeStatementArray*>(&statement->var)) {
+                mark = mark || (*array)->size != nullptr;
+            }
+        }
+        const size_t mark_range = m_ranges.size();
+        if (mark) {
+            m_ranges.push_back({ m_pos, m_pos, nullptr, nullptr, nullptr, scope });
+            m_pos++;
+        }
+        const size_t names = m_names.size();
+        for (const NodeStatement* statement : scope->statements) {
+            walk_statement(statement);
+        }
+        m_names.resize(names);
+        if (mark) {
+            touch(mark_range);
+        }
+    }
+
+    // Whether `scope` or anything in it declares a heap array.
+    static bool allocates(const NodeScope* scope)
+    {
+        for (const NodeStatement* statement : scope->statements) {
+            if (auto array = std::get_if<NodeStatementArray*>(&statement->var)) {
+                if ((*array)->size != nullptr) {
+                    return true;
+                }
+            } else if (auto inner = std::get_if<NodeScope*>(&statement->var)) {
+                if (allocates(*inner)) {
+                    return true;
+                }
+            } else if (auto stmt_if = std::get_if<NodeStatementIf*>(&statement->var)) {
+                if (allocates((*stmt_if)->scope)) {
+                    return true;
+                }
+                std::optional<NodeIfPred*> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (auto elif = std::get_if<NodeIfPredicateElif*>(&pred.value()->var)) {
+                        if (allocates((*elif)->scope)) {
+                            return true;
+                        }
+                        pred = (*elif)->pred;
+                    } else {
+                        return allocates(std::get<NodeIfPredicateElse*>(pred.value()->var)->scope);
+                    }
+                }
+            } else if (auto stmt_for = std::get_if<NodeStatementFor*>(&statement->var)) {
+                if ((*stmt_for)->scope != nullptr && allocates((*stmt_for)->scope)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Numbers the whole tree first, so reuse can be decided top-down
+    // without visiting the parts of a reused expression.
+    Value walk_expression(const NodeExpr* expr)
+    {
+        m_numbers.clear();
+        const Value value = number(expr);
+        visit_expression(expr);
+        return value;
+    }
+
+    // Numbers `root` and everything in it, operands before the operator.
+    Value number(const NodeExpr* root)
+    {
+        m_number_steps.clear();
+        m_number_steps.push({ root, false });
+        while (!m_number_steps.empty()) {
+            const auto [expr, operands_done] = m_number_steps.pop();
+            Value value;
+            if (auto bin_expr = std::get_if<NodeBinExpression*>(&expr->var)) {
+                if (!operands_done) {
+                    m_number_steps.push({ expr, true });
+                    std::visit([&](const auto* bin) {
+                        m_number_steps.push({ bin->rhs, false });
+                        m_number_steps.push({ bin->lhs, false });
+                    }, (*bin_expr)->var);
+                    continue;
+                }
+                value = std::visit([&](const auto* bin) {
+                    using Bin = std::remove_cvref_t<decltype(*bin)>;
+                    constexpr bool commutative = std::is_same_v<Bin, NodeBinExpressionAdd> || std::is_same_v<Bin, NodeBinExpressionMulti>
+                        || std::is_same_v<Bin, NodeBinExpressionEquals> || std::is_same_v<Bin, NodeBinExpressionNotEquals>;
+                    Value rhs = m_number_values.pop();
+                    Value lhs = m_number_values.pop();
+                    if (commutative && rhs < lhs) {
+                        std::swap(lhs, rhs);
+                    }
+                    auto [it, added] = m_expressions.try_emplace({ (*bin_expr)->var.index(), lhs, rhs }, 0);
+                    if (added) {
+                        it->second = fresh_value(m_constant[lhs] && m_constant[rhs]);
+                    }
+                    return it->second;
+                }, (*bin_expr)->var);
+            } else {
+                const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+                if (auto int_lit = std::get_if<NodeTermIntLit*>(&term->var)) {
+                    auto [it, added] = m_literals.try_emplace((*int_lit)->value, 0);
+                    if (added) {
+                        it->second = fresh_value(true);
+                    }
+                    value = it->second;
+                } else if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+                    const Name* var = find((*ident)->ident.value.value());
+                    value = var != nullptr ? var->value : fresh_value();
+                } else if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+                    if (!operands_done) {
+                        m_number_steps.push({ expr, true });
+                        m_number_steps.push({ (*paren)->expr, false });
+                        continue;
+                    }
+                    value = m_number_values.pop();
+                } else if (auto term_not = std::get_if<NodeTermNot*>(&term->var)) {
+                    if (!operands_done) {
+                        m_number_steps.push({ expr, true });
+                        m_number_steps.push({ (*term_not)->expr, false });
+                        continue;
+                    }
+                    value = fresh_value(m_constant[m_number_values.pop()]);
+                } else if (std::holds_alternative<NodeTermLength*>(term->var)) {
+                    value = fresh_value(true);
+                } else {
+                    // Array elements change without their names being assigned.
+                    std::vector<NodeExpr*> none;
+                    auto index = std::get_if<NodeTermIndex*>(&term->var);
+                    auto call = std::get_if<NodeFunctionCall*>(&term->var);
+                    const std::vector<NodeExpr*>& args = call != nullptr ? (*call)->args : none;
+                    const size_t operands = (index != nullptr ? 1 : 0) + args.size();
+                    if (!operands_done && operands > 0) {
+                        m_number_steps.push({ expr, true });
+                        for (size_t i = args.size(); i-- > 0;) {
+                            m_number_steps.push({ args[i], false });
+                        }
+                        if (index != nullptr) {
+                            m_number_steps.push({ (*index)->index, false });
+                        }
+                        continue;
+                    }
+                    for (size_t i = 0; i < operands; i++) {
+                        m_number_values.pop();
+                    }
+                    value = fresh_value();
+                }
+            }
+            m_numbers[expr] = value;
+            m_number_values.push(value);
+        }
+        return m_number_values.pop();
+    }
+
+    // Follows the generator's evaluation order (see evaluates_lhs_first).
+    // The right operand of `&&` or `||` may not run, so nothing computed in
+    // either operand is reused after them, and neither are they.
+    void visit_expression(const NodeExpr* root)
+    {
+        m_visit_steps.clear();
+        m_visit_steps.push({ .expr = root });
+        while (!m_visit_steps.empty()) {
+            const VisitStep step = m_visit_steps.pop();
+            if (step.index != nullptr) {
+                use(step.index->ident.value.value());
+                continue;
+            }
+            if (step.forget != no_slot) {
+                forget_since(step.forget);
+                continue;
+            }
+            const NodeExpr* expr = step.expr;
+            auto bin_expr = std::get_if<NodeBinExpression*>(&expr->var);
+            if (bin_expr == nullptr) {
+                visit_term(std::get<NodeTerm*>(expr->var));
+                continue;
+            }
+            const Value value = m_numbers.at(expr);
+            if (step.operands_done) {
+                // Constants are cheaper to compute than to load.
+                if (m_reuse && !m_constant[value] && !logical(*bin_expr)) {
+                    m_available.emplace(value, Available { expr, m_pos, no_slot });
+                    m_available_log.push_back(value);
+                }
+                m_pos++;
+                continue;
+            }
+            if (auto it = m_available.find(value); it != m_available.end()) {
+                Available& first = it->second;
+                if (first.range == no_slot) {
+                    first.range = m_ranges.size();
+                    m_ranges.push_back({ first.pos, first.pos, nullptr, first.expr });
+                }
+                touch(first.range);
+                m_reused.emplace(expr, first.range);
+                continue;
+            }
+            if (logical(*bin_expr)) {
+                m_visit_steps.push({ .forget = m_available_log.size() });
+            }
+            m_visit_steps.push({ .expr = expr, .operands_done = true });
+            std::visit([&](const auto* bin) {
+                const bool lhs_first = evaluates_lhs_first(*bin_expr);
+                m_visit_steps.push({ .expr = lhs_first ? bin->rhs : bin->lhs });
+                m_visit_steps.push({ .expr = lhs_first ? bin->lhs : bin->rhs });
+            }, (*bin_expr)->var);
+        }
+    }
+
+    // Queues the expressions inside `term`.
+    void visit_term(const NodeTerm* term)
+    {
+        if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+            use((*ident)->ident.value.value());
+        } else if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+            m_visit_steps.push({ .expr = (*paren)->expr });
+        } else if (auto term_not = std::get_if<NodeTermNot*>(&term->var)) {
+            m_visit_steps.push({ .expr = (*term_not)->expr });
+        } else if (auto index = std::get_if<NodeTermIndex*>(&term->var)) {
+            m_visit_steps.push({ .index = *index });
+            m_visit_steps.push({ .expr = (*index)->index });
+        } else if (auto length = std::get_if<NodeTermLength*>(&term->var)) {
+            use((*length)->ident.value.value());
+        } else if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+            m_leaf = false;
+            for (size_t i = (*call)->args.size(); i-- > 0;) {
+                m_visit_steps.push({ .expr = (*call)->args[i] });
+            }
+        }
+    }
+
+    void walk_arm(const NodeExpr* cond, const NodeScope* scope, const Snapshot& before, std::vector<size_t>& assigned)
+    {
+        if (cond != nullptr) {
+            walk_expression(cond);
+        }
+        walk_scope(scope);
+        restore(before, assigned);
+    }
+
+    void walk_statement(const NodeStatement* stmt)
+    {
+        struct StmtVisitor {
+            FramePlanner& planner;
+            void operator()(const NodeFunctionDecl*) const { }
+            void operator()(const NodeStatementExit* stmt_exit) const
+            {
+                planner.walk_expression(stmt_exit->expr);
+            }
+            void operator()(const NodeStatementReturn* stmt_return) const
+            {
+                if (stmt_return->expr) {
+                    planner.walk_expression(stmt_return->expr);
+                }
+            }
+            void operator()(const NodeStatementPrint* stmt_print) const
+            {
+                // The print routines preserve every register but rax, so
+                // printing does not make a call as far as the frame goes.
+                if (stmt_print->expr) {
+                    planner.walk_expression(stmt_print->expr);
+                }
+            }
+            void operator()(const NodeStatementArray* stmt_array) const
+            {
+                if (stmt_array->size) {
+                    // Allocating is a call to a routine that preserves
+                    // every register but rax, like printing.
+                    planner.walk_expression(stmt_array->size);
+                    planner.declare(stmt_array->ident.value.value(), true, nullptr, planner.fresh_value());
+                    planner.m_ranges.back().array = stmt_array;
+                    planner.m_pos++;
+                    return;
+                }
+                planner.declare(stmt_array->ident.value.value(), false, nullptr, planner.fresh_value());
+                planner.m_arrays.push_back(stmt_array);
+            }
+            void operator()(const NodeStatementStore* stmt_store) const
+            {
+                planner.walk_expression(stmt_store->index);
+                planner.walk_expression(stmt_store->expr);
+                planner.use(stmt_store->ident.value.value());
+            }
+            void operator()(const NodeStatementInt* stmt_int) const
+            {
+                const Value value = planner.walk_expression(stmt_int->expr);
+                planner.declare(stmt_int->ident.value.value(), true, stmt_int, value);
+                planner.m_pos++;
+            }
+            void operator()(const NodeStatementAssign* stmt_assign) const
+            {
+                const Value value = planner.walk_expression(stmt_assign->expr);
+                planner.use(stmt_assign->ident.value.value());
+                if (Name* var = planner.find(stmt_assign->ident.value.value())) {
+                    var->value = value;
+                }
+            }
+            void operator()(const NodeScope* scope) const
+            {
+                planner.walk_scope(scope);
+            }
+            void operator()(const NodeStatementIf* stmt_if) const
+            {
+                // Only the first condition runs on every path.
+                planner.walk_expression(stmt_if->expr);
+                const Snapshot before = planner.snapshot();
+                std::vector<size_t> assigned;
+                planner.walk_arm(nullptr, stmt_if->scope, before, assigned);
+                std::optional<NodeIfPred*> pred = stmt_if->pred;
+                while (pred.has_value()) {
+                    if (auto elif = std::get_if<NodeIfPredicateElif*>(&pred.value()->var)) {
+                        planner.walk_arm((*elif)->expr, (*elif)->scope, before, assigned);
+                        pred = (*elif)->pred;
+                    } else {
+                        planner.walk_arm(nullptr, std::get<NodeIfPredicateElse*>(pred.value()->var)->scope, before, assigned);
+                        pred.reset();
+                    }
+                }
+                for (size_t var : assigned) {
+                    planner.m_names[var].value = planner.fresh_value();
+                }
+            }
+            void operator()(const NodeStatementFor* stmt_for) const
+            {
+                // The init runs once, in the enclosing scope.
+                if (stmt_for->init) {
+                    planner.walk_statement(stmt_for->init);
+                }
+                std::vector<std::string> assigned;
+                if (stmt_for->iteration) {
+                    collect_assigned(stmt_for->iteration, assigned);
+                }
+                if (stmt_for->scope) {
+                    collect_assigned(stmt_for->scope, assigned);
+                }
+                for (const std::string& name : assigned) {
+                    if (Name* var = planner.find(name)) {
+                        var->value = planner.fresh_value();
+                    }
+                }
+                planner.m_loops.push_back({ planner.m_pos++, {} });
+                const Snapshot header = planner.snapshot();
+                if (stmt_for->condition) {
+                    planner.walk_expression(stmt_for->condition);
+                }
+                // A parallel body runs in a frame of its own, on another
+                // thread, so nothing computed before it can be reused in it.
+                std::unordered_map<Value, Available> outside;
+                if (stmt_for->parallel) {
+                    planner.m_leaf = false;
+                    std::swap(outside, planner.m_available);
+                }
+                if (stmt_for->scope) {
+                    planner.walk_scope(stmt_for->scope);
+                }
+                if (stmt_for->iteration) {
+                    planner.walk_statement(stmt_for->iteration);
+                }
+                if (stmt_for->parallel) {
+                    std::swap(outside, planner.m_available);
+                }
+                // The loop exits from its header, with the values it had there.
+                std::vector<size_t> assigned_in_body;
+                planner.restore(header, assigned_in_body);
+                const size_t end = planner.m_pos++;
+                for (size_t range : planner.m_loops.back().carried) {
+                    planner.m_ranges[range].end = std::max(planner.m_ranges[range].end, end);
+                }
+                planner.m_loops.pop_back();
+            }
+        };
+        std::visit(StmtVisitor { .planner = *this }, stmt->var);
+    }
+
+    // Linear scan in order of range start: each range takes the lowest slot
+    // whose previous owner's range has ended.
+    FrameLayout assign_slots()
+    {
+        FrameLayout layout;
+        layout.leaf = m_leaf;
+        std::vector<size_t> order(m_ranges.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return m_ranges[a].start < m_ranges[b].start; });
+        std::vector<size_t> slots(m_ranges.size());
+        using Active = std::pair<size_t, size_t>; // range end, slot
+        std::priority_queue<Active, std::vector<Active>, std::greater<>> active;
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<>> free;
+        for (size_t index : order) {
+            const Range& range = m_ranges[index];
+            while (!active.empty() && active.top().first < range.start) {
+                free.push(active.top().second);
+                active.pop();
+            }
+            size_t slot = layout.slot_count;
+            if (free.empty()) {
+                layout.slot_count++;
+            } else {
+                slot = free.top();
+                free.pop();
+            }
+            active.emplace(range.end, slot);
+            slots[index] = slot;
+            if (range.expr != nullptr) {
+                layout.value_slots.emplace(range.expr, slot);
+            } else if (range.array != nullptr) {
+                layout.heap_slots.emplace(range.array, slot);
+            } else if (range.scope != nullptr) {
+                layout.heap_marks.emplace(range.scope, slot);
+            } else if (range.decl == nullptr) {
+                layout.param_slots.push_back(slot);
+            } else {
+                layout.local_slots.emplace(range.decl, slot);
+            }
+        }
+        for (const auto& [expr, range] : m_reused) {
+            layout.reused_values.emplace(expr, slots[range]);
+        }
+        for (const NodeStatementArray* array : m_arrays) {
+            layout.array_bytes += array->length * 8;
+            layout.array_offsets.emplace(array, -static_cast<int64_t>(layout.slot_count * 8 + layout.array_bytes));
+        }
+        return layout;
+    }
+
+    bool m_reuse;
+    size_t m_pos = 0;
+    bool m_leaf = true;
+    std::vector<Range> m_ranges;
+    std::vector<Name> m_names;
+    std::vector<Loop> m_loops;
+    std::vector<const NodeStatementArray*> m_arrays;
+
+    std::vector<bool> m_constant; // by value number
+    std::map<std::tuple<size_t, Value, Value>, Value> m_expressions;
+    std::unordered_map<int64_t, Value> m_literals;
+    std::unordered_map<const NodeExpr*, Value> m_numbers; // of the expression being walked
+    std::unordered_map<Value, Available> m_available;
+    std::vector<Value> m_available_log;
+    std::unordered_map<const NodeExpr*, size_t> m_reused; // expression, range
+
+    // Work stacks of number() and visit_expression().
+    struct NumberStep {
+        const NodeExpr* expr;
+        bool operands_done;
+    };
+    struct VisitStep {
+        const NodeExpr* expr = nullptr;
+        bool operands_done = false;
+        const NodeTermIndex* index = nullptr; // the array to use after its index
+        size_t forget = no_slot;              // or the available values to keep
+    };
+    ArenaStack<NumberStep> m_number_steps;
+    ArenaStack<Value> m_number_values;
+    ArenaStack<VisitStep> m_visit_steps;
+};
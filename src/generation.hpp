@@ -1,542 +1,1917 @@
-#pragma once
-#include <sstream>
-#include <vector>
-#include "./tokenization.hpp"
-#include "./parser.hpp"
-#include <map>
-#include <assert.h>
-#include <algorithm>
-
-
-class Generator{
-    public:
-        inline explicit Generator(NodeProg prog)
-        : m_program(std::move(prog))
-        {
-        }
-
-    void gen_term(const NodeTerm* term) {
-            struct TermVisitor {
-                Generator& gen;
-                void operator()(const NodeTermIntLit* term_int_lit) const {
-                    gen.m_output << ";;NodeTermIntLit" << "\n";
-                    gen.m_output << "  mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                    gen.push("rax");
-                    gen.m_output << ";;/NodeTermIntLit" << "\n";
-                }
-                void operator()(const NodeTermIdent* term_ident) const {
-                    std::cout << "m_vars: " << gen.m_vars.size() << std::endl;
-
-                    auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-                        return var.name == term_ident->ident.value.value();
-                    });
-
-                    if (it == gen.m_vars.cend()) {
-                        std::cerr << "Undeclared identifier 1: " << term_ident->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-
-                    gen.m_output << "  ;; Using variable: " << term_ident->ident.value.value() << "\n";
-                    std::vector<std::string> param_registers = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-
-                    if (it->stack_loc < param_registers.size()) {
-                        gen.m_output << "  mov rax, " << param_registers[it->stack_loc] << "\n";
-                    } else {
-                        std::stringstream offset;
-                        offset << "QWORD [rbp - " << (it->stack_loc - param_registers.size() + 1) * 8 << "]"; 
-                        gen.m_output << "  mov rax, " << offset.str() << "\n";
-                    }
-
-                    gen.push("rax");
-                }
-                void operator()(const NodeTermParen* term_paren) const
-                {
-                    gen.generate_expression(term_paren->expr);
-                }
-                void operator()(const NodeTermStringLit* term_string_lit) const {
-                    auto it = gen.m_string_literals.find(term_string_lit->value);
-                    if (it == gen.m_string_literals.end()) {
-                        std::string label = gen.create_label();
-                        gen.m_string_literals[term_string_lit->value] = label;
-                        gen.m_data << label << ": db '" << term_string_lit->value << "', 0\n"; 
-                    }
-
-                    gen.m_output << "  lea rax, [" << gen.m_string_literals[term_string_lit->value] << "]\n";
-                    gen.push("rax");
-                }
-                void operator()(const NodeFunctionCall* func_call) const {
-                    gen.m_output << ";;NodeFunctionCall" << "\n";
-
-                    const std::vector<std::string> argument_registers = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-                    size_t arg_count = func_call->args.size();
-
-                    for (size_t i = 0; i < arg_count; ++i) {
-                        gen.generate_expression(func_call->args[i]);
-
-                        if (i < argument_registers.size()) {
-                            gen.m_output << "  pop " << argument_registers[i] << "\n";
-                        } else {
-                            gen.m_output << "  pop rax\n";
-                            gen.m_output << "  push rax\n";
-                        }
-                    }
-
-                    gen.m_output << "  call " << func_call->ident.value.value() << "\n";
-                    gen.push("rax");
-
-                    gen.m_output << ";;/NodeFunctionCall" << "\n";
-                }
-
-            };
-
-            TermVisitor visitor({.gen = *this});
-            std::visit(visitor, term->var);
-        }
-
-    void generate_bin_expression(const NodeBinExpression* bin_expr){
-        struct BinExpressionVisitor {
-            Generator& gen;
-            void operator()(const NodeBinExpressionSub* sub) const 
-            {
-                gen.m_output << ";;sub\n";
-                gen.generate_expression(sub->rhs);
-                gen.generate_expression(sub->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "  sub rax, rbx\n";
-                gen.push("rax");
-                gen.m_output << ";;/sub\n";
-
-            }
-            void operator()(const NodeBinExpressionAdd* add) const 
-            {
-                gen.m_output << ";;add\n";
-                gen.generate_expression(add->rhs);
-                gen.generate_expression(add->lhs);
-                
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "  add rax, rbx\n";
-                gen.push("rax");
-                gen.m_output << ";;/add\n";
-            }
-            void operator()(const NodeBinExpressionMulti* multi) const 
-            {
-                gen.m_output << ";;multi\n";
-                gen.generate_expression(multi->rhs);
-                gen.generate_expression(multi->lhs);
-                
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "  mul rbx\n";
-                gen.push("rax");
-                gen.m_output << ";;/multi\n";
-
-            }
-            void operator()(const NodeBinExpressionDiv* div) const 
-            {
-                gen.m_output << ";;div\n";
-                gen.generate_expression(div->rhs);
-                gen.generate_expression(div->lhs);
-               
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "  div rbx\n";
-                gen.push("rax");
-                gen.m_output << ";;/div\n";
-
-            }
-            void operator()(const NodeBinExpressionEquals* equals) const {
-                gen.m_output << ";;equals\n";
-                gen.generate_expression(equals->lhs);
-                gen.generate_expression(equals->rhs);
-
-                gen.pop("rbx");  
-                gen.pop("rax");  
-
-                gen.m_output << "  cmp rax, rbx\n"; 
-                gen.m_output << "  mov rax, 0\n";    
-                gen.m_output << "  sete al\n";       
-                gen.push("rax");
-                gen.m_output << ";;/equals\n";
-            }
-            void operator()(const NodeBinExpressionNotEquals* not_equals) const {
-                gen.m_output << ";;not_equals\n";
-                gen.generate_expression(not_equals->lhs);
-                gen.generate_expression(not_equals->rhs);
-
-                gen.pop("rbx");  
-                gen.pop("rax");  
-
-                gen.m_output << "  cmp rax, rbx\n"; 
-                gen.m_output << "  mov rax, 0\n";    
-                gen.m_output << "  setne al\n";       
-                gen.push("rax");
-                gen.m_output << ";;/not_equals\n";
-            }
-            void operator()(const NodeBinExpressionLess* less) const {
-                gen.m_output << ";;less_than\n";
-                gen.generate_expression(less->lhs);
-                gen.generate_expression(less->rhs);
-
-                gen.pop("rbx");  
-                gen.pop("rax");  
-
-                gen.m_output << "  cmp rax, rbx\n"; 
-                gen.m_output << "  mov rax, 0\n";    
-                gen.m_output << "  setl al\n";       
-                gen.push("rax");
-                gen.m_output << ";;/less_than\n";
-            }
-            void operator()(const NodeBinExpressionGreater* greater_than) const {
-                gen.m_output << ";;greater_than\n";
-                gen.generate_expression(greater_than->lhs);
-                gen.generate_expression(greater_than->rhs);
-
-                gen.pop("rbx");  
-                gen.pop("rax");  
-
-                gen.m_output << "  cmp rax, rbx\n"; 
-                gen.m_output << "  mov rax, 0\n";    
-                gen.m_output << "  setg al\n";       
-                gen.push("rax");
-                gen.m_output << ";;/greater_than\n";
-            }
-            void operator()(const NodeTermParen* term_paren) const 
-            {
-                gen.generate_expression(term_paren->expr);
-            }
-        };
-
-        BinExpressionVisitor visitor { .gen = *this };
-        std::visit(visitor, bin_expr->var);
-    }
-
-    void generate_expression(const NodeExpr* expr)
-    {
-        struct ExprVisitor {
-            Generator& gen;
-            void operator()(const NodeTerm* term) const
-            {
-                gen.gen_term(term);
-            }
-            void operator()(const NodeBinExpression* bin_expr) const
-            {
-                gen.generate_bin_expression(bin_expr);
-            }
-        };
-
-        ExprVisitor visitor { .gen = *this };
-        std::visit(visitor, expr->var);
-    }
-
-    void generate_scope(const NodeScope* scope){
-        begin_scope();
-        for(const NodeStatement* statement: scope->statements){
-            generate_statement(statement);
-        }
-        end_scope();
-    }
-
-    void generate_if_predicate(const NodeIfPred* pred, const std::string& end_label){
-        struct PredVisitor {
-            Generator& gen;
-            const std::string& end_label;
-
-            void operator()(const NodeIfPredicateElif* elif) const{
-                gen.generate_expression(elif->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "  test rax, rax\n";
-                gen.m_output << "  jz " << label << "\n";
-                gen.generate_scope(elif->scope);
-                gen.m_output << "  jmp "<< end_label <<  "\n";
-                
-                if(elif->pred.has_value()){
-                    gen.m_output << label << ":\n";
-                    gen.generate_if_predicate(elif->pred.value(), end_label);
-                }
-                
-            }
-            void operator()(const NodeIfPredicateElse* else_) const{
-                gen.generate_scope(else_->scope);
-
-            }
-        };
-
-        PredVisitor visitor{.gen = *this, .end_label = end_label};
-        std::visit(visitor, pred->var);
-
-
-    }
-
-
-    void generate_statement(const NodeStatement* stmt, bool functionPass = false)
-    {
-        struct StmtVisitor {
-            Generator& gen;
-            bool& functionPass;
-
-
-            void operator()(const NodeStatementReturn* statement_return) const {
-                if (!functionPass) {
-                    gen.m_output << ";;Return\n";
-
-                    if (statement_return->expr) {
-                        gen.generate_expression(statement_return->expr);
-                        gen.pop("rax");
-                    }
-                    gen.m_output << "  jmp " << gen.currentFunctionEpilogueLabel() << "\n";
-                    gen.m_output << ";;/Return\n";
-                }
-            }
-
-            
-            void operator()(const NodeFunctionDecl* func_decl) const {
-                    if (functionPass) {
-                    if (!func_decl->ident.value.has_value()) {
-                        std::cerr << "Function identifier is missing." << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-
-                    gen.m_currentFunctionEpilogueLabel = gen.create_label() + "_epilogue";
-
-                    std::string funcName = func_decl->ident.value.value();
-                    gen.m_output << ";; Function: " << funcName << "\n";
-                    gen.m_output << "global " << funcName << "\n";
-                    gen.m_output << funcName << ":\n";
-
-                    gen.m_output << "  push rbp" << "\n";
-                    gen.m_output << "  mov rbp, rsp" << "\n";
-
-                    std::vector<std::string> param_registers = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-
-                    size_t index = 0;
-                    for (const auto& param : func_decl->params) {
-                        if (index < param_registers.size()) {
-                            gen.m_vars.push_back({param.value.value(), index});
-                        } else {
-                            gen.m_output << "  mov rax, [rbp + " << 16 + (index - param_registers.size()) * 8 << "]\n";
-                            gen.m_output << "  push rax\n";
-                            gen.m_vars.push_back({param.value.value(), gen.m_stack_size++});
-                        }
-                        ++index;
-                    }
-
-                    gen.generate_scope(func_decl->body);
-
-                    // Function epilogue
-                    gen.m_output << "  mov rsp, rbp" << "\n";
-                    gen.m_output << "  pop rbp" << "\n";
-                    gen.m_output << "  ret" << "\n";
-
-                    gen.m_output << gen.m_currentFunctionEpilogueLabel << ":\n";
-                    gen.m_output << "  mov rsp, rbp\n";
-                    gen.m_output << "  pop rbp\n";
-                    gen.m_output << "  ret\n";
-                    gen.m_output << ";; /Function: " << funcName << "\n";
-                }
-            }
-
-            void operator()(const NodeStatementExit* stmt_exit) const
-            {
-                if(!functionPass){
-                gen.m_output << ";;Exit\n";
-                gen.generate_expression(stmt_exit->expr);
-                gen.m_output << "  mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "  syscall\n";
-                gen.m_output << ";;/Exit\n";
-                }
-            }
-            void operator()(const NodeStatementInt* stmt_int) const {
-                if (!functionPass) {
-                    auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
-                    return var.name == stmt_int->ident.value.value();
-                    });
-
-                    if (it != gen.m_vars.cend()) {
-                        std::cerr << "Identifier already used: " << stmt_int->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-
-                    gen.generate_expression(stmt_int->expr);
-                    gen.m_vars.push_back({.name = stmt_int->ident.value.value(), .stack_loc = gen.m_stack_size });
-
-                    gen.m_output << "  ;; Declaring int variable: " << stmt_int->ident.value.value() << "\n";
-                }
-            }
-            void operator()(const NodeStatementIf* statement_if) const {
-                if(!functionPass){
-                gen.m_output << ";;If\n";
-                gen.generate_expression(statement_if->expr); 
-                gen.pop("rax");  
-                gen.m_output << "  test rax, rax\n";
-                std::string label = gen.create_label();
-                gen.m_output << "  jz " << label << "\n";
-                gen.generate_scope(statement_if->scope);
-
-                if (statement_if->pred.has_value()) {
-                    const std::string end_label = gen.create_label();
-                    gen.m_output << "  jmp " << end_label << "\n"; 
-                    gen.m_output << label << ":\n";  
-                    gen.generate_if_predicate(statement_if->pred.value(), end_label);
-                    gen.m_output << end_label << ":\n";
-                } else {
-                    gen.m_output << label << ":\n";
-                }
-                
-                }
-                gen.m_output << ";;/If\n";
-            }
-            void operator()(const NodeScope* scope) const
-            {
-                if(!functionPass){
-                gen.generate_scope(scope);
-                }
-            }
-            void operator()(const NodeStatementAssign* stmt_assign) const
-            {
-                if(!functionPass){
-                auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var){
-                    return var.name == stmt_assign->ident.value.value();
-                });
-                
-                if(it == gen.m_vars.end()){
-                    std::cerr << "Undeclared identifier 2: " << stmt_assign->ident.value.value() << std::endl;
-                }
-                gen.generate_expression(stmt_assign->expr);
-                gen.pop("rax");
-
-                std::cout << "NodeStatementAssign:" << std::endl;
-                std::cout << "stack size:" << gen.m_stack_size << std::endl;
-                std::cout << "stack loc:" <<(*it).stack_loc << std::endl;
-                std::cout << "QWORD [rsp + : " << (gen.m_stack_size - (*it).stack_loc) * 8 << std::endl;
-                gen.m_output << "  ;; Assigning to variable: " << stmt_assign->ident.value.value() << "\n";
-                gen.m_output << "  mov [rsp + " << (gen.m_stack_size - (*it).stack_loc) * 8 << "], rax\n";
-                }
-            }
-            void operator()(const NodeStatementFor* stmt_for) const {
-                if(!functionPass){
-                if (stmt_for->init) {
-                    gen.generate_statement(stmt_for->init);
-                }
-                std::string start_label = gen.create_label();
-                std::string end_label = gen.create_label();
-
-                gen.m_output << start_label << ":\n";
-
-                if (stmt_for->condition) {
-                    gen.generate_expression(stmt_for->condition);
-                    gen.pop("rax");
-                    gen.m_output << "  test rax, rax\n";
-                    gen.m_output << "  jz " << end_label << "\n";
-                }
-
-                if (stmt_for->scope) {
-                    gen.generate_scope(stmt_for->scope);
-                }
-
-                if (stmt_for->iteration) {
-                    gen.generate_statement(stmt_for->iteration);
-                }
-                gen.m_output << "  jmp " << start_label << "\n";
-                gen.m_output << end_label << ":\n";
-                }
-            }
-
-            
-        };
-
-        StmtVisitor visitor { .gen = *this, .functionPass = functionPass};
-        std::visit(visitor, stmt->var);
-    }
-
-    std::string generate_program() {
-    std::cout << "generating program" << std::endl;
-    std::stringstream full_output;
-
-    
-
-    m_output << "section .data\n";
-    m_output << m_data.str();
-    m_output << "section .text\n";
-    m_output << "global _start\n";
-    m_output << "_start:\n";
-
-    
-
-    for(const NodeStatement* statement : m_program.statements) {
-        generate_statement(statement, false);
-    }
-
-    m_output << "  mov rdi, rax\n";
-    m_output << "  mov rax, 60\n";
-    m_output << "  syscall\n";
-    
-    m_output << ";;functions\n";
-
-    for(const NodeStatement* statement : m_program.statements) {
-        generate_statement(statement, true);
-    }
-
-    return m_output.str();
-    }
-
-    std::string currentFunctionEpilogueLabel() const {
-        return m_currentFunctionEpilogueLabel;
-    }
-
-    private:    
-
-        void push(const std::string& reg) {
-            m_output << "  push " << reg << "\n";
-            m_stack_size++;
-        }
-
-        void pop(const std::string& reg) {
-            m_output << "  pop " << reg << "\n";
-            m_stack_size--;
-        }
-
-        void begin_scope(){
-            m_output << ";;begin_scope" << "\n";
-            m_scopes.push_back(m_vars.size());
-        }
-
-        void end_scope(){
-            size_t pop_count = m_vars.size() - m_scopes.back();
-            m_output << "  add rsp," << pop_count * 8 << "\n";
-            m_output << ";;endscope" << "\n";
-            m_stack_size -= pop_count;
-            for(int i = 0; i < pop_count; i++){
-                m_vars.pop_back();
-            }
-            m_scopes.pop_back();
-        }
-
-        std::string create_label(){
-            std::stringstream ss;
-            ss << "label" << m_label_count++;
-            std::cout << ss.str() << "\n";
-            return ss.str();
-        }
-
-
-
-        struct Var {
-            std::string name;
-            size_t stack_loc;
-        };
-
-        std::string m_currentFunctionEpilogueLabel;
-        std::stringstream m_function_defs;
-        std::stringstream m_data; // For storing data section
-        std::map<std::string, std::string> m_string_literals; // Map from string literal to its label
-        const NodeProg m_program;
-        std::stringstream m_output;
-        size_t m_stack_size = 0;
-        std::vector<Var> m_vars {};
-        std::vector<size_t> m_scopes {};
-        int m_label_count = 0;
+#pragma once
+#include <sstream>
+#include <vector>
+#include "./tokenization.hpp"
+#include "./parser.hpp"
+#include "./cache.hpp"
+#include "./thread_pool.hpp"
+#include "./profile.hpp"
+#include "./layout.hpp"
+#include "./frame.hpp"
+#include "./evaluator.hpp"
+#include "./runtime.hpp"
+#include "./vectorize.hpp"
+#include "./parallel.hpp"
+#include "./stats.hpp"
+#include <map>
+#include <assert.h>
+#include <algorithm>
+
+// One function's code. Functions are assembled and cached apart from
+// `_start` when a cache is in use.
+struct FunctionUnit {
+    uint64_t key = 0;
+    std::string code;
+    std::vector<std::string> strings;
+    std::optional<ObjectFile> object; // set when it came from the cache
+    std::string name;
+    uint64_t hash = 0;                // of the function's tokens
+    size_t counters = 0;              // profile counters, when instrumented
+    uint64_t entry_count = 0;         // calls seen in the profile in use
+
+    std::string source() const
+    {
+        return "default rel\nsection .text\n" + code;
+    }
+};
+
+// The optimizations the generator applies, all on by default. With every
+// one off, each statement is lowered on its own through the stack.
+struct Passes {
+    bool fold = true;      // calls with constant arguments and whole programs, through the evaluator
+    bool reuse = true;     // common subexpressions, see FramePlanner
+    bool registers = true; // leaves keep their variables in registers and have no frame
+    bool vectorize = true; // counted loops, see Vectorizer
+    bool tidy = true;      // see tidy_layout
+
+    // -O0 is none of them. -O1 keeps the ones that need no analysis across
+    // statements: folding, leaf registers and tidying. -O2, the default,
+    // adds common subexpressions and vector loops.
+    static Passes level(int level)
+    {
+        Passes passes;
+        passes.fold = passes.registers = passes.tidy = level >= 1;
+        passes.reuse = passes.vectorize = level >= 2;
+        return passes;
+    }
+
+    std::string key() const
+    {
+        return std::string("passes ") + (fold ? "f" : "") + (reuse ? "r" : "") + (registers ? "g" : "")
+            + (vectorize ? "v" : "") + (tidy ? "t" : "");
+    }
+};
+
+inline constexpr std::pair<const char*, bool Passes::*> pass_list[] = {
+    { "fold", &Passes::fold },
+    { "reuse", &Passes::reuse },
+    { "registers", &Passes::registers },
+    { "vectorize", &Passes::vectorize },
+    { "tidy", &Passes::tidy },
+};
+
+class Generator{
+    public:
+        // With `jit`, `__cato_exit` flushes the output and then jumps to
+        // `__cato_host_exit`, which the JIT binds to a host routine;
+        // everything else is lowered exactly as for AOT.
+        inline explicit Generator(NodeProg prog, bool jit = false)
+        : m_program(std::move(prog)), m_jit(jit)
+        {
+        }
+
+        // Reuses cached functions; the caller stores new ones once assembled.
+        inline void use_cache(FunctionCache* cache)
+        {
+            m_cache = cache;
+        }
+
+        // Functions are lowered on this many threads. The output does not
+        // depend on it.
+        inline void set_jobs(size_t jobs)
+        {
+            m_jobs = std::max<size_t>(jobs, 1);
+        }
+
+        // Counts function entries, if/elif/else arms and for loop entries
+        // and back-edges; the program writes the counts to `path` when it
+        // exits. Instrumented functions are not cached.
+        inline void instrument(std::string path)
+        {
+            m_profile_path = std::move(path);
+        }
+
+        // Lays out branches and orders functions by the counts in `profile`.
+        inline void use_profile(const Profile* profile)
+        {
+            m_profile = profile;
+        }
+
+        inline void set_layout(const LayoutPolicy& layout)
+        {
+            m_layout = layout;
+        }
+
+        // Asks the kernel to back heap regions with huge pages.
+        inline void set_huge_pages(bool huge_pages)
+        {
+            m_huge_pages = huge_pages;
+        }
+
+        // Times the passes that run inside lowering (frame planning with
+        // value numbering, leaf registers, vectorizing, evaluating calls
+        // and tidying the layout) apart from the lowering itself.
+        inline void set_stats(BuildStats* stats)
+        {
+            m_stats = stats;
+        }
+
+        // Marks the code of each statement with a `%line` directive naming
+        // its line in `file`, which the assembler keeps as a line table.
+        inline void set_debug_lines(std::string file)
+        {
+            m_line_file = std::move(file);
+        }
+
+        // Replaces calls whose arguments are constants with their results
+        // and, if it runs to completion, the whole program with its exit
+        // code. Not used when instrumenting, which needs the calls to count.
+        inline void use_evaluator(Evaluator* evaluator)
+        {
+            m_evaluator = evaluator;
+        }
+
+        inline void set_passes(const Passes& passes)
+        {
+            m_passes = passes;
+        }
+
+    // Lowers a term, or queues the steps for the expressions inside it.
+    void gen_term(const NodeTerm* term) {
+            struct TermVisitor {
+                Generator& gen;
+                void operator()(const NodeTermIntLit* term_int_lit) const {
+                    gen.m_output << ";;NodeTermIntLit" << "\n";
+                    gen.m_output << "  mov rax, " << term_int_lit->value << "\n";
+                    gen.push("rax");
+                    gen.m_output << ";;/NodeTermIntLit" << "\n";
+                }
+                void operator()(const NodeTermIdent* term_ident) const {
+                    auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
+                        return var.name == term_ident->ident.value.value();
+                    });
+
+                    if (it == gen.m_vars.cend()) {
+                        compile_error("Undeclared identifier 1: " + term_ident->ident.value.value());
+                    }
+                    if (it->is_array()) {
+                        compile_error("Array used as a value: " + term_ident->ident.value.value());
+                    }
+
+                    gen.m_output << "  ;; Using variable: " << term_ident->ident.value.value() << "\n";
+                    gen.m_output << "  mov rax, " << it->location << "\n";
+                    gen.push("rax");
+                }
+                void operator()(const NodeTermParen* term_paren) const
+                {
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = term_paren->expr });
+                }
+                void operator()(const NodeTermNot* term_not) const
+                {
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::negate });
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = term_not->expr });
+                }
+                void operator()(const NodeTermIndex* term_index) const {
+                    gen.find_array(term_index->ident); // reports a bad name before the index
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::element, .term = term_index });
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = term_index->index });
+                }
+                void operator()(const NodeTermLength* term_length) const {
+                    const Var array = gen.find_array(term_length->ident);
+                    if (array.heap) {
+                        // The length is in the qword before element 0.
+                        gen.m_output << "  mov rax, " << array.location << "\n";
+                        gen.m_output << "  mov rax, [rax - 8]\n";
+                    } else {
+                        gen.m_output << "  mov rax, " << array.length << "\n";
+                    }
+                    gen.push("rax");
+                }
+                void operator()(const NodeTermStringLit* term_string_lit) const {
+                    gen.m_output << "  lea rax, [" << gen.string_label(term_string_lit->value) << "]\n";
+                    gen.push("rax");
+                }
+                void operator()(const NodeFunctionCall* func_call) const {
+                    if (std::optional<int64_t> value = gen.fold_call(func_call)) {
+                        gen.m_output << "  ;; " << func_call->ident.value.value() << "(...) evaluated at compile time\n";
+                        gen.m_output << "  mov rax, " << value.value() << "\n";
+                        gen.push("rax");
+                        return;
+                    }
+                    gen.m_output << ";;NodeFunctionCall" << "\n";
+
+                    // Every argument is evaluated before any register is
+                    // loaded, since evaluating one may itself make a call.
+                    gen.m_expr_steps.push({ .kind = ExprStep::Kind::call, .call = func_call });
+                    for (size_t i = func_call->args.size(); i-- > 0;) {
+                        gen.m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = func_call->args[i] });
+                    }
+                }
+
+            };
+
+            TermVisitor visitor({.gen = *this});
+            std::visit(visitor, term->var);
+        }
+
+    // Reads the element whose index was just pushed.
+    void generate_element(const NodeTermIndex* term_index) {
+        const Var array = find_array(term_index->ident);
+        pop("rax");
+        m_output << "  ;; Reading an element of: " << array.name << "\n";
+        const std::string address = element(array, "rax", "rcx");
+        m_output << "  mov rax, " << address << "\n";
+        push("rax");
+    }
+
+    // Makes the call once its arguments are pushed, in order.
+    void generate_call(const NodeFunctionCall* func_call) {
+        const size_t arg_count = func_call->args.size();
+        if (arg_count <= param_registers.size()) {
+            for (size_t i = arg_count; i-- > 0;) {
+                pop(param_registers[i]);
+            }
+            m_output << "  call " << func_call->ident.value.value() << "\n";
+        } else {
+            // Stack arguments are copied below the evaluated
+            // ones so the seventh ends up on top.
+            const size_t stack_args = arg_count - param_registers.size();
+            for (size_t i = 0; i < stack_args; i++) {
+                m_output << "  mov rax, [rsp + " << (2 * i) * 8 << "]\n";
+                push("rax");
+            }
+            for (size_t i = 0; i < param_registers.size(); i++) {
+                m_output << "  mov " << param_registers[i] << ", [rsp + " << (stack_args + arg_count - 1 - i) * 8 << "]\n";
+            }
+            m_output << "  call " << func_call->ident.value.value() << "\n";
+            m_output << "  add rsp, " << (stack_args + arg_count) * 8 << "\n";
+        }
+        push("rax");
+
+        m_output << ";;/NodeFunctionCall" << "\n";
+    }
+
+    static const char* bin_name(const NodeBinExpression* bin_expr) {
+        static constexpr const char* names[] = { "add", "sub", "multi", "div", "equals", "not_equals", "less_than", "greater_than", "and", "or" };
+        return names[bin_expr->var.index()];
+    }
+
+    // Applies the operator once both operands are pushed, the one
+    // evaluated second on top.
+    void generate_bin_expression(const NodeBinExpression* bin_expr){
+        if (evaluates_lhs_first(bin_expr)) {
+            pop("rbx");
+            pop("rax");
+        } else {
+            pop("rax");
+            pop("rbx");
+        }
+        struct BinExpressionVisitor {
+            Generator& gen;
+            void operator()(const NodeBinExpressionSub*) const
+            {
+                gen.m_output << "  sub rax, rbx\n";
+            }
+            void operator()(const NodeBinExpressionAdd*) const
+            {
+                gen.m_output << "  add rax, rbx\n";
+            }
+            void operator()(const NodeBinExpressionMulti*) const
+            {
+                gen.m_output << "  imul rax, rbx\n";
+            }
+            void operator()(const NodeBinExpressionDiv*) const
+            {
+                if (gen.m_preserve_rdx) {
+                    gen.push("rdx");
+                }
+                gen.m_output << "  cqo\n";
+                gen.m_output << "  idiv rbx\n";
+                if (gen.m_preserve_rdx) {
+                    gen.pop("rdx");
+                }
+            }
+            void operator()(const NodeBinExpressionEquals*) const
+            {
+                compare("sete");
+            }
+            void operator()(const NodeBinExpressionNotEquals*) const
+            {
+                compare("setne");
+            }
+            void operator()(const NodeBinExpressionLess*) const
+            {
+                compare("setl");
+            }
+            void operator()(const NodeBinExpressionGreater*) const
+            {
+                compare("setg");
+            }
+            // Lowered by generate_shortcut and generate_join instead.
+            void operator()(const NodeBinExpressionAnd*) const { }
+            void operator()(const NodeBinExpressionOr*) const { }
+            void compare(const char* set) const
+            {
+                gen.m_output << "  cmp rax, rbx\n";
+                gen.m_output << "  mov rax, 0\n";
+                gen.m_output << "  " << set << " al\n";
+            }
+        };
+
+        BinExpressionVisitor visitor { .gen = *this };
+        std::visit(visitor, bin_expr->var);
+        push("rax");
+        m_output << ";;/" << bin_name(bin_expr) << "\n";
+    }
+
+    // `&&` and `||` have the value of their left operand, just popped into
+    // rax, if it decides them: 0 for `&&` and anything else for `||`. Then
+    // the right operand is skipped and rax is normalized at the join.
+    void generate_shortcut(const NodeBinExpression* bin_expr) {
+        const std::string label = create_label();
+        m_join_labels.push_back(label);
+        pop("rax");
+        m_output << "  test rax, rax\n";
+        m_output << "  " << (std::holds_alternative<NodeBinExpressionAnd*>(bin_expr->var) ? "jz " : "jnz ") << label << "\n";
+    }
+
+    void generate_join(const NodeBinExpression* bin_expr) {
+        const std::string label = m_join_labels.back();
+        m_join_labels.pop_back();
+        pop("rax");
+        const bool is_and = std::holds_alternative<NodeBinExpressionAnd*>(bin_expr->var);
+        if (!is_and) {
+            m_output << label << ":\n";
+        }
+        m_output << "  test rax, rax\n";
+        m_output << "  mov rax, 0\n";
+        m_output << "  setne al\n";
+        if (is_and) {
+            m_output << label << ":\n";
+        }
+        push("rax");
+        m_output << ";;/" << bin_name(bin_expr) << "\n";
+    }
+
+    void generate_negate() {
+        pop("rax");
+        m_output << "  test rax, rax\n";
+        m_output << "  mov rax, 0\n";
+        m_output << "  sete al\n";
+        push("rax");
+    }
+
+    // Lowers `expr`, leaving its value pushed. The walk keeps its own stack
+    // of steps instead of recursing, so nesting is limited only by memory.
+    void generate_expression(const NodeExpr* expr)
+    {
+        const size_t base = m_expr_steps.size();
+        m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = expr });
+        while (m_expr_steps.size() > base) {
+            const ExprStep step = m_expr_steps.pop();
+            switch (step.kind) {
+            case ExprStep::Kind::lower:
+                lower_expression(step.expr);
+                break;
+            case ExprStep::Kind::operation:
+                generate_bin_expression(std::get<NodeBinExpression*>(step.expr->var));
+                break;
+            case ExprStep::Kind::shortcut:
+                generate_shortcut(std::get<NodeBinExpression*>(step.expr->var));
+                break;
+            case ExprStep::Kind::join:
+                generate_join(std::get<NodeBinExpression*>(step.expr->var));
+                break;
+            case ExprStep::Kind::negate:
+                generate_negate();
+                break;
+            case ExprStep::Kind::element:
+                generate_element(step.term);
+                break;
+            case ExprStep::Kind::call:
+                generate_call(step.call);
+                break;
+            case ExprStep::Kind::save:
+                // rax still holds the value just pushed.
+                m_output << "  mov " << slot_location(m_frame.value_slots.at(step.expr)) << ", rax\n";
+                break;
+            }
+        }
+    }
+
+    void lower_expression(const NodeExpr* expr)
+    {
+        if (auto reused = m_frame.reused_values.find(expr); reused != m_frame.reused_values.end()) {
+            m_output << "  ;; Reusing an earlier value\n";
+            m_output << "  mov rax, " << slot_location(reused->second) << "\n";
+            push("rax");
+            return;
+        }
+        if (m_frame.value_slots.contains(expr)) {
+            m_expr_steps.push({ .kind = ExprStep::Kind::save, .expr = expr });
+        }
+        if (auto bin_expr = std::get_if<NodeBinExpression*>(&expr->var)) {
+            m_output << ";;" << bin_name(*bin_expr) << "\n";
+            const auto [lhs, rhs] = std::visit([](const auto* bin) {
+                return std::pair<const NodeExpr*, const NodeExpr*> { bin->lhs, bin->rhs };
+            }, (*bin_expr)->var);
+            if (logical(*bin_expr)) {
+                m_expr_steps.push({ .kind = ExprStep::Kind::join, .expr = expr });
+                m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = rhs });
+                m_expr_steps.push({ .kind = ExprStep::Kind::shortcut, .expr = expr });
+                m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = lhs });
+                return;
+            }
+            m_expr_steps.push({ .kind = ExprStep::Kind::operation, .expr = expr });
+            const bool lhs_first = evaluates_lhs_first(*bin_expr);
+            m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = lhs_first ? rhs : lhs });
+            m_expr_steps.push({ .kind = ExprStep::Kind::lower, .expr = lhs_first ? lhs : rhs });
+        } else {
+            gen_term(std::get<NodeTerm*>(expr->var));
+        }
+    }
+
+    void generate_scope(const NodeScope* scope){
+        begin_scope();
+        auto mark = m_frame.heap_marks.find(scope);
+        if (mark != m_frame.heap_marks.end()) {
+            m_output << "  mov rax, [__cato_heap_top]\n";
+            m_output << "  mov " << slot_location(mark->second) << ", rax\n";
+        }
+        for(const NodeStatement* statement: scope->statements){
+            generate_statement(statement);
+        }
+        if (mark != m_frame.heap_marks.end()) {
+            release_heap(mark->second);
+        }
+        end_scope();
+    }
+
+    // Frees what was allocated since the heap top was saved in `slot`.
+    // rax may hold a return value or the last statement's.
+    // A program without `exit` exits with rax. Statements with no value
+    // of their own leave 0 there instead of an address, which would change
+    // from run to run, or whatever the runtime left.
+    void clear_implicit_value(){
+        if (!m_in_function) {
+            m_output << "  mov rax, 0\n";
+        }
+    }
+
+    void release_heap(size_t slot){
+        push("rax");
+        m_output << "  mov rax, " << slot_location(slot) << "\n";
+        m_output << "  call __cato_heap_reset\n";
+        pop("rax");
+    }
+
+    // An if/elif/else chain being lowered. Arms the profile says are
+    // unlikely are moved past the end of the chain so the likely path falls
+    // through; arms that almost never run go to the end of the function.
+    struct IfChain {
+        std::string end_label;
+        uint64_t reached = 0; // profiled runs that got to the current arm
+        std::stringstream unlikely {};
+    };
+
+    void generate_if_predicate(const NodeIfPred* pred, IfChain& chain){
+        struct PredVisitor {
+            Generator& gen;
+            IfChain& chain;
+
+            void operator()(const NodeIfPredicateElif* elif) const{
+                gen.generate_arm(elif->expr, elif->scope, !elif->pred.has_value(), chain);
+                if(elif->pred.has_value()){
+                    gen.generate_if_predicate(elif->pred.value(), chain);
+                }
+            }
+            void operator()(const NodeIfPredicateElse* else_) const{
+                gen.count_point();
+                gen.generate_scope(else_->scope);
+            }
+        };
+
+        PredVisitor visitor{.gen = *this, .chain = chain};
+        std::visit(visitor, pred->var);
+    }
+
+    // Runs `scope` if `cond` holds and then leaves the chain; otherwise
+    // falls through to the next arm.
+    void generate_arm(const NodeExpr* cond, const NodeScope* scope, bool last, IfChain& chain){
+        const std::string label = create_label();
+        // The arm's own counter is the next one handed out.
+        const uint64_t taken = profile_count(m_profile_counters);
+        const uint64_t skipped = chain.reached - std::min(taken, chain.reached);
+        if (!m_function_profile || chain.reached == 0 || taken >= skipped) {
+            generate_branch(cond, false, label);
+            count_point();
+            generate_scope(scope);
+            if (!last) {
+                m_output << "  jmp " << chain.end_label << "\n";
+            }
+            m_output << label << ":\n";
+        } else {
+            generate_branch(cond, true, label);
+            std::stringstream body;
+            std::swap(m_output, body);
+            m_output << label << ":\n";
+            count_point();
+            generate_scope(scope);
+            m_output << "  jmp " << chain.end_label << "\n";
+            std::swap(m_output, body);
+            // Under one run in a hundred counts as cold.
+            (taken * 100 < chain.reached ? m_cold_output : chain.unlikely) << body.str();
+        }
+        chain.reached = skipped;
+    }
+
+
+    // Jumps to `target` if `cond` is nonzero and `when` is true, or if it is
+    // zero and `when` is false, and falls through otherwise.
+    void generate_branch(const NodeExpr* cond, bool when, const std::string& target){
+        if (!jumps_on_parts(cond)) {
+            generate_expression(cond);
+            pop("rax");
+            m_output << "  test rax, rax\n";
+            m_output << "  " << (when ? "jnz " : "jz ") << target << "\n";
+            return;
+        }
+        generate_condition(cond, when, target);
+        if (!m_in_function) {
+            // Top-level code exits with rax when it runs off the end, which
+            // is the value of the last condition, 0 or 1 for these.
+            m_output << "  mov rax, " << (when ? 0 : 1) << "\n";
+        }
+    }
+
+    // Whether `cond` is a `&&`, `||` or `!`, which generate_condition
+    // lowers to jumps on their operands.
+    static bool jumps_on_parts(const NodeExpr* cond){
+        while (auto term = std::get_if<NodeTerm*>(&cond->var)) {
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                cond = (*paren)->expr;
+            } else {
+                return std::holds_alternative<NodeTermNot*>((*term)->var);
+            }
+        }
+        return logical(std::get<NodeBinExpression*>(cond->var));
+    }
+
+    // Lowers `cond` as a chain of jumps, as generate_branch describes, that
+    // evaluates the operands of `&&` and `||` only as far as they decide it
+    // and never materializes their values. Comparisons in it jump on their
+    // flags unless their value is reused.
+    void generate_condition(const NodeExpr* cond, bool jump_when, const std::string& target){
+        std::vector<std::string> labels { target };
+        m_cond_steps.clear();
+        m_cond_steps.push({ .expr = cond, .when = jump_when });
+        while (!m_cond_steps.empty()) {
+            const CondStep step = m_cond_steps.pop();
+            if (step.expr == nullptr) {
+                m_output << labels[step.place] << ":\n";
+                continue;
+            }
+            const NodeExpr* expr = step.expr;
+            bool when = step.when;
+            while (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+                if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                    expr = (*paren)->expr;
+                } else if (auto term_not = std::get_if<NodeTermNot*>(&(*term)->var)) {
+                    expr = (*term_not)->expr;
+                    when = !when;
+                } else {
+                    break;
+                }
+            }
+            // A jump to `target` sets the exit value first, as
+            // generate_branch does when falling through.
+            const char* exit_value = m_in_function || step.target != 0 ? nullptr : (jump_when ? "1" : "0");
+            auto bin_expr = std::get_if<NodeBinExpression*>(&expr->var);
+            if (bin_expr != nullptr && logical(*bin_expr)) {
+                const auto [lhs, rhs] = std::visit([](const auto* bin) {
+                    return std::pair<const NodeExpr*, const NodeExpr*> { bin->lhs, bin->rhs };
+                }, (*bin_expr)->var);
+                // `a && b` is false as soon as a is and `a || b` true as
+                // soon as a is, so a jump on that goes straight to the
+                // target and otherwise past b.
+                const bool decides = !std::holds_alternative<NodeBinExpressionAnd*>((*bin_expr)->var);
+                if (when == decides) {
+                    m_cond_steps.push({ .expr = rhs, .when = when, .target = step.target });
+                    m_cond_steps.push({ .expr = lhs, .when = when, .target = step.target });
+                } else {
+                    const size_t skip = labels.size();
+                    labels.push_back(create_label());
+                    m_cond_steps.push({ .place = skip });
+                    m_cond_steps.push({ .expr = rhs, .when = when, .target = step.target });
+                    m_cond_steps.push({ .expr = lhs, .when = decides, .target = skip });
+                }
+                continue;
+            }
+            const char* jump = nullptr;
+            if (bin_expr != nullptr && !m_frame.value_slots.contains(expr) && !m_frame.reused_values.contains(expr)) {
+                jump = std::visit([&](const auto* bin) -> const char* {
+                    using Bin = std::remove_cvref_t<decltype(*bin)>;
+                    if constexpr (std::is_same_v<Bin, NodeBinExpressionEquals>) {
+                        return when ? "je " : "jne ";
+                    } else if constexpr (std::is_same_v<Bin, NodeBinExpressionNotEquals>) {
+                        return when ? "jne " : "je ";
+                    } else if constexpr (std::is_same_v<Bin, NodeBinExpressionLess>) {
+                        return when ? "jl " : "jge ";
+                    } else if constexpr (std::is_same_v<Bin, NodeBinExpressionGreater>) {
+                        return when ? "jg " : "jle ";
+                    } else {
+                        return nullptr;
+                    }
+                }, (*bin_expr)->var);
+            }
+            if (jump != nullptr) {
+                const auto [lhs, rhs] = std::visit([](const auto* bin) {
+                    return std::pair<const NodeExpr*, const NodeExpr*> { bin->lhs, bin->rhs };
+                }, (*bin_expr)->var);
+                const bool lhs_first = evaluates_lhs_first(*bin_expr);
+                generate_expression(lhs_first ? lhs : rhs);
+                generate_expression(lhs_first ? rhs : lhs);
+                pop(lhs_first ? "rbx" : "rax");
+                pop(lhs_first ? "rax" : "rbx");
+                m_output << "  cmp rax, rbx\n";
+            } else {
+                generate_expression(expr);
+                pop("rax");
+                m_output << "  test rax, rax\n";
+                jump = when ? "jnz " : "jz ";
+            }
+            if (exit_value != nullptr) {
+                m_output << "  mov rax, " << exit_value << "\n";
+            }
+            m_output << "  " << jump << labels[step.target] << "\n";
+        }
+    }
+
+    // Runs `loop` two iterations at a time while at least two are left and
+    // leaves the counter and the reduction targets as the scalar loop would
+    // have had them by then. Framed code keeps its variables in memory, so
+    // the argument registers and all the SSE registers are free here; a
+    // leaf keeps variables in those registers and is left alone. xmm0-xmm5
+    // evaluate expressions, xmm6 is scratch, xmm7 holds ones, xmm8-xmm12
+    // are the reductions' partial sums, xmm13 the counters and xmm14-xmm15
+    // the broadcast values.
+    void generate_vector_loop(const VectorLoop& loop){
+        if (m_frameless) {
+            return;
+        }
+        auto find = [&](const std::string& name, bool array) -> const Var* {
+            auto it = std::find_if(m_vars.cbegin(), m_vars.cend(), [&](const Var& var) {
+                return var.name == name;
+            });
+            return it != m_vars.cend() && it->is_array() == array ? &*it : nullptr;
+        };
+        const Var* counter = find(loop.counter, false);
+        std::string end = std::to_string(loop.end.value);
+        const Var* end_array = nullptr; // a heap array, whose length is in memory
+        if (!loop.end.name.empty()) {
+            const Var* var = find(loop.end.name, false);
+            if (var == nullptr) {
+                return;
+            }
+            end = var->location;
+        } else if (!loop.end_length.empty()) {
+            const Var* var = find(loop.end_length, true);
+            if (var == nullptr) {
+                return;
+            }
+            end = std::to_string(var->length);
+            end_array = var->heap ? var : nullptr;
+        }
+        std::vector<const Var*> bases;
+        for (const std::string& name : loop.arrays) {
+            const Var* var = find(name, true);
+            if (var == nullptr) {
+                return;
+            }
+            bases.push_back(var);
+        }
+        std::vector<std::string> broadcasts;
+        for (const VectorLoop::Broadcast& broadcast : loop.broadcasts) {
+            const Var* var = broadcast.name.empty() ? nullptr : find(broadcast.name, false);
+            if (!broadcast.name.empty() && var == nullptr) {
+                return;
+            }
+            broadcasts.push_back(var != nullptr ? var->location : std::to_string(broadcast.value));
+        }
+        std::vector<std::string> targets;
+        for (const VectorLoop::Step& step : loop.steps) {
+            const Var* var = find(step.name, step.kind == VectorLoop::StepKind::store);
+            if (var == nullptr || counter == nullptr) {
+                return;
+            }
+            if (step.kind != VectorLoop::StepKind::store) {
+                targets.push_back(var->location);
+            }
+        }
+
+        const std::string start_label = create_label();
+        const std::string end_label = create_label();
+        m_output << "  ;; Two iterations at a time\n";
+        m_output << "  mov rcx, " << counter->location << "\n";
+        if (end_array != nullptr) {
+            m_output << "  mov rdx, " << end_array->location << "\n";
+            m_output << "  mov rdx, [rdx - 8]\n";
+        } else {
+            m_output << "  mov rdx, " << end << "\n";
+        }
+        for (size_t i = 0; i < bases.size(); i++) {
+            if (bases[i]->heap) {
+                m_output << "  mov " << vector_base_registers[i] << ", " << bases[i]->location << "\n";
+            } else {
+                m_output << "  lea " << vector_base_registers[i] << ", [" << bases[i]->location << "]\n";
+            }
+        }
+        if (loop.uses_not_equals || loop.uses_counter) {
+            m_output << "  mov rax, 1\n";
+            m_output << "  movq xmm7, rax\n";
+            m_output << "  punpcklqdq xmm7, xmm7\n";
+        }
+        if (loop.uses_counter) {
+            // xmm13 holds counter and counter + 1.
+            m_output << "  movq xmm13, rcx\n";
+            m_output << "  punpcklqdq xmm13, xmm13\n";
+            m_output << "  movq xmm6, rax\n";
+            m_output << "  pshufd xmm6, xmm6, 0x4E\n";
+            m_output << "  paddq xmm13, xmm6\n";
+        }
+        for (size_t i = 0; i < broadcasts.size(); i++) {
+            m_output << "  mov rax, " << broadcasts[i] << "\n";
+            m_output << "  movq " << xmm(14 + i) << ", rax\n";
+            m_output << "  punpcklqdq " << xmm(14 + i) << ", " << xmm(14 + i) << "\n";
+        }
+        for (size_t i = 0; i < targets.size(); i++) {
+            m_output << "  pxor " << xmm(8 + i) << ", " << xmm(8 + i) << "\n";
+        }
+        // A pair is left while counter < end - 1.
+        m_output << "  sub rdx, 1\n";
+        m_output << "  jo " << end_label << "\n";
+        if (m_layout.loop_align > 1) {
+            m_output << "align " << m_layout.loop_align << "\n";
+        }
+        m_output << start_label << ":\n";
+        m_output << "  cmp rcx, rdx\n";
+        m_output << "  jge " << end_label << "\n";
+        size_t reduction = 0;
+        for (const VectorLoop::Step& step : loop.steps) {
+            const std::string value = generate_vector_expr(loop, step.expr, 0);
+            if (step.kind == VectorLoop::StepKind::store) {
+                const size_t array = std::find(loop.arrays.begin(), loop.arrays.end(), step.name) - loop.arrays.begin();
+                m_output << "  movdqu [" << vector_base_registers[array] << " + rcx*8], " << value << "\n";
+            } else {
+                m_output << "  paddq " << xmm(8 + reduction++) << ", " << value << "\n";
+            }
+        }
+        if (loop.uses_counter) {
+            m_output << "  paddq xmm13, xmm7\n";
+            m_output << "  paddq xmm13, xmm7\n";
+        }
+        m_output << "  add rcx, 2\n";
+        m_output << "  jmp " << start_label << "\n";
+        m_output << end_label << ":\n";
+        m_output << "  mov " << counter->location << ", rcx\n";
+        reduction = 0;
+        for (const VectorLoop::Step& step : loop.steps) {
+            if (step.kind == VectorLoop::StepKind::store) {
+                continue;
+            }
+            const std::string acc = xmm(8 + reduction);
+            m_output << "  pshufd xmm6, " << acc << ", 0xEE\n";
+            m_output << "  paddq " << acc << ", xmm6\n";
+            m_output << "  movq rax, " << acc << "\n";
+            m_output << "  " << (step.kind == VectorLoop::StepKind::add ? "add " : "sub ") << targets[reduction++] << ", rax\n";
+        }
+    }
+
+    static std::string xmm(size_t index){
+        return "xmm" + std::to_string(index);
+    }
+
+    // Leaves the value of `expr` for elements rcx and rcx + 1 in xmm`reg`,
+    // using the registers above it, and returns where it is: a broadcast
+    // value stays in its own register. xmm6 is scratch.
+    std::string generate_vector_expr(const VectorLoop& loop, size_t expr, size_t reg){
+        const VectorExpr& e = loop.exprs[expr];
+        if (e.kind == VectorExpr::Kind::broadcast) {
+            return xmm(14 + e.operand);
+        }
+        if (e.kind == VectorExpr::Kind::counter) {
+            return "xmm13";
+        }
+        const std::string dst = xmm(reg);
+        if (e.kind == VectorExpr::Kind::load) {
+            m_output << "  movdqu " << dst << ", [" << vector_base_registers[e.operand] << " + rcx*8]\n";
+            return dst;
+        }
+        const std::string lhs = generate_vector_expr(loop, e.lhs, reg);
+        if (lhs != dst) {
+            m_output << "  movdqa " << dst << ", " << lhs << "\n";
+        }
+        const std::string rhs = generate_vector_expr(loop, e.rhs, reg + 1);
+        switch (e.kind) {
+        case VectorExpr::Kind::add:
+            m_output << "  paddq " << dst << ", " << rhs << "\n";
+            break;
+        case VectorExpr::Kind::sub:
+            m_output << "  psubq " << dst << ", " << rhs << "\n";
+            break;
+        default:
+            // Both halves of a qword compare equal, ANDed into a 0 or 1.
+            m_output << "  pcmpeqd " << dst << ", " << rhs << "\n";
+            m_output << "  pshufd xmm6, " << dst << ", 0xB1\n";
+            m_output << "  pand " << dst << ", xmm6\n";
+            m_output << "  psrlq " << dst << ", 63\n";
+            if (e.kind == VectorExpr::Kind::not_equals) {
+                m_output << "  pxor " << dst << ", xmm7\n";
+            }
+            break;
+        }
+        return dst;
+    }
+
+    void generate_statement(const NodeStatement* stmt, bool functionPass = false)
+    {
+        if (!functionPass && !std::holds_alternative<NodeFunctionDecl*>(stmt->var)) {
+            mark_line(stmt->line);
+        }
+        struct StmtVisitor {
+            Generator& gen;
+            bool& functionPass;
+
+
+            void operator()(const NodeStatementReturn* statement_return) const {
+                if (!functionPass) {
+                    gen.m_output << ";;Return\n";
+
+                    if (statement_return->expr) {
+                        gen.generate_expression(statement_return->expr);
+                        gen.pop("rax");
+                    }
+                    gen.m_output << "  jmp " << gen.currentFunctionEpilogueLabel() << "\n";
+                    gen.m_output << ";;/Return\n";
+                }
+            }
+
+            
+            void operator()(const NodeFunctionDecl* func_decl) const {
+                if (functionPass) {
+                    gen.generate_function(func_decl);
+                }
+            }
+
+            void operator()(const NodeStatementExit* stmt_exit) const
+            {
+                if(!functionPass){
+                gen.m_output << ";;Exit\n";
+                gen.generate_expression(stmt_exit->expr);
+                gen.pop("rdi");
+                gen.m_output << "  call __cato_exit\n";
+                gen.m_output << ";;/Exit\n";
+                }
+            }
+            void operator()(const NodeStatementPrint* stmt_print) const
+            {
+                if(!functionPass){
+                gen.m_output << ";;Print\n";
+                if (stmt_print->expr) {
+                    gen.generate_expression(stmt_print->expr);
+                    gen.pop("rax");
+                    gen.m_output << "  call " << (stmt_print->newline ? "__cato_println_int" : "__cato_print_int") << "\n";
+                } else {
+                    // The newline is part of the string.
+                    const std::string text = (stmt_print->string ? stmt_print->string->value : std::string {}) + (stmt_print->newline ? "\n" : "");
+                    gen.m_output << "  lea rax, [" << gen.string_label(text) << "]\n";
+                    gen.m_output << "  call __cato_print_str\n";
+                }
+                gen.clear_implicit_value();
+                gen.m_output << ";;/Print\n";
+                }
+            }
+            void operator()(const NodeStatementArray* stmt_array) const {
+                if (!functionPass) {
+                    const std::string& name = stmt_array->ident.value.value();
+                    auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
+                        return var.name == name;
+                    });
+                    if (it != gen.m_vars.cend()) {
+                        compile_error("Identifier already used: " + name);
+                    }
+
+                    if (stmt_array->size) {
+                        gen.generate_expression(stmt_array->size);
+                        gen.pop("rax");
+                        gen.m_output << "  ;; Allocating int array: " << name << "\n";
+                        gen.m_output << "  call __cato_alloc\n";
+                        const std::string location = gen.slot_location(gen.m_frame.heap_slots.at(stmt_array));
+                        gen.m_output << "  mov " << location << ", rax\n";
+                        gen.m_vars.push_back({ .name = name, .location = location, .heap = true });
+                        gen.clear_implicit_value();
+                        return;
+                    }
+                    gen.m_output << "  ;; Declaring int array: " << name << "[" << stmt_array->length << "]\n";
+                    auto offset = gen.m_frame.array_offsets.find(stmt_array);
+                    if (offset == gen.m_frame.array_offsets.end()) {
+                        // Top-level arrays are declared once, so .bss has
+                        // already zeroed them.
+                        const std::string label = "__cato_array_" + name;
+                        gen.m_arrays << label << ": resq " << stmt_array->length << "\n";
+                        gen.m_vars.push_back({ .name = name, .location = label, .length = stmt_array->length });
+                        gen.clear_implicit_value();
+                        return;
+                    }
+                    const std::string base = "rbp - " + std::to_string(-offset->second);
+                    gen.m_vars.push_back({ .name = name, .location = base, .length = stmt_array->length });
+                    const std::string loop = gen.create_label();
+                    gen.m_output << "  lea rax, [" << base << "]\n";
+                    gen.m_output << "  mov rcx, " << stmt_array->length << "\n";
+                    gen.m_output << loop << ":\n";
+                    gen.m_output << "  mov qword [rax + rcx*8 - 8], 0\n";
+                    gen.m_output << "  dec rcx\n";
+                    gen.m_output << "  jnz " << loop << "\n";
+                    gen.clear_implicit_value();
+                }
+            }
+            void operator()(const NodeStatementStore* stmt_store) const {
+                if (!functionPass) {
+                    const Var array = gen.find_array(stmt_store->ident);
+                    gen.generate_expression(stmt_store->index);
+                    gen.generate_expression(stmt_store->expr);
+                    gen.pop("rax");
+                    gen.pop("rcx");
+                    gen.m_output << "  ;; Storing to an element of: " << array.name << "\n";
+                    const std::string element = gen.element(array, "rcx", "rdx");
+                    gen.m_output << "  mov " << element << ", rax\n";
+                }
+            }
+            void operator()(const NodeStatementInt* stmt_int) const {
+                if (!functionPass) {
+                    auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var) {
+                    return var.name == stmt_int->ident.value.value();
+                    });
+
+                    if (it != gen.m_vars.cend()) {
+                        compile_error("Identifier already used: " + stmt_int->ident.value.value());
+                    }
+
+                    gen.generate_expression(stmt_int->expr);
+                    gen.pop("rax");
+                    const std::string location = gen.slot_location(gen.m_frame.local_slots.at(stmt_int));
+                    gen.m_vars.push_back({.name = stmt_int->ident.value.value(), .location = location });
+
+                    gen.m_output << "  ;; Declaring int variable: " << stmt_int->ident.value.value() << "\n";
+                    gen.m_output << "  mov " << location << ", rax\n";
+                }
+            }
+            void operator()(const NodeStatementIf* statement_if) const {
+                if(!functionPass){
+                gen.m_output << ";;If\n";
+                IfChain chain { .end_label = gen.create_label() };
+                chain.reached = gen.profile_count(gen.count_point());
+                gen.generate_arm(statement_if->expr, statement_if->scope, !statement_if->pred.has_value(), chain);
+                if (statement_if->pred.has_value()) {
+                    gen.generate_if_predicate(statement_if->pred.value(), chain);
+                }
+                if (!chain.unlikely.view().empty()) {
+                    gen.m_output << "  jmp " << chain.end_label << "\n";
+                    gen.m_output << chain.unlikely.str();
+                }
+                gen.m_output << chain.end_label << ":\n";
+                }
+                gen.m_output << ";;/If\n";
+            }
+            void operator()(const NodeScope* scope) const
+            {
+                if(!functionPass){
+                gen.generate_scope(scope);
+                }
+            }
+            void operator()(const NodeStatementAssign* stmt_assign) const
+            {
+                if(!functionPass){
+                auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var& var){
+                    return var.name == stmt_assign->ident.value.value();
+                });
+                
+                if(it == gen.m_vars.end()){
+                    compile_error("Undeclared identifier 2: " + stmt_assign->ident.value.value());
+                }
+                if (it->is_array()) {
+                    compile_error("Assigning to an array: " + stmt_assign->ident.value.value());
+                }
+                gen.generate_expression(stmt_assign->expr);
+                gen.pop("rax");
+
+                gen.m_output << "  ;; Assigning to variable: " << stmt_assign->ident.value.value() << "\n";
+                gen.m_output << "  mov " << it->location << ", rax\n";
+                }
+            }
+            void operator()(const NodeStatementFor* stmt_for) const {
+                if(!functionPass){
+                if (stmt_for->parallel) {
+                    gen.generate_parallel_for(stmt_for);
+                    return;
+                }
+                if (stmt_for->init) {
+                    gen.generate_statement(stmt_for->init);
+                }
+                // Pairs of iterations first; the loop below does the rest.
+                // Not when instrumenting, so the counts stay per iteration.
+                if (gen.m_passes.vectorize && gen.m_profile_path.empty()) {
+                    auto timer = BuildStats::time(gen.m_stats, "vectorize");
+                    if (std::optional<VectorLoop> vector_loop = Vectorizer().match(stmt_for)) {
+                        gen.generate_vector_loop(vector_loop.value());
+                    }
+                }
+                std::string start_label = gen.create_label();
+                std::string end_label = gen.create_label();
+                const uint64_t entries = gen.profile_count(gen.count_point());
+
+                // Lowered on the side: whether the header is worth aligning
+                // depends on the back-edge count, whose counter comes last.
+                std::stringstream loop;
+                std::swap(gen.m_output, loop);
+                gen.m_output << start_label << ":\n";
+
+                if (stmt_for->condition) {
+                    gen.generate_branch(stmt_for->condition, false, end_label);
+                }
+
+                if (stmt_for->scope) {
+                    gen.generate_scope(stmt_for->scope);
+                }
+
+                if (stmt_for->iteration) {
+                    gen.generate_statement(stmt_for->iteration);
+                }
+                const uint64_t iterations = gen.profile_count(gen.count_point());
+                gen.m_output << "  jmp " << start_label << "\n";
+                gen.m_output << end_label << ":\n";
+                std::swap(gen.m_output, loop);
+                const bool hot = gen.m_function_profile == nullptr || (iterations > 0 && iterations >= entries);
+                if (gen.m_layout.loop_align > 1 && hot) {
+                    gen.m_output << "align " << gen.m_layout.loop_align << "\n";
+                }
+                gen.m_output << loop.str();
+                }
+            }
+
+            
+        };
+
+        StmtVisitor visitor { .gen = *this, .functionPass = functionPass};
+        std::visit(visitor, stmt->var);
+    }
+
+    // The body goes into a routine of its own that the runtime calls on
+    // every thread with a range of iterations. The code here works out how
+    // many there are and waits for them all to run.
+    void generate_parallel_for(const NodeStatementFor* stmt_for) {
+        const ParallelLoop loop = ParallelChecker(m_program).check(stmt_for);
+        generate_statement(stmt_for->init);
+        const std::string counter = find_var(loop.counter).location;
+        m_output << "  ;; Parallel loop over " << loop.counter << "\n";
+        generate_expression(loop.end);
+        pop("rax");
+        m_output << "  sub rax, " << counter << "\n";
+        if (loop.step > 1) {
+            m_output << "  add rax, " << loop.step - 1 << "\n";
+            m_output << "  mov rcx, " << loop.step << "\n";
+            m_output << "  cqo\n";
+            m_output << "  idiv rcx\n";
+        }
+        const std::string counted = create_label();
+        m_output << "  test rax, rax\n";
+        m_output << "  jg " << counted << "\n";
+        m_output << "  mov rax, 0\n";
+        m_output << counted << ":\n";
+        m_output << "  mov rcx, rax\n";
+        const std::string body = create_label();
+        m_output << "  push r12\n";
+        m_output << "  mov r12, rbp\n";
+        m_output << "  lea rax, [" << body << "]\n";
+        m_output << "  call __cato_parallel_for\n";
+        m_output << "  pop r12\n";
+        // Where the loop would have left the counter.
+        m_output << "  imul rcx, rcx, " << loop.step << "\n";
+        m_output << "  add " << counter << ", rcx\n";
+        m_output << "  mov rax, 0\n";
+        generate_parallel_body(stmt_for, loop, body);
+    }
+
+    // Runs iterations [rdi, rsi) in a frame laid out like the one r12
+    // points to, where the variables from outside the loop are. The counter
+    // and the reductions are the only ones the body writes; the counter
+    // has its own slot already and the reductions get theirs below the
+    // frame, next to the end of the range.
+    void generate_parallel_body(const NodeStatementFor* stmt_for, const ParallelLoop& loop, const std::string& label) {
+        const std::vector<Var> vars = m_vars;
+        const int64_t below = static_cast<int64_t>(m_frame.frame_bytes());
+        const std::string end = frame_slot(-below - 8);
+        std::vector<std::pair<std::string, std::string>> reductions; // own copy, variable
+        for (Var& var : m_vars) {
+            const size_t base = var.location.find("rbp");
+            if (base == std::string::npos || var.name == loop.counter) {
+                continue;
+            }
+            var.location.replace(base, 3, "r12");
+            if (std::find(loop.reductions.begin(), loop.reductions.end(), var.name) != loop.reductions.end()) {
+                const int64_t offset = -below - 16 - 8 * static_cast<int64_t>(reductions.size());
+                reductions.emplace_back(frame_slot(offset), var.location);
+                var.location = frame_slot(offset);
+            }
+        }
+        const std::string counter = find_var(loop.counter).location;
+        std::string start = counter;
+        start.replace(start.find("rbp"), 3, "r12");
+        const size_t frame = (below + 8 + 8 * reductions.size() + 15) / 16 * 16;
+
+        std::stringstream outlined;
+        std::swap(m_output, outlined);
+        m_output << label << ":\n";
+        m_output << "  push rbp\n";
+        m_output << "  mov rbp, rsp\n";
+        m_output << "  sub rsp, " << frame << "\n";
+        m_output << "  imul rdi, rdi, " << loop.step << "\n";
+        m_output << "  imul rsi, rsi, " << loop.step << "\n";
+        m_output << "  mov rax, " << start << "\n";
+        m_output << "  add rdi, rax\n";
+        m_output << "  add rsi, rax\n";
+        m_output << "  mov " << counter << ", rdi\n";
+        m_output << "  mov " << end << ", rsi\n";
+        for (const auto& [own, shared] : reductions) {
+            m_output << "  mov qword " << own << ", 0\n";
+        }
+        const std::string top_label = create_label();
+        const std::string end_label = create_label();
+        m_output << top_label << ":\n";
+        m_output << "  mov rax, " << counter << "\n";
+        m_output << "  cmp rax, " << end << "\n";
+        m_output << "  jge " << end_label << "\n";
+        generate_scope(stmt_for->scope);
+        generate_statement(stmt_for->iteration);
+        m_output << "  jmp " << top_label << "\n";
+        m_output << end_label << ":\n";
+        for (const auto& [own, shared] : reductions) {
+            m_output << "  mov rax, " << own << "\n";
+            m_output << "  lock add qword " << shared << ", rax\n";
+        }
+        m_output << "  mov rsp, rbp\n";
+        m_output << "  pop rbp\n";
+        m_output << "  ret\n";
+        std::swap(m_output, outlined);
+        m_outlined << outlined.str();
+        m_vars = vars;
+    }
+
+    void generate_function(const NodeFunctionDecl* func_decl)
+    {
+        add_unit(lower_function(func_decl));
+    }
+
+    // A function's code depends only on its own tokens: labels are local to
+    // it and it does not see top-level variables. That is what lets it be
+    // cached by content and lowered on any thread.
+    FunctionUnit lower_function(const NodeFunctionDecl* func_decl)
+    {
+        if (!func_decl->ident.value.has_value()) {
+            compile_error("Function identifier is missing.");
+        }
+
+        m_function_profile = m_profile != nullptr ? m_profile->function(func_decl->hash) : nullptr;
+        const uint64_t entry_count = m_function_profile != nullptr && !m_function_profile->empty() ? m_function_profile->front() : 0;
+
+        uint64_t key = 0;
+        if (m_cache != nullptr && m_profile_path.empty()) {
+            // Profile-driven layout depends on the counts as well.
+            std::string flags = (m_jit ? "jit " : "") + m_layout.key() + " " + m_passes.key() + (m_evaluator != nullptr ? " eval" : "");
+            if (m_function_profile != nullptr) {
+                uint64_t counts = fnv_offset;
+                for (uint64_t count : *m_function_profile) {
+                    counts = fnv1a(count, counts);
+                }
+                flags += " profile " + std::to_string(counts);
+            }
+            if (!m_line_file.empty()) {
+                flags += " lines " + m_line_file + " " + std::to_string(func_decl->line_hash);
+            }
+            // Whether a parallel loop may call a function depends on that
+            // function's body, and on those it calls, as well.
+            if (std::set<std::string> calls = ParallelChecker::loop_calls(func_decl->body); !calls.empty()) {
+                if (!m_parallel_checker.has_value()) {
+                    m_parallel_checker.emplace(m_program);
+                }
+                flags += " parallel " + std::to_string(m_parallel_checker->hash_reachable(std::move(calls)));
+            }
+            key = m_cache->key(func_decl->hash, flags);
+            if (std::optional<CachedFunction> cached = m_cache->load(key)) {
+                return { key, std::move(cached->code), std::move(cached->strings), std::move(cached->object), func_decl->ident.value.value(), func_decl->hash, 0, entry_count };
+            }
+        }
+
+        std::stringstream outer;
+        std::swap(m_output, outer);
+        m_function_strings.clear();
+        m_vars.clear();
+        m_scopes.clear();
+        m_in_function = true;
+        m_function_label_count = 0;
+        m_function_name = func_decl->ident.value.value();
+        m_profile_counters = 0;
+        m_cold_output.str("");
+        m_outlined.str("");
+        m_folded = false;
+        m_eval_budget = m_evaluator != nullptr ? m_evaluator->budget() : 0;
+
+        m_currentFunctionEpilogueLabel = create_label() + "_epilogue";
+
+        std::string funcName = func_decl->ident.value.value();
+        m_output << ";; Function: " << funcName << "\n";
+        m_output << "global " << funcName << "\n";
+        if (m_layout.function_align > 1) {
+            m_output << "align " << m_layout.function_align << "\n";
+        }
+        m_output << funcName << ":\n";
+        mark_line(func_decl->line);
+
+        {
+            auto timer = BuildStats::time(m_stats, "frame");
+            m_frame = FramePlanner(m_passes.reuse).plan_function(func_decl, param_registers.size());
+        }
+        {
+            auto timer = BuildStats::time(m_stats, "leaf-regs");
+            m_frameless = m_passes.registers && m_frame.leaf && func_decl->params.size() <= param_registers.size()
+                && m_frame.array_bytes == 0 && m_frame.heap_slots.empty() && assign_leaf_registers();
+        }
+        m_uses_rbx = false;
+
+        // A leaf keeps its variables in registers and has no frame. Which
+        // callee-saved registers it has to save is only known once the body
+        // is lowered, so the body goes to the side.
+        std::stringstream body;
+        if (m_frameless) {
+            std::swap(m_output, body);
+        } else {
+            generate_prologue();
+        }
+        count_point();
+        // Otherwise register parameters are spilled to their slots so calls
+        // in the body cannot clobber them; the rest stay where the caller
+        // put them.
+        for (size_t index = 0; index < func_decl->params.size(); index++) {
+            std::string location;
+            if (index < param_registers.size()) {
+                location = slot_location(m_frame.param_slots[index]);
+                if (!m_frameless) {
+                    m_output << "  mov " << location << ", " << param_registers[index] << "\n";
+                }
+            } else {
+                location = frame_slot(16 + static_cast<int64_t>(index - param_registers.size()) * 8);
+            }
+            m_vars.push_back({func_decl->params[index].value.value(), location});
+        }
+
+        generate_scope(func_decl->body);
+        // A body that runs off its end returns 0, as it does when the
+        // evaluator or the interpreter runs it, rather than whatever its
+        // last statement left in rax.
+        const std::vector<NodeStatement*>& statements = func_decl->body->statements;
+        if (statements.empty() || !std::holds_alternative<NodeStatementReturn*>(statements.back()->var)) {
+            m_output << "  mov rax, 0\n";
+        }
+
+        // The body falls into the epilogue that `return` jumps to; cold arms
+        // go after it, out of the way of the hot path.
+        if (m_frameless) {
+            std::swap(m_output, body);
+            const std::vector<std::string> saved = clobbered_callee_saved();
+            for (const std::string& reg : saved) {
+                m_output << "  push " << reg << "\n";
+            }
+            m_output << body.str();
+            m_output << m_currentFunctionEpilogueLabel << ":\n";
+            for (auto reg = saved.rbegin(); reg != saved.rend(); ++reg) {
+                m_output << "  pop " << *reg << "\n";
+            }
+        } else {
+            m_output << m_currentFunctionEpilogueLabel << ":\n";
+            // `return` can leave from any scope, so the heap is put back
+            // here as well.
+            if (auto mark = m_frame.heap_marks.find(func_decl->body); mark != m_frame.heap_marks.end()) {
+                release_heap(mark->second);
+            }
+            m_output << "  mov rsp, rbp\n";
+            m_output << "  pop rbp\n";
+        }
+        m_output << "  ret\n";
+        m_output << m_cold_output.str();
+        m_output << m_outlined.str();
+        m_output << ";; /Function: " << funcName << "\n";
+
+        m_in_function = false;
+        m_frameless = false;
+        m_preserve_rdx = false;
+        std::swap(m_output, outer);
+        // A folded call depends on the callee as well, which the key does
+        // not cover.
+        if (m_folded) {
+            key = 0;
+        }
+        return { key, tidy(outer.str()), m_function_strings, {}, funcName, func_decl->hash, m_profile_counters, entry_count };
+    }
+
+    std::string generate_program() {
+    m_output << "default rel\n";
+    if (m_jit) {
+        m_output << "extern __cato_host_exit\n";
+    }
+    m_output << "section .text\n";
+    m_output << "global _start\n";
+    m_output << "_start:\n";
+
+    std::optional<int64_t> result;
+    if (m_passes.fold && m_evaluator != nullptr && m_profile_path.empty()) {
+        auto timer = BuildStats::time(m_stats, "evaluate");
+        result = m_evaluator->run_program();
+    }
+    if (result.has_value()) {
+        m_output << "  ;; evaluated at compile time\n";
+        m_output << "  mov rdi, " << result.value() << "\n";
+        m_output << "  call __cato_exit\n";
+    } else {
+        m_eval_budget = m_evaluator != nullptr ? m_evaluator->budget() : 0;
+        {
+            auto timer = BuildStats::time(m_stats, "frame");
+            m_frame = FramePlanner(m_passes.reuse).plan_program(m_program);
+        }
+        generate_prologue();
+        for(const NodeStatement* statement : m_program.statements) {
+            generate_statement(statement, false);
+        }
+        m_output << "  mov rdi, rax\n";
+        m_output << "  call __cato_exit\n";
+        m_output << m_outlined.str();
+    }
+    
+    m_output << ";;functions\n";
+    const std::string head = tidy(m_output.str());
+    m_output.str("");
+
+    if (result.has_value()) {
+        // Nothing is left to call the functions.
+    } else if (m_jobs == 1) {
+        for(const NodeStatement* statement : m_program.statements) {
+            generate_statement(statement, true);
+        }
+    } else {
+        generate_functions_parallel();
+    }
+
+    if (m_profile != nullptr) {
+        std::stable_sort(m_units.begin(), m_units.end(), [](const FunctionUnit& a, const FunctionUnit& b) {
+            return a.entry_count > b.entry_count;
+        });
+    }
+
+    // Every exit goes through here, so a JIT can intercept it. It and the
+    // runtime after it have no source line.
+    mark_line(0);
+    m_output << "global __cato_exit\n";
+    m_output << "__cato_exit:\n";
+    m_output << "  call __cato_flush\n";
+    m_output << "  call __cato_pool_stop\n";
+    if (m_jit) {
+        m_output << "  jmp __cato_host_exit\n";
+    } else {
+        if (!m_profile_path.empty()) {
+            generate_profile_dump();
+        }
+        m_output << "  mov rax, 60\n";
+        m_output << "  syscall\n";
+    }
+    m_output << runtime::text;
+
+    m_output << "section .rodata\n";
+    m_output << runtime::rodata;
+    m_output << "__cato_heap_huge: dq " << (m_huge_pages ? 1 : 0) << "\n";
+    m_output << m_data.str();
+    m_output << "section .bss\n";
+    m_output << runtime::bss;
+    m_output << m_arrays.str();
+    if (!m_profile_path.empty()) {
+        m_output << "section .data\n";
+        generate_profile_data();
+    }
+
+    const std::string tail = m_output.str();
+    m_main_unit = head + tail;
+    std::string program = head;
+    for (const FunctionUnit& unit : m_units) {
+        program += unit.code;
+    }
+    return program + tail;
+    }
+
+    // Everything but the functions, which come separately.
+    const std::string& main_unit() const {
+        return m_main_unit;
+    }
+
+    const std::vector<FunctionUnit>& function_units() const {
+        return m_units;
+    }
+
+    size_t data_bytes() const {
+        return m_data.view().size();
+    }
+
+    std::string currentFunctionEpilogueLabel() const {
+        return m_currentFunctionEpilogueLabel;
+    }
+
+    private:    
+
+        inline static const std::vector<std::string> param_registers = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        // Array base addresses in a vector loop, in VectorLoop::arrays order.
+        inline static const std::vector<std::string> vector_base_registers = {"rsi", "rdi", "r8", "r9", "r10", "r11"};
+
+        void push(const std::string& reg) {
+            m_output << "  push " << reg << "\n";
+        }
+
+        void pop(const std::string& reg) {
+            m_output << "  pop " << reg << "\n";
+            m_uses_rbx = m_uses_rbx || reg == "rbx";
+        }
+
+        std::string slot_location(size_t slot) const {
+            return m_frameless ? m_slot_registers[slot] : frame_slot(FrameLayout::offset(slot));
+        }
+
+        // A leaf's slot i is register parameter i, if it has one, so
+        // parameters stay in the registers they arrived in. The other slots
+        // take the unused argument registers and r10/r11 before any
+        // callee-saved register. False if there are too many slots.
+        bool assign_leaf_registers() {
+            m_slot_registers.assign(param_registers.begin(), param_registers.end());
+            m_slot_registers.insert(m_slot_registers.end(), { "r10", "r11", "r12", "r13", "r14", "r15" });
+            if (m_frame.slot_count > m_slot_registers.size()) {
+                return false;
+            }
+            m_slot_registers.resize(m_frame.slot_count);
+            // cqo/idiv write rdx.
+            m_preserve_rdx = std::find(m_slot_registers.begin(), m_slot_registers.end(), "rdx") != m_slot_registers.end();
+            return true;
+        }
+
+        std::vector<std::string> clobbered_callee_saved() const {
+            std::vector<std::string> saved;
+            if (m_uses_rbx) {
+                saved.push_back("rbx");
+            }
+            for (const char* reg : { "r12", "r13", "r14", "r15" }) {
+                if (std::find(m_slot_registers.begin(), m_slot_registers.end(), reg) != m_slot_registers.end()) {
+                    saved.push_back(reg);
+                }
+            }
+            return saved;
+        }
+
+        static std::string frame_slot(int64_t offset) {
+            return offset < 0 ? "[rbp - " + std::to_string(-offset) + "]" : "[rbp + " + std::to_string(offset) + "]";
+        }
+
+        // The whole frame is allocated here; nothing else moves rsp except
+        // expression temporaries, which are popped as they are used.
+        void generate_prologue() {
+            m_output << "  push rbp\n";
+            m_output << "  mov rbp, rsp\n";
+            if (m_frame.frame_bytes() > 0) {
+                m_output << "  sub rsp, " << m_frame.frame_bytes() << "\n";
+            }
+        }
+
+        // Says where the code that follows came from; line 0 is no line.
+        void mark_line(uint32_t line){
+            if (!m_line_file.empty()) {
+                m_output << "%line " << line << "+0 " << m_line_file << "\n";
+            }
+        }
+
+        void begin_scope(){
+            m_output << ";;begin_scope" << "\n";
+            m_scopes.push_back(m_vars.size());
+        }
+
+        void end_scope(){
+            m_output << ";;endscope" << "\n";
+            m_vars.resize(m_scopes.back());
+            m_scopes.pop_back();
+        }
+
+        std::string create_label(){
+            std::stringstream ss;
+            if (m_in_function) {
+                ss << ".L" << m_function_label_count++;
+                return ss.str();
+            }
+            ss << "label" << m_label_count++;
+            return ss.str();
+        }
+
+
+
+        void add_unit(FunctionUnit unit){
+            for (const std::string& value : unit.strings) {
+                string_label(value);
+            }
+            m_units.push_back(std::move(unit));
+        }
+
+        std::string tidy(const std::string& code){
+            if (!m_passes.tidy) {
+                return code;
+            }
+            auto timer = BuildStats::time(m_stats, "layout");
+            return tidy_layout(code);
+        }
+
+        // Each worker lowers with its own Generator; the units are added in
+        // source order afterwards, which also registers their string
+        // literals in the same order a serial run would.
+        void generate_functions_parallel(){
+            std::vector<const NodeFunctionDecl*> functions;
+            for (const NodeStatement* statement : m_program.statements) {
+                if (auto func_decl = std::get_if<NodeFunctionDecl*>(&statement->var)) {
+                    functions.push_back(*func_decl);
+                }
+            }
+            ThreadPool pool(std::min(m_jobs, std::max<size_t>(functions.size(), 1)));
+            std::vector<std::optional<Generator>> workers(pool.size());
+            std::vector<FunctionUnit> units(functions.size());
+            pool.parallel_for(functions.size(), [&](size_t index, size_t worker) {
+                if (!workers[worker].has_value()) {
+                    workers[worker].emplace(NodeProg {}, m_jit);
+                    workers[worker]->use_cache(m_cache);
+                    workers[worker]->instrument(m_profile_path);
+                    workers[worker]->use_profile(m_profile);
+                    workers[worker]->set_layout(m_layout);
+                    workers[worker]->use_evaluator(m_evaluator);
+                    workers[worker]->set_passes(m_passes);
+                    workers[worker]->set_debug_lines(m_line_file);
+                    workers[worker]->set_stats(m_stats);
+                }
+                units[index] = workers[worker]->lower_function(functions[index]);
+            });
+            for (FunctionUnit& unit : units) {
+                add_unit(std::move(unit));
+            }
+        }
+
+        // Named after the contents so cached code can refer to it. Equal
+        // literals share one record, wherever they are used.
+        std::string string_label(const std::string& value){
+            std::stringstream ss;
+            ss << "str_" << std::hex << fnv1a(value);
+            const std::string label = ss.str();
+            if (m_string_literals.emplace(value, label).second) {
+                m_data << "global " << label << "\n";
+                m_data << label << ": dq " << value.size() << "\n";
+                for (size_t i = 0; i < value.size(); i += 16) {
+                    m_data << "db ";
+                    for (size_t j = i; j < std::min(i + 16, value.size()); j++) {
+                        m_data << (j > i ? ", " : "") << static_cast<int>(static_cast<unsigned char>(value[j]));
+                    }
+                    m_data << "\n";
+                }
+            }
+            if (m_in_function && std::find(m_function_strings.begin(), m_function_strings.end(), value) == m_function_strings.end()) {
+                m_function_strings.push_back(value);
+            }
+            return label;
+        }
+
+        // Hands out the next profile counter of the current function and,
+        // in an instrumented build, counts it. Top-level code is not
+        // profiled.
+        size_t count_point(){
+            const size_t index = m_profile_counters;
+            if (!m_in_function) {
+                return index;
+            }
+            m_profile_counters++;
+            if (!m_profile_path.empty()) {
+                m_output << "  inc qword [" << profile_label(m_function_name) << " + " << 16 + index * 8 << "]\n";
+            }
+            return index;
+        }
+
+        uint64_t profile_count(size_t index) const {
+            if (!m_in_function || m_function_profile == nullptr || index >= m_function_profile->size()) {
+                return 0;
+            }
+            return (*m_function_profile)[index];
+        }
+
+        // The value of `func_call` when its arguments are constants and the
+        // evaluator can run it.
+        std::optional<int64_t> fold_call(const NodeFunctionCall* func_call){
+            if (!m_passes.fold || m_evaluator == nullptr || !m_profile_path.empty()) {
+                return {};
+            }
+            if (auto known = m_call_values.find(func_call); known != m_call_values.end()) {
+                m_folded = m_folded || known->second.has_value();
+                return known->second;
+            }
+            m_constant_steps.clear();
+            m_constants.clear();
+            queue_call(func_call);
+            return run_constant_steps();
+        }
+
+        // A call's arguments are evaluated in order, then the call.
+        void queue_call(const NodeFunctionCall* func_call){
+            m_constant_steps.push({ .call = func_call });
+            for (size_t i = func_call->args.size(); i-- > 0;) {
+                m_constant_steps.push({ .expr = func_call->args[i] });
+            }
+        }
+
+        // Works through m_constant_steps: literals and calls that fold,
+        // combined as the native code would, with division that would trap
+        // left to run. It stops at the first part that is not constant since
+        // then nothing containing it is. Every call is
+        // remembered either way, so lowering the calls nested in one does
+        // not evaluate their arguments again.
+        std::optional<int64_t> run_constant_steps(){
+            auto not_constant = [&]() -> std::optional<int64_t> {
+                // The calls still waiting are the ones containing this part.
+                while (!m_constant_steps.empty()) {
+                    if (const ConstantStep step = m_constant_steps.pop(); step.call != nullptr) {
+                        m_call_values.emplace(step.call, std::nullopt);
+                    }
+                }
+                return {};
+            };
+            while (!m_constant_steps.empty()) {
+                const ConstantStep step = m_constant_steps.pop();
+                if (step.call != nullptr) {
+                    std::vector<int64_t> args(step.call->args.size());
+                    for (size_t i = args.size(); i-- > 0;) {
+                        args[i] = m_constants.pop();
+                    }
+                    std::optional<int64_t> value;
+                    {
+                        auto timer = BuildStats::time(m_stats, "evaluate");
+                        value = m_evaluator->call(step.call->ident.value.value(), args, m_eval_budget);
+                    }
+                    m_folded = m_folded || value.has_value();
+                    m_call_values.emplace(step.call, value);
+                    if (!value.has_value()) {
+                        return not_constant();
+                    }
+                    m_constants.push(value.value());
+                } else if (step.bin != nullptr) {
+                    const int64_t rhs = m_constants.pop();
+                    const int64_t lhs = m_constants.pop();
+                    std::optional<int64_t> value = std::visit([&](const auto* bin) -> std::optional<int64_t> {
+                        using Bin = std::remove_cvref_t<decltype(*bin)>;
+                        const uint64_t a = static_cast<uint64_t>(lhs);
+                        const uint64_t b = static_cast<uint64_t>(rhs);
+                        if constexpr (std::is_same_v<Bin, NodeBinExpressionAdd>) {
+                            return static_cast<int64_t>(a + b);
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionSub>) {
+                            return static_cast<int64_t>(a - b);
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionMulti>) {
+                            return static_cast<int64_t>(a * b);
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionDiv>) {
+                            if (rhs == 0 || (rhs == -1 && lhs == std::numeric_limits<int64_t>::min())) {
+                                return {};
+                            }
+                            return lhs / rhs;
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionEquals>) {
+                            return lhs == rhs;
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionNotEquals>) {
+                            return lhs != rhs;
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionLess>) {
+                            return lhs < rhs;
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionGreater>) {
+                            return lhs > rhs;
+                        } else if constexpr (std::is_same_v<Bin, NodeBinExpressionAnd>) {
+                            return lhs != 0 && rhs != 0;
+                        } else {
+                            return lhs != 0 || rhs != 0;
+                        }
+                    }, step.bin->var);
+                    if (!value.has_value()) {
+                        return not_constant();
+                    }
+                    m_constants.push(value.value());
+                } else if (step.negate) {
+                    m_constants.push(m_constants.pop() == 0);
+                } else if (auto bin_expr = std::get_if<NodeBinExpression*>(&step.expr->var)) {
+                    const auto [lhs, rhs] = std::visit([](const auto* bin) {
+                        return std::pair<const NodeExpr*, const NodeExpr*> { bin->lhs, bin->rhs };
+                    }, (*bin_expr)->var);
+                    m_constant_steps.push({ .bin = *bin_expr });
+                    m_constant_steps.push({ .expr = rhs });
+                    m_constant_steps.push({ .expr = lhs });
+                } else {
+                    const NodeTerm* term = std::get<NodeTerm*>(step.expr->var);
+                    if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+                        m_constant_steps.push({ .expr = (*paren)->expr });
+                    } else if (auto term_not = std::get_if<NodeTermNot*>(&term->var)) {
+                        m_constant_steps.push({ .negate = true });
+                        m_constant_steps.push({ .expr = (*term_not)->expr });
+                    } else if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+                        if (auto known = m_call_values.find(*call); known == m_call_values.end()) {
+                            queue_call(*call);
+                        } else if (known->second.has_value()) {
+                            m_folded = true;
+                            m_constants.push(known->second.value());
+                        } else {
+                            return not_constant();
+                        }
+                    } else if (auto int_lit = std::get_if<NodeTermIntLit*>(&term->var)) {
+                        m_constants.push((*int_lit)->value);
+                    } else {
+                        return not_constant();
+                    }
+                }
+            }
+            return m_constants.pop();
+        }
+
+        static std::string profile_label(const std::string& function){
+            return "__cato_prof_" + function;
+        }
+
+        // Writes the counter blocks to the profile file; rdi holds the exit
+        // code throughout.
+        void generate_profile_dump(){
+            size_t bytes = 16;
+            for (const FunctionUnit& unit : m_units) {
+                bytes += 16 + unit.counters * 8;
+            }
+            m_output << "  mov r12, rdi\n";
+            m_output << "  mov rax, 2\n"; // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+            m_output << "  lea rdi, [__cato_prof_path]\n";
+            m_output << "  mov rsi, 577\n";
+            m_output << "  mov rdx, 420\n";
+            m_output << "  syscall\n";
+            m_output << "  test rax, rax\n";
+            m_output << "  js __cato_prof_done\n";
+            m_output << "  mov rdi, rax\n";
+            m_output << "  mov rax, 1\n";
+            m_output << "  lea rsi, [__cato_prof]\n";
+            m_output << "  mov rdx, " << bytes << "\n";
+            m_output << "  syscall\n";
+            m_output << "  mov rax, 3\n";
+            m_output << "  syscall\n";
+            m_output << "__cato_prof_done:\n";
+            m_output << "  mov rdi, r12\n";
+        }
+
+        void generate_profile_data(){
+            m_output << "__cato_prof_path: db ";
+            for (unsigned char c : m_profile_path) {
+                m_output << static_cast<int>(c) << ", ";
+            }
+            m_output << "0\n";
+            m_output << "align 8\n";
+            m_output << "__cato_prof: dq " << profile_magic << ", " << m_units.size() << "\n";
+            for (const FunctionUnit& unit : m_units) {
+                m_output << profile_label(unit.name) << ": dq " << unit.hash << ", " << unit.counters << "\n";
+                m_output << "resq " << unit.counters << "\n";
+            }
+        }
+
+        struct Var {
+            std::string name;
+            std::string location; // register or frame slot; an array's base address
+            size_t length = 0;    // elements, for an array
+            bool heap = false;    // an array whose address is at `location`
+
+            bool is_array() const {
+                return length > 0 || heap;
+            }
+        };
+
+        const Var& find_var(const std::string& name) const {
+            auto it = std::find_if(m_vars.cbegin(), m_vars.cend(), [&](const Var& var) {
+                return var.name == name;
+            });
+            if (it == m_vars.cend()) {
+                compile_error("Undeclared identifier: " + name);
+            }
+            return *it;
+        }
+
+        const Var& find_array(const Token& ident) const {
+            auto it = std::find_if(m_vars.cbegin(), m_vars.cend(), [&](const Var& var) {
+                return var.name == ident.value.value();
+            });
+            if (it == m_vars.cend()) {
+                compile_error("Undeclared identifier: " + ident.value.value());
+            }
+            if (!it->is_array()) {
+                compile_error("Not an array: " + ident.value.value());
+            }
+            return *it;
+        }
+
+        // The element of `array` at the index in `index`. A static array's
+        // address goes through `scratch`: an absolute address cannot be
+        // combined with a register. Indices are not checked.
+        std::string element(const Var& array, const std::string& index, const std::string& scratch) {
+            if (array.heap) {
+                m_output << "  mov " << scratch << ", " << array.location << "\n";
+                return "qword [" + scratch + " + " + index + "*8]";
+            }
+            if (array.location.starts_with("rbp") || array.location.starts_with("r12")) {
+                return "qword [" + array.location + " + " + index + "*8]";
+            }
+            m_output << "  lea " << scratch << ", [" << array.location << "]\n";
+            return "qword [" + scratch + " + " + index + "*8]";
+        }
+
+        std::string m_currentFunctionEpilogueLabel;
+        std::stringstream m_function_defs;
+        std::stringstream m_data; // string records, in .rodata
+        std::stringstream m_arrays; // top-level arrays, in .bss
+        std::map<std::string, std::string> m_string_literals; // Map from string literal to its label
+        const NodeProg m_program;
+        const bool m_jit;
+        std::stringstream m_output;
+        // Pending work of generate_expression, innermost last.
+        struct ExprStep {
+            enum class Kind { lower, operation, shortcut, join, negate, element, call, save } kind;
+            const NodeExpr* expr = nullptr;
+            const NodeTermIndex* term = nullptr;
+            const NodeFunctionCall* call = nullptr;
+        };
+        ArenaStack<ExprStep> m_expr_steps;
+        std::vector<std::string> m_join_labels; // of the `&&` and `||` being lowered, innermost last
+        // Those of generate_condition, which index its labels.
+        struct CondStep {
+            const NodeExpr* expr = nullptr; // to jump on
+            bool when = false;              // to the target if its truth is this
+            size_t target = 0;
+            size_t place = 0;               // or, without an expression, the label to place
+        };
+        ArenaStack<CondStep> m_cond_steps;
+        // Those of fold_call, and the values computed so far.
+        struct ConstantStep {
+            const NodeExpr* expr = nullptr;          // to evaluate
+            const NodeBinExpression* bin = nullptr;  // or to apply to the two values on top
+            const NodeFunctionCall* call = nullptr;  // or to call with the values on top
+            bool negate = false;                     // or to apply `!` to the value on top
+        };
+        ArenaStack<ConstantStep> m_constant_steps;
+        ArenaStack<int64_t> m_constants;
+        std::unordered_map<const NodeFunctionCall*, std::optional<int64_t>> m_call_values; // folded, or not constant
+        FrameLayout m_frame;
+        bool m_frameless = false;                // lowering a leaf function
+        std::vector<std::string> m_slot_registers; // a leaf's slots
+        bool m_preserve_rdx = false;
+        bool m_uses_rbx = false;
+        std::vector<Var> m_vars {};
+        std::vector<size_t> m_scopes {};
+        int m_label_count = 0;
+        FunctionCache* m_cache = nullptr;
+        size_t m_jobs = 1;
+        bool m_in_function = false;
+        int m_function_label_count = 0;
+        std::vector<std::string> m_function_strings;
+        std::vector<FunctionUnit> m_units;
+        std::string m_main_unit;
+        std::string m_profile_path;
+        bool m_huge_pages = false;
+        std::string m_line_file; // set when emitting `%line`
+        const Profile* m_profile = nullptr;
+        const std::vector<uint64_t>* m_function_profile = nullptr;
+        std::string m_function_name;
+        size_t m_profile_counters = 0;
+        std::stringstream m_cold_output; // the current function's cold arms
+        std::stringstream m_outlined;    // its parallel loop bodies
+        LayoutPolicy m_layout;
+        Evaluator* m_evaluator = nullptr;
+        BuildStats* m_stats = nullptr;
+        Passes m_passes;
+        bool m_folded = false; // the current function folded a call
+        std::optional<ParallelChecker> m_parallel_checker; // for cache keys
+        uint64_t m_eval_budget = 0; // left for it to fold calls with
 };
\ No newline at end of file
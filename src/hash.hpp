@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// 64-bit FNV-1a. Stable across runs and platforms, which is what cache keys
+// and generated label names need; not meant to resist adversarial input.
+constexpr uint64_t fnv_offset = 0xcbf29ce484222325ULL;
+
+constexpr uint64_t fnv1a(std::string_view data, uint64_t hash = fnv_offset)
+{
+    for (const char c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+constexpr uint64_t fnv1a(uint64_t value, uint64_t hash = fnv_offset)
+{
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
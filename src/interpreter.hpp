@@ -0,0 +1,379 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+#include "./bytecode.hpp"
+
+// Threaded-dispatch interpreter for BytecodeProgram. Each handler jumps
+// straight to the next one through a computed goto (a GCC/Clang extension),
+// so there is no central dispatch branch for the predictor to miss.
+
+struct InterpreterResult {
+    enum class Status { exited, returned, error, out_of_fuel };
+    Status status;
+    int64_t value = 0;
+    std::string error {};
+};
+
+class Interpreter {
+public:
+    static constexpr size_t max_registers = 64 * 1024 * 1024;
+    static constexpr size_t max_heap = 64 * 1024 * 1024;
+
+    inline explicit Interpreter(const BytecodeProgram& program)
+        : m_program(program)
+        , m_executed(program.functions.size(), 0)
+    {
+    }
+
+    inline InterpreterResult run()
+    {
+        return start(0, {});
+    }
+
+    // Runs one function until it returns. It may still exit instead.
+    inline InterpreterResult call(size_t function, const std::vector<int64_t>& args)
+    {
+        return start(function, args);
+    }
+
+    // Stops with Status::out_of_fuel after `fuel` more instructions.
+    inline void set_fuel(uint64_t fuel)
+    {
+        m_fuel = fuel;
+        m_limited = true;
+    }
+
+    inline uint64_t fuel() const
+    {
+        return m_fuel;
+    }
+
+    // Stops with Status::error once the calls in progress would take more
+    // than `bytes` of native stack, counting each frame as its registers
+    // plus a return address and saved rbp. That bounds the call depth as
+    // well. The top-level frame is not counted: native code keeps
+    // top-level arrays in static memory.
+    inline void set_stack_limit(size_t bytes)
+    {
+        m_stack_limit = bytes;
+    }
+
+    // Where `print` goes, buffered. Without one a print stops the program
+    // with Status::error: code evaluated at compile time must not print.
+    inline void set_output(std::FILE* output)
+    {
+        m_output = output;
+    }
+
+    // Enables per-function executed-instruction counts, at some cost.
+    inline void count_instructions(bool enabled)
+    {
+        m_count = enabled;
+    }
+
+    inline const std::vector<uint64_t>& executed() const
+    {
+        return m_executed;
+    }
+
+private:
+    struct Frame {
+        const Instr* return_pc;
+        size_t base;
+        size_t function;
+        size_t heap; // the heap top at the call
+    };
+
+    static constexpr size_t output_buffer_size = 64 * 1024;
+
+    static inline size_t frame_bytes(const BytecodeFunction& fn)
+    {
+        return fn.frame_size * sizeof(int64_t) + 16;
+    }
+
+    inline InterpreterResult start(size_t function, const std::vector<int64_t>& args)
+    {
+        InterpreterResult result;
+        m_heap.clear();
+        if (m_limited) {
+            result = m_count ? execute<true, true>(function, args) : execute<false, true>(function, args);
+        } else {
+            result = m_count ? execute<true, false>(function, args) : execute<false, false>(function, args);
+        }
+        flush();
+        return result;
+    }
+
+    inline void flush()
+    {
+        if (m_output != nullptr && !m_buffer.empty()) {
+            std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_output);
+            std::fflush(m_output);
+        }
+        m_buffer.clear();
+    }
+
+    template <bool Count, bool Limited>
+    inline InterpreterResult execute(size_t function, const std::vector<int64_t>& args)
+    {
+        static void* const handlers[] = {
+            &&op_loadi, &&op_loadk, &&op_mov,
+            &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_eq, &&op_ne, &&op_lt, &&op_gt,
+            &&op_addi, &&op_subi, &&op_muli, &&op_divi, &&op_eqi, &&op_nei, &&op_lti, &&op_gti,
+            &&op_jmp, &&op_jz, &&op_call, &&op_ret, &&op_exit, &&op_print, &&op_prints,
+            &&op_array, &&op_loadx, &&op_storex,
+            &&op_alloc, &&op_loadh, &&op_storeh, &&op_lenh, &&op_mark, &&op_release,
+        };
+        static_assert(sizeof(handlers) / sizeof(handlers[0]) == static_cast<size_t>(Op::count));
+
+        std::vector<int64_t> stack(std::max<size_t>(m_program.functions[function].frame_size, 1024), 0);
+        std::copy(args.begin(), args.end(), stack.begin());
+        std::vector<Frame> frames;
+        size_t base = 0;
+        const BytecodeFunction* fn = &m_program.functions[function];
+        const Instr* code = fn->code.data();
+        const Instr* pc = code;
+        int64_t* r = stack.data();
+        size_t stack_bytes = function == 0 ? 0 : frame_bytes(*fn);
+        if (stack_bytes > m_stack_limit) {
+            return { InterpreterResult::Status::error, 0, "stack overflow in " + fn->name };
+        }
+        const Instr* ins;
+        int64_t lhs;
+        int64_t rhs;
+
+#define CATO_DISPATCH()                   \
+    do {                                  \
+        ins = pc++;                       \
+        if constexpr (Count) {            \
+            m_executed[function]++;       \
+        }                                 \
+        if constexpr (Limited) {          \
+            if (m_fuel == 0) {            \
+                return { InterpreterResult::Status::out_of_fuel }; \
+            }                             \
+            m_fuel--;                     \
+        }                                 \
+        goto* handlers[static_cast<size_t>(ins->op)]; \
+    } while (0)
+
+#define CATO_BINARY(name, imm_name, expr)           \
+    name:                                           \
+    lhs = r[ins->b];                                \
+    rhs = r[ins->c];                                \
+    goto name##_body;                               \
+    imm_name:                                       \
+    lhs = r[ins->b];                                \
+    rhs = static_cast<int16_t>(ins->c);             \
+    name##_body:                                    \
+    r[ins->a] = (expr);                             \
+    CATO_DISPATCH();
+
+        CATO_DISPATCH();
+
+    op_loadi:
+        r[ins->a] = static_cast<int32_t>(ins->bc());
+        CATO_DISPATCH();
+    op_loadk:
+        r[ins->a] = fn->constants[ins->bc()];
+        CATO_DISPATCH();
+    op_mov:
+        r[ins->a] = r[ins->b];
+        CATO_DISPATCH();
+
+        CATO_BINARY(op_add, op_addi, static_cast<int64_t>(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs)))
+        CATO_BINARY(op_sub, op_subi, static_cast<int64_t>(static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs)))
+        CATO_BINARY(op_mul, op_muli, static_cast<int64_t>(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs)))
+        CATO_BINARY(op_eq, op_eqi, lhs == rhs)
+        CATO_BINARY(op_ne, op_nei, lhs != rhs)
+        CATO_BINARY(op_lt, op_lti, lhs < rhs)
+        CATO_BINARY(op_gt, op_gti, lhs > rhs)
+
+    op_div:
+        lhs = r[ins->b];
+        rhs = r[ins->c];
+        goto op_div_body;
+    op_divi:
+        lhs = r[ins->b];
+        rhs = static_cast<int16_t>(ins->c);
+    op_div_body:
+        // idiv traps on both of these; report them instead.
+        if (rhs == 0 || (rhs == -1 && lhs == std::numeric_limits<int64_t>::min())) {
+            return { InterpreterResult::Status::error, 0, "division error in " + fn->name };
+        }
+        r[ins->a] = lhs / rhs;
+        CATO_DISPATCH();
+
+    op_jmp:
+        pc = code + ins->bc();
+        CATO_DISPATCH();
+    op_jz:
+        if (r[ins->a] == 0) {
+            pc = code + ins->bc();
+        }
+        CATO_DISPATCH();
+
+    op_call: {
+        const size_t callee = ins->b;
+        const size_t callee_base = base + ins->a;
+        const BytecodeFunction& target = m_program.functions[callee];
+        stack_bytes += frame_bytes(target);
+        if (stack_bytes > m_stack_limit) {
+            return { InterpreterResult::Status::error, 0, "stack overflow in " + target.name };
+        }
+        if (callee_base + target.frame_size > stack.size()) {
+            if (callee_base + target.frame_size > max_registers) {
+                return { InterpreterResult::Status::error, 0, "stack overflow in " + target.name };
+            }
+            stack.resize(std::max(stack.size() * 2, callee_base + target.frame_size));
+        }
+        frames.push_back({ pc, base, function, m_heap.size() });
+        function = callee;
+        base = callee_base;
+        fn = &target;
+        code = fn->code.data();
+        pc = code;
+        r = stack.data() + base;
+        CATO_DISPATCH();
+    }
+
+    op_ret: {
+        const int64_t value = r[ins->a];
+        if (frames.empty()) {
+            return { InterpreterResult::Status::returned, value, {} };
+        }
+        const Frame frame = frames.back();
+        frames.pop_back();
+        stack_bytes -= frame_bytes(*fn);
+        m_heap.resize(frame.heap);
+        // The callee window starts at the caller's destination register.
+        stack[base] = value;
+        function = frame.function;
+        base = frame.base;
+        fn = &m_program.functions[function];
+        code = fn->code.data();
+        pc = frame.return_pc;
+        r = stack.data() + base;
+        CATO_DISPATCH();
+    }
+
+    op_exit:
+        return { InterpreterResult::Status::exited, r[ins->a], {} };
+
+    op_print: {
+        if (m_output == nullptr) {
+            return { InterpreterResult::Status::error, 0, "print in " + fn->name };
+        }
+        char digits[24];
+        m_buffer.append(digits, std::to_chars(digits, digits + sizeof(digits), r[ins->a]).ptr);
+        if (ins->b) {
+            m_buffer.push_back('\n');
+        }
+        if (m_buffer.size() >= output_buffer_size) {
+            flush();
+        }
+        CATO_DISPATCH();
+    }
+    op_prints:
+        if (m_output == nullptr) {
+            return { InterpreterResult::Status::error, 0, "print in " + fn->name };
+        }
+        m_buffer += m_program.strings[ins->bc()];
+        if (m_buffer.size() >= output_buffer_size) {
+            flush();
+        }
+        CATO_DISPATCH();
+
+    op_array:
+        if constexpr (Limited) {
+            // Zeroing is work too, as for op_alloc.
+            if (ins->bc() > m_fuel) {
+                return { InterpreterResult::Status::out_of_fuel };
+            }
+            m_fuel -= ins->bc();
+        }
+        r[ins->a] = ins->bc();
+        std::fill(r + ins->a + 1, r + ins->a + 1 + ins->bc(), 0);
+        CATO_DISPATCH();
+    // Native code does not check indices; out of range is an error here so
+    // nothing is evaluated at compile time from memory it does not own.
+    op_loadx:
+        rhs = r[ins->c];
+        if (static_cast<uint64_t>(rhs) >= static_cast<uint64_t>(r[ins->b])) {
+            return { InterpreterResult::Status::error, 0, "index out of range in " + fn->name };
+        }
+        r[ins->a] = r[ins->b + 1 + rhs];
+        CATO_DISPATCH();
+    op_storex:
+        rhs = r[ins->b];
+        if (static_cast<uint64_t>(rhs) >= static_cast<uint64_t>(r[ins->a])) {
+            return { InterpreterResult::Status::error, 0, "index out of range in " + fn->name };
+        }
+        r[ins->a + 1 + rhs] = r[ins->c];
+        CATO_DISPATCH();
+
+    // A heap array is its length followed by its elements; its handle is
+    // where the length is.
+    op_alloc: {
+        const int64_t length = std::max<int64_t>(r[ins->b], 0);
+        if (static_cast<uint64_t>(length) >= max_heap - m_heap.size()) {
+            return { InterpreterResult::Status::error, 0, "out of memory in " + fn->name };
+        }
+        if constexpr (Limited) {
+            // Zeroing is work too.
+            if (static_cast<uint64_t>(length) > m_fuel) {
+                return { InterpreterResult::Status::out_of_fuel };
+            }
+            m_fuel -= length;
+        }
+        r[ins->a] = static_cast<int64_t>(m_heap.size());
+        m_heap.push_back(length);
+        m_heap.resize(m_heap.size() + length, 0);
+        CATO_DISPATCH();
+    }
+    op_loadh:
+        lhs = r[ins->b];
+        rhs = r[ins->c];
+        if (static_cast<uint64_t>(rhs) >= static_cast<uint64_t>(m_heap[lhs])) {
+            return { InterpreterResult::Status::error, 0, "index out of range in " + fn->name };
+        }
+        r[ins->a] = m_heap[lhs + 1 + rhs];
+        CATO_DISPATCH();
+    op_storeh:
+        lhs = r[ins->a];
+        rhs = r[ins->b];
+        if (static_cast<uint64_t>(rhs) >= static_cast<uint64_t>(m_heap[lhs])) {
+            return { InterpreterResult::Status::error, 0, "index out of range in " + fn->name };
+        }
+        m_heap[lhs + 1 + rhs] = r[ins->c];
+        CATO_DISPATCH();
+    op_lenh:
+        r[ins->a] = m_heap[r[ins->b]];
+        CATO_DISPATCH();
+    op_mark:
+        r[ins->a] = static_cast<int64_t>(m_heap.size());
+        CATO_DISPATCH();
+    op_release:
+        m_heap.resize(r[ins->a]);
+        CATO_DISPATCH();
+
+#undef CATO_BINARY
+#undef CATO_DISPATCH
+    }
+
+    const BytecodeProgram& m_program;
+    std::vector<uint64_t> m_executed;
+    std::FILE* m_output = nullptr;
+    std::string m_buffer;
+    std::vector<int64_t> m_heap;
+    bool m_count = false;
+    bool m_limited = false;
+    uint64_t m_fuel = 0;
+    size_t m_stack_limit = SIZE_MAX;
+};
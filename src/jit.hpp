@@ -0,0 +1,186 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "./assembler.hpp"
+#include "./linker.hpp"
+
+// Runs a program in-process: the object produced by the Assembler is linked
+// at the address of a fresh mapping, made executable (never writable and
+// executable at once) and entered on its own stack. The program's
+// `__cato_exit` ends in `__cato_host_exit`, which calls a host routine that
+// unwinds back here with the exit code.
+
+namespace jit_detail {
+    inline thread_local std::jmp_buf* t_exit_target = nullptr;
+    inline thread_local int64_t t_exit_code = 0;
+
+    [[noreturn]] inline void handle_exit(int64_t code)
+    {
+        t_exit_code = code;
+        std::longjmp(*t_exit_target, 1);
+    }
+
+    // `__cato_host_exit` realigns the stack before calling into C++;
+    // `__cato_jit_enter(stack_top, entry)` switches to the program stack.
+    inline const char* const glue = R"(
+extern __cato_jit_exit
+section .text
+global __cato_host_exit
+__cato_host_exit:
+  and rsp, -16
+  mov rax, __cato_jit_exit
+  call rax
+  ud2
+global __cato_jit_enter
+__cato_jit_enter:
+  mov rsp, rdi
+  call rsi
+  ud2
+)";
+}
+
+class Jit {
+public:
+    static constexpr size_t stack_size = 8 * 1024 * 1024;
+
+    inline explicit Jit(std::vector<ObjectFile> program, bool perf_map = true)
+        : m_perf_map(perf_map)
+    {
+        for (ObjectFile& obj : program) {
+            m_linker.add_object(std::move(obj));
+        }
+        Assembler glue(jit_detail::glue);
+        std::optional<ObjectFile> glue_obj = glue.assemble();
+        if (!glue_obj.has_value()) {
+            std::cerr << "jit: failed to assemble entry glue" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_linker.add_object(std::move(glue_obj.value()));
+    }
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    inline ~Jit()
+    {
+        if (m_code != nullptr) {
+            munmap(m_code, m_code_size);
+        }
+    }
+
+    // Loads the program and runs it to completion. Returns the value passed
+    // to exit(), or nothing if loading failed.
+    inline std::optional<int64_t> run()
+    {
+        if (!load()) {
+            return {};
+        }
+
+        void* stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+            std::cerr << "jit: cannot map the program stack" << std::endl;
+            return {};
+        }
+
+        using Enter = void (*)(void* stack_top, uint64_t entry);
+        const auto enter = reinterpret_cast<Enter>(symbol_address("__cato_jit_enter"));
+        std::jmp_buf target;
+        std::jmp_buf* const previous = jit_detail::t_exit_target;
+        jit_detail::t_exit_target = &target;
+        if (setjmp(target) == 0) {
+            enter(static_cast<uint8_t*>(stack) + stack_size, m_image.entry);
+        }
+        jit_detail::t_exit_target = previous;
+        munmap(stack, stack_size);
+        return jit_detail::t_exit_code;
+    }
+
+    inline const LinkedImage& image() const
+    {
+        return m_image;
+    }
+
+private:
+    inline bool load()
+    {
+        const std::map<std::string, uint64_t> externs = {
+            { "__cato_jit_exit", reinterpret_cast<uint64_t>(&jit_detail::handle_exit) },
+        };
+
+        // Sizes do not depend on the base address, so a provisional link
+        // tells us how much to map before linking at the real address.
+        std::optional<LinkedImage> sizing = m_linker.link(0, externs);
+        if (!sizing.has_value()) {
+            return false;
+        }
+        const size_t text_span = sizing->data_addr - sizing->text_addr;
+        m_code_size = text_span + align_up(sizing->data_memsz, Linker::page_size);
+        void* mapping = mmap(nullptr, std::max<size_t>(m_code_size, Linker::page_size), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "jit: cannot map code" << std::endl;
+            return false;
+        }
+        m_code = static_cast<uint8_t*>(mapping);
+        m_code_size = std::max<size_t>(m_code_size, Linker::page_size);
+
+        std::optional<LinkedImage> image = m_linker.link(reinterpret_cast<uint64_t>(m_code), externs);
+        if (!image.has_value()) {
+            return false;
+        }
+        m_image = std::move(image.value());
+        std::memcpy(m_code, m_image.text.data(), m_image.text.size());
+        std::memcpy(m_code + text_span, m_image.data.data(), m_image.data.size());
+        if (mprotect(m_code, std::max<size_t>(text_span, Linker::page_size), PROT_READ | PROT_EXEC) != 0) {
+            std::cerr << "jit: cannot make code executable" << std::endl;
+            return false;
+        }
+
+        if (m_perf_map) {
+            write_perf_map();
+        }
+        return true;
+    }
+
+    // perf looks up JIT symbols in /tmp/perf-<pid>.map: "START SIZE name".
+    inline void write_perf_map() const
+    {
+        std::ofstream map("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+        for (const LinkedSymbol& sym : m_image.symbols) {
+            if (sym.global && sym.exec && sym.size > 0) {
+                map << std::hex << sym.address << " " << sym.size << " " << sym.name << std::dec << "\n";
+            }
+        }
+    }
+
+    inline uint64_t symbol_address(const std::string& name) const
+    {
+        for (const LinkedSymbol& sym : m_image.symbols) {
+            if (sym.name == name) {
+                return sym.address;
+            }
+        }
+        return 0;
+    }
+
+    static constexpr uint64_t align_up(uint64_t value, uint64_t align)
+    {
+        return (value + align - 1) / align * align;
+    }
+
+    Linker m_linker;
+    LinkedImage m_image;
+    uint8_t* m_code = nullptr;
+    size_t m_code_size = 0;
+    bool m_perf_map;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Where code is placed within the text section.
+struct LayoutPolicy {
+    uint64_t function_align = 16; // 1 leaves function entries where they fall
+    uint64_t loop_align = 16;     // loop headers; with a profile only loops that iterate
+
+    std::string key() const
+    {
+        return "align " + std::to_string(function_align) + " " + std::to_string(loop_align);
+    }
+};
+
+namespace layout_detail {
+    inline std::string trim(const std::string& line)
+    {
+        const size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            return {};
+        }
+        return line.substr(first, line.find_last_not_of(" \t") - first + 1);
+    }
+
+    // The generator indents instructions and nothing else.
+    inline bool is_instruction(const std::string& line)
+    {
+        return line.starts_with("  ") && !trim(line).empty() && trim(line)[0] != ';';
+    }
+
+    inline bool is_label(const std::string& line)
+    {
+        return !line.empty() && line[0] != ' ' && line[0] != ';' && line.back() == ':';
+    }
+
+    // `%line` markers only say where the code after them came from.
+    inline bool is_comment(const std::string& line)
+    {
+        const std::string text = trim(line);
+        return text.empty() || text[0] == ';' || text.starts_with("%line ");
+    }
+
+    inline std::string jump_target(const std::string& line)
+    {
+        const std::string text = trim(line);
+        return text.starts_with("jmp ") ? trim(text.substr(4)) : std::string {};
+    }
+}
+
+// Tidies the straight-line order of lowered code: drops instructions that
+// follow an unconditional jump or return before the next label, since
+// nothing can reach them, and then jumps to the label that comes next.
+inline std::string tidy_layout(const std::string& code)
+{
+    using namespace layout_detail;
+    std::vector<std::string> lines;
+    std::istringstream input(code);
+    bool unreachable = false;
+    for (std::string line; std::getline(input, line);) {
+        if (is_instruction(line)) {
+            if (unreachable) {
+                continue;
+            }
+            const std::string text = trim(line);
+            unreachable = text == "ret" || text.starts_with("jmp ");
+        } else if (!is_comment(line)) {
+            unreachable = false;
+        }
+        lines.push_back(std::move(line));
+    }
+
+    std::string out;
+    out.reserve(code.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        const std::string target = jump_target(lines[i]);
+        if (!target.empty()) {
+            size_t next = i + 1;
+            while (next < lines.size() && (is_comment(lines[next]) || trim(lines[next]).starts_with("align "))) {
+                next++;
+            }
+            if (next < lines.size() && is_label(lines[next]) && lines[next] == target + ":") {
+                continue;
+            }
+        }
+        out += lines[i];
+        out += '\n';
+    }
+    return out;
+}
@@ -0,0 +1,636 @@
+#pragma once
+
+#include <elf.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+#include "./object.hpp"
+
+// In-process static linker for the programs cato emits: self-contained
+// ELF64 relocatable objects with an `_start` entry, no libc and no shared
+// libraries. Anything outside that subset is reported and the caller falls
+// back to the system `ld`.
+
+struct LinkedSymbol {
+    std::string name;
+    uint64_t address;
+    uint64_t size;
+    bool global;
+    bool exec;
+};
+
+struct LinkedLine {
+    uint64_t address;
+    uint32_t line; // 0 for code that has none
+};
+
+struct LinkedImage {
+    uint64_t entry = 0;
+    uint64_t text_addr = 0;
+    std::vector<uint8_t> text; // read + execute: code and read-only data
+    uint64_t data_addr = 0;
+    std::vector<uint8_t> data; // read + write: initialised data
+    uint64_t data_memsz = 0;   // data plus zero-filled .bss
+    std::vector<LinkedSymbol> symbols;
+    std::vector<LinkedLine> lines; // by address; each runs to the next
+    std::string line_file;
+};
+
+inline std::optional<ObjectFile> read_object(const std::string& path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        std::cerr << "linker: cannot open " << path << std::endl;
+        return {};
+    }
+    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    auto in_bounds = [&](uint64_t offset, uint64_t size) {
+        return offset <= bytes.size() && size <= bytes.size() - offset;
+    };
+
+    Elf64_Ehdr ehdr;
+    if (!in_bounds(0, sizeof(ehdr))) {
+        std::cerr << "linker: " << path << " is truncated" << std::endl;
+        return {};
+    }
+    std::memcpy(&ehdr, bytes.data(), sizeof(ehdr));
+    if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 || ehdr.e_ident[EI_CLASS] != ELFCLASS64
+        || ehdr.e_type != ET_REL || ehdr.e_machine != EM_X86_64) {
+        std::cerr << "linker: " << path << " is not an x86-64 relocatable object" << std::endl;
+        return {};
+    }
+    if (!in_bounds(ehdr.e_shoff, uint64_t(ehdr.e_shnum) * sizeof(Elf64_Shdr)) || ehdr.e_shstrndx >= ehdr.e_shnum) {
+        std::cerr << "linker: " << path << " has a corrupt section table" << std::endl;
+        return {};
+    }
+
+    std::vector<Elf64_Shdr> shdrs(ehdr.e_shnum);
+    std::memcpy(shdrs.data(), bytes.data() + ehdr.e_shoff, shdrs.size() * sizeof(Elf64_Shdr));
+    for (const Elf64_Shdr& shdr : shdrs) {
+        if (shdr.sh_type != SHT_NOBITS && !in_bounds(shdr.sh_offset, shdr.sh_size)) {
+            std::cerr << "linker: " << path << " has a section outside the file" << std::endl;
+            return {};
+        }
+    }
+
+    auto c_string = [&](const Elf64_Shdr& table, uint32_t offset) -> std::string {
+        if (offset >= table.sh_size) {
+            return {};
+        }
+        const char* begin = reinterpret_cast<const char*>(bytes.data() + table.sh_offset + offset);
+        return std::string(begin, strnlen(begin, table.sh_size - offset));
+    };
+
+    ObjectFile obj;
+    std::vector<int> section_map(shdrs.size(), -1);
+    for (size_t i = 0; i < shdrs.size(); i++) {
+        const Elf64_Shdr& shdr = shdrs[i];
+        if (!(shdr.sh_flags & SHF_ALLOC) || (shdr.sh_type != SHT_PROGBITS && shdr.sh_type != SHT_NOBITS)) {
+            continue;
+        }
+        ObjectSection section;
+        section.name = c_string(shdrs[ehdr.e_shstrndx], shdr.sh_name);
+        section.size = shdr.sh_size;
+        section.align = std::max<uint64_t>(shdr.sh_addralign, 1);
+        section.flags = shdr.sh_flags;
+        section.nobits = shdr.sh_type == SHT_NOBITS;
+        if (!section.nobits) {
+            section.data.assign(bytes.begin() + shdr.sh_offset, bytes.begin() + shdr.sh_offset + shdr.sh_size);
+        }
+        section_map[i] = static_cast<int>(obj.sections.size());
+        obj.sections.push_back(std::move(section));
+    }
+
+    for (const Elf64_Shdr& shdr : shdrs) {
+        if (shdr.sh_type != SHT_SYMTAB) {
+            continue;
+        }
+        if (shdr.sh_link >= shdrs.size()) {
+            std::cerr << "linker: " << path << " has a symbol table without strings" << std::endl;
+            return {};
+        }
+        const size_t count = shdr.sh_size / sizeof(Elf64_Sym);
+        for (size_t i = 0; i < count; i++) {
+            Elf64_Sym sym;
+            std::memcpy(&sym, bytes.data() + shdr.sh_offset + i * sizeof(Elf64_Sym), sizeof(sym));
+            ObjectSymbol symbol;
+            symbol.name = c_string(shdrs[shdr.sh_link], sym.st_name);
+            symbol.value = sym.st_value;
+            symbol.size = sym.st_size;
+            symbol.global = ELF64_ST_BIND(sym.st_info) != STB_LOCAL;
+            if (sym.st_shndx == SHN_ABS) {
+                symbol.absolute = true;
+            } else if (sym.st_shndx == SHN_COMMON) {
+                std::cerr << "linker: common symbol `" << symbol.name << "` is not supported" << std::endl;
+                return {};
+            } else if (sym.st_shndx != SHN_UNDEF && sym.st_shndx < section_map.size()) {
+                symbol.section = section_map[sym.st_shndx];
+            }
+            obj.symbols.push_back(std::move(symbol));
+        }
+    }
+
+    for (const Elf64_Shdr& shdr : shdrs) {
+        if (shdr.sh_type == SHT_REL) {
+            std::cerr << "linker: SHT_REL relocations are not supported" << std::endl;
+            return {};
+        }
+        if (shdr.sh_type != SHT_RELA || shdr.sh_info >= section_map.size() || section_map[shdr.sh_info] < 0) {
+            continue;
+        }
+        const size_t count = shdr.sh_size / sizeof(Elf64_Rela);
+        for (size_t i = 0; i < count; i++) {
+            Elf64_Rela rela;
+            std::memcpy(&rela, bytes.data() + shdr.sh_offset + i * sizeof(Elf64_Rela), sizeof(rela));
+            const size_t symbol = ELF64_R_SYM(rela.r_info);
+            if (symbol >= obj.symbols.size()) {
+                std::cerr << "linker: relocation against a missing symbol" << std::endl;
+                return {};
+            }
+            obj.relocs.push_back({
+                .section = static_cast<size_t>(section_map[shdr.sh_info]),
+                .offset = rela.r_offset,
+                .type = static_cast<uint32_t>(ELF64_R_TYPE(rela.r_info)),
+                .symbol = symbol,
+                .addend = rela.r_addend,
+            });
+        }
+    }
+
+    return obj;
+}
+
+class Linker {
+public:
+    static constexpr uint64_t base_address = 0x400000;
+    static constexpr uint64_t page_size = 0x1000;
+    // The ELF header and both program headers sit at the start of the text
+    // segment, so code begins right after them.
+    static constexpr uint64_t header_size = sizeof(Elf64_Ehdr) + 2 * sizeof(Elf64_Phdr);
+
+    inline void add_object(ObjectFile obj)
+    {
+        m_objects.push_back(std::move(obj));
+    }
+
+    // Lays out every allocated section starting at `text_addr` and applies
+    // relocations. `externs` supplies addresses for symbols that no object
+    // defines.
+    inline std::optional<LinkedImage> link(uint64_t text_addr = base_address + header_size,
+        const std::map<std::string, uint64_t>& externs = {}) const
+    {
+        LinkedImage image;
+        image.text_addr = text_addr;
+
+        // section_addr[object][section]
+        std::vector<std::vector<uint64_t>> section_addr(m_objects.size());
+        for (size_t i = 0; i < m_objects.size(); i++) {
+            section_addr[i].resize(m_objects[i].sections.size());
+        }
+
+        auto place = [&](std::vector<uint8_t>& segment, uint64_t segment_addr, bool want_exec_or_ro, bool want_nobits) {
+            for (size_t i = 0; i < m_objects.size(); i++) {
+                for (size_t j = 0; j < m_objects[i].sections.size(); j++) {
+                    const ObjectSection& section = m_objects[i].sections[j];
+                    const bool in_text = !(section.flags & SHF_WRITE);
+                    if (in_text != want_exec_or_ro || section.nobits != want_nobits) {
+                        continue;
+                    }
+                    uint64_t offset = align_up(segment_addr + segment.size(), section.align) - segment_addr;
+                    segment.resize(offset, in_text ? 0x90 : 0);
+                    section_addr[i][j] = segment_addr + offset;
+                    if (section.nobits) {
+                        segment.resize(offset + section.size, 0);
+                    } else {
+                        segment.insert(segment.end(), section.data.begin(), section.data.end());
+                    }
+                }
+            }
+        };
+
+        place(image.text, image.text_addr, true, false);
+        image.data_addr = align_up(image.text_addr + image.text.size(), page_size);
+        place(image.data, image.data_addr, false, false);
+        const size_t file_size = image.data.size();
+        place(image.data, image.data_addr, false, true);
+        image.data_memsz = image.data.size();
+        image.data.resize(file_size);
+
+        std::map<std::string, uint64_t> globals;
+        auto symbol_addr = [&](size_t obj, const ObjectSymbol& sym) {
+            return sym.absolute ? sym.value : section_addr[obj][sym.section] + sym.value;
+        };
+        for (size_t i = 0; i < m_objects.size(); i++) {
+            for (const ObjectSymbol& sym : m_objects[i].symbols) {
+                if (sym.name.empty() || (sym.section < 0 && !sym.absolute)) {
+                    continue;
+                }
+                const uint64_t address = symbol_addr(i, sym);
+                if (sym.global) {
+                    if (!globals.emplace(sym.name, address).second) {
+                        std::cerr << "linker: duplicate symbol `" << sym.name << "`" << std::endl;
+                        return {};
+                    }
+                }
+                const bool exec = !sym.absolute && (m_objects[i].sections[sym.section].flags & SHF_EXECINSTR);
+                image.symbols.push_back({ sym.name, address, sym.size, sym.global, exec });
+            }
+        }
+
+        auto resolve = [&](size_t obj, const ObjectSymbol& sym) -> std::optional<uint64_t> {
+            if (sym.section >= 0 || sym.absolute) {
+                return symbol_addr(obj, sym);
+            }
+            if (auto it = globals.find(sym.name); it != globals.end()) {
+                return it->second;
+            }
+            if (auto it = externs.find(sym.name); it != externs.end()) {
+                return it->second;
+            }
+            std::cerr << "linker: undefined reference to `" << sym.name << "`" << std::endl;
+            return {};
+        };
+
+        for (size_t i = 0; i < m_objects.size(); i++) {
+            for (const ObjectReloc& reloc : m_objects[i].relocs) {
+                const ObjectSection& section = m_objects[i].sections[reloc.section];
+                const auto target = resolve(i, m_objects[i].symbols[reloc.symbol]);
+                if (!target.has_value()) {
+                    return {};
+                }
+                const uint64_t place_addr = section_addr[i][reloc.section] + reloc.offset;
+                const bool in_text = !(section.flags & SHF_WRITE);
+                std::vector<uint8_t>& segment = in_text ? image.text : image.data;
+                const uint64_t segment_offset = place_addr - (in_text ? image.text_addr : image.data_addr);
+                if (!apply_reloc(segment, segment_offset, reloc, target.value(), place_addr)) {
+                    return {};
+                }
+            }
+        }
+
+        // An object's lines stop at the end of its section, where the next
+        // object's code takes over.
+        for (size_t i = 0; i < m_objects.size(); i++) {
+            const ObjectFile& obj = m_objects[i];
+            if (obj.lines.empty()) {
+                continue;
+            }
+            if (image.line_file.empty()) {
+                image.line_file = obj.line_file;
+            }
+            for (size_t j = 0; j < obj.lines.size(); j++) {
+                const ObjectLine& line = obj.lines[j];
+                image.lines.push_back({ section_addr[i][line.section] + line.offset, line.line });
+                if (j + 1 == obj.lines.size() || obj.lines[j + 1].section != line.section) {
+                    image.lines.push_back({ section_addr[i][line.section] + obj.sections[line.section].size, 0 });
+                }
+            }
+        }
+        std::stable_sort(image.lines.begin(), image.lines.end(), [](const LinkedLine& a, const LinkedLine& b) {
+            return a.address < b.address;
+        });
+        std::vector<LinkedLine> lines;
+        for (const LinkedLine& line : image.lines) {
+            if (!lines.empty() && lines.back().address == line.address) {
+                lines.back() = line;
+            } else if (lines.empty() || lines.back().line != line.line) {
+                lines.push_back(line);
+            }
+        }
+        image.lines = std::move(lines);
+
+        auto entry = globals.find("_start");
+        if (entry == globals.end()) {
+            std::cerr << "linker: no `_start` entry point" << std::endl;
+            return {};
+        }
+        image.entry = entry->second;
+        std::sort(image.symbols.begin(), image.symbols.end(), [](const LinkedSymbol& a, const LinkedSymbol& b) {
+            return a.address < b.address;
+        });
+        return image;
+    }
+
+    static inline bool write_executable(const LinkedImage& image, const std::string& path)
+    {
+        // Sized up front and copied into: inserting after the zeroed header
+        // trips a -Wstringop-overread false positive in GCC 12.
+        std::vector<uint8_t> out(header_size + image.text.size(), 0);
+        std::copy(image.text.begin(), image.text.end(), out.begin() + header_size);
+        const uint64_t text_end = out.size();
+        const uint64_t data_offset = align_up(text_end, page_size);
+        if (image.data_memsz > 0) {
+            out.resize(data_offset + image.data.size(), 0);
+            std::copy(image.data.begin(), image.data.end(), out.begin() + static_cast<std::ptrdiff_t>(data_offset));
+        }
+
+        // Section headers are not needed to run, but keep objdump, gdb and
+        // perf able to find the code and its symbols.
+        std::vector<uint8_t> strtab(1, 0);
+        std::vector<Elf64_Sym> symtab(1, Elf64_Sym {});
+        size_t first_global = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                first_global = symtab.size();
+            }
+            for (const LinkedSymbol& sym : image.symbols) {
+                if (sym.global != (pass == 1)) {
+                    continue;
+                }
+                Elf64_Sym entry {};
+                entry.st_name = static_cast<uint32_t>(strtab.size());
+                strtab.insert(strtab.end(), sym.name.begin(), sym.name.end());
+                strtab.push_back(0);
+                // Labels inside a function are not functions themselves.
+                entry.st_info = ELF64_ST_INFO(sym.global ? STB_GLOBAL : STB_LOCAL, sym.exec && sym.size > 0 ? STT_FUNC : STT_NOTYPE);
+                entry.st_shndx = sym.address < image.data_addr ? 1 : 2;
+                entry.st_value = sym.address;
+                entry.st_size = sym.size;
+                symtab.push_back(entry);
+            }
+        }
+        const std::string shstrtab("\0.text\0.data\0.symtab\0.strtab\0.shstrtab\0.debug_line\0.debug_info\0.debug_abbrev\0", 77);
+
+        auto append = [&](const void* src, size_t size, size_t align) {
+            out.resize(align_up(out.size(), align), 0);
+            const size_t offset = out.size();
+            const auto* begin = static_cast<const uint8_t*>(src);
+            out.insert(out.end(), begin, begin + size);
+            return offset;
+        };
+        const size_t symtab_offset = append(symtab.data(), symtab.size() * sizeof(Elf64_Sym), 8);
+        const size_t strtab_offset = append(strtab.data(), strtab.size(), 1);
+        const size_t shstrtab_offset = append(shstrtab.data(), shstrtab.size(), 1);
+        const std::vector<uint8_t> lines = debug_line(image);
+        const size_t lines_offset = append(lines.data(), lines.size(), 1);
+        std::vector<uint8_t> abbrev;
+        const std::vector<uint8_t> info = debug_info(image, abbrev);
+        const size_t info_offset = append(info.data(), info.size(), 1);
+        const size_t abbrev_offset = append(abbrev.data(), abbrev.size(), 1);
+
+        std::vector<Elf64_Shdr> shdrs(lines.empty() ? 6 : 9, Elf64_Shdr {});
+        auto section = [](uint32_t name, uint32_t type, uint64_t offset, uint64_t size, uint64_t align) {
+            Elf64_Shdr shdr {};
+            shdr.sh_name = name;
+            shdr.sh_type = type;
+            shdr.sh_offset = offset;
+            shdr.sh_size = size;
+            shdr.sh_addralign = align;
+            return shdr;
+        };
+        shdrs[1] = section(1, SHT_PROGBITS, header_size, image.text.size(), 16);
+        shdrs[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+        shdrs[1].sh_addr = image.text_addr;
+        shdrs[2] = section(7, image.data_memsz > 0 ? SHT_PROGBITS : SHT_NULL, data_offset, image.data.size(), 8);
+        shdrs[2].sh_flags = SHF_ALLOC | SHF_WRITE;
+        shdrs[2].sh_addr = image.data_addr;
+        shdrs[3] = section(13, SHT_SYMTAB, symtab_offset, symtab.size() * sizeof(Elf64_Sym), 8);
+        shdrs[3].sh_link = 4;
+        shdrs[3].sh_info = static_cast<uint32_t>(first_global);
+        shdrs[3].sh_entsize = sizeof(Elf64_Sym);
+        shdrs[4] = section(21, SHT_STRTAB, strtab_offset, strtab.size(), 1);
+        shdrs[5] = section(29, SHT_STRTAB, shstrtab_offset, shstrtab.size(), 1);
+        if (!lines.empty()) {
+            shdrs[6] = section(39, SHT_PROGBITS, lines_offset, lines.size(), 1);
+            shdrs[7] = section(51, SHT_PROGBITS, info_offset, info.size(), 1);
+            shdrs[8] = section(63, SHT_PROGBITS, abbrev_offset, abbrev.size(), 1);
+        }
+        const size_t shdr_offset = append(shdrs.data(), shdrs.size() * sizeof(Elf64_Shdr), 8);
+
+        Elf64_Ehdr ehdr {};
+        std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_EXEC;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = image.entry;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_shoff = shdr_offset;
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = image.data_memsz > 0 ? 2 : 1;
+        ehdr.e_shentsize = sizeof(Elf64_Shdr);
+        ehdr.e_shnum = static_cast<uint16_t>(shdrs.size());
+        ehdr.e_shstrndx = 5;
+
+        Elf64_Phdr phdrs[2] {};
+        phdrs[0] = { .p_type = PT_LOAD, .p_flags = PF_R | PF_X, .p_offset = 0, .p_vaddr = image.text_addr - header_size,
+            .p_paddr = image.text_addr - header_size, .p_filesz = text_end, .p_memsz = text_end, .p_align = page_size };
+        phdrs[1] = { .p_type = PT_LOAD, .p_flags = PF_R | PF_W, .p_offset = data_offset, .p_vaddr = image.data_addr,
+            .p_paddr = image.data_addr, .p_filesz = image.data.size(), .p_memsz = image.data_memsz, .p_align = page_size };
+
+        std::memcpy(out.data(), &ehdr, sizeof(ehdr));
+        std::memcpy(out.data() + sizeof(ehdr), phdrs, sizeof(phdrs));
+
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()))) {
+                std::cerr << "linker: cannot write " << path << std::endl;
+                return false;
+            }
+        }
+        std::error_code ec;
+        std::filesystem::permissions(path,
+            std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec,
+            std::filesystem::perm_options::add, ec);
+        return !ec;
+    }
+
+private:
+    static constexpr uint64_t align_up(uint64_t value, uint64_t align)
+    {
+        return (value + align - 1) / align * align;
+    }
+
+    // The compile unit that points debuggers at the line table: a single
+    // DIE, described by the abbreviation table it writes to `abbrev`.
+    // Empty when there are no lines.
+    static inline std::vector<uint8_t> debug_info(const LinkedImage& image, std::vector<uint8_t>& abbrev)
+    {
+        std::vector<uint8_t> out;
+        abbrev.clear();
+        if (image.lines.empty()) {
+            return out;
+        }
+        auto fixed = [&](uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        };
+        auto string = [&](const std::string& value) {
+            out.insert(out.end(), value.begin(), value.end());
+            out.push_back(0);
+        };
+        // Code 1: DW_TAG_compile_unit without children; name, stmt_list,
+        // low_pc, high_pc and producer. Every value here fits one byte.
+        abbrev = { 1, 0x11, 0, 0x03, 0x08, 0x10, 0x06, 0x11, 0x01, 0x12, 0x01, 0x25, 0x08, 0, 0, 0 };
+
+        fixed(0, 4); // unit length
+        fixed(2, 2); // version
+        fixed(0, 4); // abbreviation offset
+        out.push_back(8); // address size
+        out.push_back(1);
+        string(image.line_file.empty() ? "<source>" : image.line_file);
+        fixed(0, 4); // the only line table
+        fixed(image.text_addr, 8);
+        fixed(image.text_addr + image.text.size(), 8);
+        string("cato");
+        const uint32_t length = static_cast<uint32_t>(out.size() - 4);
+        std::memcpy(out.data(), &length, sizeof(length));
+        return out;
+    }
+
+    // The image's line table as a DWARF 2 `.debug_line` unit with one
+    // sequence, so gdb, addr2line and perf can map code back to source.
+    // Empty when there are no lines.
+    static inline std::vector<uint8_t> debug_line(const LinkedImage& image)
+    {
+        enum : uint8_t {
+            lns_copy = 1,
+            lns_advance_pc = 2,
+            lns_advance_line = 3,
+            lne_end_sequence = 1,
+            lne_set_address = 2,
+        };
+        std::vector<uint8_t> out;
+        if (image.lines.empty()) {
+            return out;
+        }
+        auto u8 = [&](uint64_t value) { out.push_back(static_cast<uint8_t>(value)); };
+        auto fixed = [&](uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                u8(value >> (8 * i));
+            }
+        };
+        auto uleb = [&](uint64_t value) {
+            do {
+                u8((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+                value >>= 7;
+            } while (value != 0);
+        };
+        auto sleb = [&](int64_t value) {
+            bool more = true;
+            while (more) {
+                const uint8_t byte = value & 0x7f;
+                value >>= 7;
+                more = !((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)));
+                u8(byte | (more ? 0x80 : 0));
+            }
+        };
+        auto patch = [&](size_t at, uint32_t value) {
+            std::memcpy(out.data() + at, &value, sizeof(value));
+        };
+
+        fixed(0, 4); // unit length
+        fixed(2, 2); // version
+        fixed(0, 4); // header length
+        const size_t header_start = out.size();
+        u8(1); // minimum instruction length
+        u8(1); // default is_stmt
+        u8(static_cast<uint8_t>(-5)); // line base
+        u8(14); // line range
+        u8(10); // opcode base
+        for (uint8_t length : { 0, 1, 1, 1, 1, 0, 0, 0, 1 }) {
+            u8(length);
+        }
+        u8(0); // no include directories
+        const std::string file = image.line_file.empty() ? "<source>" : image.line_file;
+        out.insert(out.end(), file.begin(), file.end());
+        u8(0);
+        uleb(0); // directory
+        uleb(0); // modification time
+        uleb(0); // length
+        u8(0);
+        patch(6, static_cast<uint32_t>(out.size() - header_start));
+
+        u8(0); // extended opcode
+        uleb(9);
+        u8(lne_set_address);
+        fixed(image.lines.front().address, 8);
+        uint64_t address = image.lines.front().address;
+        int64_t line = 1;
+        for (const LinkedLine& row : image.lines) {
+            if (row.address != address) {
+                u8(lns_advance_pc);
+                uleb(row.address - address);
+                address = row.address;
+            }
+            if (row.line != line) {
+                u8(lns_advance_line);
+                sleb(static_cast<int64_t>(row.line) - line);
+                line = row.line;
+            }
+            u8(lns_copy);
+        }
+        const uint64_t end = std::max(address, image.text_addr + image.text.size());
+        if (end != address) {
+            u8(lns_advance_pc);
+            uleb(end - address);
+        }
+        u8(0); // extended opcode
+        uleb(1);
+        u8(lne_end_sequence);
+        patch(0, static_cast<uint32_t>(out.size() - 4));
+        return out;
+    }
+
+    static inline bool apply_reloc(std::vector<uint8_t>& segment, uint64_t offset, const ObjectReloc& reloc,
+        uint64_t symbol, uint64_t place)
+    {
+        const uint64_t value = symbol + reloc.addend;
+        auto write = [&](const auto field) {
+            if (offset + sizeof(field) > segment.size()) {
+                std::cerr << "linker: relocation outside its section" << std::endl;
+                return false;
+            }
+            std::memcpy(segment.data() + offset, &field, sizeof(field));
+            return true;
+        };
+        auto overflow = [&]() {
+            std::cerr << "linker: relocation type " << reloc.type << " overflows" << std::endl;
+            return false;
+        };
+
+        switch (reloc.type) {
+        case R_X86_64_NONE:
+            return true;
+        case R_X86_64_64:
+            return write(value);
+        case R_X86_64_32:
+            if (value > UINT32_MAX) {
+                return overflow();
+            }
+            return write(static_cast<uint32_t>(value));
+        case R_X86_64_32S:
+            if (static_cast<int64_t>(value) != static_cast<int32_t>(value)) {
+                return overflow();
+            }
+            return write(static_cast<int32_t>(value));
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32: {
+            const int64_t relative = static_cast<int64_t>(value - place);
+            if (relative != static_cast<int32_t>(relative)) {
+                return overflow();
+            }
+            return write(static_cast<int32_t>(relative));
+        }
+        default:
+            std::cerr << "linker: unsupported relocation type " << reloc.type << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<ObjectFile> m_objects;
+};
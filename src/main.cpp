@@ -1,56 +1,835 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <optional>
-#include <vector>
-#include "./tokenization.hpp"
-#include "./parser.hpp"
-#include "./generation.hpp"
-#include "./arena.hpp"
-
-int main(int argc, char* argv[]){
-
-    if(argc != 2){
-        std::cerr << "Incorrect Usage" << std::endl;
-         std::cerr << "cato <input.cato>" << std::endl;
-         return EXIT_FAILURE;
-    }
-
-    std::string contents;
-    {  
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
-    }
-
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
-
-
-    if(!prog.has_value()){
-        std::cerr << "Invalid Program" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-
-
-    Generator generator(prog.value());
-
-
-
-    {
-        std::fstream file ("out.asm", std::ios::out);
-        file << generator.generate_program();
-    }
-
-
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
-
-    return EXIT_SUCCESS;
-
-}
\ No newline at end of file
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <vector>
+#include "./tokenization.hpp"
+#include "./parser.hpp"
+#include "./generation.hpp"
+#include "./arena.hpp"
+#include "./linker.hpp"
+#include "./assembler.hpp"
+#include "./jit.hpp"
+#include "./bytecode.hpp"
+#include "./interpreter.hpp"
+#include "./cache.hpp"
+#include <iomanip>
+#include <filesystem>
+#include <set>
+#include <map>
+#include <mutex>
+#include "./error.hpp"
+#include "./thread_pool.hpp"
+#include "./server.hpp"
+#include "./stats.hpp"
+#include "./profile.hpp"
+#include "./evaluator.hpp"
+#include "./sampler.hpp"
+#include "./code_stats.hpp"
+
+struct BuildOptions {
+    bool system_ld = false;
+    size_t jobs = 1;
+    FunctionCache* cache = nullptr;
+    ArenaPool* arenas = nullptr;
+    const std::map<std::string, std::string>* sources = nullptr; // inline sources by name
+    BuildStats* stats = nullptr; // --time-passes, --mem-stats
+    std::string profile_generate; // where instrumented programs write their counts
+    const Profile* profile = nullptr;
+    LayoutPolicy layout;
+    uint64_t eval_fuel = Evaluator::default_fuel; // 0 turns compile-time evaluation off
+    Passes passes;
+    CodeStats* code_stats = nullptr; // --code-stats
+    bool huge_pages = false; // --huge-pages
+    bool debug_lines = false; // -g
+    LinkedImage* image = nullptr; // receives the image when linked in process
+};
+
+// The token vector together with the token values that live on the heap.
+size_t token_bytes(const std::vector<Token>& tokens){
+    size_t bytes = tokens.capacity() * sizeof(Token);
+    for(const Token& token : tokens){
+        if(token.value.has_value() && token.value->capacity() > std::string().capacity()){
+            bytes += token.value->capacity() + 1;
+        }
+    }
+    return bytes;
+}
+
+
+
+std::string object_path(const std::string& asm_path){
+    return std::filesystem::path(asm_path).replace_extension(".o").string();
+}
+
+std::string read_source(const std::string& path, const BuildOptions& options){
+    auto timer = BuildStats::time(options.stats, "read");
+    if(options.sources != nullptr){
+        if(auto it = options.sources->find(path); it != options.sources->end()){
+            return it->second;
+        }
+    }
+    std::fstream input(path, std::ios::in);
+    if(!input){
+        compile_error("cannot open " + path);
+    }
+    std::stringstream contents_stream;
+    contents_stream << input.rdbuf();
+    return contents_stream.str();
+}
+
+std::vector<Token> tokenize_source(const std::string& path, const BuildOptions& options){
+    Tokenizer tokenizer(read_source(path, options));
+    auto timer = BuildStats::time(options.stats, "tokenize");
+    return tokenizer.tokenize();
+}
+
+void record_memory(const BuildOptions& options, const Parser& parser, size_t output_bytes, size_t data_bytes){
+    if(options.stats != nullptr){
+        options.stats->add_memory({ parser.m_tokens.size(), token_bytes(parser.m_tokens), parser.m_allocator.bytes_used(),
+            parser.m_allocator.peak_bytes(), output_bytes, data_bytes });
+    }
+}
+
+NodeProg parse_tokens(Parser& parser, const BuildOptions& options){
+    auto timer = BuildStats::time(options.stats, "parse");
+    std::optional<NodeProg> prog = parser.parse_prog();
+    if(!prog.has_value()){
+        compile_error("Invalid Program");
+    }
+    return prog.value();
+}
+
+// Runs an external tool and waits for it; true if it exited with 0. The
+// arguments go to it as they are, never through a shell, since the server
+// builds paths from what its clients send.
+bool run_tool(const std::vector<std::string>& command){
+    std::vector<char*> argv;
+    for(const std::string& arg : command){
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    const pid_t pid = fork();
+    if(pid < 0){
+        return false;
+    }
+    if(pid == 0){
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0){
+        if(errno != EINTR){
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Assembles in-process; falls back to nasm on `asm_path` for anything the
+// built-in assembler does not handle.
+std::optional<ObjectFile> assemble_program(const std::string& source, const std::string& asm_path){
+    if(auto obj = Assembler(source).assemble()){
+        return obj;
+    }
+    std::cerr << "Falling back to nasm" << std::endl;
+    {
+        std::fstream file (asm_path, std::ios::out);
+        file << source;
+    }
+    const std::string obj_path = object_path(asm_path);
+    if(!run_tool({ "nasm", "-felf64", asm_path, "-o", obj_path })){
+        return {};
+    }
+    return read_object(obj_path);
+}
+
+// Assembles `_start` and each function on its own, so functions that came
+// from the cache skip assembly as well; newly assembled ones are stored
+// unless they have no key.
+// Returns nothing if any part needs the external assembler.
+std::optional<std::vector<ObjectFile>> assemble_units(const Generator& generator, FunctionCache& cache){
+    std::vector<ObjectFile> objects;
+    std::optional<ObjectFile> main_obj = Assembler(generator.main_unit(), true).assemble();
+    if(!main_obj.has_value()){
+        return {};
+    }
+    objects.push_back(std::move(main_obj.value()));
+    for(const FunctionUnit& unit : generator.function_units()){
+        if(unit.object.has_value()){
+            objects.push_back(unit.object.value());
+            continue;
+        }
+        std::optional<ObjectFile> obj = Assembler(unit.source(), true).assemble();
+        if(!obj.has_value()){
+            return {};
+        }
+        if(unit.key != 0){
+            cache.store(unit.key, { unit.code, unit.strings, obj.value() });
+        }
+        objects.push_back(std::move(obj.value()));
+    }
+    return objects;
+}
+
+// Links without spawning `ld`. Returns false when an object uses something
+// the built-in linker does not handle.
+bool link_in_process(std::vector<ObjectFile> objects, const std::string& output_path, LinkedImage* keep = nullptr){
+    Linker linker;
+    for(ObjectFile& obj : objects){
+        linker.add_object(std::move(obj));
+    }
+    std::optional<LinkedImage> image = linker.link();
+    if(!image.has_value() || !Linker::write_executable(image.value(), output_path)){
+        return false;
+    }
+    if(keep != nullptr){
+        *keep = std::move(image.value());
+    }
+    return true;
+}
+
+// Lowers `prog` to a whole program as `options` ask, with `generator`
+// set up here apart from its cache.
+std::string lower_program(Generator& generator, const NodeProg& prog, const std::string& input_path, const BuildOptions& options){
+    generator.set_jobs(options.jobs);
+    if(!options.profile_generate.empty()){
+        generator.instrument(options.profile_generate);
+    }
+    generator.use_profile(options.profile);
+    generator.set_layout(options.layout);
+    generator.set_huge_pages(options.huge_pages);
+    generator.set_passes(options.passes);
+    generator.set_stats(options.stats);
+    if(options.debug_lines){
+        generator.set_debug_lines(input_path == "-" ? input_path : std::filesystem::absolute(input_path).lexically_normal().string());
+    }
+    std::optional<Evaluator> evaluator;
+    if(options.eval_fuel > 0 && options.passes.fold){
+        auto timer = BuildStats::time(options.stats, "evaluate");
+        evaluator.emplace(prog, options.eval_fuel);
+        generator.use_evaluator(&evaluator.value());
+    }
+    auto timer = BuildStats::time(options.stats, "generate");
+    return generator.generate_program();
+}
+
+// --code-stats: measures `source`, the program as built, then lowers it
+// again without each pass that was on to see what that pass changed.
+void record_code_stats(const NodeProg& prog, const std::string& input_path, const std::string& source, const BuildOptions& options){
+    auto timer = BuildStats::time(options.stats, "code-stats");
+    auto measure = [](const std::string& program){
+        return measure_code(program, Assembler(program).assemble());
+    };
+    CodeReport report { input_path, measure(source), {} };
+    const CodeMetrics total = total_metrics(report.functions);
+    BuildOptions without = options;
+    without.stats = nullptr;
+    for(const auto& [name, pass] : pass_list){
+        if(!(options.passes.*pass)){
+            continue;
+        }
+        without.passes = options.passes;
+        without.passes.*pass = false;
+        Generator generator(prog);
+        CodeMetrics gain = total - total_metrics(measure(lower_program(generator, prog, input_path, without)));
+        gain.name = name;
+        report.passes.push_back(std::move(gain));
+    }
+    options.code_stats->add(std::move(report));
+}
+
+// Compiles one file to an executable, writing its assembly to `asm_path`.
+// Errors in the program come out as CompileError; anything else that goes
+// wrong is reported here and returns false.
+bool build(const std::string& input_path, const std::string& exe_path, const std::string& asm_path, const BuildOptions& options, std::ostream& diag){
+    std::vector<Token> tokens = tokenize_source(input_path, options);
+    Parser parser = options.arenas != nullptr ? Parser(std::move(tokens), options.arenas->acquire()) : Parser(std::move(tokens));
+    const ArenaPool::Lease<Parser> lease(options.arenas, parser);
+    const NodeProg prog = parse_tokens(parser, options);
+
+    Generator generator(prog);
+    if(options.cache != nullptr){
+        generator.use_cache(options.cache);
+    }
+    const std::string source = lower_program(generator, prog, input_path, options);
+
+    record_memory(options, parser, source.size(), generator.data_bytes());
+    if(options.code_stats != nullptr){
+        record_code_stats(prog, input_path, source, options);
+    }
+
+    {
+        auto timer = BuildStats::time(options.stats, "write-asm");
+        std::fstream file (asm_path, std::ios::out);
+        file << source;
+    }
+
+    std::optional<std::vector<ObjectFile>> objects;
+    if(!options.system_ld){
+        auto timer = BuildStats::time(options.stats, "assemble");
+        // Instrumented functions are not cached.
+        if(options.cache != nullptr && options.profile_generate.empty()){
+            objects = assemble_units(generator, *options.cache);
+        }
+        if(!objects.has_value()){
+            if(std::optional<ObjectFile> obj = assemble_program(source, asm_path)){
+                objects.emplace();
+                objects->push_back(std::move(obj.value()));
+            }
+        }
+    }
+
+    auto link_timer = BuildStats::time(options.stats, "link");
+    if(!objects.has_value() || !link_in_process(std::move(objects.value()), exe_path, options.image)){
+        if(!options.system_ld){
+            diag << "Falling back to nasm and system ld" << std::endl;
+        }
+        const std::string obj_path = object_path(asm_path);
+        if(!run_tool({ "nasm", "-felf64", asm_path, "-o", obj_path })){
+            diag << "Assembling " << asm_path << " failed" << std::endl;
+            return false;
+        }
+        if(!run_tool({ "ld", "-o", exe_path, obj_path })){
+            diag << "Linking " << obj_path << " failed" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Builds every input into `output_dir`, one file per pool task. A file that
+// fails is reported against its name and does not stop the others.
+int build_batch(const std::vector<std::string>& inputs, const std::filesystem::path& output_dir, const BuildOptions& options, std::ostream& diag){
+    std::set<std::string> stems;
+    for(const std::string& input : inputs){
+        if(!stems.insert(std::filesystem::path(input).stem().string()).second){
+            diag << "Two inputs would both be written to " << (output_dir / std::filesystem::path(input).stem()).string() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(output_dir, ec);
+    if(ec){
+        diag << "Cannot create " << output_dir.string() << ": " << ec.message() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Files are the unit of parallelism here, so each is lowered serially.
+    BuildOptions file_options = options;
+    file_options.jobs = 1;
+    std::vector<std::string> errors(inputs.size());
+    std::vector<std::ostringstream> file_diags(inputs.size());
+    std::vector<char> built(inputs.size(), 0);
+    ThreadPool pool(std::min(options.jobs, inputs.size()));
+    pool.parallel_for(inputs.size(), [&](size_t i, size_t){
+        const std::filesystem::path exe_path = output_dir / std::filesystem::path(inputs[i]).stem();
+        std::filesystem::path asm_path = exe_path;
+        asm_path += ".asm";
+        try{
+            built[i] = build(inputs[i], exe_path.string(), asm_path.string(), file_options, file_diags[i]);
+        }
+        catch(const CompileError& err){
+            errors[i] = err.what();
+        }
+    });
+
+    size_t failed = 0;
+    for(size_t i = 0; i < inputs.size(); i++){
+        diag << file_diags[i].str();
+        if(!built[i]){
+            failed++;
+            diag << inputs[i] << ": " << (errors[i].empty() ? "build failed" : errors[i]) << std::endl;
+        }
+    }
+    if(failed > 0){
+        diag << failed << " of " << inputs.size() << " files failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int run_program(const std::string& input_path, bool interp, bool interp_stats, const BuildOptions& options){
+    Parser parser(tokenize_source(input_path, options));
+    const NodeProg prog = parse_tokens(parser, options);
+
+    if(interp){
+        BytecodeCompiler compiler(prog);
+        std::optional<BytecodeProgram> program;
+        {
+            auto timer = BuildStats::time(options.stats, "bytecode");
+            program = compiler.compile();
+        }
+        record_memory(options, parser, 0, 0);
+        if(!program.has_value()){
+            std::cerr << compiler.error() << std::endl;
+            return EXIT_FAILURE;
+        }
+        Interpreter interpreter(program.value());
+        interpreter.set_output(stdout);
+        interpreter.count_instructions(interp_stats);
+        InterpreterResult result = interpreter.run();
+        if(interp_stats){
+            std::cerr << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "static"
+                      << std::setw(16) << "executed" << "\n";
+            for(size_t i = 0; i < program->functions.size(); i++){
+                std::cerr << std::left << std::setw(24) << program->functions[i].name << std::right
+                          << std::setw(10) << program->functions[i].code.size()
+                          << std::setw(16) << interpreter.executed()[i] << "\n";
+            }
+        }
+        if(result.status == InterpreterResult::Status::error){
+            std::cerr << "Runtime error: " << result.error << std::endl;
+            return EXIT_FAILURE;
+        }
+        // As the native runtime does when a write fails.
+        if(std::ferror(stdout)){
+            std::cerr << "cannot write output" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return static_cast<int>(result.value);
+    }
+
+    Generator generator(prog, true);
+    if(options.cache != nullptr){
+        generator.use_cache(options.cache);
+    }
+    const std::string source = lower_program(generator, prog, input_path, options);
+    record_memory(options, parser, source.size(), generator.data_bytes());
+
+    std::optional<std::vector<ObjectFile>> objects;
+    {
+        auto timer = BuildStats::time(options.stats, "assemble");
+        if(options.cache != nullptr){
+            objects = assemble_units(generator, *options.cache);
+        }
+        if(!objects.has_value()){
+            if(std::optional<ObjectFile> obj = assemble_program(source, "out.asm")){
+                objects.emplace();
+                objects->push_back(std::move(obj.value()));
+            }
+        }
+    }
+    if(!objects.has_value()){
+        std::cerr << "Assembling failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if(options.cache != nullptr){
+        options.cache->flush();
+    }
+    Jit jit(std::move(objects.value()));
+    std::optional<int64_t> result = jit.run();
+    if(!result.has_value()){
+        std::cerr << "Loading the program failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return static_cast<int>(result.value());
+}
+
+void print_cache_stats(const CacheStats& stats, std::ostream& out){
+    out << "cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.bytes_read << " bytes read, " << stats.bytes_written << " bytes written, "
+              << stats.evicted << " evicted, " << stats.size << " bytes on disk" << std::endl;
+}
+
+struct Invocation {
+    BuildOptions options;
+    bool run = false;
+    bool interp = false;
+    bool interp_stats = false;
+    bool sample = false; // `cato profile`
+    bool cache_stats = false;
+    bool time_passes = false;
+    bool mem_stats = false;
+    bool stats_json = false;
+    bool code_stats = false;
+    std::vector<std::string> profile_use;
+    bool server = false;
+    bool client = false;
+    std::string socket_path;
+    std::string cache_dir;
+    std::string output_dir;
+    std::vector<std::string> inputs;
+};
+
+std::optional<Invocation> parse_invocation(const std::vector<std::string>& args){
+    Invocation inv;
+    if(const char* cache_dir = std::getenv("CATO_CACHE_DIR")){
+        inv.cache_dir = cache_dir;
+    }
+    for(size_t i = 0; i < args.size(); i++){
+        const std::string& arg = args[i];
+        const bool has_value = i + 1 < args.size();
+        if(arg == "--system-ld"){
+            inv.options.system_ld = true;
+        }
+        else if(arg == "--run"){
+            inv.run = true;
+        }
+        else if(arg == "--interp"){
+            inv.interp = true;
+        }
+        else if(arg == "--interp-stats"){
+            inv.interp = true;
+            inv.interp_stats = true;
+        }
+        else if(arg == "--cache-dir" && has_value){
+            inv.cache_dir = args[++i];
+        }
+        else if(arg == "--cache-stats"){
+            inv.cache_stats = true;
+        }
+        else if(arg == "--time-passes"){
+            inv.time_passes = true;
+        }
+        else if(arg == "--mem-stats"){
+            inv.mem_stats = true;
+        }
+        else if(arg == "--stats-json"){
+            inv.stats_json = true;
+        }
+        else if(arg == "--code-stats"){
+            inv.code_stats = true;
+        }
+        else if(arg == "--profile-generate" && has_value){
+            inv.options.profile_generate = args[++i];
+        }
+        else if(arg == "--profile-use" && has_value){
+            inv.profile_use.push_back(args[++i]);
+        }
+        else if((arg == "--align-functions" || arg == "--align-loops") && has_value){
+            const uint64_t alignment = std::max<uint64_t>(std::strtoull(args[++i].c_str(), nullptr, 10), 1);
+            if((alignment & (alignment - 1)) != 0 || alignment > 4096){
+                return {};
+            }
+            (arg == "--align-functions" ? inv.options.layout.function_align : inv.options.layout.loop_align) = alignment;
+        }
+        else if(arg == "--eval-fuel" && has_value){
+            inv.options.eval_fuel = std::strtoull(args[++i].c_str(), nullptr, 10);
+        }
+        else if(arg == "--huge-pages"){
+            inv.options.huge_pages = true;
+        }
+        else if(arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '2'){
+            inv.options.passes = Passes::level(arg[2] - '0');
+        }
+        else if(arg == "-g"){
+            inv.options.debug_lines = true;
+        }
+        else if(arg == "profile" && i == 0){
+            inv.sample = true;
+        }
+        else if(arg == "--server"){
+            inv.server = true;
+        }
+        else if(arg == "--client"){
+            inv.client = true;
+        }
+        else if(arg == "--socket" && has_value){
+            inv.socket_path = args[++i];
+        }
+        else if(arg == "-o" && has_value){
+            inv.output_dir = args[++i];
+        }
+        else if(arg.starts_with("-j")){
+            const std::string count = arg.size() > 2 ? arg.substr(2) : (has_value ? args[++i] : "");
+            inv.options.jobs = std::strtoul(count.c_str(), nullptr, 10);
+            if(inv.options.jobs == 0){
+                return {};
+            }
+        }
+        else if(arg == "-" || !arg.starts_with("-")){
+            inv.inputs.push_back(arg);
+        }
+        else{
+            return {};
+        }
+    }
+    if(inv.server){
+        return inv.inputs.empty() && !inv.client && !inv.run && !inv.interp && !inv.sample ? std::optional(inv) : std::nullopt;
+    }
+    if(inv.sample && (inv.run || inv.interp || inv.client || inv.inputs.size() != 1 || !inv.output_dir.empty()
+        || !inv.options.profile_generate.empty())){
+        return {};
+    }
+    if(inv.inputs.empty() || ((inv.run || inv.interp) && (inv.inputs.size() != 1 || !inv.output_dir.empty() || !inv.options.profile_generate.empty()))){
+        return {};
+    }
+    if(inv.client && inv.socket_path.empty()){
+        inv.socket_path = default_server_socket();
+    }
+    return inv;
+}
+
+void print_usage(){
+    std::cerr << "Incorrect Usage" << std::endl;
+    std::cerr << "cato [--system-ld] [--cache-dir <dir>] [--cache-stats] [--time-passes] [--mem-stats] [--code-stats] [--stats-json]" << std::endl;
+    std::cerr << "     [--profile-generate <file> | --profile-use <file>...] [--align-functions <n>] [--align-loops <n>]" << std::endl;
+    std::cerr << "     [--eval-fuel <n>] [--huge-pages] [-g] [-O0 | -O1 | -O2]" << std::endl;
+    std::cerr << "     [-j <threads>] [-o <dir>] <input.cato>..." << std::endl;
+    std::cerr << "cato [--run | --interp | --interp-stats] [--cache-dir <dir>] [--profile-use <file>...] [--huge-pages] [-O<level>] [-j <threads>] <input.cato>" << std::endl;
+    std::cerr << "cato profile [build options] <input.cato>" << std::endl;
+    std::cerr << "cato --server [--socket <path>] [--cache-dir <dir>]" << std::endl;
+    std::cerr << "cato --client [--socket <path>] <build arguments>" << std::endl;
+}
+
+void print_build_stats(const Invocation& inv, BuildStats& stats, std::ostream& out){
+    if(inv.time_passes){
+        stats.print_times(out, inv.stats_json);
+    }
+    if(inv.mem_stats){
+        stats.print_memory(out, inv.stats_json);
+    }
+}
+
+// Sums the --profile-use files; relative paths are taken against `cwd`.
+Profile load_profile(const Invocation& inv, const std::filesystem::path& cwd){
+    Profile profile;
+    for(const std::string& path : inv.profile_use){
+        profile.merge_file((cwd / path).string());
+    }
+    return profile;
+}
+
+// Builds the inputs of an invocation. Relative paths are taken against `cwd`.
+int build_invocation(const Invocation& inv, const std::filesystem::path& cwd, BuildOptions options, std::ostream& diag){
+    BuildStats stats;
+    if(inv.time_passes || inv.mem_stats){
+        options.stats = &stats;
+    }
+    CodeStats code_stats;
+    if(inv.code_stats){
+        options.code_stats = &code_stats;
+    }
+    int status = EXIT_FAILURE;
+    Profile profile;
+    try{
+        if(!inv.profile_use.empty()){
+            profile = load_profile(inv, cwd);
+            options.profile = &profile;
+        }
+        if(inv.inputs.size() == 1 && inv.output_dir.empty()){
+            status = build(inv.inputs[0], (cwd / "out").string(), (cwd / "out.asm").string(), options, diag) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        else{
+            status = build_batch(inv.inputs, cwd / (inv.output_dir.empty() ? "." : inv.output_dir), options, diag);
+        }
+    }
+    catch(const CompileError& err){
+        diag << err.what() << std::endl;
+    }
+    print_build_stats(inv, stats, diag);
+    if(inv.code_stats){
+        code_stats.print(diag, inv.stats_json);
+    }
+    return status;
+}
+
+// `cato profile`: builds `out` as usual but with a line table, then runs it
+// under the sampler and reports where its time went. The report goes to
+// stderr; the program's own exit status is returned.
+int profile_program(const Invocation& inv, BuildOptions options){
+    LinkedImage image;
+    options.debug_lines = true;
+    options.image = &image;
+    if(const int status = build_invocation(inv, ".", options, std::cerr); status != EXIT_SUCCESS){
+        return status;
+    }
+    if(image.text.empty()){
+        std::cerr << "profile: the program was linked by the system ld, so its line table is not at hand" << std::endl;
+        return EXIT_FAILURE;
+    }
+    Sampler sampler;
+    std::optional<SampleRun> run = sampler.run((std::filesystem::current_path() / "out").string());
+    if(!run.has_value()){
+        std::cerr << "profile: " << sampler.error() << std::endl;
+        return EXIT_FAILURE;
+    }
+    print_samples(run.value(), image, sampler.period_ns(), read_source(inv.inputs[0], options), std::cerr);
+    return run->status;
+}
+
+// $CATO_CACHE_MAX_SIZE, in bytes, or the default.
+uint64_t cache_max_bytes(){
+    if(const char* max_size = std::getenv("CATO_CACHE_MAX_SIZE")){
+        return std::strtoull(max_size, nullptr, 10);
+    }
+    return FunctionCache::default_max_bytes;
+}
+
+// Everything a warm server keeps between requests.
+class ServerState {
+public:
+    explicit ServerState(const std::string& cache_dir)
+        : m_arenas(Parser::arena_size)
+        , m_default_cache_dir(cache_dir)
+    {
+        keywords();
+        if(!cache_dir.empty()){
+            cache(cache_dir);
+        }
+    }
+
+    int handle(const CompileRequest& request, std::ostream& diag){
+        std::vector<std::string> args = request.args;
+        std::optional<Invocation> inv = parse_invocation(args);
+        if(!inv.has_value() || inv->server || inv->client || inv->run || inv->interp || inv->sample){
+            diag << "server: unsupported request" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const std::filesystem::path cwd = request.cwd;
+        std::map<std::string, std::string> sources(request.sources.begin(), request.sources.end());
+        for(std::string& input : inv->inputs){
+            if(!sources.count(input)){
+                input = (cwd / input).string();
+            }
+        }
+
+        BuildOptions options = inv->options;
+        options.arenas = &m_arenas;
+        options.sources = &sources;
+        const std::string cache_dir = request_cache_dir(args, cwd);
+        if(!cache_dir.empty()){
+            options.cache = &cache(cache_dir);
+        }
+
+        const int status = build_invocation(inv.value(), cwd, options, diag);
+        if(options.cache != nullptr){
+            options.cache->flush();
+            if(inv->cache_stats){
+                print_cache_stats(options.cache->stats(), diag);
+            }
+        }
+        return status;
+    }
+
+private:
+    // The client's own --cache-dir wins over the one the server started with.
+    std::string request_cache_dir(const std::vector<std::string>& args, const std::filesystem::path& cwd) const {
+        for(size_t i = 0; i + 1 < args.size(); i++){
+            if(args[i] == "--cache-dir"){
+                return (cwd / args[i + 1]).string();
+            }
+        }
+        return m_default_cache_dir;
+    }
+
+    FunctionCache& cache(const std::string& dir){
+        std::lock_guard lock(m_caches_mutex);
+        auto it = m_caches.find(dir);
+        if(it == m_caches.end()){
+            it = m_caches.emplace(std::piecewise_construct, std::forward_as_tuple(dir), std::forward_as_tuple(dir, cache_max_bytes())).first;
+        }
+        return it->second;
+    }
+
+    ArenaPool m_arenas;
+    std::string m_default_cache_dir;
+    std::mutex m_caches_mutex;
+    std::map<std::string, FunctionCache> m_caches;
+};
+
+// Forwards a build to the server, sending stdin along when the input is
+// `-`. Falls back to building locally if no server answers.
+std::optional<int> forward_to_server(const Invocation& inv, const std::vector<std::string>& args){
+    CompileRequest request { std::filesystem::current_path().string(), {}, {} };
+    for(const std::string& arg : args){
+        if(arg != "--client"){
+            request.args.push_back(arg);
+        }
+    }
+    for(const std::string& input : inv.inputs){
+        if(input == "-"){
+            std::stringstream contents;
+            contents << std::cin.rdbuf();
+            request.sources.emplace_back("-", contents.str());
+        }
+    }
+    std::optional<CompileResponse> response = send_compile_request(inv.socket_path, request);
+    if(!response.has_value()){
+        return {};
+    }
+    std::cerr << response->diagnostics;
+    return response->status;
+}
+
+int main(int argc, char* argv[]){
+
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    std::optional<Invocation> inv = parse_invocation(args);
+    if(!inv.has_value()){
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    if(inv->server){
+        std::string cache_dir = inv->cache_dir;
+        if(!cache_dir.empty()){
+            cache_dir = std::filesystem::absolute(cache_dir).string();
+        }
+        ServerState state(cache_dir);
+        CompileServer server(inv->socket_path.empty() ? default_server_socket() : inv->socket_path,
+            [&state](const CompileRequest& request, std::ostream& diag){ return state.handle(request, diag); });
+        return server.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if(inv->client && !inv->run && !inv->interp){
+        if(std::optional<int> status = forward_to_server(inv.value(), args)){
+            return status.value();
+        }
+        std::cerr << "No compile server on " << inv->socket_path << ", building locally" << std::endl;
+    }
+
+    std::map<std::string, std::string> stdin_sources;
+    if(std::find(inv->inputs.begin(), inv->inputs.end(), "-") != inv->inputs.end()){
+        std::stringstream contents;
+        contents << std::cin.rdbuf();
+        stdin_sources["-"] = contents.str();
+        inv->options.sources = &stdin_sources;
+    }
+
+    std::optional<FunctionCache> cache;
+    if(!inv->cache_dir.empty()){
+        cache.emplace(inv->cache_dir, cache_max_bytes());
+        inv->options.cache = &cache.value();
+    }
+
+    int status = EXIT_SUCCESS;
+    if(inv->run || inv->interp){
+        BuildStats stats;
+        if(inv->time_passes || inv->mem_stats){
+            inv->options.stats = &stats;
+        }
+        try{
+            Profile profile;
+            if(!inv->profile_use.empty()){
+                profile = load_profile(inv.value(), ".");
+                inv->options.profile = &profile;
+            }
+            status = run_program(inv->inputs[0], inv->interp, inv->interp_stats, inv->options);
+        }
+        catch(const CompileError& err){
+            std::cerr << err.what() << std::endl;
+            status = EXIT_FAILURE;
+        }
+        print_build_stats(inv.value(), stats, std::cerr);
+    }
+    else if(inv->sample){
+        status = profile_program(inv.value(), inv->options);
+    }
+    else{
+        status = build_invocation(inv.value(), ".", inv->options, std::cerr);
+    }
+
+    if(cache.has_value()){
+        cache->flush();
+        if(inv->cache_stats){
+            print_cache_stats(cache->stats(), std::cerr);
+        }
+    }
+    return status;
+
+}
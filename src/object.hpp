@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// In-memory form of an ELF64 relocatable object, shared by the built-in
+// assembler (which produces it), the ELF reader (which loads nasm output)
+// and the linker / JIT (which consume it).
+
+struct ObjectSection {
+    std::string name;
+    std::vector<uint8_t> data; // empty for SHT_NOBITS sections
+    uint64_t size = 0;
+    uint64_t align = 1;
+    uint64_t flags = 0; // SHF_* bits
+    bool nobits = false;
+};
+
+struct ObjectSymbol {
+    std::string name;
+    int section = -1; // index into ObjectFile::sections, -1 when undefined
+    uint64_t value = 0;
+    uint64_t size = 0;
+    bool global = false;
+    bool absolute = false;
+};
+
+struct ObjectReloc {
+    size_t section;
+    uint64_t offset;
+    uint32_t type;
+    size_t symbol;
+    int64_t addend;
+};
+
+// Code from `offset` on, up to the next entry, came from source `line`.
+struct ObjectLine {
+    size_t section;
+    uint64_t offset;
+    uint32_t line;
+};
+
+struct ObjectFile {
+    std::vector<ObjectSection> sections;
+    std::vector<ObjectSymbol> symbols;
+    std::vector<ObjectReloc> relocs;
+    std::vector<ObjectLine> lines; // from `%line` directives
+    std::string line_file;         // the source they refer to
+};
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+#include "./hash.hpp"
+#include "./parser.hpp"
+
+// A `parallel for` in the only form the generator splits across threads:
+//
+//     parallel for (int i = START; i < END; i = i + STEP) { ... }
+//
+// with STEP a positive literal. END is evaluated once, before any
+// iteration runs, and the iterations run in no particular order.
+struct ParallelLoop {
+    std::string counter;
+    const NodeExpr* end;
+    int64_t step;
+    // Variables declared outside the loop that the body only adds to, with
+    // `s = s + e` or `s = s - e`: each thread sums into its own copy and
+    // adds that to the variable when it is done.
+    std::vector<std::string> reductions;
+};
+
+// Checks that a loop's iterations are independent as far as the compiler
+// can tell. The body may read any variable, but the only ones declared
+// outside it that it may assign are reductions, which it must not read
+// otherwise. It may not print, exit, return or allocate, directly or
+// through a call, since the output buffer and the heap are not shared
+// between threads. Iterations that write an array element another one
+// reads or writes are not detected.
+class ParallelChecker {
+public:
+    inline explicit ParallelChecker(const NodeProg& prog)
+    {
+        for (const NodeStatement* stmt : prog.statements) {
+            if (auto decl = std::get_if<NodeFunctionDecl*>(&stmt->var)) {
+                const std::string& name = (*decl)->ident.value.value();
+                Effects effects;
+                effects.walk((*decl)->body);
+                m_functions[name] = { (*decl)->hash, std::move(effects.calls) };
+                if (effects.effect) {
+                    m_effectful.insert(name);
+                }
+            }
+        }
+        // A function is effectful if it calls one that is, or one that does
+        // not exist.
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const auto& [name, function] : m_functions) {
+                if (m_effectful.count(name) != 0) {
+                    continue;
+                }
+                for (const std::string& callee : function.calls) {
+                    if (m_effectful.count(callee) != 0 || m_functions.count(callee) == 0) {
+                        m_effectful.insert(name);
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // The functions the parallel loops in `scope` call directly.
+    static inline std::set<std::string> loop_calls(const NodeScope* scope)
+    {
+        std::set<std::string> calls;
+        std::vector<const NodeStatement*> pending(scope->statements.rbegin(), scope->statements.rend());
+        while (!pending.empty()) {
+            const NodeStatement* stmt = pending.back();
+            pending.pop_back();
+            if (auto loop = std::get_if<NodeStatementFor*>(&stmt->var); loop && (*loop)->parallel) {
+                Effects effects;
+                effects.walk(stmt);
+                calls.merge(effects.calls);
+                continue;
+            }
+            for_each_part(stmt, [&](const NodeScope* inner) { pending.insert(pending.end(), inner->statements.rbegin(), inner->statements.rend()); },
+                [&](const NodeStatement* part) { pending.push_back(part); }, [](const NodeExpr*) { });
+        }
+        return calls;
+    }
+
+    // A hash of the bodies of `names` and of every function they call in
+    // turn, which decide whether a loop calling them is allowed.
+    inline uint64_t hash_reachable(std::set<std::string> names) const
+    {
+        uint64_t hash = fnv_offset;
+        std::vector<std::string> pending(names.begin(), names.end());
+        while (!pending.empty()) {
+            const std::string name = std::move(pending.back());
+            pending.pop_back();
+            hash = fnv1a(name, hash);
+            auto function = m_functions.find(name);
+            if (function == m_functions.end()) {
+                continue;
+            }
+            hash = fnv1a(function->second.hash, hash);
+            for (const std::string& callee : function->second.calls) {
+                if (names.insert(callee).second) {
+                    pending.push_back(callee);
+                }
+            }
+        }
+        return hash;
+    }
+
+    inline ParallelLoop check(const NodeStatementFor* stmt_for)
+    {
+        ParallelLoop loop;
+        auto init = std::get_if<NodeStatementInt*>(&stmt_for->init->var);
+        auto bin = std::get_if<NodeBinExpression*>(&stmt_for->condition->var);
+        auto condition = bin ? std::get_if<NodeBinExpressionLess*>(&(*bin)->var) : nullptr;
+        auto iteration = std::get_if<NodeStatementAssign*>(&stmt_for->iteration->var);
+        if (init == nullptr || condition == nullptr || iteration == nullptr) {
+            compile_error(shape_error);
+        }
+        loop.counter = (*init)->ident.value.value();
+        loop.end = (*condition)->rhs;
+        if (!is_ident((*condition)->lhs, loop.counter) || (*iteration)->ident.value.value() != loop.counter) {
+            compile_error(shape_error);
+        }
+        auto add = std::get_if<NodeBinExpression*>(&(*iteration)->expr->var);
+        auto sum = add ? std::get_if<NodeBinExpressionAdd*>(&(*add)->var) : nullptr;
+        if (sum == nullptr || !is_ident((*sum)->lhs, loop.counter) || !literal((*sum)->rhs, loop.step) || loop.step <= 0) {
+            compile_error(shape_error);
+        }
+
+        m_counter = loop.counter;
+        walk(stmt_for->scope);
+        for (const std::string& name : m_reductions) {
+            if (m_reads.count(name) != 0) {
+                compile_error("`" + name + "` is read in the parallel loop that sums into it");
+            }
+            loop.reductions.push_back(name);
+        }
+        return loop;
+    }
+
+private:
+    struct Function {
+        uint64_t hash = 0; // of its body
+        std::set<std::string> calls;
+    };
+
+    static constexpr const char* shape_error = "parallel for needs the form `parallel for (int i = a; i < b; i = i + step)`";
+
+    // What a function body does that a parallel loop may not.
+    struct Effects {
+        bool effect = false;
+        std::set<std::string> calls;
+
+        void walk(const NodeScope* scope)
+        {
+            for (const NodeStatement* stmt : scope->statements) {
+                walk(stmt);
+            }
+        }
+
+        void walk(const NodeStatement* stmt)
+        {
+            if (std::holds_alternative<NodeStatementPrint*>(stmt->var) || std::holds_alternative<NodeStatementExit*>(stmt->var)) {
+                effect = true;
+            } else if (auto array = std::get_if<NodeStatementArray*>(&stmt->var); array && (*array)->size) {
+                effect = true;
+            }
+            for_each_part(stmt, [&](const NodeScope* scope) { walk(scope); }, [&](const NodeStatement* part) { walk(part); },
+                [&](const NodeExpr* expr) { visit_calls(expr, calls); });
+        }
+    };
+
+    // Calls `scope`, `statement` and `expr` on the parts of `stmt`.
+    template <typename Scope, typename Statement, typename Expr>
+    static void for_each_part(const NodeStatement* stmt, Scope scope, Statement statement, Expr expr)
+    {
+        if (auto stmt_int = std::get_if<NodeStatementInt*>(&stmt->var)) {
+            expr((*stmt_int)->expr);
+        } else if (auto assign = std::get_if<NodeStatementAssign*>(&stmt->var)) {
+            expr((*assign)->expr);
+        } else if (auto store = std::get_if<NodeStatementStore*>(&stmt->var)) {
+            expr((*store)->index);
+            expr((*store)->expr);
+        } else if (auto array = std::get_if<NodeStatementArray*>(&stmt->var)) {
+            if ((*array)->size) {
+                expr((*array)->size);
+            }
+        } else if (auto stmt_exit = std::get_if<NodeStatementExit*>(&stmt->var)) {
+            expr((*stmt_exit)->expr);
+        } else if (auto stmt_return = std::get_if<NodeStatementReturn*>(&stmt->var)) {
+            if ((*stmt_return)->expr) {
+                expr((*stmt_return)->expr);
+            }
+        } else if (auto print = std::get_if<NodeStatementPrint*>(&stmt->var)) {
+            if ((*print)->expr) {
+                expr((*print)->expr);
+            }
+        } else if (auto inner = std::get_if<NodeScope*>(&stmt->var)) {
+            scope(*inner);
+        } else if (auto stmt_if = std::get_if<NodeStatementIf*>(&stmt->var)) {
+            expr((*stmt_if)->expr);
+            scope((*stmt_if)->scope);
+            std::optional<NodeIfPred*> pred = (*stmt_if)->pred;
+            while (pred.has_value()) {
+                if (auto elif = std::get_if<NodeIfPredicateElif*>(&pred.value()->var)) {
+                    expr((*elif)->expr);
+                    scope((*elif)->scope);
+                    pred = (*elif)->pred;
+                } else {
+                    scope(std::get<NodeIfPredicateElse*>(pred.value()->var)->scope);
+                    pred.reset();
+                }
+            }
+        } else if (auto stmt_for = std::get_if<NodeStatementFor*>(&stmt->var)) {
+            if ((*stmt_for)->init) {
+                statement((*stmt_for)->init);
+            }
+            if ((*stmt_for)->condition) {
+                expr((*stmt_for)->condition);
+            }
+            if ((*stmt_for)->scope) {
+                scope((*stmt_for)->scope);
+            }
+            if ((*stmt_for)->iteration) {
+                statement((*stmt_for)->iteration);
+            }
+        }
+    }
+
+    static void visit_calls(const NodeExpr* expr, std::set<std::string>& calls)
+    {
+        visit_terms(expr, [&](const NodeTerm* term) {
+            if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+                calls.insert((*call)->ident.value.value());
+            }
+        });
+    }
+
+    // Every term in `expr`, outermost first, left to right.
+    template <typename Visit>
+    static void visit_terms(const NodeExpr* expr, Visit visit)
+    {
+        std::vector<const NodeExpr*> pending { expr };
+        while (!pending.empty()) {
+            expr = pending.back();
+            pending.pop_back();
+            if (auto bin = std::get_if<NodeBinExpression*>(&expr->var)) {
+                std::visit([&](const auto* node) {
+                    pending.push_back(node->rhs);
+                    pending.push_back(node->lhs);
+                }, (*bin)->var);
+                continue;
+            }
+            const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+            visit(term);
+            if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+                pending.push_back((*paren)->expr);
+            } else if (auto term_not = std::get_if<NodeTermNot*>(&term->var)) {
+                pending.push_back((*term_not)->expr);
+            } else if (auto index = std::get_if<NodeTermIndex*>(&term->var)) {
+                pending.push_back((*index)->index);
+            } else if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+                for (size_t i = (*call)->args.size(); i-- > 0;) {
+                    pending.push_back((*call)->args[i]);
+                }
+            }
+        }
+    }
+
+    static bool is_ident(const NodeExpr* expr, const std::string& name)
+    {
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        auto ident = term ? std::get_if<NodeTermIdent*>(&(*term)->var) : nullptr;
+        return ident != nullptr && (*ident)->ident.value.value() == name;
+    }
+
+    static bool literal(const NodeExpr* expr, int64_t& value)
+    {
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        auto lit = term ? std::get_if<NodeTermIntLit*>(&(*term)->var) : nullptr;
+        if (lit == nullptr) {
+            return false;
+        }
+        value = (*lit)->value;
+        return true;
+    }
+
+    // The operands of `target + a - b ...`, or false if `expr` is not a
+    // sum that starts with target.
+    static bool match_sum(const NodeExpr* expr, const std::string& target, std::vector<const NodeExpr*>& operands)
+    {
+        while (!is_ident(expr, target)) {
+            auto bin = std::get_if<NodeBinExpression*>(&expr->var);
+            if (bin == nullptr) {
+                return false;
+            }
+            if (auto add = std::get_if<NodeBinExpressionAdd*>(&(*bin)->var)) {
+                operands.push_back((*add)->rhs);
+                expr = (*add)->lhs;
+            } else if (auto sub = std::get_if<NodeBinExpressionSub*>(&(*bin)->var)) {
+                operands.push_back((*sub)->rhs);
+                expr = (*sub)->lhs;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void read(const NodeExpr* expr)
+    {
+        visit_terms(expr, [&](const NodeTerm* term) {
+            if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+                m_reads.insert((*ident)->ident.value.value());
+            } else if (auto call = std::get_if<NodeFunctionCall*>(&term->var)) {
+                if (m_effectful.count((*call)->ident.value.value()) != 0) {
+                    compile_error("`" + (*call)->ident.value.value() + "` prints, exits or allocates and cannot be called in a parallel loop");
+                }
+            }
+        });
+    }
+
+    void walk(const NodeScope* scope)
+    {
+        for (const NodeStatement* stmt : scope->statements) {
+            walk(stmt);
+        }
+    }
+
+    void walk(const NodeStatement* stmt)
+    {
+        if (std::holds_alternative<NodeStatementPrint*>(stmt->var)) {
+            compile_error("Printing in a parallel loop");
+        } else if (std::holds_alternative<NodeStatementExit*>(stmt->var)) {
+            compile_error("exit in a parallel loop");
+        } else if (std::holds_alternative<NodeStatementReturn*>(stmt->var)) {
+            compile_error("return in a parallel loop");
+        } else if (std::holds_alternative<NodeFunctionDecl*>(stmt->var)) {
+            compile_error("Function declared in a parallel loop");
+        } else if (auto stmt_for = std::get_if<NodeStatementFor*>(&stmt->var); stmt_for && (*stmt_for)->parallel) {
+            compile_error("Parallel loops cannot be nested");
+        } else if (auto array = std::get_if<NodeStatementArray*>(&stmt->var)) {
+            if ((*array)->size) {
+                compile_error("alloc in a parallel loop");
+            }
+            m_declared.insert((*array)->ident.value.value());
+        } else if (auto stmt_int = std::get_if<NodeStatementInt*>(&stmt->var)) {
+            read((*stmt_int)->expr);
+            m_declared.insert((*stmt_int)->ident.value.value());
+            return;
+        } else if (auto assign = std::get_if<NodeStatementAssign*>(&stmt->var)) {
+            const std::string& name = (*assign)->ident.value.value();
+            std::vector<const NodeExpr*> operands;
+            if (m_declared.count(name) != 0) {
+                read((*assign)->expr);
+            } else if (name != m_counter && match_sum((*assign)->expr, name, operands)) {
+                m_reductions.insert(name);
+                for (const NodeExpr* operand : operands) {
+                    read(operand);
+                }
+            } else {
+                compile_error("`" + name + "` is assigned in a parallel loop; only sums like `" + name + " = " + name + " + x` are allowed");
+            }
+            return;
+        }
+        for_each_part(stmt, [&](const NodeScope* scope) { walk(scope); }, [&](const NodeStatement* part) { walk(part); },
+            [&](const NodeExpr* expr) { read(expr); });
+    }
+
+    std::map<std::string, Function> m_functions;
+    std::set<std::string> m_effectful;
+    std::string m_counter;
+    std::set<std::string> m_declared; // in the body
+    std::set<std::string> m_reductions;
+    std::set<std::string> m_reads;
+};
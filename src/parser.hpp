@@ -1,669 +1,930 @@
-#pragma once
-
-#include <iostream>
-#include <optional>
-#include <vector>
-#include "./tokenization.hpp"
-#include <variant>
-#include "./arena.hpp"
-
-    struct NodeTermIntLit {
-    Token int_lit;
-    };
-
-    struct NodeTermIdent {
-        Token ident;
-    };
-
-    struct NodeExpr;
-
-    struct NodeTermParen {
-        NodeExpr* expr;
-    };
-
-    struct NodeTermStringLit {
-        std::string value;
-    };
-
-    struct NodeStatementExit{
-        NodeExpr* expr;
-    };
-
-    struct NodeStatementInt{
-        Token ident;
-        NodeExpr* expr;
-    };
-
-    struct NodeStatementAssign{
-        Token ident;
-        NodeExpr* expr;
-    };
-
-    struct NodeStatement;
-    struct NodeIfPred;
-    struct NodeFunctionDecl;
-    struct NodeStatementReturn;
-
-
-    struct NodeScope{
-        std::vector<NodeStatement*> statements;
-    };
-
-    struct NodeIfPredicateElif{
-        NodeExpr* expr;
-        NodeScope* scope;
-        std::optional<NodeIfPred*> pred;
-    };
-
-    struct NodeIfPredicateElse{
-        NodeScope* scope;
-    };
-
-    struct NodeIfPred{
-        std::variant<NodeIfPredicateElif*, NodeIfPredicateElse*> var;
-    };
-
-
-    struct NodeStatementIf{
-        NodeExpr* expr;
-        NodeScope* scope;
-        std::optional<NodeIfPred*> pred;
-    };
-
-    struct NodeStatementFor{
-    NodeStatement* init;
-    NodeExpr* condition;
-    NodeStatement* iteration;
-    NodeScope* scope;
-
-    NodeStatementFor(NodeStatement* init, NodeExpr* condition, NodeStatement* iteration, NodeScope* scope)
-        : init(init), condition(condition), iteration(iteration), scope(scope) {}
-    };
-
-    struct NodeStatement{
-        std::variant<NodeStatementExit*, NodeStatementInt*, NodeScope*, NodeStatementIf*, NodeStatementAssign*, NodeStatementFor*, NodeFunctionDecl*, NodeStatementReturn*> var;
-    };
-
-
-    struct NodeBinExpressionAdd{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-
-    };
-
-    struct NodeBinExpressionMulti{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-
-    struct NodeBinExpressionSub{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-
-    struct NodeBinExpressionDiv{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-
-    struct NodeBinExpressionNotEquals{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-    struct NodeBinExpressionEquals{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-    struct NodeBinExpressionLess{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-    struct NodeBinExpressionGreater{
-        NodeExpr* lhs;
-        NodeExpr* rhs;
-    };
-
-    struct NodeBinExpression{
-        std::variant<NodeBinExpressionAdd*, NodeBinExpressionSub*,
-        NodeBinExpressionMulti*, NodeBinExpressionDiv*,
-        NodeBinExpressionEquals*, NodeBinExpressionNotEquals*,
-        NodeBinExpressionLess*, NodeBinExpressionGreater*> var;
-    };
-
-    
-
-    struct NodeFunctionDecl {
-        Token ident;
-        std::vector<Token> params;
-        NodeScope* body;
-    };
-
-    struct NodeFunctionCall {
-        Token ident;
-        std::vector<NodeExpr*> args;
-    };
-
-    struct NodeStatementReturn {
-        NodeExpr* expr;
-    };
-
-    struct NodeTerm {
-        std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*, NodeTermStringLit*, NodeFunctionCall*> var;
-    };
-
-    struct NodeExpr {
-        std::variant<NodeTerm*, NodeBinExpression*> var;
-    };
-
-    struct NodeProg{
-        std::vector<NodeStatement*> statements;
-        std::vector<NodeFunctionDecl*> functions;
-    };
-
-class Parser {
-  
-
-    public: 
-
-        const std::vector<Token> m_tokens;
-        size_t m_index = 0;
-        ArenaAllocator m_allocator;
-
-
-        inline explicit Parser(std::vector<Token> tokens)
-            : m_tokens(std::move(tokens)),
-            m_allocator(1024 * 1024 * 4) //4mb
-
-        {
-        }
-
-        std::optional<NodeTerm*> parse_term()
-        {
-            if (auto int_lit = try_consume(TokenType::int_lit)) {
-                auto term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-                term_int_lit->int_lit = int_lit.value();
-                auto term = m_allocator.alloc<NodeTerm>();
-                term->var = term_int_lit;
-                return term;
-            }
-            else if (auto ident = try_consume(TokenType::ident)) {
-                if (try_consume(TokenType::open_paren)) {
-                    auto func_call = m_allocator.alloc<NodeFunctionCall>();
-                    func_call->ident = ident.value();
-
-                    while (!try_consume(TokenType::close_paren)) {
-                        if (auto arg = parse_expr()) {
-                            func_call->args.push_back(arg.value());
-                        } else {
-                            std::cerr << "Expected argument expression" << std::endl;
-                            exit(EXIT_FAILURE);
-                        }
-                        try_consume(TokenType::comma); // Optional comma
-                    }
-
-                    auto term = m_allocator.alloc<NodeTerm>();
-                    term->var = func_call;
-                    return term;
-                } else {
-                    // Handle identifier (variable)
-                    auto expr_ident = m_allocator.alloc<NodeTermIdent>();
-                    expr_ident->ident = ident.value();
-                    auto term = m_allocator.alloc<NodeTerm>();
-                    term->var = expr_ident;
-                    return term;
-                }
-            }
-            else if (auto ident = try_consume(TokenType::ident)) {
-                auto expr_ident = m_allocator.alloc<NodeTermIdent>();
-                expr_ident->ident = ident.value();
-                auto term = m_allocator.alloc<NodeTerm>();
-                term->var = expr_ident;
-                return term;
-            }
-            else if (auto open_paren = try_consume(TokenType::open_paren)) {
-                auto expr = parse_expr();
-                if(!expr.has_value()){
-                    std::cerr << "Expected Expression" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                try_consume(TokenType::close_paren, "Expected `)` 1");
-                auto term_paren = m_allocator.alloc<NodeTermParen>();
-                term_paren->expr = expr.value();
-                auto term = m_allocator.alloc<NodeTerm>();
-                term->var = term_paren;
-                return term;
-            } else if (auto string_lit = try_consume(TokenType::string_lit)) {
-                auto term_string_lit = m_allocator.alloc<NodeTermStringLit>();
-                if (string_lit.has_value() && string_lit.value().value.has_value()) {
-                term_string_lit->value = string_lit.value().value.value();
-                } else {
-                    std::cerr << "String literal without a value." << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                auto term = m_allocator.alloc<NodeTerm>();
-                term->var = term_string_lit;
-                return term;
-            }
-            else {
-                return {};
-            }
-        }
-
-        std::optional<NodeExpr*> parse_expr(int min_prec = 0)
-    {
-
-        std::optional<NodeTerm*> term_lhs = parse_term();
-        if(!term_lhs.has_value()) {
-            return {};
-        }
-
-        auto expr_lhs = m_allocator.alloc<NodeExpr>();
-        expr_lhs->var = term_lhs.value();
-
-        while(true) {
-            std::optional<Token> current_token = peek();
-            std::optional<int> prec;
-
-            if(current_token.has_value()) {
-                prec = bin_prec(current_token->type);
-                if(!prec.has_value() || prec < min_prec){
-                    break;
-                }
-
-            }
-            else{
-                break;
-            }
-
-            Token op = consume();
-            int next_min_prec = prec.value() + 1;
-            auto expr_rhs = parse_expr(next_min_prec);
-
-            if(!expr_rhs.has_value()) {
-                std::cerr << "Error parsing expression " << std::endl;
-                exit(EXIT_FAILURE);
-            }
-
-            auto expr = m_allocator.alloc<NodeBinExpression>();
-            auto expr_lhs2 = m_allocator.alloc<NodeExpr>();
-            
-
-            if(op.type == TokenType::plus) {
-                auto add = m_allocator.alloc<NodeBinExpressionAdd>();
-                expr_lhs2->var = expr_lhs->var;
-                add->lhs = expr_lhs2;
-                add->rhs = expr_rhs.value();
-                expr->var = add;
-                std::cout << "Created NodeBinExpressionAdd" << std::endl;
-                
-            } else if (op.type == TokenType::sub) {
-                auto sub = m_allocator.alloc<NodeBinExpressionSub>();
-                expr_lhs2->var = expr_lhs->var;
-                sub->lhs = expr_lhs2;
-                sub->rhs = expr_rhs.value();
-                expr->var = sub;
-                std::cout << "Created NodeBinExpressionSub" << std::endl;
-
-            } else if (op.type == TokenType::star) {
-                auto multi = m_allocator.alloc<NodeBinExpressionMulti>();
-                expr_lhs2->var = expr_lhs->var;
-                multi->lhs = expr_lhs2;
-                multi->rhs = expr_rhs.value();
-                expr->var = multi;
-                std::cout << "Created NodeBinExpressionMulti" << std::endl;
-            } else if (op.type == TokenType::div) {
-                auto div = m_allocator.alloc<NodeBinExpressionDiv>();
-                expr_lhs2->var = expr_lhs->var;
-                div->lhs = expr_lhs2;
-                div->rhs = expr_rhs.value();
-                expr->var = div;
-                std::cout << "Created NodeBinExpressionDiv" << std::endl;
-            } else if (op.type == TokenType::equality) {
-                auto condition = m_allocator.alloc<NodeBinExpressionEquals>();
-                expr_lhs2->var = expr_lhs->var;
-                condition->lhs = expr_lhs2;
-                condition->rhs = expr_rhs.value();
-                expr->var = condition;
-                std::cout << "Created NodeBinExpressionEquals" << std::endl;
-            } else if (op.type == TokenType::not_equal) {
-                auto condition = m_allocator.alloc<NodeBinExpressionNotEquals>();
-                expr_lhs2->var = expr_lhs->var;
-                condition->lhs = expr_lhs2;
-                condition->rhs = expr_rhs.value();
-                expr->var = condition;
-                std::cout << "Created NodeBinExpressionNotEquals" << std::endl;
-            } else if (op.type == TokenType::greater_than) {
-                auto condition = m_allocator.alloc<NodeBinExpressionGreater>();
-                expr_lhs2->var = expr_lhs->var;
-                condition->lhs = expr_lhs2;
-                condition->rhs = expr_rhs.value();
-                expr->var = condition;
-                std::cout << "Created NodeBinExpressionGreater" << std::endl;
-            } else if (op.type == TokenType::less_than) {
-                auto condition = m_allocator.alloc<NodeBinExpressionLess>();
-                expr_lhs2->var = expr_lhs->var;
-                condition->lhs = expr_lhs2;
-                condition->rhs = expr_rhs.value();
-                expr->var = condition;
-                std::cout << "Created NodeBinExpressionLess" << std::endl;
-            }
-
-            expr_lhs->var = expr;
-            
-        }
-
-        return expr_lhs;
-    }
-
-        std::optional<NodeScope*> parse_scope(){
-
-            if(!try_consume(TokenType::open_curly).has_value()) {
-                return {};
-            }
-
-            auto scope = m_allocator.alloc<NodeScope>();
-            while(auto statment = parse_statement()){
-                scope->statements.push_back(statment.value());
-            }
-            try_consume(TokenType::close_curly, "Expected `}`");
-            return scope;
-    
-        }
-
-        std::optional<NodeIfPred*> parse_if_predicate()
-        {
-            if(try_consume(TokenType::elif_)){
-                try_consume(TokenType::open_paren, "Expected `(`");
-                auto elif = m_allocator.alloc<NodeIfPredicateElif>();
-                if(auto expr = parse_expr()){
-                    elif->expr = expr.value();
-                }
-                else{
-                    std::cerr << "Expected Expression" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                try_consume(TokenType::close_paren, "Expected `)` 2");
-                if(auto scope = parse_scope()){
-                    elif->scope = scope.value();
-                }else{
-                    std::cerr << "Expected scope" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                elif->pred = parse_if_predicate();
-                auto pred = m_allocator.emplace<NodeIfPred>(elif);
-                return pred;
-            }
-            if(try_consume(TokenType::else_)){
-                auto else_ = m_allocator.alloc<NodeIfPredicateElse>();
-                if(auto scope = parse_scope()){
-                    else_->scope = scope.value();
-                }else{
-                    std::cerr << "Expected scope" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                auto pred = m_allocator.emplace<NodeIfPred>(else_);
-                return pred;
-            }
-            return {};
-        };
-
-        std::optional<NodeStatement*> parse_for_statement() {
-            if (!try_consume(TokenType::for_)) {
-                return {};
-            }
-
-            try_consume(TokenType::open_paren, "Expected `(` in for loop");
-
-            auto init = parse_statement();
-            if (!init.has_value()) {
-                std::cerr << "Expected initialization in for loop" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-
-
-            auto condition = parse_expr();
-            if (!condition.has_value()) {
-                std::cerr << "Expected condition in for loop" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            try_consume(TokenType::semi, "Expected `;` after condition in for loop");
-
-
-            auto iteration = parse_statement(false);
-            if (!iteration.has_value()) {
-                std::cerr << "Expected iteration in for loop" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            try_consume(TokenType::close_paren, "Expected `)` after iteration in for loop");
-
-            auto scope = parse_scope();
-            if (!scope.has_value()) {
-                std::cerr << "Expected scope in for loop" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-
-            auto stmt_for = m_allocator.alloc<NodeStatementFor>();
-            stmt_for->init = init.value();
-            stmt_for->condition = condition.value();
-            stmt_for->iteration = iteration.value();
-            stmt_for->scope = scope.value();
-
-            auto stmt = m_allocator.alloc<NodeStatement>();
-            stmt->var = stmt_for;
-            return stmt;
-        }
-
-
-        std::optional<NodeStatement*> parse_statement(bool expect_semicolon = true){
-             if (peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren){
-                    consume();
-                    consume();
-
-                    auto stmt_exit = m_allocator.alloc<NodeStatementExit>();
-
-                    if(auto node_expr = parse_expr()){
-                        stmt_exit->expr = node_expr.value();
-                    }
-                    else{
-                        std::cerr << "Goof Invalid Expression 1 " << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    try_consume(TokenType::close_paren, "Expected `)` 3");
-                    if (expect_semicolon) {
-                        try_consume(TokenType::semi, "Expected `;`");
-                    }
-                    auto stmt = m_allocator.alloc<NodeStatement>();
-                    stmt->var = stmt_exit;
-                    return stmt;
-
-                } else if (peek().has_value() && peek().value().type == TokenType::int_ && peek(1).has_value() 
-                    && peek(1).value().type == TokenType::ident && peek(2).has_value() 
-                    && peek(2).value().type == TokenType::eq)
-                    {
-                    
-                    consume();
-                    auto statment_int = m_allocator.alloc<NodeStatementInt>();
-                    statment_int->ident = consume();
-                    consume();
-
-                    if(auto expr = parse_expr()){
-                        statment_int->expr = expr.value();
-                    } else{
-                        std::cerr << "Invalid Expression 1 " << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    if (expect_semicolon) {
-                        try_consume(TokenType::semi, "Expected `;`");
-                    }
-                    auto stmt = m_allocator.alloc<NodeStatement>();
-                    stmt->var = statment_int;
-                    return stmt;
-
-                }
-                else if(peek().has_value() && peek().value().type == TokenType::ident 
-                && peek(1).has_value() 
-                && peek(1).value().type == TokenType::eq)
-                {
-                    const auto assign = m_allocator.alloc<NodeStatementAssign>();
-                    assign->ident = consume();
-                    consume();
-                    if(const auto expr = parse_expr()){
-                        assign->expr = expr.value();
-                    } else {
-                        std::cerr << "Expected Expression" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    if (expect_semicolon) {
-                        try_consume(TokenType::semi, "Expected `;`");
-                    }
-                    auto stmt = m_allocator.emplace<NodeStatement>(assign);
-                    return stmt;
-                }
-                else if (auto func_decl = parse_function_decl()) {
-                    auto stmt = m_allocator.alloc<NodeStatement>();
-                    stmt->var = func_decl.value();
-                    return stmt;
-                }
-                else if(peek().has_value() && peek().value().type == TokenType::open_curly){
-                    if(auto scope = parse_scope()){
-                    auto statment = m_allocator.alloc<NodeStatement>();
-                    statment->var = scope.value();
-                    return statment;
-                    }else{
-                        std::cerr << "Invalid Scope" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                        
-                }
-                else if (auto return_ = try_consume(TokenType::return_)) {
-                    auto stmt_return = m_allocator.alloc<NodeStatementReturn>();
-
-                    if (!try_consume(TokenType::semi)) {
-                        if (auto expr = parse_expr()) {
-                            stmt_return->expr = expr.value();
-                        } else {
-                            std::cerr << "Expected expression after return" << std::endl;
-                            exit(EXIT_FAILURE);
-                        }
-                    } else {
-                        stmt_return->expr = nullptr; 
-                    }
-
-                    if (expect_semicolon) {
-                        try_consume(TokenType::semi, "Expected `;` after return statement");
-                    }
-
-                    auto stmt = m_allocator.alloc<NodeStatement>();
-                    stmt->var = stmt_return;
-                    return stmt;
-                }
-                else if(auto if_ = try_consume(TokenType::if_)){
-                    try_consume(TokenType::open_paren, "Expected `(`");
-                    auto statment_if = m_allocator.alloc<NodeStatementIf>();
-                    if(auto expr = parse_expr()){
-                        statment_if->expr = expr.value();
-                    }
-                    else{
-                        std::cerr << "Invalid Expression" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-
-                    try_consume(TokenType::close_paren, "Expected `)` 4");
-                    if(auto scope = parse_scope()){
-                        statment_if->scope = scope.value();
-                    }
-                    else{
-                        std::cerr << "Invalid Scope" << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-
-                    statment_if->pred = parse_if_predicate();
-                    auto statment = m_allocator.alloc<NodeStatement>();
-                    statment->var = statment_if;
-                    return statment;
-
-                }else if (auto for_stmt = parse_for_statement()) {
-                    return for_stmt;
-                }
-                
-                else{
-                    return {};
-                }
-        }
-
-        std::optional<NodeFunctionDecl*> parse_function_decl() {
-            if (!try_consume(TokenType::function)) {
-                return {};
-            }
-
-            auto func_decl = m_allocator.alloc<NodeFunctionDecl>();
-            func_decl->ident = try_consume(TokenType::ident, "Expected function name");
-
-            try_consume(TokenType::open_paren, "Expected `(` after function name");
-
-            while (!try_consume(TokenType::close_paren)) {
-                func_decl->params.push_back(try_consume(TokenType::ident, "Expected parameter name"));
-                try_consume(TokenType::comma);
-                
-            }
-            if (auto scope = parse_scope()) {
-            func_decl->body = scope.value();
-            } else {
-                std::cerr << "Expected function body" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            return func_decl;
-        }
-
-        std::optional<NodeProg> parse_prog(){
-            NodeProg prog;
-
-            while(peek().has_value()){
-                if(auto statment = parse_statement()){
-                    prog.statements.push_back(statment.value());
-                }
-                else {
-                    std::cerr << "Invalid Expression 2 " << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-            }
-            return prog;
-        }
-
-    private:
-       
-
-         [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const {
-                if(m_index + offset >= m_tokens.size()){
-                    return {};
-                } else {
-                    return m_tokens.at(m_index + offset);
-                }
-
-            }
-
-            inline Token consume() {
-                return m_tokens.at(m_index++);
-            }
-
-            inline Token try_consume(TokenType type, const std::string& err_msg)
-            {
-                if (peek().has_value() && peek().value().type == type) {
-                    return consume();
-                }
-                else {
-                    std::cerr << err_msg << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            inline std::optional<Token> try_consume(TokenType type)
-            {
-                if (peek().has_value() && peek().value().type == type) {
-                    return consume();
-                }
-                else {
-                    return {};
-                }
-            }
+#pragma once
+
+#include <charconv>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <vector>
+#include "./tokenization.hpp"
+#include <variant>
+#include "./arena.hpp"
+
+    struct NodeTermIntLit {
+    Token int_lit;
+    int64_t value = 0; // checked against int64_t when parsed
+    };
+
+    struct NodeTermIdent {
+        Token ident;
+    };
+
+    struct NodeExpr;
+
+    struct NodeTermParen {
+        NodeExpr* expr;
+    };
+
+    struct NodeTermStringLit {
+        std::string value;
+    };
+
+    // `a[i]`.
+    struct NodeTermIndex {
+        Token ident;
+        NodeExpr* index;
+    };
+
+    // `len(a)`, the array's declared length.
+    struct NodeTermLength {
+        Token ident;
+    };
+
+    // `!x`: 1 if x is 0, otherwise 0.
+    struct NodeTermNot {
+        NodeExpr* expr;
+    };
+
+    struct NodeStatementExit{
+        NodeExpr* expr;
+    };
+
+    struct NodeStatementInt{
+        Token ident;
+        NodeExpr* expr;
+    };
+
+    struct NodeStatementAssign{
+        Token ident;
+        NodeExpr* expr;
+    };
+
+    // `int a[N];`: N integers, zero when the declaration runs. N is a
+    // literal. `int a[] = alloc(n);` takes its n from the heap instead.
+    struct NodeStatementArray{
+        Token ident;
+        uint64_t length;
+        NodeExpr* size = nullptr; // for alloc
+    };
+
+    // `a[i] = x;`
+    struct NodeStatementStore{
+        Token ident;
+        NodeExpr* index;
+        NodeExpr* expr;
+    };
+
+    // `print(x);` or `println(x);`. A string literal argument is kept apart
+    // from expressions, which are all integers.
+    struct NodeStatementPrint{
+        NodeExpr* expr = nullptr;
+        const NodeTermStringLit* string = nullptr; // neither is set for `println();`
+        bool newline = false;
+    };
+
+    struct NodeStatement;
+    struct NodeIfPred;
+    struct NodeFunctionDecl;
+    struct NodeStatementReturn;
+
+
+    struct NodeScope{
+        std::vector<NodeStatement*> statements;
+    };
+
+    struct NodeIfPredicateElif{
+        NodeExpr* expr;
+        NodeScope* scope;
+        std::optional<NodeIfPred*> pred;
+    };
+
+    struct NodeIfPredicateElse{
+        NodeScope* scope;
+    };
+
+    struct NodeIfPred{
+        std::variant<NodeIfPredicateElif*, NodeIfPredicateElse*> var;
+    };
+
+
+    struct NodeStatementIf{
+        NodeExpr* expr;
+        NodeScope* scope;
+        std::optional<NodeIfPred*> pred;
+    };
+
+    struct NodeStatementFor{
+    NodeStatement* init;
+    NodeExpr* condition;
+    NodeStatement* iteration;
+    NodeScope* scope;
+    bool parallel = false; // `parallel for`: iterations split across threads
+
+    NodeStatementFor(NodeStatement* init, NodeExpr* condition, NodeStatement* iteration, NodeScope* scope)
+        : init(init), condition(condition), iteration(iteration), scope(scope) {}
+    };
+
+    struct NodeStatement{
+        std::variant<NodeStatementExit*, NodeStatementInt*, NodeScope*, NodeStatementIf*, NodeStatementAssign*, NodeStatementFor*, NodeFunctionDecl*, NodeStatementReturn*, NodeStatementPrint*, NodeStatementArray*, NodeStatementStore*> var;
+        uint32_t line = 0; // of its first token
+    };
+
+
+    struct NodeBinExpressionAdd{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+
+    };
+
+    struct NodeBinExpressionMulti{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+
+    struct NodeBinExpressionSub{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+
+    struct NodeBinExpressionDiv{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+
+    struct NodeBinExpressionNotEquals{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+    struct NodeBinExpressionEquals{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+    struct NodeBinExpressionLess{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+    struct NodeBinExpressionGreater{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+
+    // `&&` and `||` are 0 or 1 and evaluate their right operand only when
+    // the left one does not decide the result.
+    struct NodeBinExpressionAnd{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+    struct NodeBinExpressionOr{
+        NodeExpr* lhs;
+        NodeExpr* rhs;
+    };
+
+    struct NodeBinExpression{
+        std::variant<NodeBinExpressionAdd*, NodeBinExpressionSub*,
+        NodeBinExpressionMulti*, NodeBinExpressionDiv*,
+        NodeBinExpressionEquals*, NodeBinExpressionNotEquals*,
+        NodeBinExpressionLess*, NodeBinExpressionGreater*,
+        NodeBinExpressionAnd*, NodeBinExpressionOr*> var;
+    };
+
+    
+
+    struct NodeFunctionDecl {
+        Token ident;
+        std::vector<Token> params;
+        NodeScope* body;
+        uint64_t hash = 0; // of the declaration's tokens
+        uint64_t line_hash = 0; // of the lines they are on
+        uint32_t line = 0;
+    };
+
+    struct NodeFunctionCall {
+        Token ident;
+        std::vector<NodeExpr*> args;
+    };
+
+    struct NodeStatementReturn {
+        NodeExpr* expr;
+    };
+
+    struct NodeTerm {
+        std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*, NodeTermStringLit*, NodeFunctionCall*, NodeTermIndex*, NodeTermLength*, NodeTermNot*> var;
+    };
+
+    struct NodeExpr {
+        std::variant<NodeTerm*, NodeBinExpression*> var;
+    };
+
+    struct NodeProg{
+        std::vector<NodeStatement*> statements;
+        std::vector<NodeFunctionDecl*> functions;
+    };
+
+class Parser {
+  
+
+    public: 
+
+        const std::vector<Token> m_tokens;
+        size_t m_index = 0;
+        ArenaAllocator m_allocator;
+
+
+        static constexpr size_t arena_size = 1024 * 1024 * 4; //4mb
+        static constexpr uint64_t max_array_length = uint64_t(1) << 28;
+
+        inline explicit Parser(std::vector<Token> tokens)
+            : m_tokens(std::move(tokens)),
+            m_allocator(arena_size)
+
+        {
+        }
+
+        // Parses into an arena that outlives the parser (see ArenaPool).
+        inline Parser(std::vector<Token> tokens, ArenaAllocator arena)
+            : m_tokens(std::move(tokens)),
+            m_allocator(std::move(arena))
+        {
+        }
+
+        // The value of an integer literal. Every backend reads it from the
+        // node, so a literal that does not fit in an int64_t is rejected
+        // here rather than wrapped by one backend and refused by another.
+        static int64_t parse_int(const Token& token)
+        {
+            const std::string& text = token.value.value();
+            int64_t value = 0;
+            const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec != std::errc() || end != text.data() + text.size()) {
+                compile_error("Integer literal out of range: " + text);
+            }
+            return value;
+        }
+
+        // Hands the arena back once nothing refers to the parsed program.
+        inline ArenaAllocator release_arena()
+        {
+            return std::move(m_allocator);
+        }
+
+        // A term that does not contain an expression; parse_expr handles
+        // parentheses, calls, indexing and `!`.
+        std::optional<NodeTerm*> parse_term()
+        {
+            if (auto int_lit = try_consume(TokenType::int_lit)) {
+                auto term_int_lit = m_allocator.emplace<NodeTermIntLit>();
+                term_int_lit->int_lit = int_lit.value();
+                term_int_lit->value = parse_int(int_lit.value());
+                auto term = m_allocator.emplace<NodeTerm>();
+                term->var = term_int_lit;
+                return term;
+            }
+            else if (auto ident = try_consume(TokenType::ident)) {
+                auto expr_ident = m_allocator.emplace<NodeTermIdent>();
+                expr_ident->ident = ident.value();
+                auto term = m_allocator.emplace<NodeTerm>();
+                term->var = expr_ident;
+                return term;
+            }
+            else if (auto string_lit = try_consume(TokenType::string_lit)) {
+                auto term_string_lit = m_allocator.emplace<NodeTermStringLit>();
+                if (string_lit.has_value() && string_lit.value().value.has_value()) {
+                term_string_lit->value = string_lit.value().value.value();
+                } else {
+                    compile_error("String literal without a value.");
+                }
+                auto term = m_allocator.emplace<NodeTerm>();
+                term->var = term_string_lit;
+                return term;
+            }
+            else {
+                return {};
+            }
+        }
+
+        // Operator precedence parsing with explicit stacks instead of
+        // recursion, so nesting depth is limited only by memory. Each
+        // parenthesis, index and call argument opens a group whose operators
+        // are reduced when it closes. Operators are left-associative. `!`
+        // binds tighter than any of them and applies to the operand after it.
+        std::optional<NodeExpr*> parse_expr()
+        {
+            m_groups.clear();
+            m_operands.clear();
+            m_operators.clear();
+            m_groups.push({ .kind = ExprGroup::Kind::top });
+            bool group_start = true;
+            size_t nots = 0; // in front of the operand being parsed
+            while (true) {
+                // An operand, after opening the groups in front of it.
+                std::optional<NodeTerm*> term;
+                if (try_consume(TokenType::not_)) {
+                    nots++;
+                    continue;
+                }
+                if (try_consume(TokenType::open_paren)) {
+                    m_groups.push({ .kind = ExprGroup::Kind::paren, .operators = m_operators.size(), .nots = nots });
+                    group_start = true;
+                    nots = 0;
+                    continue;
+                }
+                if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value()) {
+                    if (peek_word("len") && peek(1).value().type == TokenType::open_paren && peek(2).has_value()
+                        && peek(2).value().type == TokenType::ident && peek(3).has_value() && peek(3).value().type == TokenType::close_paren) {
+                        consume();
+                        consume();
+                        auto term_length = m_allocator.emplace<NodeTermLength>();
+                        term_length->ident = consume();
+                        consume();
+                        term = m_allocator.emplace<NodeTerm>();
+                        term.value()->var = term_length;
+                    } else if (peek(1).value().type == TokenType::open_paren) {
+                        auto func_call = m_allocator.emplace<NodeFunctionCall>();
+                        func_call->ident = consume();
+                        consume();
+                        if (try_consume(TokenType::close_paren)) {
+                            term = m_allocator.emplace<NodeTerm>();
+                            term.value()->var = func_call;
+                        } else {
+                            m_groups.push({ .kind = ExprGroup::Kind::call, .call = func_call, .operators = m_operators.size(), .nots = nots });
+                            group_start = true;
+                            nots = 0;
+                            continue;
+                        }
+                    } else if (peek(1).value().type == TokenType::open_bracket) {
+                        auto term_index = m_allocator.emplace<NodeTermIndex>();
+                        term_index->ident = consume();
+                        consume();
+                        m_groups.push({ .kind = ExprGroup::Kind::index, .index = term_index, .operators = m_operators.size(), .nots = nots });
+                        group_start = true;
+                        nots = 0;
+                        continue;
+                    }
+                }
+                if (!term.has_value()) {
+                    term = parse_term();
+                }
+                if (!term.has_value()) {
+                    if (nots > 0) {
+                        compile_error("Expected an operand after `!`");
+                    }
+                    if (!group_start) {
+                        compile_error("Error parsing expression ");
+                    }
+                    switch (m_groups.top().kind) {
+                    case ExprGroup::Kind::top:
+                        m_groups.pop();
+                        return {};
+                    case ExprGroup::Kind::paren:
+                        compile_error("Expected Expression");
+                    case ExprGroup::Kind::index:
+                        compile_error("Expected an index");
+                    case ExprGroup::Kind::call:
+                        compile_error("Expected argument expression");
+                    }
+                }
+                auto expr = m_allocator.emplace<NodeExpr>();
+                expr->var = term.value();
+                m_operands.push(negate(expr, nots));
+                nots = 0;
+
+                // Operators, and the ends of the groups the operand finishes.
+                while (true) {
+                    const ExprGroup group = m_groups.top();
+                    const std::optional<Token> next = peek();
+                    if (const std::optional<int> prec = next.has_value() ? bin_prec(next->type) : std::nullopt) {
+                        reduce_operators(group.operators, prec.value());
+                        m_operators.push({ consume().type, prec.value() });
+                        group_start = false;
+                        break;
+                    }
+                    reduce_operators(group.operators, std::numeric_limits<int>::min());
+                    NodeExpr* value = m_operands.pop();
+                    m_groups.pop();
+                    if (group.kind == ExprGroup::Kind::top) {
+                        return value;
+                    }
+                    auto closed = m_allocator.emplace<NodeTerm>();
+                    if (group.kind == ExprGroup::Kind::paren) {
+                        try_consume(TokenType::close_paren, "Expected `)` 1");
+                        auto term_paren = m_allocator.emplace<NodeTermParen>();
+                        term_paren->expr = value;
+                        closed->var = term_paren;
+                    } else if (group.kind == ExprGroup::Kind::index) {
+                        try_consume(TokenType::close_bracket, "Expected `]`");
+                        group.index->index = value;
+                        closed->var = group.index;
+                    } else {
+                        group.call->args.push_back(value);
+                        try_consume(TokenType::comma); // Optional comma
+                        if (!try_consume(TokenType::close_paren)) {
+                            m_groups.push({ .kind = ExprGroup::Kind::call, .call = group.call, .operators = m_operators.size(), .nots = group.nots });
+                            group_start = true;
+                            break;
+                        }
+                        closed->var = group.call;
+                    }
+                    auto closed_expr = m_allocator.emplace<NodeExpr>();
+                    closed_expr->var = closed;
+                    m_operands.push(negate(closed_expr, group.nots));
+                }
+            }
+        }
+
+        std::optional<NodeScope*> parse_scope(){
+
+            if(!try_consume(TokenType::open_curly).has_value()) {
+                return {};
+            }
+
+            auto scope = m_allocator.emplace<NodeScope>();
+            while(auto statment = parse_statement()){
+                scope->statements.push_back(statment.value());
+            }
+            try_consume(TokenType::close_curly, "Expected `}`");
+            return scope;
+    
+        }
+
+        std::optional<NodeIfPred*> parse_if_predicate()
+        {
+            if(try_consume(TokenType::elif_)){
+                try_consume(TokenType::open_paren, "Expected `(`");
+                auto elif = m_allocator.emplace<NodeIfPredicateElif>();
+                if(auto expr = parse_expr()){
+                    elif->expr = expr.value();
+                }
+                else{
+                    compile_error("Expected Expression");
+                }
+                try_consume(TokenType::close_paren, "Expected `)` 2");
+                if(auto scope = parse_scope()){
+                    elif->scope = scope.value();
+                }else{
+                    compile_error("Expected scope");
+                }
+                elif->pred = parse_if_predicate();
+                auto pred = m_allocator.emplace<NodeIfPred>(elif);
+                return pred;
+            }
+            if(try_consume(TokenType::else_)){
+                auto else_ = m_allocator.emplace<NodeIfPredicateElse>();
+                if(auto scope = parse_scope()){
+                    else_->scope = scope.value();
+                }else{
+                    compile_error("Expected scope");
+                }
+                auto pred = m_allocator.emplace<NodeIfPred>(else_);
+                return pred;
+            }
+            return {};
+        };
+
+        std::optional<NodeStatement*> parse_for_statement() {
+            const bool parallel = peek_word("parallel") && peek(1).has_value() && peek(1).value().type == TokenType::for_;
+            if (parallel) {
+                consume();
+            }
+            if (!try_consume(TokenType::for_)) {
+                return {};
+            }
+
+            try_consume(TokenType::open_paren, "Expected `(` in for loop");
+
+            auto init = parse_statement();
+            if (!init.has_value()) {
+                compile_error("Expected initialization in for loop");
+            }
+
+
+            auto condition = parse_expr();
+            if (!condition.has_value()) {
+                compile_error("Expected condition in for loop");
+            }
+            try_consume(TokenType::semi, "Expected `;` after condition in for loop");
+
+
+            auto iteration = parse_statement(false);
+            if (!iteration.has_value()) {
+                compile_error("Expected iteration in for loop");
+            }
+            try_consume(TokenType::close_paren, "Expected `)` after iteration in for loop");
+
+            auto scope = parse_scope();
+            if (!scope.has_value()) {
+                compile_error("Expected scope in for loop");
+            }
+
+            auto stmt_for = m_allocator.emplace<NodeStatementFor>(init.value(), condition.value(), iteration.value(), scope.value());
+            stmt_for->parallel = parallel;
+
+            auto stmt = m_allocator.emplace<NodeStatement>();
+            stmt->var = stmt_for;
+            return stmt;
+        }
+
+
+        std::optional<NodeStatement*> parse_statement(bool expect_semicolon = true){
+            const uint32_t line = peek().has_value() ? peek().value().line : 0;
+            std::optional<NodeStatement*> stmt = parse_statement_kind(expect_semicolon);
+            if (stmt.has_value()) {
+                stmt.value()->line = line;
+            }
+            return stmt;
+        }
+
+        std::optional<NodeStatement*> parse_statement_kind(bool expect_semicolon){
+            // At the end of the input the caller reports what it expected.
+            if (!peek().has_value()) {
+                return {};
+            }
+             if (peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren){
+                    consume();
+                    consume();
+
+                    auto stmt_exit = m_allocator.emplace<NodeStatementExit>();
+
+                    if(auto node_expr = parse_expr()){
+                        stmt_exit->expr = node_expr.value();
+                    }
+                    else{
+                        compile_error("Goof Invalid Expression 1 ");
+                    }
+                    try_consume(TokenType::close_paren, "Expected `)` 3");
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = stmt_exit;
+                    return stmt;
+
+                } else if ((peek().value().type == TokenType::print || peek().value().type == TokenType::println)
+                    && peek(1).has_value() && peek(1).value().type == TokenType::open_paren)
+                {
+                    auto stmt_print = m_allocator.emplace<NodeStatementPrint>();
+                    stmt_print->newline = consume().type == TokenType::println;
+                    consume();
+                    if (peek().has_value() && peek().value().type == TokenType::string_lit
+                        && peek(1).has_value() && peek(1).value().type == TokenType::close_paren) {
+                        auto string_lit = m_allocator.emplace<NodeTermStringLit>();
+                        string_lit->value = consume().value.value();
+                        stmt_print->string = string_lit;
+                    } else if (auto expr = parse_expr()) {
+                        stmt_print->expr = expr.value();
+                    } else if (!stmt_print->newline) {
+                        compile_error("Expected something to print");
+                    }
+                    try_consume(TokenType::close_paren, "Expected `)` after print");
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = stmt_print;
+                    return stmt;
+
+                } else if (peek().has_value() && peek().value().type == TokenType::int_ && peek(1).has_value() 
+                    && peek(1).value().type == TokenType::ident && peek(2).has_value() 
+                    && peek(2).value().type == TokenType::eq)
+                    {
+                    
+                    consume();
+                    auto statment_int = m_allocator.emplace<NodeStatementInt>();
+                    statment_int->ident = consume();
+                    consume();
+
+                    if(auto expr = parse_expr()){
+                        statment_int->expr = expr.value();
+                    } else{
+                        compile_error("Invalid Expression 1 ");
+                    }
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = statment_int;
+                    return stmt;
+
+                } else if (peek().has_value() && peek().value().type == TokenType::int_ && peek(1).has_value()
+                    && peek(1).value().type == TokenType::ident && peek(2).has_value()
+                    && peek(2).value().type == TokenType::open_bracket)
+                {
+                    consume();
+                    auto stmt_array = m_allocator.emplace<NodeStatementArray>();
+                    stmt_array->ident = consume();
+                    consume();
+                    if (try_consume(TokenType::close_bracket)) {
+                        try_consume(TokenType::eq, "Expected `= alloc(...)`");
+                        if (!peek_word("alloc")) {
+                            compile_error("Expected `alloc`");
+                        }
+                        consume();
+                        try_consume(TokenType::open_paren, "Expected `(` after alloc");
+                        if (const auto size = parse_expr()) {
+                            stmt_array->size = size.value();
+                        } else {
+                            compile_error("Expected Expression");
+                        }
+                        try_consume(TokenType::close_paren, "Expected `)` after alloc");
+                    } else {
+                        const Token length = try_consume(TokenType::int_lit, "Expected the array length");
+                        const int64_t value = parse_int(length);
+                        if (value == 0 || static_cast<uint64_t>(value) > max_array_length) {
+                            compile_error("Bad array length: " + length.value.value());
+                        }
+                        stmt_array->length = static_cast<uint64_t>(value);
+                        try_consume(TokenType::close_bracket, "Expected `]`");
+                    }
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = stmt_array;
+                    return stmt;
+                }
+                else if(peek().has_value() && peek().value().type == TokenType::ident
+                && peek(1).has_value() && peek(1).value().type == TokenType::open_bracket)
+                {
+                    auto store = m_allocator.emplace<NodeStatementStore>();
+                    store->ident = consume();
+                    consume();
+                    store->index = parse_index();
+                    try_consume(TokenType::eq, "Expected `=` after an array element");
+                    if(const auto expr = parse_expr()){
+                        store->expr = expr.value();
+                    } else {
+                        compile_error("Expected Expression");
+                    }
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>(store);
+                    return stmt;
+                }
+                else if(peek().has_value() && peek().value().type == TokenType::ident 
+                && peek(1).has_value() 
+                && peek(1).value().type == TokenType::eq)
+                {
+                    const auto assign = m_allocator.emplace<NodeStatementAssign>();
+                    assign->ident = consume();
+                    consume();
+                    if(const auto expr = parse_expr()){
+                        assign->expr = expr.value();
+                    } else {
+                        compile_error("Expected Expression");
+                    }
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;`");
+                    }
+                    auto stmt = m_allocator.emplace<NodeStatement>(assign);
+                    return stmt;
+                }
+                else if (auto func_decl = parse_function_decl()) {
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = func_decl.value();
+                    return stmt;
+                }
+                else if(peek().has_value() && peek().value().type == TokenType::open_curly){
+                    if(auto scope = parse_scope()){
+                    auto statment = m_allocator.emplace<NodeStatement>();
+                    statment->var = scope.value();
+                    return statment;
+                    }else{
+                        compile_error("Invalid Scope");
+                    }
+                        
+                }
+                else if (auto return_ = try_consume(TokenType::return_)) {
+                    auto stmt_return = m_allocator.emplace<NodeStatementReturn>();
+
+                    if (!try_consume(TokenType::semi)) {
+                        if (auto expr = parse_expr()) {
+                            stmt_return->expr = expr.value();
+                        } else {
+                            compile_error("Expected expression after return");
+                        }
+                    } else {
+                        stmt_return->expr = nullptr; 
+                    }
+
+                    if (expect_semicolon) {
+                        try_consume(TokenType::semi, "Expected `;` after return statement");
+                    }
+
+                    auto stmt = m_allocator.emplace<NodeStatement>();
+                    stmt->var = stmt_return;
+                    return stmt;
+                }
+                else if(auto if_ = try_consume(TokenType::if_)){
+                    try_consume(TokenType::open_paren, "Expected `(`");
+                    auto statment_if = m_allocator.emplace<NodeStatementIf>();
+                    if(auto expr = parse_expr()){
+                        statment_if->expr = expr.value();
+                    }
+                    else{
+                        compile_error("Invalid Expression");
+                    }
+
+                    try_consume(TokenType::close_paren, "Expected `)` 4");
+                    if(auto scope = parse_scope()){
+                        statment_if->scope = scope.value();
+                    }
+                    else{
+                        compile_error("Invalid Scope");
+                    }
+
+                    statment_if->pred = parse_if_predicate();
+                    auto statment = m_allocator.emplace<NodeStatement>();
+                    statment->var = statment_if;
+                    return statment;
+
+                }else if (auto for_stmt = parse_for_statement()) {
+                    return for_stmt;
+                }
+                
+                else{
+                    return {};
+                }
+        }
+
+        // The index of `a[...]`, after the `[`.
+        NodeExpr* parse_index() {
+            auto index = parse_expr();
+            if (!index.has_value()) {
+                compile_error("Expected an index");
+            }
+            try_consume(TokenType::close_bracket, "Expected `]`");
+            return index.value();
+        }
+
+        std::optional<NodeFunctionDecl*> parse_function_decl() {
+            const size_t begin = m_index;
+            if (!try_consume(TokenType::function)) {
+                return {};
+            }
+
+            auto func_decl = m_allocator.emplace<NodeFunctionDecl>();
+            func_decl->line = m_tokens[begin].line;
+            func_decl->ident = try_consume(TokenType::ident, "Expected function name");
+            if (func_decl->ident.value == "len") {
+                compile_error("`len` is built in and cannot name a function");
+            }
+
+            try_consume(TokenType::open_paren, "Expected `(` after function name");
+
+            while (!try_consume(TokenType::close_paren)) {
+                func_decl->params.push_back(try_consume(TokenType::ident, "Expected parameter name"));
+                try_consume(TokenType::comma);
+                
+            }
+            if (auto scope = parse_scope()) {
+            func_decl->body = scope.value();
+            } else {
+                compile_error("Expected function body");
+            }
+            func_decl->hash = hash_tokens(m_tokens.data() + begin, m_tokens.data() + m_index);
+            func_decl->line_hash = hash_lines(m_tokens.data() + begin, m_tokens.data() + m_index);
+            return func_decl;
+        }
+
+        std::optional<NodeProg> parse_prog(){
+            NodeProg prog;
+
+            while(peek().has_value()){
+                if(auto statment = parse_statement()){
+                    prog.statements.push_back(statment.value());
+                }
+                else {
+                    compile_error("Invalid Expression 2 ");
+                }
+            }
+            return prog;
+        }
+
+    private:
+        struct ExprGroup {
+            enum class Kind { top, paren, index, call } kind;
+            NodeTermIndex* index = nullptr;
+            NodeFunctionCall* call = nullptr;
+            size_t operators = 0; // m_operators' height when it opened
+            size_t nots = 0;      // `!`s in front of it
+        };
+
+        struct PendingOperator {
+            TokenType type;
+            int prec;
+        };
+
+        ArenaStack<ExprGroup> m_groups;
+        ArenaStack<NodeExpr*> m_operands;
+        ArenaStack<PendingOperator> m_operators;
+
+        // Applies the operators above `base` that bind at least as tightly
+        // as `min_prec` to the operands under them.
+        void reduce_operators(size_t base, int min_prec)
+        {
+            while (m_operators.size() > base && m_operators.top().prec >= min_prec) {
+                const TokenType op = m_operators.pop().type;
+                NodeExpr* rhs = m_operands.pop();
+                NodeExpr* lhs = m_operands.pop();
+                auto expr = m_allocator.emplace<NodeBinExpression>();
+                switch (op) {
+                case TokenType::plus:
+                    expr->var = bin_node<NodeBinExpressionAdd>(lhs, rhs);
+                    break;
+                case TokenType::sub:
+                    expr->var = bin_node<NodeBinExpressionSub>(lhs, rhs);
+                    break;
+                case TokenType::star:
+                    expr->var = bin_node<NodeBinExpressionMulti>(lhs, rhs);
+                    break;
+                case TokenType::div:
+                    expr->var = bin_node<NodeBinExpressionDiv>(lhs, rhs);
+                    break;
+                case TokenType::equality:
+                    expr->var = bin_node<NodeBinExpressionEquals>(lhs, rhs);
+                    break;
+                case TokenType::not_equal:
+                    expr->var = bin_node<NodeBinExpressionNotEquals>(lhs, rhs);
+                    break;
+                case TokenType::greater_than:
+                    expr->var = bin_node<NodeBinExpressionGreater>(lhs, rhs);
+                    break;
+                case TokenType::and_:
+                    expr->var = bin_node<NodeBinExpressionAnd>(lhs, rhs);
+                    break;
+                case TokenType::or_:
+                    expr->var = bin_node<NodeBinExpressionOr>(lhs, rhs);
+                    break;
+                default:
+                    expr->var = bin_node<NodeBinExpressionLess>(lhs, rhs);
+                    break;
+                }
+                auto result = m_allocator.emplace<NodeExpr>();
+                result->var = expr;
+                m_operands.push(result);
+            }
+        }
+
+        // `expr` under `count` `!`s.
+        NodeExpr* negate(NodeExpr* expr, size_t count)
+        {
+            for (size_t i = 0; i < count; i++) {
+                auto term_not = m_allocator.emplace<NodeTermNot>();
+                term_not->expr = expr;
+                auto term = m_allocator.emplace<NodeTerm>();
+                term->var = term_not;
+                expr = m_allocator.emplace<NodeExpr>();
+                expr->var = term;
+            }
+            return expr;
+        }
+
+        template <typename Bin>
+        Bin* bin_node(NodeExpr* lhs, NodeExpr* rhs)
+        {
+            auto bin = m_allocator.emplace<Bin>();
+            bin->lhs = lhs;
+            bin->rhs = rhs;
+            return bin;
+        }
+
+
+         [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const {
+                if(m_index + offset >= m_tokens.size()){
+                    return {};
+                } else {
+                    return m_tokens.at(m_index + offset);
+                }
+
+            }
+
+            inline Token consume() {
+                return m_tokens.at(m_index++);
+            }
+
+            inline Token try_consume(TokenType type, const std::string& err_msg)
+            {
+                if (peek().has_value() && peek().value().type == type) {
+                    return consume();
+                }
+                else {
+                    compile_error(err_msg);
+                }
+            }
+
+            // Whether the token at `offset` is the identifier `word`.
+            inline bool peek_word(const char* word, int offset = 0) const
+            {
+                const std::optional<Token> token = peek(offset);
+                return token.has_value() && token->type == TokenType::ident && token->value == word;
+            }
+
+            inline std::optional<Token> try_consume(TokenType type)
+            {
+                if (peek().has_value() && peek().value().type == type) {
+                    return consume();
+                }
+                else {
+                    return {};
+                }
+            }
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "./error.hpp"
+
+// Execution counts written by an instrumented program (--profile-generate)
+// and read back by --profile-use. The file is a series of little-endian
+// u64s: magic, function count, then per function its token hash, its
+// counter count and the counters. Counters are numbered in the order the
+// generator lowers the function, so they are only meaningful for a function
+// whose tokens still hash the same.
+
+inline constexpr uint64_t profile_magic = 0x316672706f746163; // "catoprf1"
+
+class Profile {
+public:
+    // Adds the counts in `path` to the ones already loaded, so several
+    // training runs can be combined.
+    inline void merge_file(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            compile_error("cannot read profile " + path);
+        }
+        auto read = [&](uint64_t& value) {
+            unsigned char bytes[8];
+            if (!file.read(reinterpret_cast<char*>(bytes), 8)) {
+                compile_error("truncated profile " + path);
+            }
+            value = 0;
+            for (int i = 0; i < 8; i++) {
+                value |= static_cast<uint64_t>(bytes[i]) << (i * 8);
+            }
+        };
+        uint64_t magic = 0;
+        uint64_t functions = 0;
+        read(magic);
+        if (magic != profile_magic) {
+            compile_error(path + " is not a cato profile");
+        }
+        read(functions);
+        for (uint64_t f = 0; f < functions; f++) {
+            uint64_t hash = 0;
+            uint64_t count = 0;
+            read(hash);
+            read(count);
+            if (count > (1u << 24)) {
+                compile_error("corrupt profile " + path);
+            }
+            std::vector<uint64_t>& counters = m_functions[hash];
+            if (counters.size() != count) {
+                counters.assign(count, 0);
+            }
+            for (uint64_t& counter : counters) {
+                uint64_t value = 0;
+                read(value);
+                counter += value;
+            }
+        }
+    }
+
+    // Counters of the function whose tokens hash to `hash`, if it was
+    // profiled.
+    inline const std::vector<uint64_t>* function(uint64_t hash) const
+    {
+        auto it = m_functions.find(hash);
+        return it == m_functions.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::unordered_map<uint64_t, std::vector<uint64_t>> m_functions;
+};
@@ -0,0 +1,765 @@
+#pragma once
+
+// Output routines linked into every program. `print` writes into a buffer
+// that goes out in as few `write` calls as possible: when it fills up and
+// when the program exits. The routines take their argument in rax and
+// preserve every other register, so a call to them can sit anywhere in
+// generated code, even in a function that keeps its variables in the
+// argument registers.
+//
+// A string is a record in .rodata: its length as a qword, then its bytes.
+// The buffer holds 64 KiB.
+//
+// Heap arrays come from a bump allocator over regions of at least 64 MiB
+// from `mmap`, which the kernel only backs as they are touched. Each region
+// starts with a header: the previous region, its end, and its high-water
+// mark, above which it has never been used and so is still zero. Freeing is
+// only ever a reset to an earlier heap top; a region left behind by a reset
+// is kept for the next time the heap grows, so a loop that allocates does
+// not map and unmap on every iteration, but its pages go back to the kernel
+// and come back zeroed. With `__cato_heap_huge` set, new
+// regions are advised to use huge pages.
+//
+// `parallel for` bodies run on a pool of threads started with `clone` the
+// first time one is needed, one per CPU the process may run on, up to 64.
+// The iterations are split into a share per thread, each with its own
+// counter from which chunks are claimed with `lock xadd`; a thread that
+// has used up its share claims chunks from the others'. Idle threads sleep
+// on a futex until the next loop starts, and the thread that started it
+// sleeps on another until they are all done. __cato_exit stops the pool,
+// so a program run inside the compiler leaves no threads behind.
+
+namespace runtime {
+    inline const char* const text = R"(global __cato_print_str
+global __cato_print_int
+global __cato_println_int
+global __cato_flush
+global __cato_alloc
+global __cato_heap_reset
+global __cato_heap_top
+global __cato_parallel_for
+global __cato_pool_stop
+__cato_print_str:
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r11
+  mov rcx, [rax]
+  lea rsi, [rax + 8]
+  mov rdx, [__cato_out_len]
+  lea rax, [rdx + rcx]
+  cmp rax, 65536
+  jbe .copy
+  call __cato_flush
+  mov rdx, 0
+  cmp rcx, 65536
+  jbe .copy
+  ; Longer than the whole buffer: straight out.
+  mov rdx, rcx
+  call __cato_write
+  jmp .done
+.copy:
+  lea rdi, [__cato_out]
+  add rdi, rdx
+  add rdx, rcx
+  mov [__cato_out_len], rdx
+.words:
+  cmp rcx, 8
+  jb .bytes
+  mov rax, [rsi]
+  mov [rdi], rax
+  add rsi, 8
+  add rdi, 8
+  sub rcx, 8
+  jmp .words
+.bytes:
+  test rcx, rcx
+  jz .done
+  mov al, [rsi]
+  mov [rdi], al
+  inc rsi
+  inc rdi
+  dec rcx
+  jmp .bytes
+.done:
+  pop r11
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  ret
+__cato_print_int:
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r8
+  ; The digits are built backwards from rsp + 40 as a string record, two
+  ; at a time: dividing by 100 is a multiply by its reciprocal, and the
+  ; pair comes from a table.
+  sub rsp, 40
+  mov [rsp], rax
+  lea rdi, [rsp + 40]
+  mov rsi, rax
+  test rsi, rsi
+  jns .pairs_start
+  neg rsi
+.pairs_start:
+  lea r8, [__cato_digit_pairs]
+.pairs:
+  cmp rsi, 100
+  jb .last
+  mov rax, rsi
+  shr rax, 2
+  mov rdx, 0x28F5C28F5C28F5C3
+  mul rdx
+  shr rdx, 2
+  imul rax, rdx, 100
+  mov rcx, rsi
+  sub rcx, rax
+  mov rsi, rdx
+  movzx eax, word [r8 + rcx*2]
+  sub rdi, 2
+  mov [rdi], ax
+  jmp .pairs
+.last:
+  cmp rsi, 10
+  jb .one
+  movzx eax, word [r8 + rsi*2]
+  sub rdi, 2
+  mov [rdi], ax
+  jmp .sign
+.one:
+  lea rax, [rsi + 48]
+  dec rdi
+  mov [rdi], al
+.sign:
+  cmp qword [rsp], 0
+  jge .record
+  dec rdi
+  mov byte [rdi], 45
+.record:
+  lea rax, [rsp + 40]
+  sub rax, rdi
+  mov [rdi - 8], rax
+  lea rax, [rdi - 8]
+  call __cato_print_str
+  add rsp, 40
+  pop r8
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  ret
+__cato_println_int:
+  call __cato_print_int
+  lea rax, [__cato_newline]
+  jmp __cato_print_str
+__cato_flush:
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r11
+  lea rsi, [__cato_out]
+  mov rdx, [__cato_out_len]
+  mov qword [__cato_out_len], 0
+  call __cato_write
+  pop r11
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  ret
+; rax elements, zeroed, with their count in the qword before them.
+__cato_alloc:
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r8
+  push r9
+  push r10
+  push r11
+  test rax, rax
+  jns .count
+  mov rax, 0
+.count:
+  mov rsi, rax
+  mov rcx, 1099511627776
+  cmp rsi, rcx
+  ja __cato_out_of_memory
+  lea rcx, [rsi*8 + 8]
+.bump:
+  mov rdx, [__cato_heap_top]
+  lea rdi, [rdx + rcx]
+  cmp rdi, [__cato_heap_end]
+  ja .grow
+  ; Only what lies below the high-water mark needs zeroing.
+  mov r8, [__cato_heap_fresh]
+  cmp rdi, r8
+  jbe .reused
+  mov [__cato_heap_fresh], rdi
+  jmp .zero
+.reused:
+  mov r8, rdi
+.zero:
+  mov [__cato_heap_top], rdi
+  mov rcx, r8
+  sub rcx, rdx
+  jbe .done
+  shr rcx, 3
+  mov rdi, rdx
+  mov rax, 0
+  rep stosq
+.done:
+  mov [rdx], rsi
+  lea rax, [rdx + 8]
+  pop r11
+  pop r10
+  pop r9
+  pop r8
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  ret
+.grow:
+  mov rdx, [__cato_heap_region]
+  test rdx, rdx
+  jz .new_region
+  mov rax, [__cato_heap_fresh]
+  mov [rdx + 16], rax
+.new_region:
+  ; The header and the block have to fit.
+  lea r10, [rcx + 32]
+  mov rax, [__cato_heap_spare]
+  test rax, rax
+  jz .map
+  mov rdi, [rax + 8]
+  sub rdi, rax
+  cmp rdi, r10
+  jb .map
+  mov qword [__cato_heap_spare], 0
+  jmp .link
+.map:
+  mov rax, 67108864
+  cmp r10, rax
+  jae .round
+  mov r10, rax
+.round:
+  add r10, 2097151
+  and r10, -2097152
+  push rcx
+  push rsi
+  push r10
+  mov rax, 9
+  mov rdi, 0
+  mov rsi, r10
+  mov rdx, 3
+  mov r10, 34
+  mov r8, -1
+  mov r9, 0
+  syscall
+  pop r10
+  cmp rax, -4095
+  jae __cato_out_of_memory
+  cmp qword [__cato_heap_huge], 0
+  je .mapped
+  push rax
+  mov rdi, rax
+  mov rsi, r10
+  mov rdx, 14
+  mov rax, 28
+  syscall
+  pop rax
+.mapped:
+  pop rsi
+  pop rcx
+  lea rdi, [rax + r10]
+  mov [rax + 8], rdi
+  lea rdi, [rax + 32]
+  mov [rax + 16], rdi
+.link:
+  mov rdi, [__cato_heap_region]
+  mov [rax], rdi
+  mov [__cato_heap_region], rax
+  mov rdi, [rax + 8]
+  mov [__cato_heap_end], rdi
+  mov rdi, [rax + 16]
+  mov [__cato_heap_fresh], rdi
+  lea rdi, [rax + 32]
+  mov [__cato_heap_top], rdi
+  jmp .bump
+; Frees everything allocated since __cato_heap_top was rax.
+__cato_heap_reset:
+  push rax
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r11
+  mov rdx, rax
+.find:
+  mov rax, [__cato_heap_region]
+  test rax, rax
+  jz .done
+  lea rsi, [rax + 32]
+  cmp rdx, rsi
+  jb .drop
+  cmp rdx, [rax + 8]
+  ja .drop
+  mov [__cato_heap_top], rdx
+  jmp .done
+.drop:
+  ; The mark is in an earlier region.
+  mov rsi, [__cato_heap_fresh]
+  mov [rax + 16], rsi
+  mov rcx, [rax]
+  mov [__cato_heap_region], rcx
+  mov qword [__cato_heap_top], 0
+  mov qword [__cato_heap_end], 0
+  mov qword [__cato_heap_fresh], 0
+  test rcx, rcx
+  jz .keep
+  mov rsi, [rcx + 8]
+  mov [__cato_heap_end], rsi
+  mov rsi, [rcx + 16]
+  mov [__cato_heap_fresh], rsi
+.keep:
+  cmp qword [__cato_heap_spare], 0
+  jne .unmap
+  mov [__cato_heap_spare], rax
+  ; madvise(MADV_DONTNEED) on everything but the header page.
+  lea rdi, [rax + 4096]
+  mov rsi, [rax + 16]
+  cmp rsi, rdi
+  jbe .find
+  mov [rax + 16], rdi
+  sub rsi, rdi
+  add rsi, 4095
+  and rsi, -4096
+  push rdx
+  mov rdx, 4
+  mov rax, 28
+  syscall
+  pop rdx
+  jmp .find
+.unmap:
+  mov rdi, rax
+  mov rsi, [rax + 8]
+  sub rsi, rax
+  mov rax, 11
+  syscall
+  jmp .find
+.done:
+  pop r11
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  pop rax
+  ret
+__cato_out_of_memory:
+  mov rax, 1
+  mov rdi, 2
+  lea rsi, [__cato_out_of_memory_message + 8]
+  mov rdx, [__cato_out_of_memory_message]
+  syscall
+  mov rdi, 1
+  jmp __cato_exit
+; Runs the routine at rax on chunks of the iterations [0, rcx), passing
+; each chunk's first and end in rdi and rsi and r12 unchanged. A loop
+; started from inside another one runs on the calling thread.
+__cato_parallel_for:
+  push rbx
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r8
+  push r9
+  push r10
+  push r11
+  push r13
+  push r14
+  push r15
+  test rcx, rcx
+  jle .done
+  cmp qword [__cato_pool_body], 0
+  jne .alone
+  cmp qword [__cato_pool_size], 0
+  jne .started
+  call __cato_pool_start
+.started:
+  cmp qword [__cato_pool_size], 1
+  je .alone
+  mov [__cato_pool_body], rax
+  mov [__cato_pool_env], r12
+  ; Eight chunks per thread at least.
+  mov r8, [__cato_pool_size]
+  lea r9, [r8*8]
+  mov rax, rcx
+  mov rdx, 0
+  div r9
+  test rax, rax
+  jnz .chunk
+  mov rax, 1
+.chunk:
+  mov [__cato_pool_chunk], rax
+  ; Thread t's share is [count * t / threads, count * (t + 1) / threads).
+  mov r10, rcx
+  mov r9, 0
+  lea r11, [__cato_pool_ranges]
+.share:
+  mov rax, r10
+  mul r9
+  div r8
+  mov [r11], rax
+  inc r9
+  mov rax, r10
+  mul r9
+  div r8
+  mov [r11 + 8], rax
+  add r11, 64
+  cmp r9, r8
+  jb .share
+  lea rax, [r8 - 1]
+  mov [__cato_pool_pending], rax
+  lock inc qword [__cato_pool_generation]
+  mov rax, 202
+  lea rdi, [__cato_pool_generation]
+  mov rsi, 129
+  mov rdx, 2147483647
+  syscall
+  mov r14, 0
+  call __cato_pool_work
+.join:
+  mov rdx, [__cato_pool_pending]
+  test rdx, rdx
+  jz .joined
+  mov rax, 202
+  lea rdi, [__cato_pool_pending]
+  mov rsi, 128
+  mov r10, 0
+  syscall
+  jmp .join
+.joined:
+  mov qword [__cato_pool_body], 0
+  jmp .done
+.alone:
+  mov rdi, 0
+  mov rsi, rcx
+  call rax
+.done:
+  pop r15
+  pop r14
+  pop r13
+  pop r11
+  pop r10
+  pop r9
+  pop r8
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  pop rbx
+  ret
+; Claims chunks and runs them until every share is used up, starting with
+; thread r14's own.
+__cato_pool_work:
+  push r13
+  push r15
+  mov r13, r14
+  mov r15, [__cato_pool_size]
+.claim:
+  mov rsi, r13
+  shl rsi, 6
+  lea rax, [__cato_pool_ranges]
+  add rsi, rax
+  mov rdi, [__cato_pool_chunk]
+  lock xadd qword [rsi], rdi
+  mov rax, [rsi + 8]
+  cmp rdi, rax
+  jge .next
+  mov rsi, rdi
+  add rsi, [__cato_pool_chunk]
+  cmp rsi, rax
+  jle .run
+  mov rsi, rax
+.run:
+  mov r12, [__cato_pool_env]
+  call [__cato_pool_body]
+  jmp .claim
+.next:
+  inc r13
+  cmp r13, [__cato_pool_size]
+  jb .other
+  mov r13, 0
+.other:
+  dec r15
+  jnz .claim
+  pop r15
+  pop r13
+  ret
+; A pool thread; r14 is its index and r15 the last loop it saw.
+__cato_pool_worker:
+  mov rdx, [__cato_pool_generation]
+  cmp rdx, r15
+  jne .woken
+  mov rax, 202
+  lea rdi, [__cato_pool_generation]
+  mov rsi, 128
+  mov r10, 0
+  syscall
+  jmp __cato_pool_worker
+.woken:
+  mov r15, rdx
+  cmp qword [__cato_pool_quit], 0
+  jne .quit
+  call __cato_pool_work
+  lock dec qword [__cato_pool_pending]
+  jnz __cato_pool_worker
+  mov rax, 202
+  lea rdi, [__cato_pool_pending]
+  mov rsi, 129
+  mov rdx, 1
+  syscall
+  jmp __cato_pool_worker
+.quit:
+  mov rax, 60
+  mov rdi, 0
+  syscall
+; Sizes the pool from the affinity mask and starts its threads, each on
+; an 8 MiB stack that is only backed as it is touched.
+__cato_pool_start:
+  push rax
+  push rbx
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r8
+  push r9
+  push r10
+  push r11
+  push r14
+  push r15
+  mov rax, 204
+  mov rdi, 0
+  mov rsi, 128
+  lea rdx, [__cato_pool_mask]
+  syscall
+  mov rbx, 1
+  test rax, rax
+  jle .counted
+  mov rcx, rax
+  shr rcx, 3
+  lea rsi, [__cato_pool_mask]
+  mov rbx, 0
+.word:
+  mov rax, [rsi]
+.bit:
+  test rax, rax
+  jz .next_word
+  lea rdx, [rax - 1]
+  and rax, rdx
+  inc rbx
+  jmp .bit
+.next_word:
+  add rsi, 8
+  dec rcx
+  jnz .word
+  cmp rbx, 64
+  jbe .counted
+  mov rbx, 64
+.counted:
+  mov qword [__cato_pool_size], 1
+  mov r14, 1
+.spawn:
+  cmp r14, rbx
+  jae .spawned
+  mov rax, 9
+  mov rdi, 0
+  mov rsi, 8388608
+  mov rdx, 3
+  mov r10, 147490
+  mov r8, -1
+  mov r9, 0
+  syscall
+  cmp rax, -4095
+  jae .spawned
+  mov rsi, r14
+  shl rsi, 6
+  lea rdx, [__cato_pool_ranges]
+  add rsi, rdx
+  mov [rsi + 24], rax
+  ; The kernel clears this word when the thread exits.
+  mov qword [rsi + 16], 1
+  lea r10, [rsi + 16]
+  lea rsi, [rax + 8388608]
+  mov r15, [__cato_pool_generation]
+  ; CLONE_VM | FS | FILES | SIGHAND | THREAD | SYSVSEM | CHILD_CLEARTID
+  mov rax, 56
+  mov rdi, 2428672
+  mov rdx, 0
+  mov r8, 0
+  syscall
+  test rax, rax
+  jz __cato_pool_worker
+  js .failed
+  inc r14
+  mov [__cato_pool_size], r14
+  jmp .spawn
+.failed:
+  mov rdi, r10
+  sub rdi, 16
+  mov rdi, [rdi + 24]
+  mov rsi, 8388608
+  mov rax, 11
+  syscall
+.spawned:
+  pop r15
+  pop r14
+  pop r11
+  pop r10
+  pop r9
+  pop r8
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  pop rbx
+  pop rax
+  ret
+; Wakes the pool's threads to exit and waits until they have, then frees
+; their stacks.
+__cato_pool_stop:
+  push rax
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push r10
+  push r11
+  push r14
+  cmp qword [__cato_pool_size], 1
+  jbe .done
+  mov qword [__cato_pool_quit], 1
+  lock inc qword [__cato_pool_generation]
+  mov rax, 202
+  lea rdi, [__cato_pool_generation]
+  mov rsi, 129
+  mov rdx, 2147483647
+  syscall
+  mov r14, 1
+.thread:
+  cmp r14, [__cato_pool_size]
+  jae .stopped
+  mov rsi, r14
+  shl rsi, 6
+  lea rax, [__cato_pool_ranges]
+  add rsi, rax
+.wait:
+  mov rdx, [rsi + 16]
+  test rdx, rdx
+  jz .exited
+  ; Not a private futex: the kernel's wake on exit is a shared one.
+  push rsi
+  mov rax, 202
+  lea rdi, [rsi + 16]
+  mov rsi, 0
+  mov r10, 0
+  syscall
+  pop rsi
+  jmp .wait
+.exited:
+  mov rdi, [rsi + 24]
+  mov rsi, 8388608
+  mov rax, 11
+  syscall
+  inc r14
+  jmp .thread
+.stopped:
+  mov qword [__cato_pool_quit], 0
+.done:
+  mov qword [__cato_pool_size], 0
+  pop r14
+  pop r11
+  pop r10
+  pop rdi
+  pop rsi
+  pop rdx
+  pop rcx
+  pop rax
+  ret
+; write(1, rsi, rdx) until all of it is out. An interrupted write is
+; retried; any other failure ends the program with status 1, as running
+; out of memory does, so output that was lost is never reported as done.
+__cato_write:
+  test rdx, rdx
+  jz .done
+  mov rax, 1
+  mov rdi, 1
+  syscall
+  cmp rax, -4
+  je __cato_write
+  test rax, rax
+  jle __cato_write_failed
+  add rsi, rax
+  sub rdx, rax
+  jmp __cato_write
+.done:
+  ret
+__cato_write_failed:
+  mov rax, 1
+  mov rdi, 2
+  lea rsi, [__cato_write_failed_message + 8]
+  mov rdx, [__cato_write_failed_message]
+  syscall
+  mov rdi, 1
+  jmp __cato_exit
+)";
+
+    inline const char* const rodata = R"(__cato_newline: dq 1
+db 10
+__cato_out_of_memory_message: dq 14
+db "out of memory", 10
+__cato_write_failed_message: dq 20
+db "cannot write output", 10
+__cato_digit_pairs: db "00010203040506070809"
+db "10111213141516171819"
+db "20212223242526272829"
+db "30313233343536373839"
+db "40414243444546474849"
+db "50515253545556575859"
+db "60616263646566676869"
+db "70717273747576777879"
+db "80818283848586878889"
+db "90919293949596979899"
+)";
+
+    inline const char* const bss = R"(__cato_out_len: resq 1
+__cato_out: resb 65536
+__cato_heap_top: resq 1
+__cato_heap_end: resq 1
+__cato_heap_fresh: resq 1
+__cato_heap_region: resq 1
+__cato_heap_spare: resq 1
+__cato_pool_size: resq 1
+__cato_pool_body: resq 1
+__cato_pool_env: resq 1
+__cato_pool_chunk: resq 1
+__cato_pool_quit: resq 1
+__cato_pool_mask: resb 128
+; A cache line per thread: its next iteration, its share's end, the word
+; cleared when it exits and its stack.
+align 64
+__cato_pool_ranges: resb 4096
+align 64
+__cato_pool_generation: resq 1
+align 64
+__cato_pool_pending: resq 1
+)";
+}
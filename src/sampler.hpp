@@ -0,0 +1,286 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./linker.hpp"
+
+// Sampling profiler for the executables cato links. The program runs as a
+// child under a perf_event_open task-clock counter, which needs no hardware
+// PMU and is allowed on one's own children up to perf_event_paranoid 2; the
+// counter follows its threads. Samples are the user-space instruction
+// pointers it was interrupted at, mapped back through the image's symbols
+// and line table.
+
+struct SampleRun {
+    std::vector<uint64_t> ips;
+    uint64_t lost = 0;
+    int status = 0; // the program's exit status, or 128 + the signal that killed it
+};
+
+class Sampler {
+public:
+    static constexpr uint64_t default_period_ns = 250000;
+
+    inline explicit Sampler(uint64_t period_ns = default_period_ns)
+        : m_period_ns(period_ns)
+    {
+    }
+
+    inline uint64_t period_ns() const
+    {
+        return m_period_ns;
+    }
+
+    // Runs `path` to completion. Returns nothing, with the reason in
+    // error(), if it cannot be started or sampled.
+    inline std::optional<SampleRun> run(const std::string& path)
+    {
+        if (access(path.c_str(), X_OK) != 0) {
+            return fail("cannot run " + path);
+        }
+        int gate[2];
+        if (pipe2(gate, O_CLOEXEC) != 0) {
+            return fail("pipe");
+        }
+        const pid_t child = fork();
+        if (child < 0) {
+            close(gate[0]);
+            close(gate[1]);
+            return fail("fork");
+        }
+        if (child == 0) {
+            // Waits until the counter is attached, which then starts at exec.
+            close(gate[1]);
+            char go;
+            if (read(gate[0], &go, 1) != 1) {
+                _exit(127);
+            }
+            char* const argv[] = { const_cast<char*>(path.c_str()), nullptr };
+            execv(path.c_str(), argv);
+            _exit(127);
+        }
+        close(gate[0]);
+
+        // Inherited counters cannot share one buffer across CPUs, so there
+        // is a counter and a buffer per CPU, as `perf record` has.
+        perf_event_attr attr {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+        attr.sample_period = m_period_ns;
+        attr.sample_type = PERF_SAMPLE_IP;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t mapped = (1 + buffer_pages) * page;
+        std::vector<Buffer> buffers;
+        std::string failure;
+        int saved = 0;
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); cpu++) {
+            const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, child, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd < 0) {
+                if (errno != ENODEV) {
+                    // Offline CPUs are skipped; anything else is fatal.
+                    failure = "perf_event_open";
+                    saved = errno;
+                    break;
+                }
+                continue;
+            }
+            void* data = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                failure = "mmap of the sample buffer";
+                saved = errno;
+                close(fd);
+                break;
+            }
+            buffers.push_back({ fd, data });
+        }
+        auto release = [&]() {
+            for (const Buffer& buffer : buffers) {
+                munmap(buffer.data, mapped);
+                close(buffer.fd);
+            }
+        };
+        if (!failure.empty() || buffers.empty()) {
+            release();
+            close(gate[1]);
+            kill(child, SIGKILL);
+            waitpid(child, nullptr, 0);
+            errno = failure.empty() ? ENODEV : saved;
+            return fail((failure.empty() ? "perf_event_open" : failure)
+                + (errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : ""));
+        }
+
+        SampleRun run;
+        const char go = 1;
+        const bool started = write(gate[1], &go, 1) == 1;
+        close(gate[1]);
+        int status = 0;
+        std::vector<pollfd> ready;
+        for (const Buffer& buffer : buffers) {
+            ready.push_back({ buffer.fd, POLLIN, 0 });
+        }
+        while (started) {
+            poll(ready.data(), ready.size(), 10);
+            for (const Buffer& buffer : buffers) {
+                drain(buffer.data, page, run);
+            }
+            const pid_t done = waitpid(child, &status, WNOHANG);
+            if (done == child || (done < 0 && errno != EINTR)) {
+                break;
+            }
+        }
+        if (!started) {
+            kill(child, SIGKILL);
+            waitpid(child, &status, 0);
+        }
+        for (const Buffer& buffer : buffers) {
+            drain(buffer.data, page, run);
+        }
+        release();
+        run.status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+        return run;
+    }
+
+    inline const std::string& error() const
+    {
+        return m_error;
+    }
+
+private:
+    static constexpr size_t buffer_pages = 64; // a power of two, as perf requires
+
+    struct Buffer {
+        int fd;
+        void* data; // the control page, then the ring
+    };
+
+    inline std::nullopt_t fail(const std::string& what)
+    {
+        m_error = what + ": " + std::strerror(errno);
+        return std::nullopt;
+    }
+
+    // Takes every complete record out of the ring buffer.
+    static inline void drain(void* buffer, size_t page, SampleRun& run)
+    {
+        auto* meta = static_cast<perf_event_mmap_page*>(buffer);
+        const uint8_t* data = static_cast<const uint8_t*>(buffer) + page;
+        const uint64_t mask = buffer_pages * page - 1;
+        const uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+        auto copy = [&](uint64_t at, void* into, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                static_cast<uint8_t*>(into)[i] = data[(at + i) & mask];
+            }
+        };
+        while (tail < head) {
+            perf_event_header header;
+            copy(tail, &header, sizeof(header));
+            if (header.size < sizeof(header)) {
+                break;
+            }
+            if (header.type == PERF_RECORD_SAMPLE) {
+                uint64_t ip = 0;
+                copy(tail + sizeof(header), &ip, sizeof(ip));
+                run.ips.push_back(ip);
+            } else if (header.type == PERF_RECORD_LOST) {
+                uint64_t lost[2] = {}; // id, count
+                copy(tail + sizeof(header), lost, sizeof(lost));
+                run.lost += lost[1];
+            }
+            tail += header.size;
+        }
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    uint64_t m_period_ns;
+    std::string m_error;
+};
+
+// Prints the functions and source lines that took the most samples of a
+// run of `image`, at most `top` of each. `source` is the program text the
+// line table refers to.
+inline void print_samples(const SampleRun& run, const LinkedImage& image, uint64_t period_ns, const std::string& source,
+    std::ostream& out, size_t top = 10)
+{
+    std::vector<std::string> source_lines;
+    {
+        std::istringstream text(source);
+        for (std::string line; std::getline(text, line);) {
+            source_lines.push_back(line);
+        }
+    }
+    std::vector<const LinkedSymbol*> functions;
+    for (const LinkedSymbol& sym : image.symbols) {
+        if (sym.exec && sym.size > 0) {
+            functions.push_back(&sym);
+        }
+    }
+
+    std::map<std::string, uint64_t> by_function;
+    std::map<uint32_t, uint64_t> by_line;
+    for (const uint64_t ip : run.ips) {
+        auto sym = std::upper_bound(functions.begin(), functions.end(), ip, [](uint64_t address, const LinkedSymbol* s) {
+            return address < s->address;
+        });
+        const bool known = sym != functions.begin() && ip < (*(sym - 1))->address + (*(sym - 1))->size;
+        by_function[known ? (*(sym - 1))->name : "[unknown]"]++;
+        auto row = std::upper_bound(image.lines.begin(), image.lines.end(), ip, [](uint64_t address, const LinkedLine& l) {
+            return address < l.address;
+        });
+        if (row != image.lines.begin() && (row - 1)->line != 0) {
+            by_line[(row - 1)->line]++;
+        }
+    }
+
+    auto hottest = [&](const auto& counts) {
+        std::vector<std::pair<typename std::decay_t<decltype(counts)>::key_type, uint64_t>> sorted(counts.begin(), counts.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        sorted.resize(std::min(sorted.size(), top));
+        return sorted;
+    };
+    auto percent = [&](uint64_t samples) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << 100.0 * samples / std::max<size_t>(run.ips.size(), 1);
+        return text.str();
+    };
+
+    out << run.ips.size() << " samples, one every " << period_ns / 1000 << " us of CPU time";
+    if (run.lost > 0) {
+        out << ", " << run.lost << " lost";
+    }
+    out << "\n\n";
+    out << std::setw(10) << "samples" << std::setw(8) << "%" << "  function\n";
+    for (const auto& [name, samples] : hottest(by_function)) {
+        out << std::setw(10) << samples << std::setw(8) << percent(samples) << "  " << name << "\n";
+    }
+    out << "\n" << std::setw(10) << "samples" << std::setw(8) << "%" << "  line\n";
+    for (const auto& [line, samples] : hottest(by_line)) {
+        std::string text = line <= source_lines.size() ? source_lines[line - 1] : std::string();
+        text.erase(0, std::min(text.find_first_not_of(" \t"), text.size()));
+        out << std::setw(10) << samples << std::setw(8) << percent(samples) << "  " << std::left << std::setw(6)
+            << line << std::right << text << "\n";
+    }
+}
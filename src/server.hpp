@@ -0,0 +1,329 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A long-running compile server on a Unix domain socket, and the client
+// side of its protocol. Every connection carries one request: the client's
+// working directory and command line, plus any sources sent inline. The
+// reply is the exit status and the diagnostics the build produced. Each
+// connection is served on its own thread.
+//
+// Builds run with the server's rights, so only its own user may talk to
+// it: the socket is created 0600 in a directory only that user can write
+// to, and both ends check the other's uid with SO_PEERCRED.
+
+struct CompileRequest {
+    std::string cwd;
+    std::vector<std::string> args;
+    std::vector<std::pair<std::string, std::string>> sources; // name, contents
+};
+
+struct CompileResponse {
+    int status = 0;
+    std::string diagnostics;
+};
+
+namespace server_detail {
+    inline bool write_all(int fd, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            const ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    inline bool read_all(int fd, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            const ssize_t got = ::recv(fd, bytes, size, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            bytes += got;
+            size -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    // Messages are sequences of u32-length-prefixed strings.
+    inline void put(std::string& out, const std::string& value)
+    {
+        const uint32_t size = static_cast<uint32_t>(value.size());
+        for (int i = 0; i < 4; i++) {
+            out.push_back(static_cast<char>(size >> (i * 8)));
+        }
+        out += value;
+    }
+
+    inline bool send_message(int fd, const std::vector<std::string>& fields)
+    {
+        std::string body;
+        for (const std::string& field : fields) {
+            put(body, field);
+        }
+        std::string frame;
+        put(frame, body);
+        return write_all(fd, frame.data(), frame.size());
+    }
+
+    constexpr uint32_t max_message = 256 * 1024 * 1024;
+
+    inline std::optional<std::vector<std::string>> receive_message(int fd)
+    {
+        auto read_size = [](const char* bytes) {
+            uint32_t size = 0;
+            for (int i = 0; i < 4; i++) {
+                size |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[i])) << (i * 8);
+            }
+            return size;
+        };
+        char header[4];
+        if (!read_all(fd, header, 4)) {
+            return {};
+        }
+        const uint32_t size = read_size(header);
+        if (size > max_message) {
+            return {};
+        }
+        std::string body(size, '\0');
+        if (!read_all(fd, body.data(), size)) {
+            return {};
+        }
+        std::vector<std::string> fields;
+        for (size_t pos = 0; pos < body.size();) {
+            if (body.size() - pos < 4) {
+                return {};
+            }
+            const uint32_t length = read_size(body.data() + pos);
+            pos += 4;
+            if (length > body.size() - pos) {
+                return {};
+            }
+            fields.push_back(body.substr(pos, length));
+            pos += length;
+        }
+        return fields;
+    }
+
+    inline std::optional<sockaddr_un> address(const std::string& path)
+    {
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            return {};
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return addr;
+    }
+
+    // Whether the process at the other end of `fd` runs as this user.
+    inline bool same_user(int fd)
+    {
+        ucred peer {};
+        socklen_t size = sizeof(peer);
+        return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == ::geteuid();
+    }
+
+    inline int connect_to(const std::string& path)
+    {
+        std::optional<sockaddr_un> addr = address(path);
+        if (!addr.has_value()) {
+            return -1;
+        }
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr.value()), sizeof(sockaddr_un)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Request: cwd, argc, args..., then (name, contents) pairs.
+    inline std::vector<std::string> encode(const CompileRequest& request)
+    {
+        std::vector<std::string> fields { request.cwd, std::to_string(request.args.size()) };
+        fields.insert(fields.end(), request.args.begin(), request.args.end());
+        for (const auto& [name, contents] : request.sources) {
+            fields.push_back(name);
+            fields.push_back(contents);
+        }
+        return fields;
+    }
+
+    inline std::optional<CompileRequest> decode(const std::vector<std::string>& fields)
+    {
+        if (fields.size() < 2) {
+            return {};
+        }
+        CompileRequest request { fields[0], {}, {} };
+        char* end = nullptr;
+        const unsigned long argc = std::strtoul(fields[1].c_str(), &end, 10);
+        if (*end != '\0' || argc > fields.size() - 2 || (fields.size() - 2 - argc) % 2 != 0) {
+            return {};
+        }
+        request.args.assign(fields.begin() + 2, fields.begin() + 2 + static_cast<long>(argc));
+        for (size_t i = 2 + argc; i < fields.size(); i += 2) {
+            request.sources.emplace_back(fields[i], fields[i + 1]);
+        }
+        return request;
+    }
+}
+
+// Default socket: $CATO_SERVER_SOCKET, else cato.sock in $XDG_RUNTIME_DIR,
+// else in a directory of the user's own under /tmp, made 0700 if it is
+// not there yet. Empty if that directory belongs to someone else.
+inline std::string default_server_socket()
+{
+    if (const char* path = std::getenv("CATO_SERVER_SOCKET"); path != nullptr && *path != '\0') {
+        return path;
+    }
+    if (const char* dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && *dir != '\0') {
+        return std::string(dir) + "/cato.sock";
+    }
+    const std::string dir = "/tmp/cato-" + std::to_string(::geteuid());
+    ::mkdir(dir.c_str(), 0700);
+    struct stat info {};
+    if (::lstat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != ::geteuid() || (info.st_mode & 077) != 0) {
+        return {};
+    }
+    return dir + "/cato.sock";
+}
+
+// Sends one request; nothing is returned if no server answered.
+inline std::optional<CompileResponse> send_compile_request(const std::string& socket_path, const CompileRequest& request)
+{
+    const int fd = server_detail::connect_to(socket_path);
+    if (fd < 0) {
+        return {};
+    }
+    std::optional<std::vector<std::string>> reply;
+    if (server_detail::same_user(fd) && server_detail::send_message(fd, server_detail::encode(request))) {
+        reply = server_detail::receive_message(fd);
+    }
+    ::close(fd);
+    if (!reply.has_value() || reply->size() != 2) {
+        return {};
+    }
+    return CompileResponse { std::atoi(reply->at(0).c_str()), reply->at(1) };
+}
+
+class CompileServer {
+public:
+    using Handler = std::function<int(const CompileRequest& request, std::ostream& diagnostics)>;
+
+    inline CompileServer(std::string socket_path, Handler handler)
+        : m_socket_path(std::move(socket_path))
+        , m_handler(std::move(handler))
+    {
+    }
+
+    // Serves until the process is killed. Returns false if the socket could
+    // not be set up.
+    inline bool run()
+    {
+        if (m_socket_path.empty()) {
+            std::cerr << "server: no private directory for the socket; set XDG_RUNTIME_DIR or pass --socket" << std::endl;
+            return false;
+        }
+        std::optional<sockaddr_un> addr = server_detail::address(m_socket_path);
+        if (!addr.has_value()) {
+            std::cerr << "server: socket path too long: " << m_socket_path << std::endl;
+            return false;
+        }
+        // A socket file nobody answers on is left over from a dead server.
+        if (const int probe = server_detail::connect_to(m_socket_path); probe >= 0) {
+            ::close(probe);
+            std::cerr << "server: already running on " << m_socket_path << std::endl;
+            return false;
+        }
+        ::unlink(m_socket_path.c_str());
+
+        // Created 0600 from the start; no thread is running yet to see the
+        // umask change.
+        const int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const mode_t old_umask = ::umask(0177);
+        const bool bound = listener >= 0 && ::bind(listener, reinterpret_cast<const sockaddr*>(&addr.value()), sizeof(sockaddr_un)) == 0;
+        ::umask(old_umask);
+        if (!bound || ::listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "server: cannot listen on " << m_socket_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::signal(SIGPIPE, SIG_IGN);
+        std::cerr << "server: listening on " << m_socket_path << std::endl;
+
+        while (true) {
+            const int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                std::cerr << "server: accept failed: " << std::strerror(errno) << std::endl;
+                ::close(listener);
+                return false;
+            }
+            std::thread([this, client] { serve(client); }).detach();
+        }
+    }
+
+private:
+    inline void serve(int client) const
+    {
+        if (!server_detail::same_user(client)) {
+            server_detail::send_message(client, { std::to_string(EXIT_FAILURE), "server: connection from another user refused\n" });
+            ::close(client);
+            return;
+        }
+        std::optional<std::vector<std::string>> fields = server_detail::receive_message(client);
+        std::optional<CompileRequest> request;
+        if (fields.has_value()) {
+            request = server_detail::decode(fields.value());
+        }
+        std::ostringstream diagnostics;
+        int status = EXIT_FAILURE;
+        if (!request.has_value()) {
+            diagnostics << "server: malformed request\n";
+        } else {
+            try {
+                status = m_handler(request.value(), diagnostics);
+            } catch (const std::exception& err) {
+                diagnostics << "server: " << err.what() << "\n";
+            }
+        }
+        server_detail::send_message(client, { std::to_string(status), diagnostics.str() });
+        ::close(client);
+    }
+
+    std::string m_socket_path;
+    Handler m_handler;
+};
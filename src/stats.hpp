@@ -0,0 +1,209 @@
+#pragma once
+
+#include <sys/resource.h>
+#include <ctime>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What --time-passes and --mem-stats report. One BuildStats collects every
+// phase of every file in an invocation; the same phase in several files or
+// on several -j workers is added up.
+
+struct PassTime {
+    std::string name;
+    double wall = 0; // seconds
+    double cpu = 0;  // seconds on the thread that ran the phase
+    size_t runs = 0;
+};
+
+struct MemoryUse {
+    size_t tokens = 0;
+    size_t token_bytes = 0;      // the token vector and its values
+    size_t arena_bytes = 0;      // parser arena in use after parsing
+    size_t arena_peak_bytes = 0; // the most that arena has ever held
+    size_t output_bytes = 0;     // generated assembly text
+    size_t data_bytes = 0;       // generated data section
+};
+
+class BuildStats {
+public:
+    // Adds the time until it goes out of scope to phase `name`. A timer
+    // started inside another on the same thread pauses the outer one, so
+    // each phase counts only its own time and the phases add up.
+    class Timer {
+    public:
+        inline Timer(BuildStats* stats, const char* name)
+            : m_stats(stats)
+            , m_name(name)
+            , m_outer(stats != nullptr ? running() : nullptr)
+        {
+            if (m_stats == nullptr) {
+                return;
+            }
+            if (m_outer != nullptr) {
+                m_outer->pause();
+            }
+            running() = this;
+            resume();
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        inline ~Timer()
+        {
+            if (m_stats == nullptr) {
+                return;
+            }
+            pause();
+            m_stats->add_time(m_name, m_wall_total, m_cpu_total);
+            running() = m_outer;
+            if (m_outer != nullptr) {
+                m_outer->resume();
+            }
+        }
+
+    private:
+        static inline Timer*& running()
+        {
+            thread_local Timer* timer = nullptr;
+            return timer;
+        }
+
+        inline void resume()
+        {
+            m_wall = std::chrono::steady_clock::now();
+            m_cpu = thread_cpu_seconds();
+        }
+
+        inline void pause()
+        {
+            m_wall_total += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_wall).count();
+            m_cpu_total += thread_cpu_seconds() - m_cpu;
+        }
+
+        BuildStats* m_stats;
+        const char* m_name;
+        Timer* m_outer; // paused while this one runs
+        std::chrono::steady_clock::time_point m_wall {};
+        double m_cpu = 0;
+        double m_wall_total = 0;
+        double m_cpu_total = 0;
+    };
+
+    // A null `stats` times nothing, so call sites need no checks.
+    static inline Timer time(BuildStats* stats, const char* name)
+    {
+        return Timer(stats, name);
+    }
+
+    inline void add_time(const std::string& name, double wall, double cpu)
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = std::find_if(m_passes.begin(), m_passes.end(), [&](const PassTime& pass) { return pass.name == name; });
+        if (it == m_passes.end()) {
+            m_passes.push_back({ name });
+            it = m_passes.end() - 1;
+        }
+        it->wall += wall;
+        it->cpu += cpu;
+        it->runs++;
+    }
+
+    inline void add_memory(const MemoryUse& use)
+    {
+        std::lock_guard lock(m_mutex);
+        m_memory.tokens += use.tokens;
+        m_memory.token_bytes += use.token_bytes;
+        m_memory.arena_bytes += use.arena_bytes;
+        m_memory.arena_peak_bytes = std::max(m_memory.arena_peak_bytes, use.arena_peak_bytes);
+        m_memory.output_bytes += use.output_bytes;
+        m_memory.data_bytes += use.data_bytes;
+    }
+
+    inline void print_times(std::ostream& out, bool json)
+    {
+        std::lock_guard lock(m_mutex);
+        double wall = 0;
+        double cpu = 0;
+        for (const PassTime& pass : m_passes) {
+            wall += pass.wall;
+            cpu += pass.cpu;
+        }
+        if (json) {
+            out << "{\"passes\": [";
+            for (size_t i = 0; i < m_passes.size(); i++) {
+                const PassTime& pass = m_passes[i];
+                out << (i == 0 ? "" : ", ") << "{\"name\": \"" << pass.name << "\", \"wall_s\": " << pass.wall
+                    << ", \"cpu_s\": " << pass.cpu << ", \"runs\": " << pass.runs << "}";
+            }
+            out << "], \"wall_s\": " << wall << ", \"cpu_s\": " << cpu << "}" << std::endl;
+            return;
+        }
+        out << std::left << std::setw(12) << "pass" << std::right << std::setw(12) << "wall (ms)" << std::setw(8)
+            << "%" << std::setw(12) << "cpu (ms)" << "\n";
+        const auto row = [&](const std::string& name, double pass_wall, double pass_cpu) {
+            out << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(12) << pass_wall * 1e3 << std::setprecision(1) << std::setw(8)
+                << (wall > 0 ? pass_wall / wall * 100 : 0) << std::setprecision(3) << std::setw(12) << pass_cpu * 1e3
+                << "\n";
+        };
+        for (const PassTime& pass : m_passes) {
+            row(pass.name, pass.wall, pass.cpu);
+        }
+        row("total", wall, cpu);
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6) << std::flush;
+    }
+
+    inline void print_memory(std::ostream& out, bool json)
+    {
+        std::lock_guard lock(m_mutex);
+        const std::pair<const char*, size_t> rows[] = {
+            { "tokens", m_memory.tokens },
+            { "token_bytes", m_memory.token_bytes },
+            { "arena_bytes", m_memory.arena_bytes },
+            { "arena_peak_bytes", m_memory.arena_peak_bytes },
+            { "output_bytes", m_memory.output_bytes },
+            { "data_bytes", m_memory.data_bytes },
+            { "peak_rss_bytes", peak_rss_bytes() },
+        };
+        if (json) {
+            out << "{";
+            for (size_t i = 0; i < std::size(rows); i++) {
+                out << (i == 0 ? "" : ", ") << "\"" << rows[i].first << "\": " << rows[i].second;
+            }
+            out << "}" << std::endl;
+            return;
+        }
+        for (const auto& [name, value] : rows) {
+            out << std::left << std::setw(18) << name << std::right << std::setw(14) << value << "\n";
+        }
+        out << std::flush;
+    }
+
+private:
+    static inline double thread_cpu_seconds()
+    {
+        timespec now {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1e-9;
+    }
+
+    static inline size_t peak_rss_bytes()
+    {
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+    }
+
+    std::mutex m_mutex;
+    std::vector<PassTime> m_passes;
+    MemoryUse m_memory;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed-size work-stealing pool. parallel_for() deals the indices out to
+// per-worker queues in contiguous runs; a worker takes from the front of
+// its own queue and, once that is empty, steals from the back of another's.
+// The calling thread works as worker 0.
+
+class ThreadPool {
+public:
+    using Body = std::function<void(size_t index, size_t worker)>;
+
+    inline explicit ThreadPool(size_t threads)
+        : m_queues(std::max<size_t>(threads, 1))
+    {
+        for (size_t i = 1; i < m_queues.size(); i++) {
+            m_threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    inline ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    inline size_t size() const
+    {
+        return m_queues.size();
+    }
+
+    // Runs body(i, worker) for every i in [0, count), worker < size(), and
+    // returns once all calls have finished. If any call throws, the first
+    // exception is rethrown here after the rest have run.
+    inline void parallel_for(size_t count, const Body& body)
+    {
+        if (count == 0) {
+            return;
+        }
+        m_body = &body;
+        m_pending = count;
+        const size_t workers = m_queues.size();
+        for (size_t w = 0; w < workers; w++) {
+            std::lock_guard lock(m_queues[w].mutex);
+            for (size_t i = count * w / workers; i < count * (w + 1) / workers; i++) {
+                m_queues[w].tasks.push_back(i);
+            }
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_round++;
+        }
+        m_wake.notify_all();
+
+        run_tasks(0);
+        std::unique_lock lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending == 0; });
+        if (std::exception_ptr error = std::exchange(m_error, nullptr)) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    inline std::optional<size_t> take(size_t worker)
+    {
+        {
+            Queue& own = m_queues[worker];
+            std::lock_guard lock(own.mutex);
+            if (!own.tasks.empty()) {
+                const size_t task = own.tasks.front();
+                own.tasks.pop_front();
+                return task;
+            }
+        }
+        for (size_t k = 1; k < m_queues.size(); k++) {
+            Queue& victim = m_queues[(worker + k) % m_queues.size()];
+            std::lock_guard lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                const size_t task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return task;
+            }
+        }
+        return {};
+    }
+
+    inline void run_tasks(size_t worker)
+    {
+        while (std::optional<size_t> task = take(worker)) {
+            try {
+                (*m_body)(task.value(), worker);
+            } catch (...) {
+                std::lock_guard lock(m_mutex);
+                if (!m_error) {
+                    m_error = std::current_exception();
+                }
+            }
+            if (m_pending.fetch_sub(1) == 1) {
+                std::lock_guard lock(m_mutex);
+                m_done.notify_all();
+            }
+        }
+    }
+
+    inline void worker_loop(size_t worker)
+    {
+        size_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stopping || m_round != seen; });
+                if (m_stopping) {
+                    return;
+                }
+                seen = m_round;
+            }
+            run_tasks(worker);
+        }
+    }
+
+    std::vector<Queue> m_queues;
+    std::vector<std::thread> m_threads;
+    const Body* m_body = nullptr; // published to workers through the queue locks
+    std::atomic<size_t> m_pending = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    size_t m_round = 0;
+    std::exception_ptr m_error;
+    bool m_stopping = false;
+};
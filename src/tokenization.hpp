@@ -1,255 +1,338 @@
-#pragma once
-
-#include <iostream>
-#include <optional>
-#include <vector>
-
-
-enum class TokenType {
-    exit,
-    int_lit,
-    semi,
-    open_paren,
-    close_paren,
-    ident,
-    int_,
-    eq,
-    plus,
-    star,
-    sub, 
-    div,
-    open_curly,
-    close_curly,
-    if_,
-    elif_,
-    else_,
-    for_,
-    less_than,
-    greater_than,
-    equality,
-    not_equal,
-    string_lit,
-    function,
-    comma,
-    return_,
-};
-
-bool is_bin_op(TokenType type){
-    switch (type) {
-    case TokenType::plus:
-    case TokenType::star:
-    return true;
-    default:
-        return false;
-    }
-}
-
-std::optional<int> bin_prec(TokenType type)
-{
-    switch (type) {
-        case TokenType::plus:
-        case TokenType::sub:
-            return 1;
-        case TokenType::div:
-        case TokenType::star:
-            return 2;
-        case TokenType::greater_than:
-        case TokenType::less_than:
-        case TokenType::equality:
-        case TokenType::not_equal:
-            return 0; 
-        default:
-            return {};
-    }
-}
-
-struct Token {
-    TokenType type;
-    std::optional<std::string> value {};
-};
-
-
-
-class Tokenizer {
-    public:
-
-        const std::string m_src;
-        size_t m_index = 0;
-
-        inline explicit Tokenizer(std::string&& src) : m_src(std::move(src)) {}
-
-        inline std::vector<Token> tokenize(){
-            
-        std::string buf {};
-        std::vector<Token> tokens;
-
-        while(peek().has_value()){
-            auto optChar = peek();
-            if(!optChar.has_value()) {
-                std::cerr << "Unexpected empty optional at index: " << m_index << std::endl;
-                break;
-            }
-            
-            if(std::isalpha(peek().value())){
-                buf.push_back(consume());
-                while(peek().has_value() && std::isalnum(peek().value())){
-                    buf.push_back(consume());
-                }
-                if(buf == "exit"){
-                    tokens.push_back({.type = TokenType::exit});
-                    buf.clear();
-                } 
-                else if(buf == "int"){
-                    tokens.push_back({.type = TokenType::int_});
-                    buf.clear();
-                }
-                else if(buf == "string"){
-                    tokens.push_back({.type = TokenType::string_lit});
-                    buf.clear();
-                }
-                else if(buf == "function"){
-                    tokens.push_back({.type = TokenType::function});
-                    buf.clear();
-                }
-                else if(buf == "if"){
-                    tokens.push_back({.type = TokenType::if_});
-                    buf.clear();
-                }
-                else if(buf == "else"){
-                    tokens.push_back({.type = TokenType::else_});
-                }
-                else if(buf == "elif"){
-                    tokens.push_back({.type = TokenType::elif_});
-                    buf.clear();
-                }
-                else if(buf == "return"){
-                    tokens.push_back({.type = TokenType::return_});
-                    buf.clear();
-                }
-                else if(buf == "for"){
-                    tokens.push_back({.type = TokenType::for_});
-                    buf.clear(); 
-                }
-                else{
-                    tokens.push_back({.type = TokenType::ident, .value = buf});
-                    buf.clear();
-                    
-                }
-            }
-            else if(std::isdigit(peek().value())){
-                buf.push_back(consume());
-                while(peek().has_value() && std::isdigit(peek().value())){
-                    buf.push_back(consume());
-                }
-                tokens.push_back({.type = TokenType::int_lit, .value = buf});
-                buf.clear();
-            }
-            else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/'){
-                consume();
-                consume();
-                while(peek().has_value() && peek().value() != '\n'){
-                    consume();
-                }
-            }
-            else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*'){
-                consume();
-                consume();
-                while(peek().has_value() && peek().value() != '*' && peek(1).value() != '/'){
-                    consume();
-                }
-                consume();
-                consume();
-            }
-            else if(peek().value() == '=' && peek(1).has_value() && peek(1).value() == '='){
-                consume();
-                consume();
-                tokens.push_back({ .type = TokenType::equality });
-            }
-            else if(peek().value() == '!' && peek(1).has_value() && peek(1).value() == '='){
-                consume();
-                consume();
-                tokens.push_back({ .type = TokenType::not_equal });
-            }
-            else if(peek().value() == '('){
-                consume();
-                tokens.push_back({.type = TokenType::open_paren});
-            }
-            else if(peek().value() == ')'){
-                consume();
-                tokens.push_back({.type = TokenType::close_paren});
-            }
-            else if(peek().value() == ';'){
-                consume();
-                tokens.push_back({.type = TokenType::semi});
-            }
-            else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({ .type = TokenType::eq });    
-            }
-            else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({ .type = TokenType::plus });
-            }
-            else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({ .type = TokenType::star });
-            }
-            else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({ .type = TokenType::sub });
-            }
-            else if (peek().value() == '/') {
-                consume();
-                tokens.push_back({ .type = TokenType::div });
-            }
-            else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({ .type = TokenType::open_curly });
-            }
-            else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({ .type = TokenType::close_curly });
-            }
-            else if (peek().value() == '<') {
-                consume();
-                tokens.push_back({ .type = TokenType::less_than });
-            }
-            else if (peek().value() == '>') {
-                consume();
-                tokens.push_back({ .type = TokenType::greater_than });
-            }
-            else if (peek().value() == ',') {
-                consume();
-                tokens.push_back({ .type = TokenType::comma });
-            }
-
-            else if(std::isspace(peek().value())){
-                consume(); 
-            }
-            else{
-                std::cerr << "Goof Tokenization" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            
-        }
-        m_index = 0;
-        return tokens;
-        }
-
-    private:
-
-        [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
-            if(m_index + offset >= m_src.length()){
-                return {};
-            } else {
-                return m_src.at(m_index + offset);
-            }
-
-        }
-
-        inline char consume() {
-            return m_src.at(m_index++);
-        }
-
-        
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "./error.hpp"
+#include "./hash.hpp"
+
+
+enum class TokenType {
+    exit,
+    int_lit,
+    semi,
+    open_paren,
+    close_paren,
+    ident,
+    int_,
+    eq,
+    plus,
+    star,
+    sub, 
+    div,
+    open_curly,
+    close_curly,
+    if_,
+    elif_,
+    else_,
+    for_,
+    less_than,
+    greater_than,
+    equality,
+    not_equal,
+    string_lit,
+    function,
+    comma,
+    return_,
+    print,
+    println,
+    open_bracket,
+    close_bracket,
+    and_,
+    or_,
+    not_,
+};
+
+bool is_bin_op(TokenType type){
+    switch (type) {
+    case TokenType::plus:
+    case TokenType::star:
+    return true;
+    default:
+        return false;
+    }
+}
+
+std::optional<int> bin_prec(TokenType type)
+{
+    switch (type) {
+        case TokenType::plus:
+        case TokenType::sub:
+            return 1;
+        case TokenType::div:
+        case TokenType::star:
+            return 2;
+        case TokenType::greater_than:
+        case TokenType::less_than:
+        case TokenType::equality:
+        case TokenType::not_equal:
+            return 0; 
+        case TokenType::and_:
+            return -1;
+        case TokenType::or_:
+            return -2;
+        default:
+            return {};
+    }
+}
+
+struct Token {
+    TokenType type;
+    std::optional<std::string> value {};
+    uint32_t line = 0; // where the token starts, from 1
+};
+
+// Content hash of a token range; whitespace and comments do not affect it.
+inline uint64_t hash_tokens(const Token* begin, const Token* end)
+{
+    uint64_t hash = fnv_offset;
+    for (const Token* token = begin; token != end; ++token) {
+        hash = fnv1a(static_cast<uint64_t>(token->type), hash);
+        const std::string_view value = token->value.has_value() ? std::string_view(token->value.value()) : std::string_view();
+        hash = fnv1a(value.size(), hash);
+        hash = fnv1a(value, hash);
+    }
+    return hash;
+}
+
+// Hash of the lines a token range sits on, for output that carries line
+// numbers and so changes when the code only moves.
+inline uint64_t hash_lines(const Token* begin, const Token* end)
+{
+    uint64_t hash = fnv_offset;
+    for (const Token* token = begin; token != end; ++token) {
+        hash = fnv1a(token->line, hash);
+    }
+    return hash;
+}
+
+
+
+// Reserved words, built on first use. `len`, `alloc` and `parallel` are
+// identifiers that the parser reads as built-ins only where they are
+// followed by what those need, so programs may still use them as names.
+inline const std::unordered_map<std::string, TokenType>& keywords()
+{
+    static const std::unordered_map<std::string, TokenType> table = {
+        { "exit", TokenType::exit },
+        { "int", TokenType::int_ },
+        { "function", TokenType::function },
+        { "if", TokenType::if_ },
+        { "else", TokenType::else_ },
+        { "elif", TokenType::elif_ },
+        { "return", TokenType::return_ },
+        { "for", TokenType::for_ },
+        { "print", TokenType::print },
+        { "println", TokenType::println },
+    };
+    return table;
+}
+
+class Tokenizer {
+    public:
+
+        const std::string m_src;
+        size_t m_index = 0;
+        uint32_t m_line = 1;
+
+        inline explicit Tokenizer(std::string&& src) : m_src(std::move(src)) {}
+
+        inline std::vector<Token> tokenize(){
+            
+        std::string buf {};
+        std::vector<Token> tokens;
+
+        while(peek().has_value()){
+            const size_t count = tokens.size();
+            const uint32_t line = m_line;
+            auto optChar = peek();
+            if(!optChar.has_value()) {
+                std::cerr << "Unexpected empty optional at index: " << m_index << std::endl;
+                break;
+            }
+            
+            if(std::isalpha(peek().value())){
+                buf.push_back(consume());
+                while(peek().has_value() && std::isalnum(peek().value())){
+                    buf.push_back(consume());
+                }
+                if(auto keyword = keywords().find(buf); keyword != keywords().end()){
+                    tokens.push_back({.type = keyword->second});
+                }
+                else{
+                    tokens.push_back({.type = TokenType::ident, .value = buf});
+                }
+                buf.clear();
+            }
+            else if(std::isdigit(peek().value())){
+                buf.push_back(consume());
+                while(peek().has_value() && std::isdigit(peek().value())){
+                    buf.push_back(consume());
+                }
+                tokens.push_back({.type = TokenType::int_lit, .value = buf});
+                buf.clear();
+            }
+            else if(peek().value() == '"'){
+                consume();
+                while(peek().has_value() && peek().value() != '"' && peek().value() != '\n'){
+                    if(peek().value() != '\\'){
+                        buf.push_back(consume());
+                        continue;
+                    }
+                    consume();
+                    if(!peek().has_value()){
+                        break;
+                    }
+                    switch(const char escaped = consume()){
+                        case 'n': buf.push_back('\n'); break;
+                        case 't': buf.push_back('\t'); break;
+                        case '0': buf.push_back('\0'); break;
+                        case '\\':
+                        case '"': buf.push_back(escaped); break;
+                        default: compile_error(std::string("Unknown escape \\") + escaped);
+                    }
+                }
+                if(!peek().has_value() || peek().value() != '"'){
+                    compile_error("Unterminated string literal");
+                }
+                consume();
+                tokens.push_back({.type = TokenType::string_lit, .value = buf});
+                buf.clear();
+            }
+            else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/'){
+                consume();
+                consume();
+                while(peek().has_value() && peek().value() != '\n'){
+                    consume();
+                }
+            }
+            else if(peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*'){
+                consume();
+                consume();
+                while(peek().has_value() && peek().value() != '*' && peek(1).value() != '/'){
+                    consume();
+                }
+                consume();
+                consume();
+            }
+            else if(peek().value() == '=' && peek(1).has_value() && peek(1).value() == '='){
+                consume();
+                consume();
+                tokens.push_back({ .type = TokenType::equality });
+            }
+            else if(peek().value() == '!' && peek(1).has_value() && peek(1).value() == '='){
+                consume();
+                consume();
+                tokens.push_back({ .type = TokenType::not_equal });
+            }
+            else if(peek().value() == '&' && peek(1).has_value() && peek(1).value() == '&'){
+                consume();
+                consume();
+                tokens.push_back({ .type = TokenType::and_ });
+            }
+            else if(peek().value() == '|' && peek(1).has_value() && peek(1).value() == '|'){
+                consume();
+                consume();
+                tokens.push_back({ .type = TokenType::or_ });
+            }
+            else if(peek().value() == '!'){
+                consume();
+                tokens.push_back({ .type = TokenType::not_ });
+            }
+            else if(peek().value() == '('){
+                consume();
+                tokens.push_back({.type = TokenType::open_paren});
+            }
+            else if(peek().value() == ')'){
+                consume();
+                tokens.push_back({.type = TokenType::close_paren});
+            }
+            else if(peek().value() == ';'){
+                consume();
+                tokens.push_back({.type = TokenType::semi});
+            }
+            else if (peek().value() == '=') {
+                consume();
+                tokens.push_back({ .type = TokenType::eq });    
+            }
+            else if (peek().value() == '+') {
+                consume();
+                tokens.push_back({ .type = TokenType::plus });
+            }
+            else if (peek().value() == '*') {
+                consume();
+                tokens.push_back({ .type = TokenType::star });
+            }
+            else if (peek().value() == '-') {
+                consume();
+                tokens.push_back({ .type = TokenType::sub });
+            }
+            else if (peek().value() == '/') {
+                consume();
+                tokens.push_back({ .type = TokenType::div });
+            }
+            else if (peek().value() == '{') {
+                consume();
+                tokens.push_back({ .type = TokenType::open_curly });
+            }
+            else if (peek().value() == '}') {
+                consume();
+                tokens.push_back({ .type = TokenType::close_curly });
+            }
+            else if (peek().value() == '<') {
+                consume();
+                tokens.push_back({ .type = TokenType::less_than });
+            }
+            else if (peek().value() == '>') {
+                consume();
+                tokens.push_back({ .type = TokenType::greater_than });
+            }
+            else if (peek().value() == '[') {
+                consume();
+                tokens.push_back({ .type = TokenType::open_bracket });
+            }
+            else if (peek().value() == ']') {
+                consume();
+                tokens.push_back({ .type = TokenType::close_bracket });
+            }
+            else if (peek().value() == ',') {
+                consume();
+                tokens.push_back({ .type = TokenType::comma });
+            }
+
+            else if(std::isspace(peek().value())){
+                consume(); 
+            }
+            else{
+                compile_error("Goof Tokenization");
+            }
+            if(tokens.size() > count){
+                tokens.back().line = line;
+            }
+        }
+        m_index = 0;
+        m_line = 1;
+        return tokens;
+        }
+
+    private:
+
+        [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
+            if(m_index + offset >= m_src.length()){
+                return {};
+            } else {
+                return m_src.at(m_index + offset);
+            }
+
+        }
+
+        inline char consume() {
+            if(m_src.at(m_index) == '\n'){
+                m_line++;
+            }
+            return m_src.at(m_index++);
+        }
+
+        
 };
\ No newline at end of file
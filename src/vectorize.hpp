@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "./parser.hpp"
+
+// An expression computed on two elements at once, in an SSE register.
+struct VectorExpr {
+    enum class Kind { load, broadcast, counter, add, sub, equals, not_equals };
+    Kind kind;
+    size_t operand = 0; // load: index into arrays; broadcast: into broadcasts
+    size_t lhs = 0;     // into VectorLoop::exprs
+    size_t rhs = 0;
+};
+
+// A counted loop whose body the generator can run two iterations of at a
+// time, with SSE2 integer instructions; the scalar loop that follows it
+// finishes whatever iterations are left. Names are the source's; the
+// generator resolves them and gives up if one is not what it has to be.
+struct VectorLoop {
+    enum class StepKind { store, add, subtract };
+
+    // One statement of the body: `array[i] = expr`, `target = target + expr`
+    // or `target = target - expr`.
+    struct Step {
+        StepKind kind;
+        std::string name;
+        size_t expr;
+    };
+
+    // A value the same in every iteration: a variable or a literal.
+    struct Broadcast {
+        std::string name {}; // empty for a literal
+        int64_t value = 0;
+    };
+
+    std::string counter;
+    // The loop runs while counter < end, which is a literal, a variable or
+    // the length of an array.
+    Broadcast end;
+    std::string end_length; // set for `len(a)`
+    std::vector<Step> steps;
+    std::vector<VectorExpr> exprs;
+    std::vector<std::string> arrays;
+    std::vector<Broadcast> broadcasts;
+    bool uses_not_equals = false;
+    bool uses_counter = false; // the counter is used as a value
+
+    // What the generator has registers for: array bases in six general
+    // registers, an expression stack of six SSE registers, five accumulators
+    // and two broadcast values.
+    static constexpr size_t max_arrays = 6;
+    static constexpr size_t max_depth = 6;
+    static constexpr size_t max_reductions = 5;
+    static constexpr size_t max_broadcasts = 2;
+    // Of the expression tree, which depth() and the emitter walk recursively.
+    static constexpr size_t max_height = 64;
+
+    // Registers the expression needs, counting its result.
+    size_t depth(size_t expr) const
+    {
+        const VectorExpr& e = exprs[expr];
+        if (e.kind == VectorExpr::Kind::load || e.kind == VectorExpr::Kind::broadcast || e.kind == VectorExpr::Kind::counter) {
+            return 1;
+        }
+        return std::max(depth(e.lhs), depth(e.rhs) + 1);
+    }
+};
+
+// Recognises
+//
+//     for (int i = S; i < END; i = i + 1) { ... }
+//
+// where every statement of the body is `a[i] = E;` or `s = s + E ...;`, a
+// sum that starts with s, and E is built from `b[i]`, i, variables the
+// loop does not assign, literals, `+`, `-`, `==` and `!=`. Every element is
+// indexed by i itself, so no iteration reads what another one writes and
+// running them in pairs gives the same result; sums wrap, so the order they
+// are added in does not matter either. Products and ordered comparisons have no 64-bit
+// SSE2 instruction and stay scalar.
+class Vectorizer {
+public:
+    inline std::optional<VectorLoop> match(const NodeStatementFor* stmt_for)
+    {
+        if (!stmt_for->init || !stmt_for->condition || !stmt_for->iteration || !stmt_for->scope) {
+            return {};
+        }
+        if (auto init = std::get_if<NodeStatementInt*>(&stmt_for->init->var)) {
+            m_loop.counter = (*init)->ident.value.value();
+        } else if (auto init = std::get_if<NodeStatementAssign*>(&stmt_for->init->var)) {
+            m_loop.counter = (*init)->ident.value.value();
+        } else {
+            return {};
+        }
+        if (!match_condition(stmt_for->condition) || !match_increment(stmt_for->iteration)) {
+            return {};
+        }
+
+        for (const NodeStatement* statement : stmt_for->scope->statements) {
+            if (auto store = std::get_if<NodeStatementStore*>(&statement->var)) {
+                if (!is_counter((*store)->index)) {
+                    return {};
+                }
+                const std::optional<size_t> expr = vector_expr((*store)->expr);
+                if (!expr.has_value()) {
+                    return {};
+                }
+                add_array((*store)->ident.value.value());
+                m_loop.steps.push_back({ VectorLoop::StepKind::store, (*store)->ident.value.value(), expr.value() });
+            } else if (auto assign = std::get_if<NodeStatementAssign*>(&statement->var)) {
+                const std::string& target = (*assign)->ident.value.value();
+                if (target == m_loop.counter || !match_reduction(target, (*assign)->expr)) {
+                    return {};
+                }
+                m_assigned.push_back(target);
+            } else {
+                return {};
+            }
+        }
+
+        // A reduction's target must not be read anywhere else in the loop,
+        // and neither it nor the bound may change from under the broadcasts.
+        size_t reductions = 0;
+        for (const VectorLoop::Step& step : m_loop.steps) {
+            reductions += step.kind != VectorLoop::StepKind::store;
+            if (m_loop.depth(step.expr) > VectorLoop::max_depth) {
+                return {};
+            }
+        }
+        for (const std::string& name : m_assigned) {
+            if (name == m_loop.end.name) {
+                return {};
+            }
+            for (const VectorLoop::Broadcast& broadcast : m_loop.broadcasts) {
+                if (broadcast.name == name) {
+                    return {};
+                }
+            }
+        }
+        if (m_loop.steps.empty() || reductions > VectorLoop::max_reductions
+            || m_loop.arrays.size() > VectorLoop::max_arrays || m_loop.broadcasts.size() > VectorLoop::max_broadcasts) {
+            return {};
+        }
+        return std::move(m_loop);
+    }
+
+private:
+    static std::string ident_name(const NodeExpr* expr)
+    {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                return (*ident)->ident.value.value();
+            }
+        }
+        return {};
+    }
+
+    static std::optional<int64_t> literal(const NodeExpr* expr)
+    {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto int_lit = std::get_if<NodeTermIntLit*>(&(*term)->var)) {
+                return (*int_lit)->value;
+            }
+        }
+        return {};
+    }
+
+    bool is_counter(const NodeExpr* expr) const
+    {
+        return ident_name(expr) == m_loop.counter;
+    }
+
+    bool match_condition(const NodeExpr* condition)
+    {
+        const NodeBinExpression* const* bin = std::get_if<NodeBinExpression*>(&condition->var);
+        if (bin == nullptr) {
+            return false;
+        }
+        const NodeBinExpressionLess* const* less = std::get_if<NodeBinExpressionLess*>(&(*bin)->var);
+        if (less == nullptr || !is_counter((*less)->lhs)) {
+            return false;
+        }
+        const NodeExpr* end = (*less)->rhs;
+        if (const std::optional<int64_t> value = literal(end)) {
+            m_loop.end.value = value.value();
+            return true;
+        }
+        if (const std::string name = ident_name(end); !name.empty()) {
+            m_loop.end.name = name;
+            return name != m_loop.counter;
+        }
+        if (auto term = std::get_if<NodeTerm*>(&end->var)) {
+            if (auto length = std::get_if<NodeTermLength*>(&(*term)->var)) {
+                m_loop.end_length = (*length)->ident.value.value();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // `s = s + A - B ...`, which parses as `((s + A) - B) ...`: the terms
+    // along the left spine are summed into one expression, negated as a
+    // whole when the first is subtracted.
+    bool match_reduction(const std::string& target, const NodeExpr* expr)
+    {
+        std::vector<std::pair<bool, const NodeExpr*>> terms; // subtracted, term
+        while (ident_name(expr) != target) {
+            const NodeBinExpression* const* bin = std::get_if<NodeBinExpression*>(&expr->var);
+            if (bin == nullptr) {
+                return false;
+            }
+            if (auto add = std::get_if<NodeBinExpressionAdd*>(&(*bin)->var)) {
+                terms.emplace_back(false, (*add)->rhs);
+                expr = (*add)->lhs;
+            } else if (auto sub = std::get_if<NodeBinExpressionSub*>(&(*bin)->var)) {
+                terms.emplace_back(true, (*sub)->rhs);
+                expr = (*sub)->lhs;
+            } else {
+                return false;
+            }
+        }
+        if (terms.empty() || terms.size() > VectorLoop::max_height) {
+            return false;
+        }
+        std::reverse(terms.begin(), terms.end());
+        std::optional<size_t> sum = vector_expr(terms[0].second);
+        for (size_t i = 1; i < terms.size() && sum.has_value(); i++) {
+            const std::optional<size_t> term = vector_expr(terms[i].second);
+            if (!term.has_value()) {
+                return false;
+            }
+            const bool same_sign = terms[i].first == terms[0].first;
+            sum = add_expr({ .kind = same_sign ? VectorExpr::Kind::add : VectorExpr::Kind::sub, .lhs = sum.value(), .rhs = term.value() });
+        }
+        if (!sum.has_value()) {
+            return false;
+        }
+        m_loop.steps.push_back({ terms[0].first ? VectorLoop::StepKind::subtract : VectorLoop::StepKind::add, target, sum.value() });
+        return true;
+    }
+
+    // `i = i + 1` or `i = 1 + i`.
+    bool match_increment(const NodeStatement* iteration) const
+    {
+        const NodeStatementAssign* const* assign = std::get_if<NodeStatementAssign*>(&iteration->var);
+        if (assign == nullptr || (*assign)->ident.value.value() != m_loop.counter) {
+            return false;
+        }
+        const NodeBinExpression* const* bin = std::get_if<NodeBinExpression*>(&(*assign)->expr->var);
+        if (bin == nullptr) {
+            return false;
+        }
+        const NodeBinExpressionAdd* const* add = std::get_if<NodeBinExpressionAdd*>(&(*bin)->var);
+        if (add == nullptr) {
+            return false;
+        }
+        return (is_counter((*add)->lhs) && literal((*add)->rhs) == 1)
+            || (literal((*add)->lhs) == 1 && is_counter((*add)->rhs));
+    }
+
+    void add_array(const std::string& name)
+    {
+        if (std::find(m_loop.arrays.begin(), m_loop.arrays.end(), name) == m_loop.arrays.end()) {
+            m_loop.arrays.push_back(name);
+        }
+    }
+
+    size_t add_expr(VectorExpr expr)
+    {
+        m_loop.exprs.push_back(expr);
+        return m_loop.exprs.size() - 1;
+    }
+
+    size_t add_broadcast(VectorLoop::Broadcast broadcast)
+    {
+        for (size_t i = 0; i < m_loop.broadcasts.size(); i++) {
+            if (m_loop.broadcasts[i].name == broadcast.name && m_loop.broadcasts[i].value == broadcast.value) {
+                return i;
+            }
+        }
+        m_loop.broadcasts.push_back(std::move(broadcast));
+        return m_loop.broadcasts.size() - 1;
+    }
+
+    std::optional<size_t> vector_expr(const NodeExpr* expr, size_t height = 1)
+    {
+        if (height > VectorLoop::max_height) {
+            return {};
+        }
+        if (auto bin = std::get_if<NodeBinExpression*>(&expr->var)) {
+            const NodeExpr* lhs = nullptr;
+            const NodeExpr* rhs = nullptr;
+            VectorExpr::Kind kind;
+            if (auto add = std::get_if<NodeBinExpressionAdd*>(&(*bin)->var)) {
+                lhs = (*add)->lhs, rhs = (*add)->rhs, kind = VectorExpr::Kind::add;
+            } else if (auto sub = std::get_if<NodeBinExpressionSub*>(&(*bin)->var)) {
+                lhs = (*sub)->lhs, rhs = (*sub)->rhs, kind = VectorExpr::Kind::sub;
+            } else if (auto equals = std::get_if<NodeBinExpressionEquals*>(&(*bin)->var)) {
+                lhs = (*equals)->lhs, rhs = (*equals)->rhs, kind = VectorExpr::Kind::equals;
+            } else if (auto not_equals = std::get_if<NodeBinExpressionNotEquals*>(&(*bin)->var)) {
+                lhs = (*not_equals)->lhs, rhs = (*not_equals)->rhs, kind = VectorExpr::Kind::not_equals;
+                m_loop.uses_not_equals = true;
+            } else {
+                return {};
+            }
+            const std::optional<size_t> l = vector_expr(lhs, height + 1);
+            const std::optional<size_t> r = l.has_value() ? vector_expr(rhs, height + 1) : std::nullopt;
+            if (!r.has_value()) {
+                return {};
+            }
+            return add_expr({ .kind = kind, .lhs = l.value(), .rhs = r.value() });
+        }
+
+        const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+        if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+            return vector_expr((*paren)->expr, height + 1);
+        }
+        if (auto index = std::get_if<NodeTermIndex*>(&term->var)) {
+            if (!is_counter((*index)->index)) {
+                return {};
+            }
+            const std::string& name = (*index)->ident.value.value();
+            add_array(name);
+            const size_t operand = std::find(m_loop.arrays.begin(), m_loop.arrays.end(), name) - m_loop.arrays.begin();
+            return add_expr({ .kind = VectorExpr::Kind::load, .operand = operand });
+        }
+        if (const std::optional<int64_t> value = literal(expr)) {
+            return add_expr({ .kind = VectorExpr::Kind::broadcast, .operand = add_broadcast({ .value = value.value() }) });
+        }
+        if (is_counter(expr)) {
+            m_loop.uses_counter = true;
+            return add_expr({ .kind = VectorExpr::Kind::counter });
+        }
+        if (const std::string name = ident_name(expr); !name.empty()) {
+            return add_expr({ .kind = VectorExpr::Kind::broadcast, .operand = add_broadcast({ .name = name }) });
+        }
+        return {};
+    }
+
+    VectorLoop m_loop;
+    std::vector<std::string> m_assigned; // reduction targets
+};